@@ -24,6 +24,8 @@
 /*******************************************************************************
 * $Id$
 *******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_CLOCK
+
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -40,16 +42,18 @@
 #include <ptp_internal.h>
 #include <ptp_config.h>
 #include <ptp.h>
-#include <print.h>
 #include <time.h>               // for nanosleep
 
 // Parameters
 #define NUM_PATH_DELAY 5
+// Seconds without clock adjustments before backup domain takes the clock
+#define DISCIPLINE_TIMEOUT 5
 
 /**
  * Local clock data.
  */
 struct private_clk_if {
+    int in_use;                 ///< slot reserved by an instance
     struct Timestamp previous_master_timestamp;
     struct Timestamp previous_slave_timestamp;
     s64 trim;
@@ -59,26 +63,85 @@ struct private_clk_if {
     s64 offset_integral;
     long freq_tolerance;
     long tick;
+    struct ptp_servo_stats stats;       ///< servo statistics
 };
 
-// Local variables
-static struct private_clk_if cif_data;
+// Local variables, one clock if per PTP instance
+static struct private_clk_if cif_data[MAX_NUM_INSTANCES];
+/// Clock if (domain) disciplining the local clock
+static struct private_clk_if *volatile discipline_owner = NULL;
+/// Monotonic time of the last adjustment by discipline_owner, seconds
+static volatile time_t discipline_stamp = 0;
+
+/**
+* Check if clock if may adjust the local clock. Primary domain takes
+* the clock always, backup domain if the clock is not adjusted by 
+* others within DISCIPLINE_TIMEOUT. Monitoring domains never adjust.
+* @param ctx clock context
+* @return true if clock may be adjusted.
+*/
+static bool clock_discipline(struct clock_ctx *ctx)
+{
+    struct private_clk_if *cif = (struct private_clk_if *) ctx->arg;
+    struct private_clk_if *owner = discipline_owner;
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    switch (ctx->owner->cfg.clock_control) {
+    case CLOCK_CONTROL_PRIMARY:
+        break;
+    case CLOCK_CONTROL_BACKUP:
+        if (owner && (owner != cif) &&
+            (now.tv_sec - discipline_stamp < DISCIPLINE_TIMEOUT)) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    if (owner != cif) {
+        if (!__sync_bool_compare_and_swap(&discipline_owner, owner, cif)) {
+            return false;
+        }
+        DEBUG("Domain %i disciplines clock\n",
+              ctx->owner->default_dataset.domain);
+        // Restart servo, integral is not valid for this master
+        cif->offset_integral = 0;
+    }
+    discipline_stamp = now.tv_sec;
+    return true;
+}
 
 /**
 * Function for initializing clock interface.
 * @param ctx clock context
+* @param owner PTP instance using the clock interface.
 * @param cfg_file Clock interface configuration file name.
 * @return ptp error code.
 */
-int ptp_initialize_clock_if(struct clock_ctx *ctx, char* cfg_file)
+int ptp_initialize_clock_if(struct clock_ctx *ctx, struct ptp_ctx *owner,
+                            char* cfg_file)
 {
-    struct private_clk_if *cif = &cif_data;
+    struct private_clk_if *cif = NULL;
     struct timex t;
-    int ret = 0;
+    int ret = 0, i = 0;
 
+    // Reserve free slot
+    for (i = 0; i < MAX_NUM_INSTANCES; i++) {
+        if (__sync_lock_test_and_set(&cif_data[i].in_use, 1) == 0) {
+            cif = &cif_data[i];
+            break;
+        }
+    }
+    if (cif == NULL) {
+        ERROR("No free clock if\n");
+        return PTP_ERR_GEN;
+    }
     memset(ctx, 0, sizeof(struct clock_ctx));
     memset(cif, 0, sizeof(struct private_clk_if));
+    cif->in_use = 1;
     ctx->arg = cif;
+    ctx->owner = owner;
 
     t.modes = ADJ_FREQUENCY;
     t.freq = 0;
@@ -89,6 +152,7 @@ int ptp_initialize_clock_if(struct clock_ctx *ctx, char* cfg_file)
     } else {
         cif->freq_tolerance = t.tolerance;
         cif->tick = t.tick;
+        cif->stats.tick = t.tick;
         DEBUG("Clock state: %i, freq tolerance: %li\n",
               ret, cif->freq_tolerance);
     }
@@ -116,8 +180,13 @@ int ptp_reconfig_clock_if(struct clock_ctx *ctx, char* cfg_file)
 */
 int ptp_close_clock_if(struct clock_ctx *ctx)
 {
-//    struct private_clk_if *cif = (struct private_clk_if*) ctx->arg;
+    struct private_clk_if *cif = (struct private_clk_if*) ctx->arg;
 
+    if (cif) {
+        __sync_bool_compare_and_swap(&discipline_owner, cif, NULL);
+        ctx->arg = 0;
+        __sync_lock_release(&cif->in_use);
+    }
     return PTP_ERR_OK;
 }
 
@@ -130,20 +199,21 @@ int ptp_close_clock_if(struct clock_ctx *ctx)
 void ptp_event_clk(struct clock_ctx *ctx,
                    enum ptp_event_clk event, void *arg)
 {
-//    struct private_clk_if *cif = (struct private_clk_if*) ctx->arg;
+    struct private_clk_if *cif = (struct private_clk_if*) ctx->arg;
 
     DEBUG("%s\n", get_ptp_event_clk_str(event));
     switch (event) {
     case PTP_MASTER_CHANGED:
         // Accept new master immediately. TODO: check master first!
-        ptp_event_ctrl(PTP_MASTER_CLOCK_SELECTED, NULL);
+        ptp_event_ctrl(ctx->owner, PTP_MASTER_CLOCK_SELECTED, NULL);
         break;
     case PTP_CLK_MASTER:
+        // Not following a master anymore, let backup domain take the clock
+        __sync_bool_compare_and_swap(&discipline_owner, cif, NULL);
         break;
     default:
         break;
     }
-    print_clock_state(event);
 }
 
 /**
@@ -198,7 +268,7 @@ int ptp_get_clock_properities(struct clock_ctx *ctx,
     // TRUE if the clock timescale of the grandmaster clock is PTP.
     time_dataset->ptp_timescale = true;
     // The source of time used by the grandmaster clock.
-    time_dataset->time_source = ptp_cfg.clock_source;
+    time_dataset->time_source = ctx->owner->cfg.clock_source;
 
     return PTP_ERR_OK;
 }
@@ -220,6 +290,7 @@ void ptp_sync_rcv(struct clock_ctx *ctx,
     s64 master_to_slave_delay = 0;
     s64 offset_from_master = 0;
     s32 offset_sec = 0, offset_usec = 0;
+    bool discipline = false;
 
     DEBUG
         ("master: 0x%012llxs 0x%08x.%04xns slave: 0x%012llxs 0x%08x.%04xns\n",
@@ -254,11 +325,11 @@ void ptp_sync_rcv(struct clock_ctx *ctx,
         DEBUG
             ("detected master_to_slave_delay %lli ns16, path_delay %lli ns16\n",
              master_to_slave_delay,
-             ptp_ctx.current_dataset.mean_path_delay.scaled_nanoseconds);
+             ctx->owner->current_dataset.mean_path_delay.scaled_nanoseconds);
 
         // calculate clock adjustment
         offset_from_master = master_to_slave_delay -
-            ptp_ctx.current_dataset.mean_path_delay.scaled_nanoseconds;
+            ctx->owner->current_dataset.mean_path_delay.scaled_nanoseconds;
 
         offset_sec = (s32) ((offset_from_master >> 16) / 1000000000LL);
         offset_usec = (s32) (((offset_from_master >> 16) / 1000LL) -
@@ -268,7 +339,14 @@ void ptp_sync_rcv(struct clock_ctx *ctx,
     DEBUG("detected offset from master %is 0x%08llx ns16\n",
           offset_sec, offset_from_master);
 
-    if (offset_sec || (offset_usec > 10000) || (offset_usec < -10000)) {
+    cif->stats.sync_samples++;
+    discipline = clock_discipline(ctx);
+    cif->stats.discipline = discipline;
+    if (!discipline &&
+        (offset_sec || (offset_usec > 10000) || (offset_usec < -10000))) {
+        DEBUG("Monitoring domain %i, clock not set\n",
+              ctx->owner->default_dataset.domain);
+    } else if (offset_sec || (offset_usec > 10000) || (offset_usec < -10000)) {
         /* Our clock is in completely wrong time.. Adjust it to
          * correct time with one crash. */
         struct timeval tval;
@@ -279,13 +357,14 @@ void ptp_sync_rcv(struct clock_ctx *ctx,
             if (settimeofday(&tval, 0) != 0) {
                 perror("settimeofday");
             } else {
+                cif->stats.steps++;
                 DEBUG("settimeofday, adjust: %is %ius\n",
                       -offset_sec, -offset_usec);
             }
         }
     } else {
         /* Time is close enough, calculate delay and do adjustment. */
-        if (cif->previous_master_timestamp.seconds && cif->freq_tolerance && cif->tick) {       // If ajdtimex is not usable, skip
+        if (discipline && cif->previous_master_timestamp.seconds && cif->freq_tolerance && cif->tick) {       // If ajdtimex is not usable, skip
             s64 trim = 0, Ptrim = 0;
             int Pdiv = 30, Idiv = 1000;
             struct Timestamp control_space;
@@ -336,20 +415,24 @@ void ptp_sync_rcv(struct clock_ctx *ctx,
                 perror("adjtimex");
             } else {
                 cif->tick = t.tick;
+                cif->stats.tick = t.tick;
+                cif->stats.adjustments++;
+                cif->stats.freq = t.freq;
+                cif->stats.offset_integral = cif->offset_integral;
                 DEBUG("Clock state: %i, tick %li, freq %li\n",
                       ret, t.tick, t.freq);
             }
         } else {
             DEBUG("No trim %i %i\n",
                   (u32) cif->previous_master_timestamp.seconds,
-                  (u32) ptp_ctx.current_dataset.mean_path_delay.
+                  (u32) ctx->owner->current_dataset.mean_path_delay.
                   scaled_nanoseconds);
         }
 
         // store saved data
         cif->prev_offset_from_master =
-            ptp_ctx.current_dataset.offset_from_master.scaled_nanoseconds;
-        ptp_ctx.current_dataset.offset_from_master.scaled_nanoseconds =
+            ctx->owner->current_dataset.offset_from_master.scaled_nanoseconds;
+        ctx->owner->current_dataset.offset_from_master.scaled_nanoseconds =
             offset_from_master;
     }
     copy_timestamp(&cif->previous_master_timestamp, master_time);
@@ -390,13 +473,16 @@ void ptp_delay_rcv(struct clock_ctx *ctx,
 
     if (sign == -1) {
         DEBUG("Not using negative path delay\n");
+        cif->stats.delay_rejected++;
         return;
     }
 
     if (diff.seconds > 1000) {
         DEBUG("Not using completely too large path delay\n");
+        cif->stats.delay_rejected++;
         return;
     }
+    cif->stats.delay_samples++;
 
     // use sign to decide path_delay sign
     path_delay = sign *
@@ -422,7 +508,24 @@ void ptp_delay_rcv(struct clock_ctx *ctx,
         index++;
         index %= NUM_PATH_DELAY;
     }
-    ptp_ctx.current_dataset.mean_path_delay.scaled_nanoseconds =
+    ctx->owner->current_dataset.mean_path_delay.scaled_nanoseconds =
         path_delay;
     DEBUG("stored path_delay %ins\n", (s32) (path_delay >> 16));
 }
+
+/**
+* Function for reading clock servo statistics.
+* @param ctx clock context
+* @param stats statistics are returned here.
+* @return ptp error code.
+*/
+int ptp_get_servo_stats(struct clock_ctx *ctx, struct ptp_servo_stats *stats)
+{
+    struct private_clk_if *cif = (struct private_clk_if *) ctx->arg;
+
+    if (!cif) {
+        return PTP_ERR_GEN;
+    }
+    memcpy(stats, &cif->stats, sizeof(struct ptp_servo_stats));
+    return PTP_ERR_OK;
+}
@@ -29,11 +29,29 @@
 #define _CLOCK_IF_H_
 #include "ptp_general.h"
 
+struct ptp_ctx;
+
 /**
 * Clock context information.
 */
 struct clock_ctx {
     void *arg;                  ///< private data for clock specific data    
+    struct ptp_ctx *owner;      ///< PTP instance using this interface
+};
+
+/**
+* Clock servo statistics.
+*/
+struct ptp_servo_stats {
+    bool discipline;            ///< instance adjusts the local clock
+    u64 sync_samples;           ///< Sync samples received
+    u64 delay_samples;          ///< path delay samples accepted
+    u64 delay_rejected;         ///< path delay samples rejected
+    u64 steps;                  ///< clock stepped
+    u64 adjustments;            ///< frequency adjustments
+    s64 freq;                   ///< latest frequency adjustment, ppm 2^-16
+    s64 offset_integral;        ///< integral term of the servo, ns 2^-16
+    long tick;                  ///< tick length, us
 };
 
 /**
@@ -59,10 +77,12 @@ enum ptp_event_ctrl {
 /**
 * Function for initializing clock interface. 
 * @param ctx clock context
+* @param owner PTP instance using the interface.
 * @param cfg_file Clock interface configuration file name
 * @return ptp error code.
 */
-int ptp_initialize_clock_if(struct clock_ctx *ctx, char* cfg_file);
+int ptp_initialize_clock_if(struct clock_ctx *ctx, struct ptp_ctx *owner,
+                            char* cfg_file);
 
 /**
 * Function for reconfiguring clock interface. 
@@ -125,6 +145,14 @@ void ptp_delay_rcv(struct clock_ctx *ctx,
                    struct Timestamp *slave_time,
                    struct Timestamp *master_time);
 
+/**
+* Function for reading clock servo statistics.
+* @param ctx clock context
+* @param stats statistics are returned here.
+* @return ptp error code.
+*/
+int ptp_get_servo_stats(struct clock_ctx *ctx, struct ptp_servo_stats *stats);
+
 
 /** 
 * These API functions are called by Clock module and implemented by 
@@ -133,10 +161,11 @@ void ptp_delay_rcv(struct clock_ctx *ctx,
 
 /**
 * An event reporting function to main control.
-* @param ctx clock context
+* @param ptp_ctx PTP instance.
 * @param event status value indication function call reason.
 * @param arg event specific argument.
 */
-void ptp_event_ctrl(enum ptp_event_ctrl event, void *arg);
+void ptp_event_ctrl(struct ptp_ctx *ptp_ctx,
+                    enum ptp_event_ctrl event, void *arg);
 
 #endif                          // _CLOCK_IF_H_
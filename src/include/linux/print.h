@@ -29,11 +29,15 @@
 
 #include <clock_if.h>
 
+int print_open(void);
+
+void print_close(void);
+
 void print_clock_status(unsigned long offset_sec, signed long offset_nsec,
                         signed long drift, signed long long adjust,
                         signed long long adjust_P,
                         signed long long adjust_I);
 
-void print_clock_state(enum ptp_event_clk event);
+void print_clock_state(const char *event);
 
 #endif                          // _PRINT_H_
@@ -37,20 +37,25 @@
 
 #include "ptp_general.h"
 
+struct ptp_ctx;
+
 /**
 * OS context information.
 */
 struct os_ctx {
     void *arg;                  ///< private data for os specific data        
+    struct ptp_ctx *owner;      ///< PTP instance using this interface
 };
 
 /**
 * Function for initializing OS interface. 
 * @param ctx clock context
+* @param owner PTP instance using the interface.
 * @param cfg_file Config file name for OS interface.
 * @return ptp error code.
 */
-int ptp_initialize_os_if(struct os_ctx *ctx, char* cfg_file);
+int ptp_initialize_os_if(struct os_ctx *ctx, struct ptp_ctx *owner,
+                         char* cfg_file);
 
 /**
 * Function for reconfiguring OS interface. 
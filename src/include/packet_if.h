@@ -31,11 +31,43 @@
 #include "ptp_general.h"
 #include "ptp_message.h"
 
+struct ptp_ctx;
+
 /**
 * Packet interface context information.
 */
 struct packet_ctx {
     void *arg;                  ///< private data for os/if specific data    
+    struct ptp_ctx *owner;      ///< PTP instance using this interface
+};
+
+/**
+* Receive path statistics. Queue statistics are valid only if frames are
+* received by a dedicated RX thread.
+*/
+struct ptp_rx_stats {
+    bool rx_thread;             ///< true if RX thread is used
+    u32 depth;                  ///< frames currently queued
+    u32 max_depth;              ///< high watermark of queued frames
+    u32 dropped;                ///< frames dropped because queue was full
+    u64 frames;                 ///< frames handed to PTP module
+    u64 latency_sum_ns;         ///< sum of RX thread to PTP handoff latencies
+    u32 latency_max_ns;         ///< maximum handoff latency
+    u32 latency_last_ns;        ///< latest handoff latency
+    u64 other_domain;           ///< frames of other domains not returned
+    u64 truncated;              ///< frames shorter than their message type
+};
+
+/// Maximum number of frames in one ptp_send_batch call
+#define PTP_SEND_BATCH_MAX      64
+
+/**
+* Frame of a batch send.
+*/
+struct ptp_send_vec {
+    char *frame;                ///< frame to send
+    int length;                 ///< frame length
+    char *peer_addr;            ///< peer IP address, NULL for port destination
 };
 
 /** These API functions are called by PTP module and implemented by 
@@ -45,10 +77,12 @@ struct packet_ctx {
 /**
 * Function for initializing packet interface. 
 * @param ctx packet if context
+* @param owner PTP instance using the interface.
 * @param cfg_file Config file name for packet interface.
 * @return ptp error code.
 */
-int ptp_initialize_packet_if(struct packet_ctx *ctx, char* cfg_file);
+int ptp_initialize_packet_if(struct packet_ctx *ctx, struct ptp_ctx *owner,
+                             char* cfg_file);
 
 /**
 * Function for reconfiguring packet interface. 
@@ -73,14 +107,66 @@ int ptp_close_packet_if(struct packet_ctx *ctx);
 * @param port_num port number.
 * @param frame frame to send.
 * @param length frame length.
-* @return ptp error code.
+* @return ptp error code, PTP_ERR_SEND if only this frame was lost and
+*         PTP_ERR_NET if the socket must be reopened.
 */
 int ptp_send(struct packet_ctx *ctx, int msg_type, int port_num,
              char *frame, int length);
 
+/**
+* Function for sending PTP frames of a unicast port to a peer. Unicast
+* frames are not looped back, so frame_sent is not called for them: send
+* time is the kernel software transmit timestamp of the frame, read from
+* the socket error queue (clock time after the send if not available).
+* @param ctx packet if context
+* @param msg_type ptp message type.
+* @param port_num port number.
+* @param frame frame to send.
+* @param length frame length.
+* @param peer_addr peer IP address.
+* @param sent_time if not NULL, send time is returned here.
+* @return ptp error code, PTP_ERR_SEND if only this frame was lost and
+*         PTP_ERR_NET if the socket must be reopened.
+*/
+int ptp_send_to(struct packet_ctx *ctx, int msg_type, int port_num,
+                char *frame, int length, char *peer_addr,
+                struct Timestamp *sent_time);
+
+/**
+* Function for sending a batch of frames of one message type from a port.
+* Frames are handed to the kernel with as few system calls as possible.
+* Used for general messages only, frame_sent is not called.
+* @param ctx packet if context
+* @param msg_type ptp message type.
+* @param port_num port number.
+* @param vec frames to send.
+* @param count number of frames, at most PTP_SEND_BATCH_MAX are sent.
+* @return number of frames sent (0 if the socket queue is full), or ptp
+*         error code: PTP_ERR_SEND if the batch was lost and PTP_ERR_NET
+*         if the socket must be reopened.
+*/
+int ptp_send_batch(struct packet_ctx *ctx, int msg_type, int port_num,
+                   struct ptp_send_vec *vec, int count);
+
+/**
+* Function for sending a unicast reply to the sender of the frame last
+* returned by ptp_receive, e.g. a management response. Must be called
+* before ptp_receive is called again.
+* @param ctx packet if context
+* @param port_num port number the replied frame was received from.
+* @param frame frame to send.
+* @param length frame length.
+* @return ptp error code.
+*/
+int ptp_send_reply(struct packet_ctx *ctx, int port_num, char *frame,
+                   int length);
+
 /**
 * Function for receiving PTP frames. Function can be used to poll PTP ports
 * and if no frames are available, error code PTP_ERROR_TIMEOUT is returned.
+* Packet interface demultiplexes frames by domain: only frames of the
+* owner instance's domain are returned. Frames with unicastFlag set are
+* returned from the unicast port of the interface, if it has one.
 * @param ctx packet if context
 * @param timeout receive timeout in microseconds, decremented with used time. 
 * @param port_num port number.
@@ -94,6 +180,14 @@ int ptp_receive(struct packet_ctx *ctx, u32 * timeout, int *port_num,
                 char *frame, int *length, struct Timestamp *recv_time,
                 char *peer_addr);
 
+/**
+* Function for reading receive path statistics.
+* @param ctx packet if context
+* @param stats statistics are returned here.
+* @return ptp error code.
+*/
+int ptp_get_rx_stats(struct packet_ctx *ctx, struct ptp_rx_stats *stats);
+
 /** These API functions are called by packet module and implemented by 
 * PTP module. 
 */
@@ -102,12 +196,14 @@ int ptp_receive(struct packet_ctx *ctx, u32 * timeout, int *port_num,
 * Function for reporting new PTP port. After completion of this function call,
 * PTP module may start sending and receiving to this port.
 * @see port_num 
+* @param ptp_ctx PTP instance.
 * @param port_num port number.
 * @param identity clock identity.
 * @param set if unicast port.
 * @param if_config Interface configuration.
 */
-void ptp_new_port(int port_num, 
+void ptp_new_port(struct ptp_ctx *ptp_ctx,
+                  int port_num, 
                   ClockIdentity identity, 
                   bool unicast_port,
                   struct interface_config* if_config );
@@ -117,20 +213,24 @@ void ptp_new_port(int port_num,
 * PTP module must stop sending and receiving to this port. All pending send
 * operations are completed with frame_sent.
 * @see port_num 
+* @param ptp_ctx PTP instance.
 * @param port_num port number.
 */
-void ptp_close_port(int port_num);
+void ptp_close_port(struct ptp_ctx *ptp_ctx, int port_num);
 
 /**
 * Function for reporting the completion of sending of the PTP event 
 * frame. Called for Delay_req and Sync frames (if TWO_STEP_CLOCK). 
+* For transparent clock, called for every frame it forwarded.
 * @see send.
+* @param ptp_ctx PTP instance.
 * @param port_num port number.
 * @param msg_hdr Header of the sent frame.
 * @param error sending process failed, ptp error number returned.
 * @param sent_time timestamp of the sent ptp frame.
 */
-void ptp_frame_sent(int port_num, struct ptp_header *msg_hdr, int error,
+void ptp_frame_sent(struct ptp_ctx *ptp_ctx,
+                    int port_num, struct ptp_header *msg_hdr, int error,
                     struct Timestamp *sent_time);
 
 #endif                          //_PACKET_IF_H_
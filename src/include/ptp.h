@@ -31,6 +31,14 @@
 #include <os_if.h>
 #include <packet_if.h>
 #include <clock_if.h>
+#include <ptp_arena.h>
+#include <ptp_tc.h>
+#include <ptp_unicast.h>
+#include <ptp_stats.h>
+#include <ptp_metrics.h>
+#include <ptp_ctl.h>
+#include <ptp_trace.h>
+#include <ptp_servo_rec.h>
 
 #define SEC_IN_NS   1000000000
 
@@ -55,6 +63,24 @@ struct ptp_ctx {
     struct SecurityDataSet sec_dataset; ///< security dataset
 
     struct ptp_port_ctx *ports_list_head;       ///< List head of ports
+    struct ptp_port_ctx *free_ports_head;       ///< List head of unused port contexts
+    u32 foreign_capacity;       ///< foreign master table capacity reserved per port
+
+    struct ptp_arena arena;     ///< Memory for runtime data structures
+    struct ptp_tc tc;           ///< Transparent clock forwarding state
+    struct ptp_uc_table unicast;        ///< Unicast sessions
+
+    struct ptp_config cfg;      ///< Configuration of this instance
+    int socket_restart;         ///< set when sockets must be reopened
+    int reconfig_seen;          ///< reconfiguration generation handled
+    int dump_seen;              ///< statistics request generation handled
+    struct ptp_snapshot snapshot;       ///< statistics of the last request
+    struct ptp_metrics_slot *metrics;   ///< published snapshot, NULL if none
+    struct Timestamp metrics_timer;     ///< next snapshot publication
+    struct ptp_ctl_events *ctl; ///< events to control thread, NULL if none
+    struct ptp_trace_ring *trace;       ///< trace ring, NULL if not traced
+    struct ptp_servo_rec servo_rec;     ///< servo recorder
+    u32 dataset_generation;     ///< incremented when datasets change
 
     struct packet_ctx pkt_ctx;  ///< Packet_if context
     struct os_ctx os_ctx;       ///< Os_if context
@@ -66,8 +92,6 @@ struct ptp_ctx {
     char* os_if_file;
 };
 
-extern struct ptp_ctx ptp_ctx;
-extern int socket_restart;
 
 /**
 * PTP main.
@@ -78,12 +102,15 @@ extern int socket_restart;
 void ptp_main(int argc, char *argv[]);
 
 // dataset initializers
-void init_default_dataset(struct DefaultDataSet *dataset);
+void init_default_dataset(struct ptp_config *cfg,
+                          struct DefaultDataSet *dataset);
 void init_current_dataset(struct CurrentDataSet *dataset);
-void init_parent_dataset(struct ParentDataSet *dataset);
-void init_time_dataset(struct TimeProperitiesDataSet *dataset);
+void init_parent_dataset(struct DefaultDataSet *default_dataset,
+                         struct ParentDataSet *dataset);
+void init_time_dataset(struct ptp_config *cfg,
+                       struct TimeProperitiesDataSet *dataset);
 void init_sec_dataset(struct SecurityDataSet *dataset);
-void init_port_dataset(struct PortDataSet *dataset);
+void init_port_dataset(struct ptp_config *cfg, struct PortDataSet *dataset);
 
 // Timestamp modification functions
 void inc_timestamp(struct Timestamp *base, struct Timestamp *inc);
@@ -0,0 +1,92 @@
+/** @file ptp_arena.h
+* PTP memory arena.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_ARENA_H_
+#define _PTP_ARENA_H_
+
+#include <ptp_general.h>
+
+/// Alignment of the arena allocations (cache line)
+#define PTP_ARENA_ALIGN     64
+
+/// Round size up to arena alignment
+#define PTP_ARENA_SIZE(x) \
+    (((x) + PTP_ARENA_ALIGN - 1) & ~((size_t) PTP_ARENA_ALIGN - 1))
+
+/**
+* Memory arena. All runtime data structures are carved from the arena 
+* during initialization, nothing is returned before the arena is released.
+*/
+struct ptp_arena {
+    char *base;                 ///< start of the arena memory
+    size_t size;                ///< size of the arena
+    size_t used;                ///< bytes allocated from arena
+};
+
+/**
+* Reserve memory for the arena. Memory is prefaulted.
+* @param arena arena.
+* @param size size of the arena.
+* @return ptp error code.
+*/
+int ptp_arena_init(struct ptp_arena *arena, size_t size);
+
+/**
+* Allocate zeroed memory from the arena.
+* @param arena arena.
+* @param size number of bytes.
+* @return allocated memory, NULL if arena is exhausted.
+*/
+void *ptp_arena_alloc(struct ptp_arena *arena, size_t size);
+
+/**
+* Release the arena memory.
+* @param arena arena.
+*/
+void ptp_arena_release(struct ptp_arena *arena);
+
+/**
+* Lock all current and future pages of the process to memory.
+* @return ptp error code.
+*/
+int ptp_lock_memory(void);
+
+/**
+* Mark initialization done (or reopen it for reconfiguration). When built 
+* with PTP_ALLOC_GUARD (make ALLOC_GUARD=1), any heap allocation while 
+* sealed aborts the daemon.
+* @param sealed true when steady state begins.
+*/
+void ptp_alloc_seal(bool sealed);
+
+/**
+* Allow heap allocation in the calling thread only, e.g. while it 
+* reconfigures or restarts its sockets. Other threads stay sealed.
+* @param unsealed true when the calling thread may allocate.
+*/
+void ptp_alloc_unseal_thread(bool unsealed);
+
+#endif                          // _PTP_ARENA_H_
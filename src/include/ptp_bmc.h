@@ -29,6 +29,7 @@
 
 #include <ptp_general.h>
 #include <ptp_config.h>
+#include <ptp_internal.h>
 
 /**
 * PTP best master selection algorithm.
@@ -36,4 +37,24 @@
 */
 void ptp_bmc_run(struct ptp_ctx *ptp_ctx);
 
+/**
+* Find the worst foreign record of the table. Used for selecting
+* the record to be replaced when table is full.
+* @param table foreign master table of the port.
+* @return worst of foreigns, or NULL if empty table or comparison failed.
+*/
+struct ForeignMasterDataSet *ptp_bmc_select_worst(struct ForeignMasterTable
+                                                  *table);
+
+/**
+* Check if received announce is better than the stored foreign record.
+* @param msg announce message.
+* @param port receiver port of the announce.
+* @param foreign foreign record.
+* @return true if announce is better (or better by topology).
+*/
+bool ptp_bmc_announce_better(struct ptp_announce *msg,
+                             struct PortIdentity *port,
+                             struct ForeignMasterDataSet *foreign);
+
 #endif                          // _PTP_BMC_H_
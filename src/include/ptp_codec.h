@@ -0,0 +1,321 @@
+/** @file ptp_codec.h
+* PTP message codec.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_CODEC_H_
+#define _PTP_CODEC_H_
+
+#include <stddef.h>
+#include <ptp_general.h>
+#include <ptp_message.h>
+
+/**
+* Message description table, X(type, name, fixed length).
+* Fixed length is the length of the message without TLVs. View function
+* ptp_view_<name>() and entries of the codec tables are generated from
+* this table, struct ptp_<name> must describe the message layout.
+*/
+#define PTP_MESSAGE_TABLE(X) \
+    X(PTP_SYNC, sync, sizeof(struct ptp_sync)) \
+    X(PTP_DELAY_REQ, delay_req, sizeof(struct ptp_delay_req)) \
+    X(PTP_PDELAY_REQ, pdelay_req, sizeof(struct ptp_pdelay_req)) \
+    X(PTP_PDELAY_RESP, pdelay_resp, sizeof(struct ptp_pdelay_resp)) \
+    X(PTP_FOLLOW_UP, follow_up, sizeof(struct ptp_follow_up)) \
+    X(PTP_DELAY_RESP, delay_resp, sizeof(struct ptp_delay_resp)) \
+    X(PTP_PDELAY_RESP_FOLLOW_UP, pdelay_resp_follow_up, \
+      sizeof(struct ptp_pdelay_resp_follow_up)) \
+    X(PTP_ANNOUNCE, announce, sizeof(struct ptp_announce)) \
+    X(PTP_SIGNALING, signaling, offsetof(struct ptp_signaling, tlvs)) \
+    X(PTP_MANAGEMENT, management, offsetof(struct ptp_management, tlvs))
+
+/// Length of TLV type and length fields
+#define PTP_TLV_HDR_LEN     4
+
+/**
+* TLV of a validated message.
+*/
+struct ptp_tlv {
+    u16 type;                   ///< tlvType
+    u16 length;                 ///< lengthField
+    u8 *value;                  ///< valueField
+};
+
+/**
+* Read 16 bit network byte order value from unaligned buffer.
+* @param buf buffer.
+* @return value.
+*/
+static inline u16 ptp_get_u16(const void *buf)
+{
+    const u8 *p = buf;
+    return (u16) ((p[0] << 8) | p[1]);
+}
+
+/**
+* Read 32 bit network byte order value from unaligned buffer.
+* @param buf buffer.
+* @return value.
+*/
+static inline u32 ptp_get_u32(const void *buf)
+{
+    const u8 *p = buf;
+    return ((u32) p[0] << 24) | ((u32) p[1] << 16) |
+        ((u32) p[2] << 8) | p[3];
+}
+
+/**
+* Read 64 bit network byte order value from unaligned buffer.
+* @param buf buffer.
+* @return value.
+*/
+static inline u64 ptp_get_u64(const void *buf)
+{
+    const u8 *p = buf;
+    return ((u64) ptp_get_u32(p) << 32) | ptp_get_u32(p + 4);
+}
+
+/**
+* Write 16 bit value to unaligned buffer in network byte order.
+* @param buf buffer.
+* @param val value.
+*/
+static inline void ptp_put_u16(void *buf, u16 val)
+{
+    u8 *p = buf;
+    p[0] = val >> 8;
+    p[1] = val;
+}
+
+/**
+* Write 32 bit value to unaligned buffer in network byte order.
+* @param buf buffer.
+* @param val value.
+*/
+static inline void ptp_put_u32(void *buf, u32 val)
+{
+    u8 *p = buf;
+    p[0] = val >> 24;
+    p[1] = val >> 16;
+    p[2] = val >> 8;
+    p[3] = val;
+}
+
+/**
+* Write 64 bit value to unaligned buffer in network byte order.
+* @param buf buffer.
+* @param val value.
+*/
+static inline void ptp_put_u64(void *buf, u64 val)
+{
+    u8 *p = buf;
+    ptp_put_u32(p, val >> 32);
+    ptp_put_u32(p + 4, val);
+}
+
+/**
+* Read 10 byte PTP timestamp.
+* @param time timestamp to fill.
+* @param buf timestamp in network byte order.
+*/
+static inline void ptp_get_timestamp(struct Timestamp *time, const u8 * buf)
+{
+    time->seconds = ((u48) ptp_get_u16(buf) << 32) | ptp_get_u32(buf + 2);
+    time->nanoseconds = ptp_get_u32(buf + 6);
+    time->frac_nanoseconds = 0; // unused
+}
+
+/**
+* Write 10 byte PTP timestamp.
+* @param buf buffer.
+* @param time timestamp.
+*/
+static inline void ptp_put_timestamp(u8 * buf, struct Timestamp *time)
+{
+    ptp_put_u16(buf, time->seconds >> 32);
+    ptp_put_u32(buf + 2, time->seconds);
+    ptp_put_u32(buf + 6, time->nanoseconds);
+}
+
+/**
+* Get message type of the header.
+* @param hdr message header.
+* @return message type.
+*/
+static inline u8 ptp_hdr_type(const struct ptp_header *hdr)
+{
+    return hdr->msg_type & 0x0f;
+}
+
+/**
+* Get flags of the header. Flags are returned as PTP_* flag bits
+* independent of host byte order.
+* @param hdr message header.
+* @return flags.
+*/
+static inline u16 ptp_hdr_flags(const struct ptp_header *hdr)
+{
+    const u8 *p = (const u8 *) &hdr->flags;
+    return p[0] | (p[1] << 8);
+}
+
+/**
+* Set flags of the header.
+* @param hdr message header.
+* @param flags PTP_* flag bits.
+*/
+static inline void ptp_hdr_set_flags(struct ptp_header *hdr, u16 flags)
+{
+    u8 *p = (u8 *) &hdr->flags;
+    p[0] = flags;
+    p[1] = flags >> 8;
+}
+
+/**
+* Get messageLength of the header.
+* @param hdr message header.
+* @return messageLength.
+*/
+static inline u16 ptp_hdr_len(const struct ptp_header *hdr)
+{
+    return ptp_get_u16(&hdr->msg_len);
+}
+
+/**
+* Get correctionField of the header.
+* @param hdr message header.
+* @return correctionField (scaled ns).
+*/
+static inline s64 ptp_hdr_corr_field(const struct ptp_header *hdr)
+{
+    return (s64) ptp_get_u64(&hdr->corr_field);
+}
+
+/**
+* Set correctionField of the header.
+* @param hdr message header.
+* @param corr_field correctionField (scaled ns).
+*/
+static inline void ptp_hdr_set_corr_field(struct ptp_header *hdr,
+                                          s64 corr_field)
+{
+    ptp_put_u64(&hdr->corr_field, (u64) corr_field);
+}
+
+/**
+* Get sequenceId of the header.
+* @param hdr message header.
+* @return sequenceId.
+*/
+static inline u16 ptp_hdr_seq_id(const struct ptp_header *hdr)
+{
+    return ptp_get_u16(&hdr->seq_id);
+}
+
+/**
+* Read port identity.
+* @param port_id port identity to fill (host order).
+* @param buf port identity in network byte order.
+*/
+static inline void ptp_get_port_id(struct PortIdentity *port_id,
+                                   const void *buf)
+{
+    memcpy(port_id->clock_identity, buf, sizeof(ClockIdentity));
+    port_id->port_number =
+        ptp_get_u16((const u8 *) buf + sizeof(ClockIdentity));
+}
+
+/**
+* Write port identity.
+* @param buf buffer.
+* @param port_id port identity (host order).
+*/
+static inline void ptp_put_port_id(void *buf, struct PortIdentity *port_id)
+{
+    memcpy(buf, port_id->clock_identity, sizeof(ClockIdentity));
+    ptp_put_u16((u8 *) buf + sizeof(ClockIdentity), port_id->port_number);
+}
+
+/**
+* Typed views to a message validated with ptp_msg_check().
+*/
+#define PTP_VIEW(type, name, len) \
+static inline struct ptp_##name *ptp_view_##name(void *buf) \
+{ \
+    return (struct ptp_##name *) buf; \
+}
+PTP_MESSAGE_TABLE(PTP_VIEW)
+#undef PTP_VIEW
+
+/**
+* Validate received message. Header, message length and the bounds of
+* all TLVs are checked in one pass, after which the message can be
+* accessed through views and TLVs iterated with ptp_tlv_next() without
+* further checks.
+* @param buf message.
+* @param len number of bytes received.
+* @return messageLength, or PTP_ERR_FRAME if message is invalid.
+*/
+int ptp_msg_check(const void *buf, int len);
+
+/**
+* Get fixed length of message type.
+* @param type message type.
+* @return fixed length, 0 for unknown message types.
+*/
+int ptp_msg_fixed_len(u8 type);
+
+/**
+* Get name of message type.
+* @param type message type.
+* @return name.
+*/
+const char *ptp_msg_name(u8 type);
+
+/**
+* Iterate TLVs of a message validated with ptp_msg_check().
+* @param buf message.
+* @param offset offset of next TLV, initialize to 0.
+* @param tlv TLV to fill.
+* @return true if TLV was found, false at the end of message.
+*/
+static inline bool ptp_tlv_next(void *buf, int *offset, struct ptp_tlv *tlv)
+{
+    u8 *msg = buf;
+    int len = ptp_hdr_len(buf);
+
+    if (*offset == 0) {
+        *offset = ptp_msg_fixed_len(ptp_hdr_type(buf));
+    }
+    if (*offset + PTP_TLV_HDR_LEN > len) {
+        return false;
+    }
+    tlv->type = ptp_get_u16(msg + *offset);
+    tlv->length = ptp_get_u16(msg + *offset + 2);
+    tlv->value = msg + *offset + PTP_TLV_HDR_LEN;
+    *offset += PTP_TLV_HDR_LEN + tlv->length;
+    return true;
+}
+
+#endif                          // _PTP_CODEC_H_
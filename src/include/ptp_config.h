@@ -34,15 +34,30 @@
 // Protocol version
 #define PTP_VERSION         2
 
-// Maximum number of foreign master datasets that can be stored per port
-// this list should cleanup if better masters arrive to the network
-#define MAX_NUM_FOREIGN_MASTERS     5
+// Default number of foreign master datasets that can be stored per port,
+// worst record is evicted if better masters arrive to the network
+#define DEFAULT_NUM_FOREIGN_MASTERS 5
+// Maximum configurable number of foreign master datasets per port
+#define MAX_NUM_FOREIGN_MASTERS     1024
 
 // maximum number of interfaces supported
 #define MAX_NUM_INTERFACES  20
 #define INTERFACE_NAME_LEN  10
 #define IP_STR_MAX_LEN      20
 
+// maximum number of PTP instances (config files) in one process
+#define MAX_NUM_INSTANCES   8
+
+// How the instance (domain) controls the local clock
+#define CLOCK_CONTROL_MONITOR   0   ///< track master, never adjust clock
+#define CLOCK_CONTROL_PRIMARY   1   ///< adjust clock
+#define CLOCK_CONTROL_BACKUP    2   ///< adjust clock if primary is lost
+
+// Clock type of the instance
+#define CLOCK_TYPE_OC           0   ///< ordinary or boundary clock
+#define CLOCK_TYPE_E2E_TC       1   ///< end-to-end transparent clock
+#define CLOCK_TYPE_P2P_TC       2   ///< peer-to-peer transparent clock
+
 #define MAX_VALUE_LEN 100       // for parser
 
 // Constants
@@ -84,29 +99,51 @@ struct interface_config {
     /// Unicast entries
     int num_unicast_addr;
     char unicast_ip[MAX_NUM_INTERFACES][IP_STR_MAX_LEN];
+    int unicast_negotiation;      ///< '1' if unicast transmission negotiated
+    int hybrid;                   ///< '1' if Delay_Req/Delay_Resp are unicast
 };
 
 struct ptp_config {
     int debug;
+    int cpu;                      ///< CPU the instance is pinned to, -1 if none
+    int rx_thread;                ///< receive frames in dedicated thread
+    int rx_cpu;                   ///< CPU the RX thread is pinned to, -1 if none
     int num_interfaces;
     struct interface_config interfaces[MAX_NUM_INTERFACES];
     int one_step_clock;
+    int delay_mechanism;          ///< DELAY_E2E or DELAY_P2P
+    int clock_type;               ///< CLOCK_TYPE_xxx
+    int max_foreign_masters;      ///< capacity of the foreign master table
+    int lock_memory;              ///< lock process memory (mlockall)
+    int unicast_lease;            ///< unicast lease duration, s
+    int unicast_max_rate;         ///< granted messages/s, 0 if unlimited
+    int unicast_sessions;         ///< unicast sessions reserved at startup
+    int delay_resp_queue;         ///< Delay_Resp queued per port
+    int delay_req_clients;        ///< Delay_Req requesters tracked per port
+    int metrics_port;             ///< localhost TCP port of metrics, 0 if none
+    char control_socket[MAX_VALUE_LEN]; ///< control socket path, empty if none
+    int status_files;             ///< write status files to /tmp
+    int management_set;           ///< accept management SET requests
+    int trace;                    ///< enum ptp_trace_mode
+    char trace_file[MAX_VALUE_LEN];       ///< binary trace file
+    char servo_record[MAX_VALUE_LEN];     ///< servo recorder file, empty if none
+    char log[MAX_VALUE_LEN];      ///< log levels of categories, empty if none
     int clock_class;
     int clock_accuracy;
     int clock_priority1;
     int clock_priority2;
     int clock_source;
     int domain;
+    int clock_control;            ///< CLOCK_CONTROL_xxx
     int announce_interval;
     int sync_interval;
     int delay_req_interval;
+    int pdelay_req_interval;
     /* The DEFAULT_DELAY_REQ_INTERVAL value shall be an integer 
      * with the minimum value being
      * DEFAULT_SYNC_INTERVAL and a maximum 
      * value of DEFAULT_SYNC_INTERVAL +5. */
 };
-extern struct ptp_config ptp_cfg;
-
-int read_initialization(char *filename);
+int read_initialization(struct ptp_config *cfg, char *filename);
 
 #endif                          // _PTP_CONFIG_H_
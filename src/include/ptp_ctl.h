@@ -0,0 +1,117 @@
+/** @file ptp_ctl.h
+* Control and status socket.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_CTL_H_
+#define _PTP_CTL_H_
+
+#include <ptp_general.h>
+#include <ptp_spsc.h>
+
+struct ptp_ctx;
+struct ptp_port_ctx;
+
+/// Control socket used by ptpctl if none is given
+#define PTP_CTL_DEFAULT_PATH    "/var/run/openptp.sock"
+/// Events queued per instance, power of two
+#define PTP_CTL_EVENTS          64
+/// Event subscribers served at a time
+#define PTP_CTL_CLIENTS         16
+/// Longest command or reply line
+#define PTP_CTL_LINE_LEN        512
+/// Interval of status file lines, s
+#define PTP_CTL_STATUS_INTERVAL 1
+
+/**
+* Event types pushed to subscribers.
+*/
+enum ptp_ctl_event_type {
+    PTP_CTL_PORT_STATE = 0,     ///< port state changed
+    PTP_CTL_PARENT,             ///< parent or grandmaster changed
+};
+
+/**
+* Event of an instance.
+*/
+struct ptp_ctl_event {
+    enum ptp_ctl_event_type type;
+    struct Timestamp time;      ///< time of the event
+    u8 domain;                  ///< domain of the instance
+    u16 port_number;            ///< port of a state change
+    char name[INTERFACE_NAME_LEN + 1];  ///< interface of the port
+    enum PortState old_state;   ///< state before the change
+    enum PortState new_state;   ///< state after the change
+    bool local;                 ///< local clock is the grandmaster
+    struct PortIdentity parent; ///< new parent port
+    ClockIdentity grandmaster;  ///< new grandmaster
+};
+
+/**
+* Events of an instance, queued by the instance thread and sent by the
+* control thread.
+*/
+struct ptp_ctl_events {
+    struct ptp_spsc ring;       ///< ring indexes
+    u32 dropped;                ///< events lost because ring was full
+    struct ptp_ctl_event events[PTP_CTL_EVENTS];
+};
+
+/**
+* Start control thread. It serves status queries and event subscriptions
+* on a UNIX socket and writes the optional status files. Must be called
+* before the instances run, after ptp_metrics_init().
+* @param path socket path, NULL or empty for no socket.
+* @param status_files write clock state and status to files in /tmp.
+* @param num_instances number of instances.
+* @return ptp error code.
+*/
+int ptp_ctl_start(const char *path, bool status_files, int num_instances);
+
+/**
+* Stop control thread.
+*/
+void ptp_ctl_stop(void);
+
+/**
+* Get event queue of an instance.
+* @param instance index of the instance.
+* @return event queue, NULL if control thread is not running.
+*/
+struct ptp_ctl_events *ptp_ctl_events(int instance);
+
+/**
+* Queue port state change event. Called by the instance thread.
+* @param ctx Port context, new state is set.
+* @param old_state state before the change.
+*/
+void ptp_ctl_port_state(struct ptp_port_ctx *ctx, enum PortState old_state);
+
+/**
+* Queue parent change event. Called by the instance thread.
+* @param ptp_ctx PTP instance, parent dataset is updated.
+*/
+void ptp_ctl_parent(struct ptp_ctx *ptp_ctx);
+
+#endif                          // _PTP_CTL_H_
@@ -31,9 +31,45 @@
 
 #include <ptp_config.h>
 
+/**
+* Log categories. A source file logs to the category it defines as
+* PTP_LOG_CAT before its includes, PTP_LOG_GENERAL if none.
+*/
+enum ptp_log_cat {
+    PTP_LOG_GENERAL = 0,        ///< daemon, configuration, threads
+    PTP_LOG_PACKET,             ///< packet interface
+    PTP_LOG_CLOCK,              ///< clock interface and servo
+    PTP_LOG_FRAMER,             ///< frame building and parsing
+    PTP_LOG_PORT,               ///< port state machine and message handling
+    PTP_LOG_BMC,                ///< best master clock and foreign masters
+    PTP_LOG_UNICAST,            ///< unicast negotiation
+    PTP_LOG_MGMT,               ///< management, control and metrics
+    PTP_LOG_NUM,
+};
+
+#ifndef PTP_LOG_CAT
+#define PTP_LOG_CAT PTP_LOG_GENERAL
+#endif
+
+/// Most verbose level compiled in, make RELEASE=1 compiles out DEBUG()
+#ifndef PTP_LOG_MAX_LEVEL
+#define PTP_LOG_MAX_LEVEL LOG_DEBUG
+#endif
+
+/// Level of each category: LOG_ERR, LOG_INFO or LOG_DEBUG
+extern u8 ptp_log_levels[PTP_LOG_NUM];
+
+/// True if level is logged in the category of the source file. Levels
+/// above PTP_LOG_MAX_LEVEL are constant false, so arguments are not
+/// evaluated and the call is left out.
+#define PTP_LOG_ENABLED(level) \
+    (((level) <= PTP_LOG_MAX_LEVEL) && \
+     (__atomic_load_n(&ptp_log_levels[PTP_LOG_CAT], __ATOMIC_RELAXED) >= \
+      (level)))
+
 #define DEBUG(x...) \
     do { \
-        if(ptp_cfg.debug) { \
+        if (PTP_LOG_ENABLED(LOG_DEBUG)) { \
             OUTPUT_SYSLOG(LOG_DEBUG, ##x); \
         } \
     } while(0)
@@ -43,6 +79,13 @@
         OUTPUT_SYSLOG(LOG_ERR, ##x); \
     } while(0)
 
+#define INFO(x...) \
+    do { \
+        if (PTP_LOG_ENABLED(LOG_INFO)) { \
+            OUTPUT_SYSLOG(LOG_INFO, ##x); \
+        } \
+    } while(0)
+
 /// Output a message to syslog. Not meant to be used directly.
 #define OUTPUT_SYSLOG(prio,fmt,x...) \
     syslog(LOG_DAEMON | prio, "%s:%i %s: " fmt, \
@@ -50,7 +93,7 @@
 
 #define DEBUG_PLAIN(fmt,x...) DEBUG("[PLAIN] ", fmt, ##x)
 
-static char tmp_str[40];
+static __thread char tmp_str[40];
 inline static char *ptp_clk_id(u8 * clk_id)
 {
     snprintf(tmp_str, 40, "%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x",
@@ -60,6 +103,28 @@ inline static char *ptp_clk_id(u8 * clk_id)
     return tmp_str;
 }
 
+/**
+* Set level of all categories.
+* @param level LOG_ERR, LOG_INFO or LOG_DEBUG.
+*/
+void ptp_log_set_all(int level);
+
+/**
+* Set levels of categories.
+* @param spec comma or space separated <category>=<level> pairs, e.g.
+*        "bmc=debug,packet=err". Category "all" sets every category.
+* @return ptp error code, no level is changed on error.
+*/
+int ptp_log_parse(const char *spec);
+
+/**
+* Print levels of all categories as <category>=<level> pairs.
+* @param buf text is written here.
+* @param len buffer length.
+* @return text length.
+*/
+int ptp_log_print(char *buf, int len);
+
 inline static void ptp_dump(u8 * str, int len)
 {
     int i = 0;
@@ -0,0 +1,110 @@
+/** @file ptp_dresp.h
+* PTP Delay_Resp queue of master ports.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_DRESP_H_
+#define _PTP_DRESP_H_
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_config.h>
+
+struct ptp_port_ctx;
+
+/// Default and maximum number of queued Delay_Resp per port
+#define PTP_DRESP_DEFAULT_QUEUE 256
+#define PTP_DRESP_MAX_QUEUE     65536
+/// Delay_Resp sent per port and wakeup, rest wait for the next wakeup
+#define PTP_DRESP_BUDGET        128
+
+/**
+* Queued Delay_Resp, built when Delay_Req is received.
+*/
+struct ptp_dresp_entry {
+    char frame[sizeof(struct ptp_delay_resp)];  ///< Delay_Resp frame
+    char peer_ip[IP_STR_MAX_LEN];       ///< requester, if answered unicast
+    bool unicast;               ///< sent to the requester
+    bool delayed;               ///< left over from an earlier wakeup
+};
+
+/**
+* Delay_Resp statistics of a port.
+*/
+struct ptp_dresp_stats {
+    u64 queued;                 ///< Delay_Req answered
+    u64 sent;                   ///< Delay_Resp sent
+    u64 delayed;                ///< Delay_Resp not sent on first wakeup
+    u64 dropped;                ///< Delay_Resp dropped (queue full, error)
+    u32 max_depth;              ///< high watermark of the queue
+};
+
+/**
+* Delay_Resp queue of a port. Delay_Req received during a wakeup are
+* answered in batches after Sync has been sent.
+*/
+struct ptp_dresp_queue {
+    struct ptp_dresp_entry *entries;    ///< ring of queued responses
+    u32 capacity;               ///< number of entries
+    u32 head;                   ///< oldest entry
+    u32 count;                  ///< entries in use
+    struct ptp_dresp_stats stats;
+};
+
+/**
+* Initialize Delay_Resp queue on preallocated entries.
+* @param queue Delay_Resp queue.
+* @param entries memory for the entries.
+* @param capacity number of entries.
+*/
+void ptp_dresp_init(struct ptp_dresp_queue *queue,
+                    struct ptp_dresp_entry *entries, u32 capacity);
+
+/**
+* Queue Delay_Resp answering a Delay_Req.
+* @param ctx Port context.
+* @param msg Delay_Req message.
+* @param time receive time of the Delay_Req.
+* @param peer_ip address of the requester.
+*/
+void ptp_dresp_queue(struct ptp_port_ctx *ctx, struct ptp_delay_req *msg,
+                     struct Timestamp *time, char *peer_ip);
+
+/**
+* Send queued Delay_Resp of a port, at most PTP_DRESP_BUDGET of them.
+* Sending stops early if Sync of the port becomes due.
+* @param ctx Port context.
+* @param current_time current time.
+* @return number of responses still queued.
+*/
+u32 ptp_dresp_flush(struct ptp_port_ctx *ctx, struct Timestamp *current_time);
+
+/**
+* Number of queued Delay_Resp of a port.
+* @param ctx Port context.
+* @return number of responses.
+*/
+u32 ptp_dresp_pending(struct ptp_port_ctx *ctx);
+
+#endif                          // _PTP_DRESP_H_
@@ -0,0 +1,113 @@
+/** @file ptp_foreign.h
+* PTP foreign master table.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_FOREIGN_H_
+#define _PTP_FOREIGN_H_
+
+#include <ptp_general.h>
+#include <ptp_internal.h>
+
+/**
+* Get number of slots needed for the foreign master table.
+* @param capacity maximum number of records.
+* @return number of slots.
+*/
+u32 ptp_foreign_table_slots(u32 capacity);
+
+/**
+* Initialize foreign master table on preallocated records.
+* No allocations are done when table is used.
+* @param table foreign master table.
+* @param capacity maximum number of records.
+* @param records memory for the slots.
+* @param num_slots number of slots, from ptp_foreign_table_slots().
+* @return ptp error code.
+*/
+int ptp_foreign_table_init(struct ForeignMasterTable *table, u32 capacity,
+                           struct ForeignMasterDataSet *records,
+                           u32 num_slots);
+
+/**
+* Find foreign master record.
+* @param table foreign master table.
+* @param port_id sourcePortIdentity of the foreign master (host order).
+* @return record, NULL if not found.
+*/
+struct ForeignMasterDataSet *ptp_foreign_lookup(struct ForeignMasterTable
+                                                *table,
+                                                struct PortIdentity
+                                                *port_id);
+
+/**
+* Add new (cleared) foreign master record.
+* @param table foreign master table.
+* @param port_id sourcePortIdentity of the foreign master (host order).
+* @return record, NULL if table is full.
+*/
+struct ForeignMasterDataSet *ptp_foreign_insert(struct ForeignMasterTable
+                                                *table,
+                                                struct PortIdentity
+                                                *port_id);
+
+/**
+* Remove foreign master record.
+* @param table foreign master table.
+* @param record record to remove.
+*/
+void ptp_foreign_remove(struct ForeignMasterTable *table,
+                        struct ForeignMasterDataSet *record);
+
+/**
+* Store received announce to the record and update its expiry deadlines.
+* @param record foreign master record.
+* @param msg announce message.
+* @param time receive time of the announce.
+* @param receipt_timeout announce_receipt_timeout of the port.
+*/
+void ptp_foreign_update(struct ForeignMasterDataSet *record,
+                        struct ptp_announce *msg,
+                        struct Timestamp *time, u8 receipt_timeout);
+
+/**
+* Remove records whose announce window has expired.
+* @param table foreign master table.
+* @param current_time current time.
+*/
+void ptp_foreign_expire(struct ForeignMasterTable *table,
+                        struct Timestamp *current_time);
+
+/**
+* Iterate records of the foreign master table.
+* @param table foreign master table.
+* @param record previous record, NULL to get the first one.
+* @return next record in use, NULL when all records are iterated.
+*/
+struct ForeignMasterDataSet *ptp_foreign_next(struct ForeignMasterTable
+                                              *table,
+                                              struct ForeignMasterDataSet
+                                              *record);
+
+#endif                          // _PTP_FOREIGN_H_
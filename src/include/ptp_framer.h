@@ -29,14 +29,23 @@
 #include <ptp_general.h>
 #include "ptp_port.h"
 
+/**
+* Invalidate message templates of all ports of the instance. Must be called
+* when default, parent, time properities or port datasets change.
+* @param ptp_ctx PTP instance.
+*/
+void ptp_framer_invalidate(struct ptp_ctx *ptp_ctx);
+
 /**
 * Function for creating PTP Sync message.
 * @param ctx Port context.
 * @param buf Buffer to which frame is created.
 * @param seqid Sequence id.
+* @param time current time, used as originTimestamp in two-step mode.
 * @return size of the created frame.
 */
-int create_sync(struct ptp_port_ctx *ctx, char *buf, u16 seqid);
+int create_sync(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                struct Timestamp *time);
 
 /**
 * Function for creating PTP Follow_Up message.
@@ -55,18 +64,22 @@ int create_follow_up(struct ptp_port_ctx *ctx, char *buf,
 * @param buf Buffer to which frame is created.
 * @param seqid Sequence id.
 * @param local if true, use data from defaut dataset (instead of parent).
+* @param time current time used as originTimestamp, NULL for zero.
 * @return size of the created frame.
 */
-int create_announce(struct ptp_port_ctx *ctx, char *buf, u16 seq_id, int local);
+int create_announce(struct ptp_port_ctx *ctx, char *buf, u16 seq_id, 
+                    int local, struct Timestamp *time);
 
 /**
 * Function for creating PTP Delay_Req message.
 * @param ctx Port context.
 * @param buf Buffer to which frame is created.
 * @param seqid Sequence id.
+* @param time current time used as originTimestamp.
 * @return size of the created frame.
 */
-int create_delay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid);
+int create_delay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                     struct Timestamp *time);
 
 /**
 * Function for creating PTP Delay_Resp message.
@@ -83,4 +96,74 @@ int create_delay_resp(struct ptp_port_ctx *ctx, char *buf,
                       struct PortIdentity *src_port_id,
                       u16 seqid, u64 corr_field);
 
+/**
+* Function for creating PTP Pdelay_Req message.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param seqid Sequence id.
+* @param time current time used as originTimestamp.
+* @return size of the created frame.
+*/
+int create_pdelay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                      struct Timestamp *time);
+
+/**
+* Function for creating PTP Pdelay_Resp message (two-step).
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param time when pdelay_req was recvd
+* @param req_port_id Source port of Pdelay_Req
+* @param seqid Sequence id of Pdelay_Req.
+* @return size of the created frame.
+*/
+int create_pdelay_resp(struct ptp_port_ctx *ctx,
+                       char *buf,
+                       struct Timestamp *time,
+                       struct PortIdentity *req_port_id, u16 seqid);
+
+/**
+* Function for creating PTP Pdelay_Resp_Follow_Up message.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param time when pdelay_resp was sent
+* @param req_port_id Source port of Pdelay_Req
+* @param seqid Sequence id of Pdelay_Req.
+* @param corr_field Correction field of the Pdelay_Req
+* @return size of the created frame.
+*/
+int create_pdelay_resp_follow_up(struct ptp_port_ctx *ctx,
+                                 char *buf,
+                                 struct Timestamp *time,
+                                 struct PortIdentity *req_port_id,
+                                 u16 seqid, s64 corr_field);
+
+/**
+* Function for creating PTP Management response without TLVs. Response
+* is sent as unicast, TLVs are appended by the caller.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param target_port_id Source port of the request (targetPortIdentity).
+* @param seqid Sequence id of the request.
+* @param hops startingBoundaryHops and boundaryHops.
+* @param action actionField.
+* @return size of the created frame.
+*/
+int create_management(struct ptp_port_ctx *ctx,
+                      char *buf,
+                      struct PortIdentity *target_port_id,
+                      u16 seqid, u8 hops, u8 action);
+
+/**
+* Function for creating PTP Signaling message without TLVs. TLVs are
+* appended and messageLength set by the caller.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param target_port_id targetPortIdentity.
+* @param seqid Sequence id.
+* @return size of the created frame.
+*/
+int create_signaling(struct ptp_port_ctx *ctx,
+                     char *buf,
+                     struct PortIdentity *target_port_id, u16 seqid);
+
 #endif                          // _PTP_FRAMER_H_
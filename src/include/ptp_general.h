@@ -38,6 +38,10 @@
 #define PTP_ERR_FRAME   -2      ///< Frame error
 #define PTP_ERR_TIMEOUT -3      ///< Timeout error
 #define PTP_ERR_NET     -4      ///< Error from network interface
+#define PTP_ERR_SEND    -5      ///< Frame not sent, socket is usable
+
+/// Size of a cache line, data shared between threads is aligned to it
+#define PTP_CACHE_LINE  64
 
 /**
 * PTP protocol state machine states.
@@ -39,44 +39,31 @@
 * Foreign master dataset.
 */
 struct ForeignMasterDataSet {
+    bool in_use;                        ///< slot of the foreign master table is in use
     struct PortIdentity src_port_id;    ///< sourcePortIdentity from announce message
     char src_ip[IP_STR_MAX_LEN];        ///< source ip from announce msg
     struct PortIdentity dst_port_id;    ///< sourcePortIdentity of the receiver of the announce message
     u8 foreign_master_announce_messages;        ///< number of annouce messages received during FOREIGN_MASTER_TIME_WINDOW
-    u8 tstamp_index;            ///< wr index for announce_tstamp
-    struct Timestamp announce_tstamp[ANNOUNCE_WINDOW];  ///< timestamps for the announce messages during recv window
+    u8 tstamp_index;            ///< wr index for announce_expiry
+    s8 window_log_interval;     ///< logMeanMessageInterval window was calculated for
+    struct Timestamp window;    ///< announce window (announce interval * announce_receipt_timeout)
+    struct Timestamp announce_expiry[ANNOUNCE_WINDOW];  ///< expiry deadlines of the announce messages during recv window
+    struct Timestamp expiry;    ///< expiry deadline of the whole record (newest announce + window)
     struct ptp_announce msg;    ///< stored announce message (one per src_port_id)
 };
 
 /**
-* Foreign master dataset linked list element. 
+* Foreign master table. Open-addressed (linear probing) hash table 
+* keyed by the sourcePortIdentity of the foreign master. Records are 
+* preallocated when the port is created.
 */
-struct ForeignMasterDataSetElem {
-    struct ForeignMasterDataSetElem *next;      ///< for linked list of foreign masters
-    struct ForeignMasterDataSet *data_p;        ///< pointer to data (to be identical to ForeignMasterDataSetElem_p)
-    struct ForeignMasterDataSet data;   ///< dataset
+struct ForeignMasterTable {
+    u32 capacity;               ///< maximum number of records in table
+    u32 num_slots;              ///< number of slots, power of 2 (>= 2*capacity)
+    u32 num_records;            ///< number of records in use
+    struct ForeignMasterDataSet *records;      ///< slots
 };
 
-/**
-* Foreign master dataset pointer linked list struct. 
-*/
-struct ForeignMasterDataSetElem_p {
-    struct ForeignMasterDataSetElem_p *next;    ///< for linked list of foreign masters
-    struct ForeignMasterDataSet *data_p;        ///< pointer to data
-};
-
-// Helpers
-inline static u64 ntohll(u64 x)
-{
-    u32 *tmp1 = (u32 *) & x;
-    u32 *tmp2 = (tmp1 + 1);
-    u64 tmp3 = (((u64) (ntohl(*tmp1))) << 32) & 0xffffffff00000000ll;
-    tmp3 |= 0xffffffff & ntohl(*tmp2);
-    return tmp3;
-}
-
-#define htonll(x) ntohll(x)
-
 // String helpers
 char *get_ptp_event_clk_str(enum ptp_event_clk event);
 char *get_ptp_event_ctrl_str(enum ptp_event_ctrl event);
@@ -50,7 +50,7 @@
 #define PTP_UTC_OFFSET_VALID        0x0400      ///<  The value of current_utc_offset_valid
 #define PTP_TIMESCALE               0x0800      ///<  The value of ptp_timescale of the time properties data set.
 #define PTP_TIME_TRACEABLE          0x1000      ///<  The value of time_traceable of the time properties data set.
-#define PTP_FREQ_TRACEABLE          0x1000      ///<  The value of frequency_traceable of the time properties data set.
+#define PTP_FREQ_TRACEABLE          0x2000      ///<  The value of frequency_traceable of the time properties data set.
 
 /// PTP header control field values (for backward combatibility).
 #define PTP_CTRL_SYNC               0x0 ///< Sync
@@ -171,4 +171,17 @@ struct ptp_signaling {
     u8 tlvs;                    ///< One or more TLVs
 } __attribute__ ((packed));
 
+/**
+* PTP Management message.
+*/
+struct ptp_management {
+    struct ptp_header hdr;      ///< common PTP header
+    u8 target_port_id[10];      ///< targetPortIdentity
+    u8 starting_boundary_hops;  ///< startingBoundaryHops
+    u8 boundary_hops;           ///< boundaryHops
+    u8 action;                  ///< actionField (bits 3-0)
+    u8 res;
+    u8 tlvs;                    ///< management TLV
+} __attribute__ ((packed));
+
 #endif                          // _PTP_MESSAGE_H_
@@ -0,0 +1,99 @@
+/** @file ptp_metrics.h
+* Metrics exporter.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_METRICS_H_
+#define _PTP_METRICS_H_
+
+#include <ptp_general.h>
+#include <ptp_stats.h>
+
+struct ptp_ctx;
+
+/// Interval of snapshots published by instances, s
+#define PTP_METRICS_INTERVAL    1
+/// Size of the response buffer of the exporter
+#define PTP_METRICS_BUF_LEN     (256 * 1024)
+/// Reads of a snapshot before a scrape gives up on an instance
+#define PTP_METRICS_RETRIES     100
+
+/**
+* Snapshot published by an instance. The instance thread is the only
+* writer: sequence is odd while the snapshot is written, so the exporter
+* copies it without locks and retries if sequence changed meanwhile.
+*/
+struct ptp_metrics_slot {
+    u32 sequence;               ///< incremented before and after update
+    bool valid;                 ///< snapshot has been published
+    struct ptp_snapshot snap;   ///< statistics of the instance
+} __attribute__ ((aligned(PTP_CACHE_LINE)));
+
+/**
+* Reserve snapshot slots of the instances. Snapshots are published when
+* the exporter or the control socket is used.
+* @param num_instances number of instances publishing snapshots.
+*/
+void ptp_metrics_init(int num_instances);
+
+/**
+* Start exporter thread serving metrics in Prometheus text format over
+* HTTP on a localhost TCP port. Must be called before the instances run.
+* @param port TCP port.
+* @return ptp error code.
+*/
+int ptp_metrics_start(int port);
+
+/**
+* Stop exporter thread.
+*/
+void ptp_metrics_stop(void);
+
+/**
+* Get snapshot slot of an instance.
+* @param instance index of the instance.
+* @return slot, NULL if snapshots are not published.
+*/
+struct ptp_metrics_slot *ptp_metrics_slot(int instance);
+
+/**
+* Copy latest snapshot of an instance without waiting for it.
+* @param instance index of the instance.
+* @param snap snapshot is copied here.
+* @return true if a consistent snapshot was copied.
+*/
+bool ptp_metrics_read(int instance, struct ptp_snapshot *snap);
+
+/**
+* Publish snapshot of an instance when it is due. Called from the
+* instance thread.
+* @param ptp_ctx PTP instance.
+* @param current_time current time.
+* @param next_time moved earlier if a snapshot is due sooner.
+*/
+void ptp_metrics_run(struct ptp_ctx *ptp_ctx,
+                     struct Timestamp *current_time,
+                     struct Timestamp *next_time);
+
+#endif                          // _PTP_METRICS_H_
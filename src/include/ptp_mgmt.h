@@ -0,0 +1,135 @@
+/** @file ptp_mgmt.h
+* PTP management messages.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_MGMT_H_
+#define _PTP_MGMT_H_
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_codec.h>
+
+struct ptp_port_ctx;
+
+/// actionField of management message
+#define PTP_MGMT_GET            0
+#define PTP_MGMT_SET            1
+#define PTP_MGMT_RESPONSE       2
+#define PTP_MGMT_COMMAND        3
+#define PTP_MGMT_ACKNOWLEDGE    4
+
+/// managementErrorId of MANAGEMENT_ERROR_STATUS TLV
+#define PTP_MGMT_ERR_RESPONSE_TOO_BIG   0x0001
+#define PTP_MGMT_ERR_NO_SUCH_ID         0x0002
+#define PTP_MGMT_ERR_WRONG_LENGTH       0x0003
+#define PTP_MGMT_ERR_WRONG_VALUE        0x0004
+#define PTP_MGMT_ERR_NOT_SETABLE        0x0005
+#define PTP_MGMT_ERR_NOT_SUPPORTED      0x0006
+#define PTP_MGMT_ERR_GENERAL_ERROR      0xFFFE
+
+/// managementId applies to the clock or to each targeted port
+#define PTP_MGMT_CLOCK          0
+#define PTP_MGMT_PORT           1
+
+/// Length of managementId field of MANAGEMENT TLV
+#define PTP_MGMT_ID_LEN         2
+/// Length of MANAGEMENT_ERROR_STATUS TLV value without displayData
+#define PTP_MGMT_ERR_LEN        8
+/// Largest dataField of the supported managementIds
+#define PTP_MGMT_DATA_MAX       32
+/// Management message with one TLV of the largest supported dataField
+#define PTP_MGMT_FRAME_LEN      (offsetof(struct ptp_management, tlvs) + \
+                                 PTP_TLV_HDR_LEN + PTP_MGMT_ID_LEN + \
+                                 PTP_MGMT_DATA_MAX)
+
+/**
+* Supported managementIds: value, name, dataField length, scope and
+* whether the value can be SET. Data of one-octet values is padded with
+* a reserved octet.
+*/
+#define PTP_MGMT_TABLE(X) \
+    X(0x0000, NULL_MANAGEMENT, 0, PTP_MGMT_CLOCK, false) \
+    X(0x2000, DEFAULT_DATA_SET, 20, PTP_MGMT_CLOCK, false) \
+    X(0x2001, CURRENT_DATA_SET, 18, PTP_MGMT_CLOCK, false) \
+    X(0x2002, PARENT_DATA_SET, 32, PTP_MGMT_CLOCK, false) \
+    X(0x2003, TIME_PROPERTIES_DATA_SET, 4, PTP_MGMT_CLOCK, false) \
+    X(0x2004, PORT_DATA_SET, 26, PTP_MGMT_PORT, false) \
+    X(0x2005, PRIORITY1, 2, PTP_MGMT_CLOCK, true) \
+    X(0x2006, PRIORITY2, 2, PTP_MGMT_CLOCK, true) \
+    X(0x2007, DOMAIN, 2, PTP_MGMT_CLOCK, false) \
+    X(0x2008, SLAVE_ONLY, 2, PTP_MGMT_CLOCK, false) \
+    X(0x2009, LOG_ANNOUNCE_INTERVAL, 2, PTP_MGMT_PORT, true) \
+    X(0x200A, ANNOUNCE_RECEIPT_TIMEOUT, 2, PTP_MGMT_PORT, true) \
+    X(0x200B, LOG_SYNC_INTERVAL, 2, PTP_MGMT_PORT, true) \
+    X(0x200C, VERSION_NUMBER, 2, PTP_MGMT_PORT, false) \
+    X(0x6000, DELAY_MECHANISM, 2, PTP_MGMT_PORT, false) \
+    X(0x6001, LOG_MIN_PDELAY_REQ_INTERVAL, 2, PTP_MGMT_PORT, true)
+
+#define PTP_MGMT_ID(id, name, len, scope, set) PTP_MGMT_##name = id,
+/**
+* managementId values.
+*/
+enum ptp_mgmt_id {
+    PTP_MGMT_TABLE(PTP_MGMT_ID)
+};
+#undef PTP_MGMT_ID
+
+/**
+* Properties of a managementId.
+*/
+struct ptp_mgmt_info {
+    u16 id;                     ///< managementId
+    const char *name;           ///< managementId name
+    int len;                    ///< dataField length
+    int scope;                  ///< PTP_MGMT_CLOCK or PTP_MGMT_PORT
+    bool settable;              ///< SET action supported
+};
+
+/**
+* Get properties of a managementId. Lookups are implemented by the codec,
+* so management clients can use them without the rest of the stack.
+* @param id managementId.
+* @return properties, NULL if managementId is not supported.
+*/
+const struct ptp_mgmt_info *ptp_mgmt_lookup(u16 id);
+
+/**
+* Get properties of a managementId by name.
+* @param name managementId name, e.g. "DEFAULT_DATA_SET".
+* @return properties, NULL if managementId is not supported.
+*/
+const struct ptp_mgmt_info *ptp_mgmt_lookup_name(const char *name);
+
+/**
+* Handle received management message. GET, SET and COMMAND actions
+* targeted to this clock are answered with a unicast response to the
+* sender, other actions are ignored.
+* @param ctx Port context the message was received from.
+* @param buf management message validated with ptp_msg_check().
+* @param len msg length.
+*/
+void ptp_mgmt_recv(struct ptp_port_ctx *ctx, char *buf, int len);
+
+#endif                          // _PTP_MGMT_H_
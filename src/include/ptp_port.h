@@ -27,12 +27,92 @@
 #ifndef _PTP_PORT_H_
 #define _PTP_PORT_H_
 #include <ptp_general.h>
+#include <ptp_internal.h>
+#include <ptp_unicast.h>
+#include <ptp_dresp.h>
+#include <ptp_ratelimit.h>
+#include <ptp_seqstat.h>
+#include <ptp_stats.h>
+
+/**
+* Prebuilt messages of the port. Templates are rebuilt when datasets
+* change, on send only the per frame fields are patched.
+*/
+struct ptp_port_templates {
+    u32 generation;             ///< dataset generation of the templates
+    struct ptp_sync sync;
+    struct ptp_follow_up follow_up;
+    struct ptp_announce announce;       ///< announce from parent dataset
+    struct ptp_announce announce_local; ///< announce from default dataset
+    struct ptp_delay_req delay_req;
+    struct ptp_delay_resp delay_resp;
+    struct ptp_pdelay_req pdelay_req;
+    struct ptp_pdelay_resp pdelay_resp;
+    struct ptp_pdelay_resp_follow_up pdelay_resp_follow_up;
+};
+
+/// Outstanding two-step Syncs remembered per port, power of two
+#define PTP_SYNC_WINDOW         8
+
+/**
+* Sync and Follow_Up of one sequenceId. Either may arrive first.
+*/
+struct ptp_sync_slot {
+    bool sync_valid;            ///< Sync received
+    bool follow_up_valid;       ///< Follow_Up received
+    u16 seq_id;                 ///< sequenceId of the slot
+    struct Timestamp recv_time; ///< receive time of Sync
+    s64 sync_corr_field;        ///< correction of Sync, with asymmetry
+    struct Timestamp origin;    ///< preciseOriginTimestamp of Follow_Up
+    s64 follow_up_corr_field;   ///< correction of Follow_Up
+};
+
+/**
+* Two-step Syncs of the current master waiting for their pair. Slot is
+* selected by sequenceId.
+*/
+struct ptp_sync_window {
+    ClockIdentity master;       ///< master the slots belong to
+    bool last_valid;            ///< last_seq_id is valid
+    u16 last_seq_id;            ///< sequenceId of the last sample
+    struct ptp_sync_slot slots[PTP_SYNC_WINDOW];
+};
+
+/// Delay_Req in flight remembered per port, power of two
+#define PTP_DELAY_REQ_WINDOW    16
+/// Delay_Req without Delay_Resp is lost after this many request intervals
+#define PTP_DELAY_REQ_EXPIRY    8
+
+/**
+* Sent Delay_Req waiting for Delay_Resp.
+*/
+struct ptp_delay_req_slot {
+    bool valid;                 ///< waiting for Delay_Resp
+    u16 seq_id;                 ///< sequenceId of Delay_Req
+    struct Timestamp send_time; ///< send time of Delay_Req
+    struct Timestamp expiry;    ///< Delay_Resp not accepted after this
+};
+
+/**
+* Delay_Req in flight. Slot is selected by sequenceId, so a response to
+* an earlier request still gives a sample.
+*/
+struct ptp_delay_req_table {
+    u16 last_seq_id;            ///< sequenceId of the latest Delay_Req
+    u64 matched;                ///< responses to the latest Delay_Req
+    u64 late;                   ///< responses to an earlier Delay_Req
+    u64 lost;                   ///< Delay_Req expired without response
+    u64 unmatched;              ///< responses without Delay_Req in flight
+    struct ptp_delay_req_slot slots[PTP_DELAY_REQ_WINDOW];
+};
 
 /**
 * Port context. Given as argument to every port specific function.
 */
 struct ptp_port_ctx {
     struct ptp_port_ctx *next;  ///< Internal pointer for utilizing lists.
+    struct ptp_ctx *ptp;        ///< PTP instance this port belongs to
+    struct ptp_port_counters counters;  ///< message counters
 
     char name[INTERFACE_NAME_LEN]; // interface name
     char current_master_ip[IP_STR_MAX_LEN]; // Current master ip address str
@@ -50,15 +130,34 @@ struct ptp_port_ctx {
     u16 sync_seqid;             ///< sequence id for sync
     u16 delay_req_seqid;        ///< sequence id for delay_req 
     u16 announce_seqid;         ///< sequence id for announce 
-    struct Timestamp sync_recv_time;    ///< timestamp of the received sync
-    u64 sync_recv_corr_field;   ///< correction field of the received sync
-    /// sequence id for delay_req for which delay_req_send_time is valid
-    u16 delay_req_seqid_sent;   
-    struct Timestamp delay_req_send_time;       ///< timestamp of the sent delay_req
-    struct ForeignMasterDataSetElem *foreign_master_head;
-    ///< List head of foreign master datasets
+    struct ptp_sync_window sync_window; ///< received two-step Syncs
+    struct ptp_seq_stats seq_stats;     ///< sequenceIds of received frames
+    struct ptp_delay_req_table delay_reqs;      ///< Delay_Req in flight
+    // Peer delay mechanism, requester
+    u16 pdelay_req_seqid;       ///< sequence id for pdelay_req
+    bool pdelay_t1_valid;       ///< pdelay_t1 is valid for pdelay_req_seqid_sent
+    u16 pdelay_req_seqid_sent;  ///< sequence id of the last sent pdelay_req
+    struct Timestamp pdelay_t1; ///< send time of pdelay_req
+    bool pdelay_resp_valid;     ///< pdelay_resp received, waiting follow_up
+    struct PortIdentity pdelay_peer;    ///< responder of pdelay_req
+    struct Timestamp pdelay_t2; ///< receive time of pdelay_req at peer
+    struct Timestamp pdelay_t4; ///< receive time of pdelay_resp
+    s64 pdelay_corr_field;      ///< correction field of pdelay_resp
+    /// t3 and t4 of the reference measurement for neighbor rate ratio
+    struct Timestamp pdelay_ratio_t3;
+    struct Timestamp pdelay_ratio_t4;
+    int pdelay_ratio_count;     ///< measurements since reference, 0 if none
+    double neighbor_rate_ratio; ///< peer clock rate / local clock rate
+    // Peer delay mechanism, responder
+    s64 pdelay_req_corr_field;  ///< correction field of received pdelay_req
+    struct ForeignMasterTable foreign_masters;
+    ///< Table of foreign master datasets
     ClockIdentity current_master;       ///< clock identity of the current master
     bool unicast_port;          ///< flag, unicast port
+    bool hybrid;                ///< flag, multicast port with unicast delay
+    struct ptp_dresp_queue delay_resp;  ///< Delay_Resp waiting to be sent
+    struct ptp_rl_table delay_req_clients;      ///< Delay_Req requesters
+    struct ptp_unicast unicast; ///< Unicast negotiation
     /** delay asymmetry for port. This is used if delay_asymmetry_master_set==0 
      * or delay_asymmetry_master_set==1 and delay_asymmetry_master is the
      * clock_id of the current_master */
@@ -69,6 +168,7 @@ struct ptp_port_ctx {
     ClockIdentity delay_asymmetry_master;
 
     struct PortDataSet port_dataset;    ///< Port dataset      
+    struct ptp_port_templates templates;        ///< Prebuilt messages
 };
 
 /// Timer enable flags
@@ -80,6 +180,15 @@ enum PortTimerFlags {
     ANNOUNCE_RECV_TIMER = 0x10,
 };
 
+/**
+* Reserve port contexts (with their foreign master tables) from the arena.
+* Port contexts are taken from this pool when ports are created and 
+* returned when ports are closed.
+* @param ptp_ctx main context.
+* @return ptp error code.
+*/
+int ptp_port_pool_init(struct ptp_ctx *ptp_ctx);
+
 /**
 * Statemachine for PTP port.
 * @param ctx Port context.
@@ -104,6 +213,28 @@ void ptp_port_recv(struct ptp_port_ctx *ctx,
                    struct Timestamp *time,
                    char* peer_ip);
 
+/**
+* Handle received PTP message, which is already validated and counted,
+* e.g. by a transparent clock that passes peer delay messages to its ports.
+* @param ctx Port context.
+* @param buf PTP message.
+* @param len msg length.
+* @param time timestamp for received frame.
+* @param peer_ip IP address of the sender of this message.
+*/
+void ptp_port_dispatch(struct ptp_port_ctx *ctx, char *buf, int len,
+                       struct Timestamp *time, char *peer_ip);
+
+/**
+* Store send time of Delay_Req. Delay_Req in flight which have expired
+* are counted lost.
+* @param ctx Port context.
+* @param seq_id sequenceId of Delay_Req.
+* @param sent_time send time.
+*/
+void ptp_port_delay_req_sent(struct ptp_port_ctx *ctx, u16 seq_id,
+                             struct Timestamp *sent_time);
+
 /**
 * Function for updating the PTP port state
 * @param ctx Port context.
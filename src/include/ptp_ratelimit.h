@@ -0,0 +1,109 @@
+/** @file ptp_ratelimit.h
+* PTP Delay_Req admission of master ports.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_RATELIMIT_H_
+#define _PTP_RATELIMIT_H_
+
+#include <ptp_general.h>
+#include <ptp_config.h>
+
+/// Default and maximum number of requesters tracked per port
+#define PTP_RL_DEFAULT_CLIENTS  256
+#define PTP_RL_MAX_CLIENTS      65536
+/// Requests a requester may send back to back (bucket size)
+#define PTP_RL_BURST            4
+/// Slots searched for a requester before the least recent is replaced
+#define PTP_RL_PROBE            8
+/// Number of worst requesters reported
+#define PTP_RL_REPORT           8
+
+/**
+* Token bucket of one requester. Requesters are keyed by source address,
+* all identities sent from one address share the bucket. Tokens are kept
+* as nanoseconds of credit, one request costs one request interval.
+*/
+struct ptp_rl_client {
+    bool in_use;                ///< slot holds a requester
+    struct PortIdentity port_id;        ///< latest sourcePortIdentity (host order)
+    char addr[IP_STR_MAX_LEN];  ///< source address, key of the requester
+    u64 last_ns;                ///< time of last request
+    u64 credit_ns;              ///< tokens left, ns
+    u32 accepted;               ///< requests answered
+    u32 dropped;                ///< requests over rate
+};
+
+/**
+* Requesters of a port. Open addressing with a short probe window, when
+* the window is full the least recent requester is replaced.
+*/
+struct ptp_rl_table {
+    struct ptp_rl_client *clients;      ///< slots
+    u32 num_slots;              ///< number of slots (power of two)
+    u64 accepted;               ///< requests answered
+    u64 dropped;                ///< requests over rate
+    u64 evicted;                ///< requesters replaced
+};
+
+/**
+* Get number of slots needed for the requester table.
+* @param capacity number of requesters.
+* @return number of slots.
+*/
+u32 ptp_rl_slots(u32 capacity);
+
+/**
+* Initialize requester table on preallocated slots.
+* @param table requester table.
+* @param clients memory for the slots.
+* @param num_slots number of slots, from ptp_rl_slots().
+*/
+void ptp_rl_init(struct ptp_rl_table *table, struct ptp_rl_client *clients,
+                 u32 num_slots);
+
+/**
+* Admit a request. Requester (source address) may send PTP_RL_BURST
+* requests back to back, then one per 2^log_interval seconds.
+* @param table requester table.
+* @param port_id sourcePortIdentity of the request (host order).
+* @param addr source address.
+* @param log_interval minimum request interval of the requester.
+* @param time receive time of the request.
+* @return true if request is answered, false if it is over rate.
+*/
+bool ptp_rl_admit(struct ptp_rl_table *table, struct PortIdentity *port_id,
+                  char *addr, s8 log_interval, struct Timestamp *time);
+
+/**
+* Get requesters with the most dropped requests.
+* @param table requester table.
+* @param worst requesters returned here, worst first.
+* @param max size of worst.
+* @return number of requesters returned.
+*/
+int ptp_rl_offenders(struct ptp_rl_table *table,
+                     struct ptp_rl_client **worst, int max);
+
+#endif                          // _PTP_RATELIMIT_H_
@@ -0,0 +1,118 @@
+/** @file ptp_seqstat.h
+* PTP sequenceId gap and loss accounting of received messages.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_SEQSTAT_H_
+#define _PTP_SEQSTAT_H_
+
+#include <ptp_general.h>
+
+/// Sending ports tracked per port, least recent is replaced
+#define PTP_SEQ_SOURCES         4
+/// Frames arriving this many sequenceIds late are counted reordered
+#define PTP_SEQ_WINDOW          64
+/// Longer jumps of sequenceId are counted as sender restarts
+#define PTP_SEQ_MAX_GAP         1024
+
+/**
+* Message types whose sequenceIds are tracked.
+*/
+enum ptp_seq_type {
+    PTP_SEQ_ANNOUNCE = 0,
+    PTP_SEQ_SYNC,
+    PTP_SEQ_FOLLOW_UP,
+    PTP_SEQ_NUM_TYPES,
+};
+
+/**
+* Sequence counters of one message type.
+*/
+struct ptp_seq_counters {
+    u64 frames;                 ///< frames received
+    u64 gaps;                   ///< jumps forward over missing sequenceIds
+    u64 lost;                   ///< missing frames, late arrivals excluded
+    u64 duplicates;             ///< frames received twice
+    u64 reordered;              ///< frames received after a newer one
+    u64 restarts;               ///< sequence restarted by sender
+};
+
+/**
+* Received sequenceIds of one message type of one sender.
+*/
+struct ptp_seq_track {
+    bool valid;                 ///< last_seq_id is valid
+    u16 last_seq_id;            ///< newest sequenceId received
+    u64 history;                ///< bit n: last_seq_id - n received
+    struct ptp_seq_counters counters;
+};
+
+/**
+* Sending port whose frames are tracked.
+*/
+struct ptp_seq_source {
+    bool in_use;                ///< source is tracked
+    struct PortIdentity port_id;        ///< sourcePortIdentity (host order)
+    u64 last_frame;             ///< value of frame counter at last frame
+    struct ptp_seq_track types[PTP_SEQ_NUM_TYPES];
+};
+
+/**
+* Sequence accounting of a port: per sender, and totals of the port which
+* include senders that have been replaced.
+*/
+struct ptp_seq_stats {
+    u64 frames;                 ///< frames tracked
+    struct ptp_seq_source sources[PTP_SEQ_SOURCES];
+    struct ptp_seq_counters total[PTP_SEQ_NUM_TYPES];
+};
+
+/**
+* Account received frame.
+* @param stats sequence statistics of the port.
+* @param port_id sourcePortIdentity of the frame (host order).
+* @param msg_type PTP message type, other than Announce, Sync and
+* Follow_Up are ignored.
+* @param seq_id sequenceId of the frame.
+*/
+void ptp_seq_recv(struct ptp_seq_stats *stats, struct PortIdentity *port_id,
+                  u8 msg_type, u16 seq_id);
+
+/**
+* Get tracked sender.
+* @param stats sequence statistics of the port.
+* @param port_id sourcePortIdentity (host order).
+* @return sender, NULL if not tracked.
+*/
+struct ptp_seq_source *ptp_seq_find(struct ptp_seq_stats *stats,
+                                    struct PortIdentity *port_id);
+
+/**
+* Get name of tracked message type.
+* @param type PTP_SEQ_xxx.
+* @return name.
+*/
+const char *ptp_seq_type_name(int type);
+
+#endif                          // _PTP_SEQSTAT_H_
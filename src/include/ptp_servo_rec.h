@@ -0,0 +1,162 @@
+/** @file ptp_servo_rec.h
+* Servo recorder.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_SERVO_REC_H_
+#define _PTP_SERVO_REC_H_
+
+#include <pthread.h>
+
+#include <ptp_general.h>
+#include <clock_if.h>
+
+struct ptp_port_ctx;
+
+/// Records of a recorder file, the file is rotated to <name>.1 when full
+#define PTP_SERVO_REC_RECORDS   65536
+/// Recorder file identification
+#define PTP_SERVO_REC_MAGIC     "PTPSERVO"
+#define PTP_SERVO_REC_VERSION   1
+
+/**
+* Servo input of a record.
+*/
+enum ptp_servo_rec_type {
+    PTP_SERVO_REC_SYNC = 0,     ///< t1 and t2 of a Sync
+    PTP_SERVO_REC_DELAY,        ///< t3 and t4 of a Delay_Req
+};
+
+/// Record flags: instance disciplines the clock
+#define PTP_SERVO_REC_DISCIPLINE 0x01
+/// Record flags: clock was stepped
+#define PTP_SERVO_REC_STEP       0x02
+/// Record flags: frequency was adjusted
+#define PTP_SERVO_REC_FREQ       0x04
+/// Record flags: tick was adjusted
+#define PTP_SERVO_REC_TICK       0x08
+/// Record flags: path delay sample was rejected
+#define PTP_SERVO_REC_REJECTED   0x10
+
+/**
+* Record of one servo input and the servo state after it. Scaled values
+* are nanoseconds (ppm for freq) multiplied by 2^16.
+*/
+struct ptp_servo_record {
+    u64 time;                   ///< CLOCK_MONOTONIC when recorded, ns
+    u8 type;                    ///< enum ptp_servo_rec_type
+    u8 flags;                   ///< PTP_SERVO_REC_xxx
+    u16 port;                   ///< port number
+    u16 seq;                    ///< sequenceId
+    u16 reserved;
+    u64 origin;                 ///< t1 or t3 without correction, ns
+    u64 receive;                ///< t2 or t4, ns
+    s64 correction;             ///< correction applied to t1 or t3, scaled
+    s64 path_delay;             ///< filtered mean path delay, scaled
+    s64 offset;                 ///< offset from master, scaled
+    s64 freq;                   ///< frequency adjustment, scaled ppm
+    s64 integral;               ///< integral term of the servo, scaled
+    s32 tick;                   ///< tick length, us
+    u32 reserved2;
+};
+
+/**
+* Header at the start of a recorder file, followed by the records.
+*/
+struct ptp_servo_rec_header {
+    char magic[8];              ///< PTP_SERVO_REC_MAGIC
+    u32 version;                ///< PTP_SERVO_REC_VERSION
+    u32 record_size;            ///< sizeof(struct ptp_servo_record)
+    u32 capacity;               ///< records the file has room for
+    u32 domain;                 ///< domain of the instance
+    u64 count;                  ///< records written, updated after record
+    u64 realtime;               ///< CLOCK_REALTIME when file was created, ns
+    u64 monotonic;              ///< CLOCK_MONOTONIC when file was created, ns
+};
+
+/**
+* Recorder of an instance. Only the instance thread writes records. The
+* recorder thread keeps the next file (<name>.next) created and mapped,
+* and closes and renames the full file after the instance thread has
+* switched to the next one.
+*/
+struct ptp_servo_rec {
+    int fd;                     ///< recorder file
+    struct ptp_servo_rec_header *header;        ///< mapped file, NULL if off
+    struct ptp_servo_record *records;   ///< records of the mapped file
+    char path[MAX_VALUE_LEN];   ///< recorder file
+    u8 domain;                  ///< domain of the instance
+    struct ptp_servo_stats stats;       ///< servo statistics of last record
+    u32 dropped;                ///< records dropped, next file not ready
+    int spare_fd;               ///< next file
+    struct ptp_servo_rec_header *spare; ///< next file, NULL until mapped
+    int retired_fd;             ///< full file
+    struct ptp_servo_rec_header *retired;       ///< full file, NULL if none
+    int stop_fd;                ///< eventfd stopping the recorder thread
+    pthread_t thread;           ///< recorder thread
+};
+
+/**
+* Open recorder file. An existing file is replaced.
+* @param rec recorder.
+* @param path recorder file.
+* @param domain domain of the instance.
+* @param stats servo statistics at open, changes to them are flagged.
+* @return ptp error code.
+*/
+int ptp_servo_rec_open(struct ptp_servo_rec *rec, const char *path,
+                       u8 domain, struct ptp_servo_stats *stats);
+
+/**
+* Close recorder file.
+* @param rec recorder.
+*/
+void ptp_servo_rec_close(struct ptp_servo_rec *rec);
+
+/**
+* Record Sync given to the servo. Called after ptp_sync_rcv().
+* @param ctx Port context.
+* @param seq_id sequenceId of the Sync.
+* @param t1 origin timestamp without correction.
+* @param t2 receive timestamp.
+* @param correction correction applied to t1, ns 2^-16.
+*/
+void ptp_servo_rec_sync(struct ptp_port_ctx *ctx, u16 seq_id,
+                        struct Timestamp *t1, struct Timestamp *t2,
+                        s64 correction);
+
+/**
+* Record Delay_Req timestamps given to the servo. Called after
+* ptp_delay_rcv().
+* @param ctx Port context.
+* @param seq_id sequenceId of the Delay_Req.
+* @param t3 send timestamp without correction.
+* @param t4 receive timestamp of the master.
+* @param correction correction applied to t3, ns 2^-16.
+*/
+void ptp_servo_rec_delay(struct ptp_port_ctx *ctx, u16 seq_id,
+                         struct Timestamp *t3, struct Timestamp *t4,
+                         s64 correction);
+
+#endif                          // _PTP_SERVO_REC_H_
@@ -0,0 +1,121 @@
+/** @file ptp_spsc.h
+* Lock-free single-producer/single-consumer ring.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_SPSC_H_
+#define _PTP_SPSC_H_
+
+#include <ptp_general.h>
+
+/// Cache line size, producer and consumer indexes are kept apart
+#define PTP_SPSC_CACHE_LINE 64
+
+/**
+* Ring indexes. Ring only manages the indexes, entries are stored by the
+* user to an array of ring size. Producer fills the entry returned by
+* ptp_spsc_produce_slot() and publishes it with ptp_spsc_produce(),
+* consumer reads the entry returned by ptp_spsc_consume_slot() and
+* releases it with ptp_spsc_consume().
+*/
+struct ptp_spsc {
+    /// Next entry to write, written by producer only
+    u32 head __attribute__ ((aligned(PTP_SPSC_CACHE_LINE)));
+    /// Next entry to read, written by consumer only
+    u32 tail __attribute__ ((aligned(PTP_SPSC_CACHE_LINE)));
+    u32 mask;                   ///< ring size - 1
+};
+
+/**
+* Initialize ring.
+* @param ring ring.
+* @param size number of entries, power of two.
+*/
+static inline void ptp_spsc_init(struct ptp_spsc *ring, u32 size)
+{
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = size - 1;
+}
+
+/**
+* Get entry for producer.
+* @param ring ring.
+* @return entry index, -1 if ring is full.
+*/
+static inline int ptp_spsc_produce_slot(struct ptp_spsc *ring)
+{
+    u32 head = ring->head;
+
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > ring->mask) {
+        return -1;
+    }
+    return head & ring->mask;
+}
+
+/**
+* Publish entry returned by ptp_spsc_produce_slot() to consumer.
+* @param ring ring.
+*/
+static inline void ptp_spsc_produce(struct ptp_spsc *ring)
+{
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+* Get entry for consumer.
+* @param ring ring.
+* @return entry index, -1 if ring is empty.
+*/
+static inline int ptp_spsc_consume_slot(struct ptp_spsc *ring)
+{
+    u32 tail = ring->tail;
+
+    if (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+        return -1;
+    }
+    return tail & ring->mask;
+}
+
+/**
+* Release entry returned by ptp_spsc_consume_slot() to producer.
+* @param ring ring.
+*/
+static inline void ptp_spsc_consume(struct ptp_spsc *ring)
+{
+    __atomic_store_n(&ring->tail, ring->tail + 1, __ATOMIC_RELEASE);
+}
+
+/**
+* Get number of entries in ring. Can be called from any thread.
+* @param ring ring.
+* @return number of entries.
+*/
+static inline u32 ptp_spsc_depth(struct ptp_spsc *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) -
+        __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+#endif                          // _PTP_SPSC_H_
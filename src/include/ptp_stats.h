@@ -0,0 +1,159 @@
+/** @file ptp_stats.h
+* PTP port counters and statistics snapshot.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_STATS_H_
+#define _PTP_STATS_H_
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_config.h>
+#include <packet_if.h>
+#include <clock_if.h>
+#include <ptp_dresp.h>
+#include <ptp_seqstat.h>
+#include <ptp_ratelimit.h>
+
+struct ptp_ctx;
+
+/// Number of messageType values
+#define PTP_NUM_MSG_TYPES       16
+
+/**
+* Message counters of a port. Written by the instance thread only, on
+* its own cache line so readers of other ports' data do not share it.
+*/
+struct ptp_port_counters {
+    u64 rx[PTP_NUM_MSG_TYPES];  ///< frames received by messageType
+    u64 tx[PTP_NUM_MSG_TYPES];  ///< frames sent by messageType
+    u64 rx_invalid;             ///< truncated, bad length or TLVs
+    u64 rx_version;             ///< unsupported versionPTP
+    u64 tx_errors;              ///< frames not sent
+    u64 state_changes;          ///< port state transitions
+} __attribute__ ((aligned(PTP_CACHE_LINE)));
+
+/**
+* Count sent frames.
+* @param counters counters of the port.
+* @param msg_type message type.
+* @param count number of frames sent.
+* @param error true if sending failed.
+*/
+static inline void ptp_count_tx(struct ptp_port_counters *counters,
+                                int msg_type, int count, bool error)
+{
+    if (error) {
+        counters->tx_errors++;
+    } else {
+        counters->tx[msg_type & 0x0f] += count;
+    }
+}
+
+/**
+* Count received frame which failed validation.
+* @param counters counters of the port.
+* @param buf frame.
+* @param len frame length.
+*/
+static inline void ptp_count_rx_invalid(struct ptp_port_counters *counters,
+                                        const char *buf, int len)
+{
+    const struct ptp_header *hdr = (const struct ptp_header *) buf;
+
+    if ((len >= (int) sizeof(struct ptp_header)) &&
+        ((hdr->ptp_ver & 0x0f) != PTP_VERSION)) {
+        counters->rx_version++;
+    } else {
+        counters->rx_invalid++;
+    }
+}
+
+/**
+* Requester with Delay_Req dropped over rate.
+*/
+struct ptp_port_offender {
+    char addr[IP_STR_MAX_LEN];  ///< source address
+    struct PortIdentity port_id;        ///< latest sourcePortIdentity
+    u32 dropped;                ///< requests over rate
+};
+
+/**
+* Statistics of a port.
+*/
+struct ptp_port_snapshot {
+    u16 port_number;            ///< port number
+    char name[INTERFACE_NAME_LEN + 1];  ///< interface name
+    bool unicast_port;          ///< unicast port of the interface
+    enum PortState state;       ///< port state
+    struct ptp_port_counters counters;
+    /// sequenceId accounting of received messages
+    struct ptp_seq_counters seq[PTP_SEQ_NUM_TYPES];
+    u64 delay_resp_matched;     ///< Delay_Resp to the latest Delay_Req
+    u64 delay_resp_late;        ///< Delay_Resp to an earlier Delay_Req
+    u64 delay_req_lost;         ///< Delay_Req without Delay_Resp
+    u64 delay_resp_unmatched;   ///< Delay_Resp without Delay_Req
+    struct ptp_dresp_stats delay_resp;  ///< Delay_Resp sent as master
+    u64 delay_req_accepted;     ///< Delay_Req answered as master
+    u64 delay_req_over_rate;    ///< Delay_Req dropped as master
+    int num_offenders;          ///< requesters in offenders
+    /// Requesters with the most Delay_Req over rate, worst first
+    struct ptp_port_offender offenders[PTP_RL_REPORT];
+};
+
+/**
+* Statistics of an instance and its ports.
+*/
+struct ptp_snapshot {
+    struct Timestamp time;      ///< time of the snapshot
+    u8 domain;                  ///< domain of the instance
+    ClockIdentity clock_identity;       ///< local clock
+    struct PortIdentity parent; ///< parent port selected by BMC
+    ClockIdentity grandmaster;  ///< grandmaster identity
+    u32 steps_removed;          ///< stepsRemoved
+    s64 offset_from_master;     ///< offsetFromMaster, ns 2^-16
+    s64 mean_path_delay;        ///< meanPathDelay, ns 2^-16
+    struct ptp_servo_stats servo;       ///< clock servo
+    struct ptp_rx_stats rx;     ///< receive path
+    u64 tc_forwarded;           ///< frames forwarded by transparent clock
+    u32 tc_uncorrected;         ///< forwarded without residence time
+    int num_ports;              ///< ports in the snapshot
+    struct ptp_port_snapshot ports[MAX_NUM_INTERFACES];
+};
+
+/**
+* Copy statistics of an instance and its ports. Must be called by the
+* instance thread, which is the only writer, so the view is consistent.
+* @param ptp_ctx PTP instance.
+* @param snap statistics are returned here.
+*/
+void ptp_stats_snapshot(struct ptp_ctx *ptp_ctx, struct ptp_snapshot *snap);
+
+/**
+* Write statistics to syslog.
+* @param snap statistics.
+*/
+void ptp_stats_dump(struct ptp_snapshot *snap);
+
+#endif                          // _PTP_STATS_H_
@@ -0,0 +1,91 @@
+/** @file ptp_tc.h
+* PTP transparent clock.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_TC_H_
+#define _PTP_TC_H_
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_config.h>
+
+struct ptp_ctx;
+struct ptp_port_ctx;
+
+/// Number of forwarded event messages remembered (power of two)
+#define PTP_TC_TABLE_LEN        64
+/// Longer residence times are not corrected, ns
+#define PTP_TC_MAX_RESIDENCE_NS 100000000
+
+/**
+* Forwarded event message. Send times on the egress ports give the
+* residence times added to the Follow_Up or Delay_Resp of the message.
+*/
+struct ptp_tc_entry {
+    u8 msg_type;                ///< PTP_SYNC or PTP_DELAY_REQ, 0 if unused
+    u16 seq_id;                 ///< sequenceId
+    struct PortIdentity src_port_id;    ///< sourcePortIdentity (host order)
+    int ingress;                ///< port number message was received from
+    struct Timestamp rx_time;   ///< receive time on ingress port
+    u32 tx_ports;               ///< egress ports, bit (port number - 1)
+    /// send time per egress port, indexed by port number - 1
+    struct Timestamp tx_time[MAX_NUM_INTERFACES];
+};
+
+/**
+* Transparent clock data of the PTP instance.
+*/
+struct ptp_tc {
+    u64 forwarded;              ///< frames forwarded
+    u32 uncorrected;            ///< Follow_Up/Delay_Resp without residence
+    struct ptp_tc_entry entries[PTP_TC_TABLE_LEN];
+};
+
+/**
+* Forward message received by transparent clock to the other ports.
+* Residence time is added to the correction field of one-step Sync,
+* two-step Sync residence is added to Follow_Up and Delay_Req residence
+* to Delay_Resp. Peer-to-peer transparent clock adds also meanLinkDelay
+* of the ingress port to Sync (Follow_Up), handles peer delay messages
+* on its ports and drops Delay_Req and Delay_Resp.
+* @param ctx Port context of the ingress port.
+* @param buf PTP message.
+* @param len msg length.
+* @param time timestamp for received frame.
+* @param peer_ip IP address of the sender of this message.
+*/
+void ptp_tc_recv(struct ptp_port_ctx *ctx, char *buf, int len,
+                 struct Timestamp *time, char *peer_ip);
+
+/**
+* Store send time of a forwarded event message.
+* @param ctx Port context of the egress port.
+* @param msg_hdr Header of the sent frame.
+* @param sent_time timestamp of the sent frame.
+*/
+void ptp_tc_frame_sent(struct ptp_port_ctx *ctx, struct ptp_header *msg_hdr,
+                       struct Timestamp *sent_time);
+
+#endif                          // _PTP_TC_H_
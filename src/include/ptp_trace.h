@@ -0,0 +1,209 @@
+/** @file ptp_trace.h
+* Binary trace of the hot path.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_TRACE_H_
+#define _PTP_TRACE_H_
+
+#include <time.h>
+
+#include <ptp_general.h>
+
+/// Records kept per thread, power of two
+#define PTP_TRACE_RECORDS       4096
+/// Arguments of a record
+#define PTP_TRACE_ARGS          4
+/// Interval of the drain thread, ms
+#define PTP_TRACE_DRAIN_MS      100
+/// Trace file is rotated to <name>.1 when it reaches this size
+#define PTP_TRACE_FILE_MAX      (64 * 1024 * 1024)
+/// Trace file used if none is configured
+#define PTP_TRACE_DEFAULT_FILE  "/tmp/openptp.trace"
+/// Trace file identification
+#define PTP_TRACE_MAGIC         "PTPTRACE"
+#define PTP_TRACE_VERSION       1
+
+/**
+* Trace modes, <trace> of the configuration.
+*/
+enum ptp_trace_mode {
+    PTP_TRACE_OFF = 0,          ///< no tracing
+    PTP_TRACE_RECORDER,         ///< latest records are written on exit
+    PTP_TRACE_STREAM,           ///< records are drained to file
+};
+
+/**
+* Trace events. Values are stored in trace files, new events are added
+* to the end.
+*/
+enum ptp_trace_id {
+    PTP_TR_LOST = 0,            ///< records overwritten before drained
+    PTP_TR_WAKEUP,              ///< event loop goes to wait
+    PTP_TR_RX,                  ///< frame received
+    PTP_TR_TX,                  ///< frame sent
+    PTP_TR_SENT,                ///< send timestamp of event message
+    PTP_TR_TIMERS,              ///< port timers evaluated
+    PTP_TR_SYNC,                ///< Sync sample given to servo
+    PTP_TR_DELAY,               ///< Delay sample given to servo
+    PTP_TR_STATE,               ///< port state changed
+    PTP_TR_DRESP,               ///< Delay_Resp batch sent
+    PTP_TR_NUM,
+};
+
+/**
+* Trace record as stored in trace files.
+*/
+struct ptp_trace_entry {
+    u64 time;                   ///< CLOCK_MONOTONIC, ns
+    u16 id;                     ///< enum ptp_trace_id
+    u16 thread;                 ///< index of the traced thread
+    u32 reserved;
+    u64 args[PTP_TRACE_ARGS];   ///< raw arguments
+};
+
+/**
+* Header of trace files, followed by records.
+*/
+struct ptp_trace_header {
+    char magic[8];              ///< PTP_TRACE_MAGIC
+    u32 version;                ///< PTP_TRACE_VERSION
+    u32 entry_size;             ///< sizeof(struct ptp_trace_entry)
+    u64 realtime;               ///< CLOCK_REALTIME at start, ns
+    u64 monotonic;              ///< CLOCK_MONOTONIC at start, ns
+};
+
+/**
+* Record of a ring. Sequence is 0 while the record is written and the
+* index of the record + 1 when it is complete, so the reader detects
+* records overwritten while it copied them.
+*/
+struct ptp_trace_record {
+    u64 sequence;
+    struct ptp_trace_entry entry;
+} __attribute__ ((aligned(PTP_CACHE_LINE)));
+
+/**
+* Ring of one thread. Only the owner thread writes, it never waits:
+* oldest records are overwritten.
+*/
+struct ptp_trace_ring {
+    /// Records written, written by owner only
+    u64 head __attribute__ ((aligned(PTP_CACHE_LINE)));
+    /// Records drained, written by drain only
+    u64 tail __attribute__ ((aligned(PTP_CACHE_LINE)));
+    u16 thread;                 ///< index of the thread
+    struct ptp_trace_record records[PTP_TRACE_RECORDS];
+};
+
+/// Ring of the calling thread, NULL if thread is not traced
+extern __thread struct ptp_trace_ring *ptp_trace_local;
+
+/**
+* Add record to the ring of the calling thread.
+* @param id enum ptp_trace_id.
+* @param a0 first argument.
+* @param a1 second argument.
+* @param a2 third argument.
+* @param a3 fourth argument.
+*/
+static inline void ptp_trace(u16 id, u64 a0, u64 a1, u64 a2, u64 a3)
+{
+    struct ptp_trace_ring *ring = ptp_trace_local;
+    struct ptp_trace_record *rec = NULL;
+    struct timespec ts;
+    u64 head = 0;
+
+    if (ring == NULL) {
+        return;
+    }
+    head = ring->head;
+    rec = &ring->records[head & (PTP_TRACE_RECORDS - 1)];
+    __atomic_store_n(&rec->sequence, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    rec->entry.time = (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    rec->entry.id = id;
+    rec->entry.thread = ring->thread;
+    rec->entry.args[0] = a0;
+    rec->entry.args[1] = a1;
+    rec->entry.args[2] = a2;
+    rec->entry.args[3] = a3;
+    __atomic_store_n(&rec->sequence, head + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#define TRACE(id, a0, a1, a2, a3) \
+    ptp_trace(id, (u64) (a0), (u64) (a1), (u64) (a2), (u64) (a3))
+
+/**
+* Get timestamp in nanoseconds for trace arguments.
+* @param time timestamp.
+* @return nanoseconds.
+*/
+static inline u64 ptp_trace_ns(struct Timestamp *time)
+{
+    return (u64) time->seconds * 1000000000ULL + time->nanoseconds;
+}
+
+/**
+* Start tracing: reserve rings, open trace file and, in stream mode,
+* start drain thread. Must be called before traced threads run.
+* @param mode enum ptp_trace_mode.
+* @param file trace file.
+* @param num_threads number of traced threads.
+* @return ptp error code.
+*/
+int ptp_trace_start(int mode, const char *file, int num_threads);
+
+/**
+* Stop tracing after traced threads have exited. Remaining records are
+* written to the trace file.
+*/
+void ptp_trace_stop(void);
+
+/**
+* Get ring of a traced thread.
+* @param thread index of the thread.
+* @return ring, NULL if tracing is off.
+*/
+struct ptp_trace_ring *ptp_trace_ring(int thread);
+
+/**
+* Trace the calling thread to a ring.
+* @param ring ring from ptp_trace_ring(), NULL to stop tracing the thread.
+*/
+void ptp_trace_attach(struct ptp_trace_ring *ring);
+
+/**
+* Format record as text.
+* @param entry record.
+* @param buf text is written here.
+* @param len buffer length.
+* @return text length.
+*/
+int ptp_trace_format(const struct ptp_trace_entry *entry, char *buf,
+                     int len);
+
+#endif                          // _PTP_TRACE_H_
@@ -0,0 +1,236 @@
+/** @file ptp_unicast.h
+* PTP unicast negotiation.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#ifndef _PTP_UNICAST_H_
+#define _PTP_UNICAST_H_
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_config.h>
+
+struct ptp_ctx;
+struct ptp_port_ctx;
+
+/// Default lease duration requested and longest lease granted, s
+#define PTP_UC_DEFAULT_LEASE    60
+#define PTP_UC_MIN_LEASE        10
+#define PTP_UC_MAX_LEASE        1000
+/// Interval of lease checks and wait before a request is repeated, s
+#define PTP_UC_CHECK_INTERVAL   1
+#define PTP_UC_RETRY_INTERVAL   2
+/// Message rates are counted in 1/PTP_UC_RATE_UNIT messages per second
+#define PTP_UC_RATE_UNIT        256
+/// Largest unicast_max_rate, messages/s, the scaled rate fits into u32
+#define PTP_UC_MAX_RATE         (0xffffffffU / PTP_UC_RATE_UNIT)
+/// Default and maximum number of unicast sessions of an instance
+#define PTP_UC_DEFAULT_SESSIONS 64
+#define PTP_UC_MAX_SESSIONS     65536
+
+/**
+* Message types that can be negotiated, index of the lease arrays.
+*/
+enum ptp_uc_type {
+    PTP_UC_ANNOUNCE = 0,
+    PTP_UC_SYNC,
+    PTP_UC_DELAY_RESP,
+    PTP_UC_PDELAY_RESP,
+    PTP_UC_NUM_TYPES,
+};
+
+/**
+* Unicast transmission lease of one message type.
+*/
+struct ptp_uc_lease {
+    bool active;                ///< lease is valid until expiry
+    s8 log_interval;            ///< logInterMessagePeriod
+    u32 duration;               ///< lease duration, s
+    u32 rate;                   ///< capacity reserved by grant
+    struct Timestamp expiry;    ///< end of lease
+    struct Timestamp retry;     ///< next request allowed (grantee)
+};
+
+/**
+* Unicast peer of a port. Configured peers are kept for the lifetime of
+* the port, other peers while they hold grants.
+*/
+struct ptp_uc_session {
+    struct ptp_uc_session *next;        ///< hash chain or free list
+    struct ptp_port_ctx *port;  ///< port of the session
+    char addr[IP_STR_MAX_LEN];  ///< peer address
+    u32 hash;                   ///< hash of port number and address
+    u32 heap_index;             ///< position in the deadline heap
+    bool configured;            ///< peer from configuration
+    u16 signaling_seqid;        ///< sequence id for signaling
+    u16 sync_seqid;             ///< sequence id for sync to peer
+    u16 announce_seqid;         ///< sequence id for announce to peer
+    struct Timestamp deadline;  ///< next time session is served
+    struct Timestamp check_timer;       ///< next lease check
+    struct Timestamp sync_timer;        ///< next sync to peer
+    struct Timestamp announce_timer;    ///< next announce to peer
+    struct Timestamp last_recv; ///< last frame received from peer
+    struct Timestamp last_sync; ///< send time of last sync to peer
+    /// Grants given to the peer (port transmits)
+    struct ptp_uc_lease granted[PTP_UC_NUM_TYPES];
+    /// Grants received from the peer (peer transmits)
+    struct ptp_uc_lease leased[PTP_UC_NUM_TYPES];
+};
+
+/**
+* Unicast sessions of an instance. Sessions are found by peer address
+* from the hash table and served in deadline order from the heap, so
+* per wakeup work depends on the sessions due, not on their number.
+* Memory is reserved at startup.
+*/
+struct ptp_uc_table {
+    u32 capacity;               ///< number of sessions reserved
+    u32 count;                  ///< sessions in use, size of the heap
+    u32 hash_mask;              ///< number of hash buckets - 1
+    u32 rate;                   ///< message rate granted to peers
+    struct ptp_uc_session *free_head;   ///< unused sessions
+    struct ptp_uc_session **buckets;    ///< hash table
+    struct ptp_uc_session **heap;       ///< sessions by deadline
+};
+
+/**
+* Unicast data of a port.
+*/
+struct ptp_unicast {
+    bool sessions;              ///< peers are served by sessions
+    bool negotiation;           ///< transmission negotiated with peers
+    u32 num_sessions;           ///< sessions of the port
+};
+
+/**
+* Memory needed from the arena for the session table.
+* @param capacity number of sessions.
+* @return size in bytes.
+*/
+size_t ptp_unicast_table_size(u32 capacity);
+
+/**
+* Reserve session table of an instance from its arena.
+* @param ptp_ctx PTP instance.
+* @param capacity number of sessions.
+* @return ptp error code.
+*/
+int ptp_unicast_table_init(struct ptp_ctx *ptp_ctx, u32 capacity);
+
+/**
+* Initialize unicast data of a port and add sessions for the configured
+* peers.
+* @param ctx Port context.
+* @param if_config Interface configuration.
+*/
+void ptp_unicast_init(struct ptp_port_ctx *ctx,
+                      struct interface_config *if_config);
+
+/**
+* Remove sessions of a closed port and release capacity they reserved.
+* @param ctx Port context.
+*/
+void ptp_unicast_close(struct ptp_port_ctx *ctx);
+
+/**
+* Handle received Signaling message: grant or deny requests, store grants
+* and acknowledge cancels. Session is created for a new peer.
+* @param ctx Port context.
+* @param buf Signaling message validated with ptp_msg_check().
+* @param time receive time.
+* @param peer_ip address of the peer.
+*/
+void ptp_unicast_recv(struct ptp_port_ctx *ctx, char *buf,
+                      struct Timestamp *time, char *peer_ip);
+
+/**
+* Record reception of a frame from a peer.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param time receive time.
+*/
+void ptp_unicast_seen(struct ptp_port_ctx *ctx, char *peer_ip,
+                      struct Timestamp *time);
+
+/**
+* Serve sessions which are due: expire leases, request and cancel leases,
+* and send Announce and Sync to the peers of master ports.
+* @param ptp_ctx PTP instance.
+* @param current_time current time.
+* @param next_time moved earlier if a session must be served sooner.
+*/
+void ptp_unicast_run(struct ptp_ctx *ptp_ctx,
+                     struct Timestamp *current_time,
+                     struct Timestamp *next_time);
+
+/**
+* Check if port may transmit a message to a peer. Ports without
+* negotiation always transmit, others only while the peer holds a grant.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param msg_type PTP_ANNOUNCE, PTP_SYNC, PTP_DELAY_RESP or PTP_PDELAY_RESP.
+* @return true if message may be sent.
+*/
+bool ptp_unicast_granted(struct ptp_port_ctx *ctx, char *peer_ip,
+                         u8 msg_type);
+
+/**
+* Check if a peer transmits a message to port. Ports without negotiation
+* always expect messages, others only while they hold a lease.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param msg_type PTP_ANNOUNCE, PTP_SYNC, PTP_DELAY_RESP or PTP_PDELAY_RESP.
+* @return true if lease is valid.
+*/
+bool ptp_unicast_leased(struct ptp_port_ctx *ctx, char *peer_ip,
+                        u8 msg_type);
+
+/**
+* Get logInterMessagePeriod of a message a peer holds a grant for.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param msg_type PTP_ANNOUNCE, PTP_SYNC, PTP_DELAY_RESP or PTP_PDELAY_RESP.
+* @param log_interval returned if port does not negotiate or peer has
+* no grant.
+* @return log interval.
+*/
+s8 ptp_unicast_interval(struct ptp_port_ctx *ctx, char *peer_ip,
+                        u8 msg_type, s8 log_interval);
+
+/**
+* Send message of a port to a unicast peer. Unicast frames are not
+* looped back for timestamping, so the send time is the transmit timestamp
+* returned by the packet interface: Follow_Up and Pdelay_Resp_Follow_Up are sent to the peer,
+* and Delay_Req and Pdelay_Req send times stored, from it.
+* @param ctx Port context.
+* @param msg_type PTP message type.
+* @param buf frame.
+* @param len frame length.
+* @param peer_ip address of the peer.
+* @return ptp error code.
+*/
+int ptp_unicast_send(struct ptp_port_ctx *ctx, int msg_type,
+                     char *buf, int len, char *peer_ip);
+
+#endif                          // _PTP_UNICAST_H_
@@ -30,11 +30,129 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <print.h>
 
 #define DEBUG_FILE "/tmp/ptp_debug.txt"
 #define DEBUG_FILE_STATE "/tmp/ptp_state.txt"
+#define PRINT_BUF_SIZE 1024
+/// File is rotated to <name>.1 when it reaches this size
+#define PRINT_MAX_FILE_SIZE (1024 * 1024)
+
+/**
+* Output file. Written with plain file descriptors, so printing does not
+* allocate memory after print_open().
+*/
+struct print_file {
+    const char *name;           ///< file name
+    const char *old_name;       ///< name of the rotated file
+    int fd;                     ///< file descriptor, -1 if not open
+    off_t size;                 ///< bytes in file
+};
+
+static struct print_file status_file = {
+    DEBUG_FILE, DEBUG_FILE ".1", -1, 0
+};
+static struct print_file state_file = {
+    DEBUG_FILE_STATE, DEBUG_FILE_STATE ".1", -1, 0
+};
+
+/**
+* Open output file for appending.
+* @param file output file.
+* @return 0 if ok, -1 on error.
+*/
+static int print_file_open(struct print_file *file)
+{
+    struct stat st;
+
+    file->fd = open(file->name, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (file->fd < 0) {
+        ERROR("%s: %s\n", file->name, strerror(errno));
+        return -1;
+    }
+    file->size = (fstat(file->fd, &st) == 0) ? st.st_size : 0;
+    return 0;
+}
+
+/**
+* Append line to output file. File is rotated when it is full.
+* @param file output file.
+* @param line line to write.
+* @param len line length.
+*/
+static void print_file_write(struct print_file *file, const char *line,
+                             int len)
+{
+    if (file->fd < 0) {
+        return;
+    }
+    if (file->size + len > PRINT_MAX_FILE_SIZE) {
+        close(file->fd);
+        rename(file->name, file->old_name);
+        if (print_file_open(file) != 0) {
+            return;
+        }
+    }
+    if (write(file->fd, line, len) == len) {
+        file->size += len;
+    }
+}
+
+/**
+* Open clock status and state files. Files are written by the control
+* thread only, never by the instances.
+* @return 0 if ok, -1 on error.
+*/
+int print_open(void)
+{
+    // Load timezone now, localtime_r() does not do it
+    tzset();
+    if ((status_file.fd < 0) && (print_file_open(&status_file) != 0)) {
+        return -1;
+    }
+    if ((state_file.fd < 0) && (print_file_open(&state_file) != 0)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+* Close clock status and state files.
+*/
+void print_close(void)
+{
+    if (status_file.fd >= 0) {
+        close(status_file.fd);
+        status_file.fd = -1;
+    }
+    if (state_file.fd >= 0) {
+        close(state_file.fd);
+        state_file.fd = -1;
+    }
+}
+
+/**
+* Get local time of day.
+* @param h hours are returned here.
+* @param m minutes are returned here.
+* @param s seconds are returned here.
+*/
+static void print_time(int *h, int *m, int *s)
+{
+    time_t tv;
+    struct tm tm;
+
+    *h = *m = *s = 0;
+    time(&tv);
+    if (localtime_r(&tv, &tm)) {
+        *h = tm.tm_hour;
+        *m = tm.tm_min;
+        *s = tm.tm_sec;
+    }
+}
 
 /**
 * Function for printing clock status.
@@ -52,73 +170,36 @@ void print_clock_status(unsigned long offset_sec,
                         signed long long adjust_P,
                         signed long long adjust_I)
 {
-    FILE *fp = 0;
-    time_t tv;
-    struct tm *tm = 0;
-    int h = 0, m = 0, s = 0;
+    char line[PRINT_BUF_SIZE];
+    int h = 0, m = 0, s = 0, len = 0;
 
-    /* open file */
-    if (!(fp = fopen(DEBUG_FILE, "a+"))) {
-        ERROR("%s\n", strerror(errno));
+    if (status_file.fd < 0) {
         return;
     }
-
-    memset(&tv, 0, sizeof(time_t));
-    time(&tv);
-    tm = localtime(&tv);
-    if (tm) {
-        h = tm->tm_hour;
-        m = tm->tm_min;
-        s = tm->tm_sec;
-    }
-
-    fprintf(fp,
-            "%2i:%2i.%2i %12lus %12lins %12lins/s %12llins/s %12llins/s %12llins/s\n",
-            h, m, s, offset_sec, offset_nsec, drift, adjust, adjust_P,
-            adjust_I);
-
-    fclose(fp);
-    return;
+    print_time(&h, &m, &s);
+    len = snprintf(line, sizeof(line),
+                   "%2i:%2i.%2i %12lus %12lins %12lins/s %12llins/s "
+                   "%12llins/s %12llins/s\n", h, m, s, offset_sec,
+                   offset_nsec, drift, adjust, adjust_P, adjust_I);
+    print_file_write(&status_file, line, len);
 }
 
 /**
 * Function for printing clock state (master/slave).
-* @param event State changed event.
+* @param event name of the state change event.
 */
-void print_clock_state(enum ptp_event_clk event)
+void print_clock_state(const char *event)
 {
-    FILE *fp = 0;
-    time_t tv;
-    struct tm *tm = 0;
-    int h = 0, m = 0, s = 0;
+    char line[PRINT_BUF_SIZE];
+    int h = 0, m = 0, s = 0, len = 0;
 
-    /* open file */
-    if (!(fp = fopen(DEBUG_FILE_STATE, "a+"))) {
-        ERROR("%s\n", strerror(errno));
+    if (state_file.fd < 0) {
         return;
     }
-
-    memset(&tv, 0, sizeof(time_t));
-    time(&tv);
-    tm = localtime(&tv);
-    if (tm) {
-        h = tm->tm_hour;
-        m = tm->tm_min;
-        s = tm->tm_sec;
-    }
-    switch (event) {
-    case PTP_MASTER_CHANGED:
-        fprintf(fp, "%2i:%2i.%2i PTP_MASTER_CHANGED\n", h, m, s);
-        break;
-
-    case PTP_CLK_MASTER:
-        fprintf(fp, "%2i:%2i.%2i PTP_CLK_MASTER\n", h, m, s);
-        break;
-    default:
-        fprintf(fp, "%2i:%2i.%2i UNKNOWN %i\n", h, m, s, event);
-        break;
+    print_time(&h, &m, &s);
+    len = snprintf(line, sizeof(line), "%2i:%2i.%2i %s\n", h, m, s, event);
+    if (len >= sizeof(line)) {
+        len = sizeof(line) - 1;
     }
-
-    fclose(fp);
-    return;
+    print_file_write(&state_file, line, len);
 }
@@ -26,27 +26,47 @@
 ******************************************************************************/
 #include <os_if.h>
 #include <ptp_general.h>
+#include <ptp_codec.h>
 
 /**
  * Private data.
  */
 struct private_os_if {
+    int in_use;                 ///< slot reserved by an instance
 };
 
-static struct private_os_if oif_data;
+/// One OS if per PTP instance
+static struct private_os_if oif_data[MAX_NUM_INSTANCES];
 
 /**
 * Function for initializing OS interface. 
 * @param ctx clock context
+* @param owner PTP instance using the OS interface.
 * @param cfg_file Config file name for OS interface.
 * @return ptp error code.
 */
-int ptp_initialize_os_if(struct os_ctx *ctx, char* cfg_file)
+int ptp_initialize_os_if(struct os_ctx *ctx, struct ptp_ctx *owner,
+                         char* cfg_file)
 {
-    struct private_os_if *oif = &oif_data;
+    struct private_os_if *oif = NULL;
+    int i = 0;
+
+    // Reserve free slot
+    for (i = 0; i < MAX_NUM_INSTANCES; i++) {
+        if (__sync_lock_test_and_set(&oif_data[i].in_use, 1) == 0) {
+            oif = &oif_data[i];
+            break;
+        }
+    }
+    if (oif == NULL) {
+        ERROR("No free OS if\n");
+        return PTP_ERR_GEN;
+    }
     memset(ctx, 0, sizeof(struct os_ctx));
     memset(oif, 0, sizeof(struct private_os_if));
+    oif->in_use = 1;
     ctx->arg = oif;
+    ctx->owner = owner;
 
     return PTP_ERR_OK;
 }
@@ -71,7 +91,12 @@ int ptp_reconfig_os_if(struct os_ctx *ctx, char* cfg_file)
 */
 int ptp_close_os_if(struct os_ctx *ctx)
 {
-//    struct private_os_if *oif = (struct private_os_if*) ctx->arg;
+    struct private_os_if *oif = (struct private_os_if*) ctx->arg;
+
+    if (oif) {
+        ctx->arg = 0;
+        __sync_lock_release(&oif->in_use);
+    }
 
     return PTP_ERR_OK;
 }
@@ -85,19 +110,7 @@ int ptp_close_os_if(struct os_ctx *ctx)
 */
 void ptp_format_timestamp(struct Timestamp *time, u8 * buf)
 {
-    u32 tmp2 = 0;
-    u16 tmp1 = 0;
-
-    tmp2 = *((u32 *) & (time->seconds));
-    tmp1 = *((u16 *) (((u32 *) & (time->seconds)) + 1));
-    tmp1 = htonl(tmp1);
-    tmp2 = htonl(tmp2);
-    memcpy(&buf[0], &tmp1, 2);
-    memcpy(&buf[2], &tmp2, 4);
-
-    tmp2 = *((u32 *) & (time->nanoseconds));
-    tmp2 = htonl(tmp2);
-    memcpy(&buf[6], &tmp2, 4);
+    ptp_put_timestamp(buf, time);
 }
 
 /** 
@@ -109,23 +122,7 @@ void ptp_format_timestamp(struct Timestamp *time, u8 * buf)
 */
 void ptp_convert_timestamp(struct Timestamp *time, u8 * buf)
 {
-    u32 tmp2 = 0;
-    u16 tmp1 = 0;
-
-    time->seconds = 0;
-    memcpy(&tmp1, &buf[0], 2);
-    memcpy(&tmp2, &buf[2], 4);
-    tmp1 = ntohl(tmp1);
-    tmp2 = ntohl(tmp2);
-    *((u32 *) & (time->seconds)) = tmp2;
-    *((u16 *) (((u32 *) & (time->seconds)) + 1)) = tmp1;
-
-    time->nanoseconds = 0;
-    memcpy(&tmp2, &buf[6], 4);
-    tmp2 = ntohl(tmp2);
-    *((u32 *) & (time->nanoseconds)) = tmp2;
-
-    time->frac_nanoseconds = 0; // unused
+    ptp_get_timestamp(time, buf);
 }
 
 /** 
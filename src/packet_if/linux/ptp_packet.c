@@ -24,6 +24,9 @@
 /******************************************************************************
 * $Id$
 ******************************************************************************/
+#define _GNU_SOURCE
+#define PTP_LOG_CAT PTP_LOG_PACKET
+
 #include <asm/socket.h>
 #include <netinet/in.h>
 #include <sys/ioctl.h>
@@ -33,6 +36,14 @@
 #include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <time.h>
 
 #include <packet_if.h>
 #include <os_if.h>
@@ -41,6 +52,16 @@
 #include <ptp_config.h>
 #include <ptp_internal.h>
 #include <ptp.h>
+#include <ptp_spsc.h>
+#include <ptp_codec.h>
+
+// Domain mailbox size, frames
+#define DOMAIN_MAILBOX_LEN  16
+// RX thread queue size, frames (power of two)
+#define RX_RING_LEN         128
+#define RX_FRAME_LEN        512
+// Longest wait for the send timestamp of a unicast frame, ms
+#define TX_TIMESTAMP_TIMEOUT_MS 5
 
 /**
  * Interface data.
@@ -51,20 +72,66 @@ struct linux_if_interface {
     struct in_addr if_addr;     ///< local IP address
     int unicast_entry;          ///< set to 1 if unicast destination
     struct in_addr net_addr;    ///< destination IP addr
+    struct in_addr pdelay_addr; ///< destination IP addr of peer delay msgs
     u8 hw_addr[IFHWADDRLEN];
     struct interface_config *if_config; ///< pointer to associated if config
 };
 
+/**
+ * Received frame queued to PTP module (by RX thread or other domain).
+ */
+struct rx_frame {
+    int if_index;
+    int length;
+    struct Timestamp recv_time;
+    struct sockaddr_in from_addr;
+    u64 queued_ns;              ///< monotonic time when frame was queued
+    char frame[RX_FRAME_LEN];
+};
+
+/**
+ * Unicast frames of this domain received by other domains' sockets.
+ */
+struct domain_mailbox {
+    pthread_mutex_t lock;
+    int wake_fd;                ///< eventfd, signaled when frame is added
+    int head;                   ///< next frame to read
+    int count;                  ///< number of frames, stored atomically
+    u32 dropped;                ///< frames dropped because mailbox was full
+    struct rx_frame frames[DOMAIN_MAILBOX_LEN];
+};
+
 /**
  * Holds socket etc. data.
  */
 struct linux_packet_if {
+    int in_use;                 ///< slot reserved by an instance
+    int forwarding;             ///< mailbox takes frames, under forward_lock
+    struct ptp_ctx *owner;      ///< PTP instance of this packet if
     int event_sock;
     int gen_sock;
+    int tx_timestamping;        ///< send timestamps from the error queue
     int num_interfaces;
     struct linux_if_interface interfaces[MAX_NUM_INTERFACES];
+    struct domain_mailbox mailbox;
+    // RX thread data
+    pthread_t rx_thread;
+    int rx_running;             ///< RX thread is used
+    int rx_stop_fd;             ///< eventfd, stops RX thread
+    int rx_waiting;             ///< PTP module waits on mailbox.wake_fd
+    struct sockaddr_in reply_addr;      ///< sender of the last returned frame
+    u32 rx_max_depth;           ///< written by RX thread only
+    u32 rx_dropped;             ///< written by RX thread only
+    u64 rx_other_domain;        ///< written by receiving thread only
+    struct ptp_rx_stats rx_stats;       ///< written by PTP module only
+    struct ptp_spsc rx_ring;
+    struct rx_frame rx_frames[RX_RING_LEN];
 };
-static struct linux_packet_if packet_if_data;
+/// One packet if per PTP instance
+static struct linux_packet_if packet_if_data[MAX_NUM_INSTANCES];
+/// Held for reading while a frame is forwarded to a mailbox, for writing
+/// while a packet if starts or stops taking frames
+static pthread_rwlock_t forward_lock = PTHREAD_RWLOCK_INITIALIZER;
 
 // function for searching interfaces to use
 static int locate_interfaces(struct linux_packet_if *pif);
@@ -72,19 +139,58 @@ static int locate_interfaces(struct linux_packet_if *pif);
 static int ptp_receive_msg(struct linux_packet_if *pif, int sock,
                            int *if_index, char *frame, int *length,
                            struct Timestamp *recv_time,
-                           struct sockaddr_in *from_addr);
+                           struct sockaddr_in *from_addr,
+                           struct in_addr *dst_addr);
+static int send_frame(struct linux_packet_if *pif, int msg_type,
+                      int port_num, char *frame, int length,
+                      struct in_addr *peer, struct Timestamp *sent_time);
+static int send_error(const char *func);
+#ifdef SO_TIMESTAMPING
+static void tx_timestamp_flush(struct linux_packet_if *pif);
+static int tx_timestamp_get(struct linux_packet_if *pif,
+                            struct Timestamp *sent_time);
+#endif
+static int frame_dest(struct linux_packet_if *pif, int msg_type, int if_num,
+                      struct in_addr *peer, struct sockaddr_in *saddr);
 // interface location
 static struct linux_if_interface *get_interface(struct linux_packet_if
                                                 *pif, int *if_index,
                                                 char *if_name,
                                                 int *port_num);
+static void get_unicast_interface(struct linux_packet_if *pif,
+                                  int if_index, int *port_num);
 // Helpers for port id vs. hw address
 static void create_clock_id(ClockIdentity clk_id, u8 * hwaddr);
 // if_num port_num conversions
 static int if_num_to_port_num(int if_num);
 //static int port_num_to_if_num( int port_num );
 
-static int if_configured(char *if_name);
+static int if_configured(struct linux_packet_if *pif, char *if_name);
+static int local_address(struct linux_packet_if *pif, struct in_addr *addr);
+
+// domain demultiplexing
+static void domain_forward(struct linux_packet_if *pif, int domain,
+                           int if_index, char *frame, int length,
+                           struct Timestamp *recv_time,
+                           struct sockaddr_in *from_addr);
+static int domain_mailbox_get(struct linux_packet_if *pif, int *if_index,
+                              char *frame, int *length,
+                              struct Timestamp *recv_time,
+                              struct sockaddr_in *from_addr);
+// socket reading
+static int receive_socket_frame(struct linux_packet_if *pif, int *if_index,
+                                char *frame, int *length,
+                                struct Timestamp *recv_time,
+                                struct sockaddr_in *from_addr);
+// RX thread
+static int rx_thread_start(struct linux_packet_if *pif);
+static void rx_thread_stop(struct linux_packet_if *pif);
+static void *rx_thread_run(void *arg);
+static int rx_ring_get(struct linux_packet_if *pif, int *if_index,
+                       char *frame, int *length,
+                       struct Timestamp *recv_time,
+                       struct sockaddr_in *from_addr);
+static u64 monotonic_ns(void);
 
 // Local macros
 #define MIN(a,b) ((a)<(b)?(a):(b))
@@ -96,22 +202,46 @@ static int if_configured(char *if_name);
 /**
 * Function for initializing packet interface. 
 * @param ctx packet if context
+* @param owner PTP instance using the packet interface.
 * @param cfg_file Config file name for packet interface.
 * @return ptp error code.
 */
-int ptp_initialize_packet_if(struct packet_ctx *ctx, char* cfg_file)
+int ptp_initialize_packet_if(struct packet_ctx *ctx, struct ptp_ctx *owner,
+                             char* cfg_file)
 {
-    struct linux_packet_if *pif = &packet_if_data;
+    struct linux_packet_if *pif = NULL;
     struct sockaddr_in saddr;
     struct ip_mreqn ip_mreq;
     int tmp = 0, ret = 0;
     ClockIdentity identity;
     int if_num = 0;
 
-    memset(&packet_if_data, 0, sizeof(struct linux_packet_if));
+    // Reserve free slot
+    for (tmp = 0; tmp < MAX_NUM_INSTANCES; tmp++) {
+        if (__sync_lock_test_and_set(&packet_if_data[tmp].in_use, 1) == 0) {
+            pif = &packet_if_data[tmp];
+            break;
+        }
+    }
+    if (pif == NULL) {
+        ERROR("No free packet if\n");
+        return PTP_ERR_GEN;
+    }
+    memset(pif, 0, sizeof(struct linux_packet_if));
+    pif->in_use = 1;
+    pif->owner = owner;
+    pthread_mutex_init(&pif->mailbox.lock, NULL);
+    pif->mailbox.wake_fd = eventfd(0, EFD_NONBLOCK);
+    if (pif->mailbox.wake_fd < 0) {
+        perror("eventfd");
+        ERROR("\n");
+        __sync_lock_release(&pif->in_use);
+        return PTP_ERR_GEN;
+    }
 
     // Store internal data
     ctx->arg = pif;
+    ctx->owner = owner;
 
     // Open sockets
     pif->event_sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
@@ -127,8 +257,7 @@ int ptp_initialize_packet_if(struct packet_ctx *ctx, char* cfg_file)
         ERROR("\n");
         return PTP_ERR_NET;
     }
-#if 0
-    tmp = 1;                    // allow address reuse
+    tmp = 1;                    // allow address reuse, instances share ports
     if (setsockopt(pif->event_sock, SOL_SOCKET, SO_REUSEADDR,
                    &tmp, sizeof(int)) != 0) {
         perror("setsockopt");
@@ -141,7 +270,6 @@ int ptp_initialize_packet_if(struct packet_ctx *ctx, char* cfg_file)
         ERROR("\n");
         return PTP_ERR_NET;
     }
-#endif
     // Get list of interfaces
     ret = locate_interfaces(pif);
     if (ret != PTP_ERR_OK) {
@@ -219,6 +347,23 @@ int ptp_initialize_packet_if(struct packet_ctx *ctx, char* cfg_file)
                 ERROR("\n");
                 return PTP_ERR_NET;
             }
+            // Peer delay messages use their own group
+            ip_mreq.imr_multiaddr.s_addr =
+                pif->interfaces[if_num].pdelay_addr.s_addr;
+            DEBUG("Group %s\n",
+                  inet_ntoa(pif->interfaces[if_num].pdelay_addr));
+            if (setsockopt(pif->event_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                           &ip_mreq, sizeof(struct ip_mreqn)) != 0) {
+                perror("setsockopt");
+                ERROR("\n");
+                return PTP_ERR_NET;
+            }
+            if (setsockopt(pif->gen_sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                           &ip_mreq, sizeof(struct ip_mreqn)) != 0) {
+                perror("setsockopt");
+                ERROR("\n");
+                return PTP_ERR_NET;
+            }
         }
     }
 
@@ -278,6 +423,18 @@ int ptp_initialize_packet_if(struct packet_ctx *ctx, char* cfg_file)
         return PTP_ERR_NET;
     }
 #endif
+#ifdef SO_TIMESTAMPING
+    // Send timestamps are reported to the error queue of the event socket,
+    // they are generated only for frames which request them (unicast)
+    tmp = SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(pif->event_sock, SOL_SOCKET, SO_TIMESTAMPING,
+                   &tmp, sizeof(int)) != 0) {
+        perror("setsockopt");
+        ERROR("Unicast send time taken after send\n");
+    } else {
+        pif->tx_timestamping = 1;
+    }
+#endif
 
     /* disable UDP checksum calculation in event port */
     tmp = 1;
@@ -313,13 +470,21 @@ int ptp_initialize_packet_if(struct packet_ctx *ctx, char* cfg_file)
     }
 
     for (if_num = 0; if_num < pif->num_interfaces; if_num++) {
-        ptp_new_port(if_num_to_port_num(if_num), 
+        ptp_new_port(owner, if_num_to_port_num(if_num),
                      identity,
                      pif->interfaces[if_num].unicast_entry,
                      pif->interfaces[if_num].if_config);
     }
     DEBUG("pif: %p\n", pif);
 
+    if (owner->cfg.rx_thread && (rx_thread_start(pif) != PTP_ERR_OK)) {
+        ERROR("RX thread not started, receiving in PTP thread\n");
+    }
+    // Interfaces and mailbox are ready for frames of other instances
+    pthread_rwlock_wrlock(&forward_lock);
+    pif->forwarding = 1;
+    pthread_rwlock_unlock(&forward_lock);
+
     return PTP_ERR_OK;
 }
 
@@ -347,9 +512,17 @@ int ptp_close_packet_if(struct packet_ctx *ctx)
     struct ip_mreqn ip_mreq;
     int if_num = 0;
 
+    // No frame is being forwarded to the mailbox after this
+    pthread_rwlock_wrlock(&forward_lock);
+    pif->forwarding = 0;
+    pthread_rwlock_unlock(&forward_lock);
+    rx_thread_stop(pif);
 
     for (if_num = 0; if_num < pif->num_interfaces; if_num++) {
-        ptp_close_port(pif->interfaces[if_num].if_index);
+        ptp_close_port(pif->owner, if_num_to_port_num(if_num));
+        if (pif->interfaces[if_num].unicast_entry) {
+            continue;
+        }
         // drop multicast if
         ip_mreq.imr_multiaddr = pif->interfaces[if_num].net_addr;
         ip_mreq.imr_address = pif->interfaces[if_num].if_addr;
@@ -360,12 +533,22 @@ int ptp_close_packet_if(struct packet_ctx *ctx)
             ERROR("\n");
             return PTP_ERR_NET;
         }
+        ip_mreq.imr_multiaddr = pif->interfaces[if_num].pdelay_addr;
+        if (setsockopt(pif->event_sock, IPPROTO_IP, IP_DROP_MEMBERSHIP,
+                       &ip_mreq, sizeof(struct ip_mreqn)) != 0) {
+            perror("setsockopt");
+            ERROR("\n");
+            return PTP_ERR_NET;
+        }
     }
     pif->num_interfaces = 0;
     close(pif->event_sock);
     close(pif->gen_sock);
+    close(pif->mailbox.wake_fd);
+    pthread_mutex_destroy(&pif->mailbox.lock);
 
     ctx->arg = 0;
+    __sync_lock_release(&pif->in_use);
 
     return PTP_ERR_OK;
 }
@@ -384,16 +567,71 @@ int ptp_send(struct packet_ctx *ctx,
              int msg_type, int port_num, char *frame, int length)
 {
     struct linux_packet_if *pif = (struct linux_packet_if *) ctx->arg;
+
+    return send_frame(pif, msg_type, port_num, frame, length, NULL, NULL);
+}
+
+/**
+* Function for sending PTP frames of a unicast port to a peer. Unicast
+* frames are not looped back, so frame_sent is not called for them: send
+* time is the software transmit timestamp of the kernel, read from the
+* error queue of the socket.
+* @param ctx packet if context
+* @param msg_type ptp message type.
+* @param port_num port number.
+* @param frame frame to send.
+* @param length frame length.
+* @param peer_addr peer IP address.
+* @param sent_time if not NULL, send time is returned here.
+* @return ptp error code.
+*/
+int ptp_send_to(struct packet_ctx *ctx, int msg_type, int port_num,
+                char *frame, int length, char *peer_addr,
+                struct Timestamp *sent_time)
+{
+    struct linux_packet_if *pif = (struct linux_packet_if *) ctx->arg;
+    struct in_addr peer;
+
+    if (peer_addr == NULL) {
+        ERROR("No peer address\n");
+        return PTP_ERR_SEND;
+    }
+    if (inet_aton(peer_addr, &peer) == 0) {
+        ERROR("peer address %s\n", peer_addr);
+        return PTP_ERR_SEND;
+    }
+    return send_frame(pif, msg_type, port_num, frame, length, &peer,
+                      sent_time);
+}
+
+/**
+* Send PTP frame from a port.
+* @param pif Linux packet if ctx
+* @param msg_type ptp message type
+* @param port_num port number.
+* @param frame frame to send.
+* @param length frame length.
+* @param peer destination, NULL for the destination of the port.
+* @param sent_time if not NULL, send time is returned here.
+* @return ptp error code.
+*/
+static int send_frame(struct linux_packet_if *pif, int msg_type,
+                      int port_num, char *frame, int length,
+                      struct in_addr *peer, struct Timestamp *sent_time)
+{
     struct sockaddr_in saddr;
     int if_num = port_num - 1;
     struct msghdr info_msg;
     struct iovec vec[1];
     union {
         struct cmsghdr cmsg;
-        char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+        char buf[CMSG_SPACE(sizeof(struct in_pktinfo)) +
+                 CMSG_SPACE(sizeof(int))];
     } cmsg_data;
     struct cmsghdr *cmsg_tmp = 0;
     struct in_pktinfo *pkt_info = 0;
+    struct timespec now;
+    int ret = 0;
 
     memset(&info_msg, 0, sizeof(struct msghdr));
     memset(&cmsg_data, 0, sizeof(cmsg_data));
@@ -401,7 +639,7 @@ int ptp_send(struct packet_ctx *ctx,
     cmsg_tmp = &cmsg_data.cmsg;
     cmsg_tmp->cmsg_level = SOL_IP;
     cmsg_tmp->cmsg_type = IP_PKTINFO;
-    cmsg_tmp->cmsg_len = CMSG_SPACE(sizeof(struct in_pktinfo));
+    cmsg_tmp->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
 
     // Create needed structures
     vec[0].iov_base = frame;
@@ -414,30 +652,199 @@ int ptp_send(struct packet_ctx *ctx,
     info_msg.msg_control = cmsg_data.buf;
     info_msg.msg_controllen = sizeof(cmsg_data.buf);
     info_msg.msg_flags = 0;
+#ifdef SO_TIMESTAMPING
+    if (sent_time && pif->tx_timestamping) {
+        // Request software send timestamp of this frame only
+        tx_timestamp_flush(pif);
+        cmsg_tmp = CMSG_NXTHDR(&info_msg, &cmsg_data.cmsg);
+        cmsg_tmp->cmsg_level = SOL_SOCKET;
+        cmsg_tmp->cmsg_type = SO_TIMESTAMPING;
+        cmsg_tmp->cmsg_len = CMSG_LEN(sizeof(int));
+        *(int *) CMSG_DATA(cmsg_tmp) = SOF_TIMESTAMPING_TX_SOFTWARE;
+        cmsg_tmp = &cmsg_data.cmsg;
+    } else
+#endif
+    {
+        info_msg.msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+    }
 
-    pkt_info = (struct in_pktinfo *) CMSG_DATA(cmsg_tmp);
-    pkt_info->ipi_ifindex = pif->interfaces[if_num].if_index;
     if ((if_num >= pif->num_interfaces) || (if_num < 0)) {
         ERROR("port number");
         return PTP_ERR_GEN;
     }
+    // Send from the interface of the port, with its address as source
+    pkt_info = (struct in_pktinfo *) CMSG_DATA(cmsg_tmp);
+    pkt_info->ipi_ifindex = pif->interfaces[if_num].if_index;
+    pkt_info->ipi_spec_dst = pif->interfaces[if_num].if_addr;
+
+    if (frame_dest(pif, msg_type, if_num, peer, &saddr) != PTP_ERR_OK) {
+        return PTP_ERR_GEN;
+    }
+    DEBUG("Send %s to %s:%i %i %i\n", ptp_msg_name(msg_type),
+          inet_ntoa(saddr.sin_addr), ntohs(saddr.sin_port),
+          length, port_num);
+    ret = sendmsg(pif->event_sock, &info_msg, 0);
+    if ((ret < 0) && (errno == EINVAL) &&
+        (info_msg.msg_controllen > CMSG_SPACE(sizeof(struct in_pktinfo)))) {
+        // Kernel does not take timestamp requests per frame
+        ERROR("Unicast send time taken after send\n");
+        pif->tx_timestamping = 0;
+        info_msg.msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+        ret = sendmsg(pif->event_sock, &info_msg, 0);
+    }
+    if (ret < 0) {
+        return send_error("send");
+    }
+    if (ret != length) {
+        ERROR("send: %i of %i bytes\n", ret, length);
+        return PTP_ERR_SEND;
+    }
+    if (sent_time == NULL) {
+        return PTP_ERR_OK;
+    }
+#ifdef SO_TIMESTAMPING
+    if (pif->tx_timestamping &&
+        (tx_timestamp_get(pif, sent_time) == PTP_ERR_OK)) {
+        return PTP_ERR_OK;
+    }
+#endif
+    // Same clock as the receive timestamps of the sockets
+    clock_gettime(CLOCK_REALTIME, &now);
+    sent_time->seconds = now.tv_sec;
+    sent_time->nanoseconds = now.tv_nsec;
+    sent_time->frac_nanoseconds = 0;
+    return PTP_ERR_OK;
+}
 
+/**
+* Classify error of a failed send. Only errors of a broken socket need
+* the sockets to be reopened, others (ENOBUFS, ENETUNREACH, EPERM, ...)
+* lose the frame and are counted by the caller.
+* @param func failed function.
+* @return PTP_ERR_NET if socket is broken, otherwise PTP_ERR_SEND.
+*/
+static int send_error(const char *func)
+{
+    if ((errno == EBADF) || (errno == ENOTSOCK) || (errno == ENODEV)) {
+        perror(func);
+        return PTP_ERR_NET;
+    }
+    DEBUG("%s: %s\n", func, strerror(errno));
+    return PTP_ERR_SEND;
+}
+
+#ifdef SO_TIMESTAMPING
+/**
+* Discard send timestamps left in the error queue of the event socket,
+* e.g. one which arrived after tx_timestamp_get gave up.
+* @param pif Linux packet if ctx
+*/
+static void tx_timestamp_flush(struct linux_packet_if *pif)
+{
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(struct msghdr));
+    while (recvmsg(pif->event_sock, &msg, MSG_ERRQUEUE) >= 0) {
+        DEBUG("Stale send timestamp\n");
+    }
+}
+
+/**
+* Read software send timestamp of the frame sent last from the error
+* queue of the event socket. Kernel takes it when the frame is handed to
+* the driver, like the loopback timestamp of multicast frames.
+* @param pif Linux packet if ctx
+* @param sent_time send time is returned here.
+* @return ptp error code, PTP_ERR_TIMEOUT if no timestamp was reported.
+*/
+static int tx_timestamp_get(struct linux_packet_if *pif,
+                            struct Timestamp *sent_time)
+{
+    struct msghdr msg;
+    // SCM_TIMESTAMPNS of SO_TIMESTAMPNS is reported too
+    union {
+        struct cmsghdr cmsg;
+        char buf[CMSG_SPACE(sizeof(struct timespec)) +
+                 CMSG_SPACE(sizeof(struct scm_timestamping)) +
+                 CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_in))];
+    } cmsg_data;
+    struct cmsghdr *cmsg = NULL;
+    struct scm_timestamping *tss = NULL;
+    struct sock_extended_err *serr = NULL;
+    struct pollfd pfd;
+    u64 deadline = monotonic_ns() + TX_TIMESTAMP_TIMEOUT_MS * 1000000ULL;
+    u64 now = 0;
+
+    pfd.fd = pif->event_sock;
+    pfd.events = 0;             // error queue is reported as POLLERR
+    for (;;) {
+        memset(&msg, 0, sizeof(struct msghdr));
+        msg.msg_control = cmsg_data.buf;
+        msg.msg_controllen = sizeof(cmsg_data.buf);
+        if (recvmsg(pif->event_sock, &msg, MSG_ERRQUEUE) >= 0) {
+            tss = NULL;
+            serr = NULL;
+            for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+                 cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if ((cmsg->cmsg_level == SOL_SOCKET) &&
+                    (cmsg->cmsg_type == SCM_TIMESTAMPING)) {
+                    tss = (struct scm_timestamping *) CMSG_DATA(cmsg);
+                } else if ((cmsg->cmsg_level == SOL_IP) &&
+                           (cmsg->cmsg_type == IP_RECVERR)) {
+                    serr = (struct sock_extended_err *) CMSG_DATA(cmsg);
+                }
+            }
+            if (tss && serr &&
+                (serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) &&
+                (serr->ee_info == SCM_TSTAMP_SND) &&
+                (tss->ts[0].tv_sec || tss->ts[0].tv_nsec)) {
+                sent_time->seconds = tss->ts[0].tv_sec;
+                sent_time->nanoseconds = tss->ts[0].tv_nsec;
+                sent_time->frac_nanoseconds = 0;
+                return PTP_ERR_OK;
+            }
+            continue;
+        }
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+            perror("recvmsg");
+            return PTP_ERR_NET;
+        }
+        now = monotonic_ns();
+        if (now >= deadline) {
+            break;
+        }
+        if (poll(&pfd, 1, (deadline - now + 999999) / 1000000) == 0) {
+            break;
+        }
+    }
+    DEBUG("No send timestamp\n");
+    return PTP_ERR_TIMEOUT;
+}
+#endif                          // SO_TIMESTAMPING
+
+/**
+* Resolve destination of a frame: event or general port of the peer, or
+* of the configured destination of the port.
+* @param pif Linux packet if ctx
+* @param msg_type ptp message type
+* @param if_num interface number of the port.
+* @param peer destination, NULL for the destination of the port.
+* @param saddr destination is returned here.
+* @return ptp error code.
+*/
+static int frame_dest(struct linux_packet_if *pif, int msg_type, int if_num,
+                      struct in_addr *peer, struct sockaddr_in *saddr)
+{
+    memset(saddr, 0, sizeof(struct sockaddr_in));
+    saddr->sin_family = AF_INET;
     switch (msg_type) {
         // Event messages
     case PTP_SYNC:
     case PTP_DELAY_REQ:
     case PTP_PDELAY_REQ:
     case PTP_PDELAY_RESP:
-        saddr.sin_family = AF_INET;
-        saddr.sin_port = htons(DEFAULT_EVENT_PORT);
-        saddr.sin_addr.s_addr = pif->interfaces[if_num].net_addr.s_addr;
-        DEBUG("Send event to %s:%i %i %i:%s\n",
-              inet_ntoa(pif->interfaces[if_num].net_addr),
-              ntohs(saddr.sin_port),
-              length, port_num, inet_ntoa(saddr.sin_addr));
-        if (sendmsg(pif->event_sock, &info_msg, 0) != length) {
-            perror("send");
-        }
+        saddr->sin_port = htons(DEFAULT_EVENT_PORT);
         break;
         // General messages
     case PTP_FOLLOW_UP:
@@ -446,16 +853,127 @@ int ptp_send(struct packet_ctx *ctx,
     case PTP_ANNOUNCE:
     case PTP_SIGNALING:
     case PTP_MANAGEMENT:
-        saddr.sin_family = AF_INET;
-        saddr.sin_port = htons(DEFAULT_GENERAL_PORT);
-        saddr.sin_addr.s_addr = pif->interfaces[if_num].net_addr.s_addr;
-        DEBUG("Send general to %s:%i %i\n",
-              inet_ntoa(pif->interfaces[if_num].net_addr),
-              ntohs(saddr.sin_port), length);
-        if (sendmsg(pif->event_sock, &info_msg, 0) != length) {
-            perror("send");
-        }
+        saddr->sin_port = htons(DEFAULT_GENERAL_PORT);
         break;
+    default:
+        ERROR("message type %i\n", msg_type);
+        return PTP_ERR_GEN;
+    }
+    if (peer) {
+        saddr->sin_addr = *peer;
+    } else if ((msg_type == PTP_PDELAY_REQ) ||
+               (msg_type == PTP_PDELAY_RESP) ||
+               (msg_type == PTP_PDELAY_RESP_FOLLOW_UP)) {
+        saddr->sin_addr.s_addr = pif->interfaces[if_num].pdelay_addr.s_addr;
+    } else {
+        saddr->sin_addr.s_addr = pif->interfaces[if_num].net_addr.s_addr;
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Function for sending a batch of frames of one message type from a port.
+* Frames are handed to the kernel with as few system calls as possible
+* (sendmmsg), up to PTP_SEND_BATCH_MAX frames per call.
+* @param ctx packet if context
+* @param msg_type ptp message type.
+* @param port_num port number.
+* @param vec frames to send.
+* @param count number of frames.
+* @return number of frames sent, or ptp error code.
+*/
+int ptp_send_batch(struct packet_ctx *ctx, int msg_type, int port_num,
+                   struct ptp_send_vec *vec, int count)
+{
+    struct linux_packet_if *pif = (struct linux_packet_if *) ctx->arg;
+    struct mmsghdr msgs[PTP_SEND_BATCH_MAX];
+    struct sockaddr_in saddr[PTP_SEND_BATCH_MAX];
+    struct iovec iov[PTP_SEND_BATCH_MAX];
+    struct in_addr peer;
+    int if_num = port_num - 1;
+    union {
+        struct cmsghdr cmsg;
+        char buf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+    } cmsg_data;
+    struct in_pktinfo *pkt_info = 0;
+    int i = 0, n = 0, ret = 0;
+
+    if ((if_num >= pif->num_interfaces) || (if_num < 0)) {
+        ERROR("port number");
+        return PTP_ERR_GEN;
+    }
+    if (count > PTP_SEND_BATCH_MAX) {
+        count = PTP_SEND_BATCH_MAX;
+    }
+    // All frames leave from the interface of the port, with its address
+    memset(&cmsg_data, 0, sizeof(cmsg_data));
+    cmsg_data.cmsg.cmsg_level = SOL_IP;
+    cmsg_data.cmsg.cmsg_type = IP_PKTINFO;
+    cmsg_data.cmsg.cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
+    pkt_info = (struct in_pktinfo *) CMSG_DATA(&cmsg_data.cmsg);
+    pkt_info->ipi_ifindex = pif->interfaces[if_num].if_index;
+    pkt_info->ipi_spec_dst = pif->interfaces[if_num].if_addr;
+
+    memset(msgs, 0, count * sizeof(struct mmsghdr));
+    for (i = 0; i < count; i++) {
+        if (vec[i].peer_addr && (inet_aton(vec[i].peer_addr, &peer) == 0)) {
+            ERROR("peer address %s\n", vec[i].peer_addr);
+            return PTP_ERR_SEND;
+        }
+        if (frame_dest(pif, msg_type, if_num,
+                       vec[i].peer_addr ? &peer : NULL,
+                       &saddr[i]) != PTP_ERR_OK) {
+            return PTP_ERR_GEN;
+        }
+        iov[i].iov_base = vec[i].frame;
+        iov[i].iov_len = vec[i].length;
+        msgs[i].msg_hdr.msg_name = &saddr[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_control = cmsg_data.buf;
+        msgs[i].msg_hdr.msg_controllen = sizeof(cmsg_data.buf);
+    }
+    // Kernel may accept only part of the batch
+    while (n < count) {
+        ret = sendmmsg(pif->event_sock, &msgs[n], count - n, 0);
+        if (ret <= 0) {
+            if ((n == 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+                return send_error("sendmmsg");
+            }
+            break;
+        }
+        n += ret;
+    }
+    DEBUG("Send %i/%i %s %i\n", n, count, ptp_msg_name(msg_type), port_num);
+    return n;
+}
+
+/**
+* Function for sending a unicast reply to the sender of the frame last
+* returned by ptp_receive. Reply is sent from the general port.
+* @param ctx packet if context
+* @param port_num port number the replied frame was received from.
+* @param frame frame to send.
+* @param length frame length.
+* @return ptp error code.
+*/
+int ptp_send_reply(struct packet_ctx *ctx, int port_num, char *frame,
+                   int length)
+{
+    struct linux_packet_if *pif = (struct linux_packet_if *) ctx->arg;
+
+    if ((port_num > pif->num_interfaces) || (port_num < 1)) {
+        ERROR("port number");
+        return PTP_ERR_GEN;
+    }
+    DEBUG("Send reply to %s:%i %i\n", inet_ntoa(pif->reply_addr.sin_addr),
+          ntohs(pif->reply_addr.sin_port), length);
+    if (sendto(pif->gen_sock, frame, length, 0,
+               (struct sockaddr *) &pif->reply_addr,
+               sizeof(struct sockaddr_in)) != length) {
+        perror("send");
+        return PTP_ERR_NET;
     }
     return PTP_ERR_OK;
 }
@@ -463,6 +981,9 @@ int ptp_send(struct packet_ctx *ctx,
 /**
 * Function for receiving PTP frames. Function can be used to poll PTP ports
 * and if no frames are available, error code PTP_ERROR_TIMEOUT is returned.
+* Only frames of the owner's domain are returned. Multicast frames of other
+* domains are dropped (every domain has a copy of them), unicast frames are
+* forwarded to the packet if of their domain.
 * @param ctx packet if context
 * @param timeout_usec receive timeout in microsecs, decremented with used time.
 * @param port_num port number.
@@ -487,10 +1008,8 @@ int ptp_receive(struct packet_ctx *ctx,
     int recv_buffer_len = *length;
     int if_index = 0;
     struct sockaddr_in from_addr;
-
-    FD_ZERO(&rd_fd);
-    FD_SET(pif->event_sock, &rd_fd);
-    FD_SET(pif->gen_sock, &rd_fd);
+    u64 wakeups = 0;
+    int max_fd = 0;
 
     if (*timeout_usec == 0) {
         // Zero timeout, this may cause problems! Force timeout!            
@@ -500,112 +1019,527 @@ int ptp_receive(struct packet_ctx *ctx,
 
   restart_recv:                // Done only if non-valid or own frame is recvd
 
-    tval_select.tv_sec = 0;
-    tval_select.tv_usec = *timeout_usec;
-    DEBUG("timeout %uus\n", *timeout_usec);
+    // Frames forwarded by other domains are handled first
+    *length = recv_buffer_len;
+    ret = domain_mailbox_get(pif, &if_index, frame, length, recv_time,
+                             &from_addr);
+    if ((ret != PTP_ERR_OK) && pif->rx_running) {
+        *length = recv_buffer_len;
+        ret = rx_ring_get(pif, &if_index, frame, length, recv_time,
+                          &from_addr);
+    }
+    if (ret != PTP_ERR_OK) {
+        FD_ZERO(&rd_fd);
+        FD_SET(pif->mailbox.wake_fd, &rd_fd);
+        max_fd = pif->mailbox.wake_fd;
+        if (pif->rx_running) {
+            // Tell RX thread to wake us, check queue again to not miss it
+            __atomic_store_n(&pif->rx_waiting, 1, __ATOMIC_SEQ_CST);
+            if (ptp_spsc_depth(&pif->rx_ring) > 0) {
+                __atomic_store_n(&pif->rx_waiting, 0, __ATOMIC_SEQ_CST);
+                goto restart_recv;
+            }
+        } else {
+            FD_SET(pif->event_sock, &rd_fd);
+            FD_SET(pif->gen_sock, &rd_fd);
+            max_fd = ptp_max(ptp_max(pif->event_sock, pif->gen_sock),
+                             max_fd);
+        }
+
+        tval_select.tv_sec = *timeout_usec / 1000000;
+        tval_select.tv_usec = *timeout_usec % 1000000;
+        DEBUG("timeout %uus\n", *timeout_usec);
 
-    ret = select(ptp_max(pif->event_sock, pif->gen_sock) + 1,
-                 &rd_fd, 0, 0, &tval_select);
-    if (ret < 0) {
-        perror("select\n");
-        ret = PTP_ERR_NET;
-    } else if (ret == 0) {
-        ret = PTP_ERR_TIMEOUT;
-        *timeout_usec = 0;
-    } else {
+        ret = select(max_fd + 1, &rd_fd, 0, 0, &tval_select);
+        __atomic_store_n(&pif->rx_waiting, 0, __ATOMIC_SEQ_CST);
+        if (ret < 0) {
+            perror("select\n");
+            return PTP_ERR_NET;
+        } else if (ret == 0) {
+            *timeout_usec = 0;
+            return PTP_ERR_TIMEOUT;
+        }
         // Data available
         DEBUG("recv %i\n", ret);
 
         // update timeout with elapsed time
-        *timeout_usec = tval_select.tv_usec;
+        *timeout_usec = tval_select.tv_sec * 1000000 + tval_select.tv_usec;
+
+        if (FD_ISSET(pif->mailbox.wake_fd, &rd_fd)) {
+            // Frame forwarded to mailbox or queued by RX thread
+            if (read(pif->mailbox.wake_fd, &wakeups, sizeof(u64)) < 0) {
+                DEBUG("eventfd read\n");
+            }
+            goto restart_recv;
+        }
 
         *length = recv_buffer_len;
-        ret = ptp_receive_msg(pif, pif->event_sock, &if_index,
-                              frame, length, recv_time, &from_addr);
-        
+        ret = receive_socket_frame(pif, &if_index, frame, length,
+                                   recv_time, &from_addr);
+        if (ret == PTP_ERR_FRAME) {
+            // Frame of other domain
+            goto restart_recv;
+        }
         if (ret != PTP_ERR_OK) {
-            *length = recv_buffer_len;
-            ret = ptp_receive_msg(pif, pif->gen_sock, &if_index,
-                                  frame, length, recv_time, &from_addr);
+            return ret;
         }
-        if (ret == PTP_ERR_OK) {
-            // Message received successfully, do sanity check for the frame.
-            struct ptp_header *hdr = (struct ptp_header *) frame;
+    }
+
+    {
+        // Message received successfully, do sanity check for the frame.
+        struct ptp_header *hdr = (struct ptp_header *) frame;
 
-            // get port_num
-            get_interface(pif, &if_index, NULL, port_num);
+        // get port_num, frames of other instances' interfaces are ignored
+        if (get_interface(pif, &if_index, NULL, port_num) == NULL) {
+            goto restart_recv;
+        }
+        // Unicast frames belong to the unicast port of the interface
+        if (ptp_hdr_flags(hdr) & PTP_UNICAST) {
+            get_unicast_interface(pif, if_index, port_num);
+        }
 
-            // Check lengths (sanity)
-            if (*length < sizeof(struct ptp_header)) {
-                ERROR("Truncated PTP message\n");
-                ret = PTP_ERR_GEN;
+        // Check lengths (sanity)
+        if (*length < sizeof(struct ptp_header)) {
+            ERROR("Truncated PTP message\n");
+            pif->rx_stats.truncated++;
+            goto restart_recv;
+        }
+        switch (hdr->msg_type & 0x0f) {
+        case PTP_SYNC:
+            if (*length < sizeof(struct ptp_sync)) {
+                ERROR("Truncated SYNC message %i<%i\n",
+                      *length, sizeof(struct ptp_sync));
+                pif->rx_stats.truncated++;
+                goto restart_recv;
             }
-            switch (hdr->msg_type & 0x0f) {
-            case PTP_SYNC:
-                if (*length < sizeof(struct ptp_sync)) {
-                    ERROR("Truncated SYNC message %i<%i\n",
-                          *length, sizeof(struct ptp_sync));
-                    goto restart_recv;
-                }
-                break;
-            case PTP_FOLLOW_UP:
-                if (*length < sizeof(struct ptp_follow_up)) {
-                    ERROR("Truncated FOLLOW_UP message %i<%i\n",
-                          *length, sizeof(struct ptp_follow_up));
-                    goto restart_recv;
-                }
-                break;
-            case PTP_DELAY_REQ:
-                if (*length < sizeof(struct ptp_delay_req)) {
-                    ERROR("Truncated DELAY_REQ message %i<%i\n",
-                          *length, sizeof(struct ptp_delay_req));
-                    goto restart_recv;
-                }
-                break;
-            case PTP_ANNOUNCE:
-                if (*length < sizeof(struct ptp_announce)) {
-                    ERROR("Truncated ANNOUNCE message %i<%i\n",
-                          *length, sizeof(struct ptp_announce));
-                    goto restart_recv;
-                }
-                break;
-            case PTP_DELAY_RESP:
-                if (*length < sizeof(struct ptp_delay_resp)) {
-                    ERROR("Truncated Delay_Resp message %i<%i\n",
-                          *length, sizeof(struct ptp_delay_resp));
-                    goto restart_recv;
-                }
-                break;
-            case PTP_PDELAY_REQ:
-            case PTP_PDELAY_RESP:
-            case PTP_PDELAY_RESP_FOLLOW_UP:
-            case PTP_SIGNALING:
-            case PTP_MANAGEMENT:
+            break;
+        case PTP_FOLLOW_UP:
+            if (*length < sizeof(struct ptp_follow_up)) {
+                ERROR("Truncated FOLLOW_UP message %i<%i\n",
+                      *length, sizeof(struct ptp_follow_up));
+                pif->rx_stats.truncated++;
+                goto restart_recv;
+            }
+            break;
+        case PTP_DELAY_REQ:
+            if (*length < sizeof(struct ptp_delay_req)) {
+                ERROR("Truncated DELAY_REQ message %i<%i\n",
+                      *length, sizeof(struct ptp_delay_req));
+                pif->rx_stats.truncated++;
+                goto restart_recv;
+            }
+            break;
+        case PTP_ANNOUNCE:
+            if (*length < sizeof(struct ptp_announce)) {
+                ERROR("Truncated ANNOUNCE message %i<%i\n",
+                      *length, sizeof(struct ptp_announce));
+                pif->rx_stats.truncated++;
+                goto restart_recv;
+            }
+            break;
+        case PTP_DELAY_RESP:
+            if (*length < sizeof(struct ptp_delay_resp)) {
+                ERROR("Truncated Delay_Resp message %i<%i\n",
+                      *length, sizeof(struct ptp_delay_resp));
+                pif->rx_stats.truncated++;
+                goto restart_recv;
+            }
+            break;
+        case PTP_PDELAY_REQ:
+        case PTP_PDELAY_RESP:
+        case PTP_PDELAY_RESP_FOLLOW_UP:
+        case PTP_SIGNALING:
+        case PTP_MANAGEMENT:
+            break;
+        }
+        if (compare_clock_id(hdr->src_port_id.clock_identity,
+                             pif->owner->default_dataset.clock_identity) ==
+            0) {
+            // This frame was sent by us. 
+            // Check port_number
+            if (ntohs(hdr->src_port_id.port_number) != *port_num) {
+                // Loopback from different interface, discard
+                DEBUG("port_num mismatch\n");
+                goto restart_recv;  // frame consumed, restart recv process.
+            }
+            DEBUG("OWN frame\n");
+
+            ptp_frame_sent(pif->owner, *port_num, hdr, PTP_ERR_OK,
+                           recv_time);
+            goto restart_recv;      // frame consumed, restart recv process.
+        }
+        // Transparent clock forwards frames of other clocks, loopback of
+        // them is recognized by the source address. Frames are sent from
+        // the event port, so local management clients are not matched.
+        if ((pif->owner->cfg.clock_type != CLOCK_TYPE_OC) &&
+            (ntohs(from_addr.sin_port) == DEFAULT_EVENT_PORT) &&
+            local_address(pif, &from_addr.sin_addr)) {
+            ptp_frame_sent(pif->owner, *port_num, hdr, PTP_ERR_OK,
+                           recv_time);
+            goto restart_recv;
+        }
+        // Store peer IP
+        if( peer_addr ){
+            strncpy(peer_addr, inet_ntoa(from_addr.sin_addr),
+                    IP_STR_MAX_LEN);
+        } 
+        memcpy(&pif->reply_addr, &from_addr, sizeof(struct sockaddr_in));
+    }
+
+    return ret;
+}
+
+/**
+* Read frame from event or general socket. Frames of other domains are
+* demultiplexed here: multicast frames are dropped and unicast frames
+* forwarded to the packet if of their domain.
+* @param pif linux packet if context
+* @param if_index interface index.
+* @param frame buffer for received frame.
+* @param length frame buffer length, frame length returned.
+* @param recv_time timestamp for received frame.
+* @param from_addr peer IP address.
+* @return ptp error code, PTP_ERR_FRAME if frame was of other domain.
+*/
+static int receive_socket_frame(struct linux_packet_if *pif, int *if_index,
+                                char *frame, int *length,
+                                struct Timestamp *recv_time,
+                                struct sockaddr_in *from_addr)
+{
+    struct in_addr dst_addr;
+    int buffer_len = *length;
+    int ret = 0;
+
+    ret = ptp_receive_msg(pif, pif->event_sock, if_index,
+                          frame, length, recv_time, from_addr, &dst_addr);
+    if (ret != PTP_ERR_OK) {
+        *length = buffer_len;
+        ret = ptp_receive_msg(pif, pif->gen_sock, if_index,
+                              frame, length, recv_time, from_addr,
+                              &dst_addr);
+    }
+    if (ret != PTP_ERR_OK) {
+        return ret;
+    }
+    if (*length >= sizeof(struct ptp_header) &&
+        ((struct ptp_header *) frame)->domain_num !=
+        pif->owner->default_dataset.domain) {
+        if (!IN_MULTICAST(ntohl(dst_addr.s_addr))) {
+            domain_forward(pif, ((struct ptp_header *) frame)->domain_num,
+                           *if_index, frame, *length, recv_time, from_addr);
+        }
+        pif->rx_other_domain++;
+        return PTP_ERR_FRAME;
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Start RX thread, which receives frames from the sockets and queues them
+* to PTP module.
+* @param pif linux packet if context
+* @return ptp error code.
+*/
+static int rx_thread_start(struct linux_packet_if *pif)
+{
+    int ret = 0;
+
+    ptp_spsc_init(&pif->rx_ring, RX_RING_LEN);
+    pif->rx_max_depth = 0;
+    pif->rx_dropped = 0;
+    memset(&pif->rx_stats, 0, sizeof(struct ptp_rx_stats));
+    pif->rx_stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (pif->rx_stop_fd < 0) {
+        perror("eventfd");
+        return PTP_ERR_GEN;
+    }
+    pif->rx_running = 1;
+    ret = pthread_create(&pif->rx_thread, NULL, rx_thread_run, pif);
+    if (ret != 0) {
+        ERROR("pthread_create %s\n", strerror(ret));
+        pif->rx_running = 0;
+        close(pif->rx_stop_fd);
+        return PTP_ERR_GEN;
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Stop RX thread.
+* @param pif linux packet if context
+*/
+static void rx_thread_stop(struct linux_packet_if *pif)
+{
+    u64 stop = 1;
+
+    if (!pif->rx_running) {
+        return;
+    }
+    if (write(pif->rx_stop_fd, &stop, sizeof(u64)) < 0) {
+        perror("write");
+    }
+    pthread_join(pif->rx_thread, NULL);
+    close(pif->rx_stop_fd);
+    pif->rx_running = 0;
+}
+
+/**
+* RX thread. Drains the sockets to the RX queue, so socket buffers do not
+* fill while PTP module is busy.
+* @param arg linux packet if context
+* @return NULL.
+*/
+static void *rx_thread_run(void *arg)
+{
+    struct linux_packet_if *pif = (struct linux_packet_if *) arg;
+    struct rx_frame overflow;
+    struct rx_frame *entry = NULL;
+    cpu_set_t cpuset;
+    fd_set rd_fd;
+    int slot = 0, ret = 0;
+    u32 depth = 0;
+    u64 wakeup = 1;
+
+    if (pif->owner->cfg.rx_cpu >= 0) {
+        CPU_ZERO(&cpuset);
+        CPU_SET(pif->owner->cfg.rx_cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                   &cpuset) != 0) {
+            ERROR("Pinning RX thread to cpu %i failed\n",
+                  pif->owner->cfg.rx_cpu);
+        }
+    }
+
+    while (1) {
+        FD_ZERO(&rd_fd);
+        FD_SET(pif->event_sock, &rd_fd);
+        FD_SET(pif->gen_sock, &rd_fd);
+        FD_SET(pif->rx_stop_fd, &rd_fd);
+        ret = select(ptp_max(ptp_max(pif->event_sock, pif->gen_sock),
+                             pif->rx_stop_fd) + 1, &rd_fd, 0, 0, NULL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            break;
+        }
+        if (FD_ISSET(pif->rx_stop_fd, &rd_fd)) {
+            break;
+        }
+        // Drain sockets
+        while (1) {
+            slot = ptp_spsc_produce_slot(&pif->rx_ring);
+            // Queue full, frame is read to be dropped
+            entry = (slot < 0) ? &overflow : &pif->rx_frames[slot];
+            entry->length = RX_FRAME_LEN;
+            ret = receive_socket_frame(pif, &entry->if_index, entry->frame,
+                                       &entry->length, &entry->recv_time,
+                                       &entry->from_addr);
+            if (ret == PTP_ERR_FRAME) {
+                continue;
+            }
+            if (ret != PTP_ERR_OK) {
                 break;
             }
-            if (compare_clock_id(hdr->src_port_id.clock_identity,
-                                 ptp_ctx.default_dataset.clock_identity) ==
-                0) {
-                // This frame was sent by us. 
-                // Check port_number
-                if (ntohs(hdr->src_port_id.port_number) != *port_num) {
-                    // Loopback from different interface, discard
-                    DEBUG("port_num mismatch\n");
-                    goto restart_recv;  // frame consumed, restart recv process.
+            if (slot < 0) {
+                pif->rx_dropped++;
+                continue;
+            }
+            entry->queued_ns = monotonic_ns();
+            ptp_spsc_produce(&pif->rx_ring);
+            depth = ptp_spsc_depth(&pif->rx_ring);
+            if (depth > pif->rx_max_depth) {
+                pif->rx_max_depth = depth;
+            }
+            if (__atomic_exchange_n(&pif->rx_waiting, 0, __ATOMIC_SEQ_CST)) {
+                if (write(pif->mailbox.wake_fd, &wakeup, sizeof(u64)) < 0) {
+                    perror("write");
                 }
-                DEBUG("OWN frame\n");
-
-                ptp_frame_sent(*port_num, hdr, PTP_ERR_OK, recv_time);
-                goto restart_recv;      // frame consumed, restart recv process.
             }
-            // Store peer IP
-            if( peer_addr ){
-                inet_aton(peer_addr, &from_addr.sin_addr);
-            } 
         }
     }
+    return NULL;
+}
 
-    return ret;
+/**
+* Get frame queued by RX thread.
+* @param pif linux packet if context
+* @param if_index interface index.
+* @param frame buffer for frame.
+* @param length frame buffer length, frame length returned.
+* @param recv_time timestamp of the frame.
+* @param from_addr peer IP address.
+* @return ptp error code, PTP_ERR_GEN if queue is empty.
+*/
+static int rx_ring_get(struct linux_packet_if *pif, int *if_index,
+                       char *frame, int *length,
+                       struct Timestamp *recv_time,
+                       struct sockaddr_in *from_addr)
+{
+    struct rx_frame *entry = NULL;
+    int slot = 0;
+    u32 latency = 0;
+
+    slot = ptp_spsc_consume_slot(&pif->rx_ring);
+    if (slot < 0) {
+        return PTP_ERR_GEN;
+    }
+    entry = &pif->rx_frames[slot];
+    *if_index = entry->if_index;
+    *length = MIN(*length, entry->length);
+    copy_timestamp(recv_time, &entry->recv_time);
+    memcpy(from_addr, &entry->from_addr, sizeof(struct sockaddr_in));
+    memcpy(frame, entry->frame, *length);
+    latency = (u32) (monotonic_ns() - entry->queued_ns);
+    ptp_spsc_consume(&pif->rx_ring);
+
+    pif->rx_stats.frames++;
+    pif->rx_stats.latency_sum_ns += latency;
+    pif->rx_stats.latency_last_ns = latency;
+    if (latency > pif->rx_stats.latency_max_ns) {
+        pif->rx_stats.latency_max_ns = latency;
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Function for reading receive path statistics.
+* @param ctx packet if context
+* @param stats statistics are returned here.
+* @return ptp error code.
+*/
+int ptp_get_rx_stats(struct packet_ctx *ctx, struct ptp_rx_stats *stats)
+{
+    struct linux_packet_if *pif = (struct linux_packet_if *) ctx->arg;
+
+    if (!pif) {
+        return PTP_ERR_GEN;
+    }
+    memcpy(stats, &pif->rx_stats, sizeof(struct ptp_rx_stats));
+    stats->rx_thread = pif->rx_running ? true : false;
+    stats->other_domain = pif->rx_other_domain;
+    if (pif->rx_running) {
+        stats->depth = ptp_spsc_depth(&pif->rx_ring);
+        stats->max_depth = pif->rx_max_depth;
+        stats->dropped = pif->rx_dropped;
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Get monotonic time.
+* @return time in nanoseconds.
+*/
+static u64 monotonic_ns(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((u64) now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+* Forward unicast frame to the packet if of its domain. Packet if must
+* use the interface the frame was received from.
+* @param pif linux packet if context which received the frame.
+* @param domain domain number of the frame.
+* @param if_index interface index.
+* @param frame received frame.
+* @param length frame length.
+* @param recv_time timestamp of the frame.
+* @param from_addr peer IP address.
+*/
+static void domain_forward(struct linux_packet_if *pif, int domain,
+                           int if_index, char *frame, int length,
+                           struct Timestamp *recv_time,
+                           struct sockaddr_in *from_addr)
+{
+    struct linux_packet_if *dst = NULL;
+    struct rx_frame *entry = NULL;
+    u64 wakeup = 1;
+    int i = 0;
+
+    if (length > RX_FRAME_LEN) {
+        ERROR("Too long frame for domain %i\n", domain);
+        return;
+    }
+    // Mailbox of the destination stays open until the lock is released
+    pthread_rwlock_rdlock(&forward_lock);
+    for (i = 0; i < MAX_NUM_INSTANCES; i++) {
+        if (packet_if_data[i].forwarding &&
+            (&packet_if_data[i] != pif) &&
+            (packet_if_data[i].owner->default_dataset.domain == domain) &&
+            get_interface(&packet_if_data[i], &if_index, NULL, NULL)) {
+            dst = &packet_if_data[i];
+            break;
+        }
+    }
+    if (dst == NULL) {
+        pthread_rwlock_unlock(&forward_lock);
+        DEBUG("No instance for domain %i\n", domain);
+        return;
+    }
+
+    pthread_mutex_lock(&dst->mailbox.lock);
+    if (dst->mailbox.count == DOMAIN_MAILBOX_LEN) {
+        dst->mailbox.dropped++;
+        pthread_mutex_unlock(&dst->mailbox.lock);
+        pthread_rwlock_unlock(&forward_lock);
+        DEBUG("Domain %i mailbox full\n", domain);
+        return;
+    }
+    entry = &dst->mailbox.frames[(dst->mailbox.head + dst->mailbox.count) %
+                                 DOMAIN_MAILBOX_LEN];
+    entry->if_index = if_index;
+    entry->length = length;
+    copy_timestamp(&entry->recv_time, recv_time);
+    memcpy(&entry->from_addr, from_addr, sizeof(struct sockaddr_in));
+    memcpy(entry->frame, frame, length);
+    // Pairs with the unlocked peek of domain_mailbox_get
+    __atomic_store_n(&dst->mailbox.count, dst->mailbox.count + 1,
+                     __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&dst->mailbox.lock);
+
+    if (write(dst->mailbox.wake_fd, &wakeup, sizeof(u64)) < 0) {
+        DEBUG("eventfd write\n");
+    }
+    pthread_rwlock_unlock(&forward_lock);
+}
+
+/**
+* Get frame forwarded by other domain.
+* @param pif linux packet if context
+* @param if_index interface index.
+* @param frame buffer for frame.
+* @param length frame buffer length, frame length returned.
+* @param recv_time timestamp of the frame.
+* @param from_addr peer IP address.
+* @return ptp error code, PTP_ERR_GEN if mailbox is empty.
+*/
+static int domain_mailbox_get(struct linux_packet_if *pif, int *if_index,
+                              char *frame, int *length,
+                              struct Timestamp *recv_time,
+                              struct sockaddr_in *from_addr)
+{
+    struct rx_frame *entry = NULL;
+
+    // Unlocked peek, only this thread decreases count
+    if (__atomic_load_n(&pif->mailbox.count, __ATOMIC_ACQUIRE) == 0) {
+        return PTP_ERR_GEN;
+    }
+    pthread_mutex_lock(&pif->mailbox.lock);
+    entry = &pif->mailbox.frames[pif->mailbox.head];
+    *if_index = entry->if_index;
+    *length = MIN(*length, entry->length);
+    copy_timestamp(recv_time, &entry->recv_time);
+    memcpy(from_addr, &entry->from_addr, sizeof(struct sockaddr_in));
+    memcpy(frame, entry->frame, *length);
+    pif->mailbox.head = (pif->mailbox.head + 1) % DOMAIN_MAILBOX_LEN;
+    __atomic_store_n(&pif->mailbox.count, pif->mailbox.count - 1,
+                     __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&pif->mailbox.lock);
+    return PTP_ERR_OK;
 }
 
  /**
@@ -617,6 +1551,7 @@ int ptp_receive(struct packet_ctx *ctx,
 * @param length frame buffer length.
 * @param recv_time timestamp for received frame.
 * @param from_addr Place for peer IP address.
+* @param dst_addr Place for destination IP address of the frame.
 * @return ptp error code.
 */
 static int ptp_receive_msg(struct linux_packet_if *pif,
@@ -625,14 +1560,16 @@ static int ptp_receive_msg(struct linux_packet_if *pif,
                            char *frame,
                            int *length, 
                            struct Timestamp *recv_time,
-                           struct sockaddr_in *from_addr )
+                           struct sockaddr_in *from_addr,
+                           struct in_addr *dst_addr)
 {
     struct msghdr info_msg;
     struct iovec vec[1];
     union {
         struct cmsghdr cmsg;
         char buf[CMSG_SPACE(sizeof(struct in_pktinfo)) +
-                 CMSG_SPACE(sizeof(struct timeval))];
+                 CMSG_SPACE(sizeof(struct timespec)) +
+                 CMSG_SPACE(sizeof(struct scm_timestamping))];
     } cmsg_data;
     struct cmsghdr *cmsg_tmp = 0;
     struct in_pktinfo *pkt_info = 0;
@@ -648,6 +1585,7 @@ static int ptp_receive_msg(struct linux_packet_if *pif,
 
     memset(&info_msg, 0, sizeof(struct msghdr));
     memset(from_addr, 0, sizeof(struct sockaddr_in));
+    memset(dst_addr, 0, sizeof(struct in_addr));
     memset(&cmsg_data, 0, sizeof(cmsg_data));
 
     info_msg.msg_name = (caddr_t) from_addr;
@@ -690,10 +1628,17 @@ static int ptp_receive_msg(struct linux_packet_if *pif,
                   (u32) recv_time->nanoseconds);
         }
 #endif                          // SO_TIMESTAMPNS
+#ifdef SO_TIMESTAMPING
+        else if (cmsg_tmp->cmsg_level == SOL_SOCKET &&
+                 cmsg_tmp->cmsg_type == SCM_TIMESTAMPING) {
+            // Reported because of send timestamping, SCM_TIMESTAMPNS is used
+        }
+#endif
         else if (cmsg_tmp->cmsg_level == SOL_IP
                  && cmsg_tmp->cmsg_type == IP_PKTINFO) {
             pkt_info = (struct in_pktinfo *) CMSG_DATA(cmsg_tmp);
             *if_index = pkt_info->ipi_ifindex;
+            *dst_addr = pkt_info->ipi_addr;
             DEBUG("IP(%i): %s %s\n", *if_index,
                   inet_ntoa(pkt_info->ipi_spec_dst),
                   inet_ntoa(pkt_info->ipi_addr));
@@ -720,7 +1665,7 @@ static int locate_interfaces(struct linux_packet_if *pif)
     struct ifconf ifdata;
     struct ifreq dev[MAX_NUM_INTERFACES * 2];
     int num_if = 0;
-    int flags = 0, i = 0, index_if = 0, num_interfaces = 0, cfg_if_index =
+    int flags = 0, i = 0, num_interfaces = 0, cfg_if_index =
         0;
     int ret = PTP_ERR_NET;
     int tmp_index = 0, prev_index = -1;
@@ -759,7 +1704,7 @@ static int locate_interfaces(struct linux_packet_if *pif)
 
         /* Check if this interface is accepted: flags ok and 
          * not same interface as previous (=logical) */
-        cfg_if_index = if_configured(dev[i].ifr_name);
+        cfg_if_index = if_configured(pif, dev[i].ifr_name);
         if ((cfg_if_index != -1) &&
             ((dev[i].ifr_flags & flags) == flags) &&
             (prev_index != tmp_index)) {
@@ -782,7 +1727,7 @@ static int locate_interfaces(struct linux_packet_if *pif)
             }
             if_addr = ((struct sockaddr_in *) &dev[i].ifr_addr)->sin_addr;
 
-            if (ptp_cfg.interfaces[cfg_if_index].multicast_ena) {
+            if (pif->owner->cfg.interfaces[cfg_if_index].multicast_ena) {
                 // Copy name
                 memcpy(pif->interfaces[pif->num_interfaces].if_name,
                        if_name, IFNAMSIZ);
@@ -800,8 +1745,15 @@ static int locate_interfaces(struct linux_packet_if *pif)
                     ERROR("\n");
                     return PTP_ERR_NET;
                 }
+                if (inet_aton(PTP_PDELAY_MULTICAST_IP,
+                              &pif->interfaces[pif->num_interfaces].
+                              pdelay_addr) == 0) {
+                    perror("inet_aton");
+                    ERROR("\n");
+                    return PTP_ERR_NET;
+                }
                 pif->interfaces[pif->num_interfaces].if_config = 
-                    &ptp_cfg.interfaces[cfg_if_index];
+                    &pif->owner->cfg.interfaces[cfg_if_index];
 
                 ret = PTP_ERR_OK;
                 pif->num_interfaces++;
@@ -809,30 +1761,37 @@ static int locate_interfaces(struct linux_packet_if *pif)
                     goto error_out;
                 }
             }
+            // One unicast port per interface, its peers are sessions
             num_interfaces =
-                ptp_cfg.interfaces[cfg_if_index].num_unicast_addr;
-            for (index_if = 0; index_if < num_interfaces; index_if++) {
+                pif->owner->cfg.interfaces[cfg_if_index].num_unicast_addr;
+            if ((num_interfaces > 0) ||
+                pif->owner->cfg.interfaces[cfg_if_index].unicast_negotiation) {
                 // Copy name
                 memcpy(pif->interfaces[pif->num_interfaces].if_name,
                        if_name, IFNAMSIZ);
                 // Copy ifindex
                 pif->interfaces[pif->num_interfaces].if_index = tmp_index;
                 pif->interfaces[pif->num_interfaces].unicast_entry = 1;
-                // copy dst addresses 
-                if (inet_aton
-                    (ptp_cfg.interfaces[cfg_if_index].unicast_ip[index_if],
-                     &pif->interfaces[pif->num_interfaces].net_addr) ==
-                    0) {
+                // Port level destination is the first configured peer
+                pif->interfaces[pif->num_interfaces].net_addr.s_addr =
+                    htonl(INADDR_ANY);
+                if ((num_interfaces > 0) &&
+                    (inet_aton
+                     (pif->owner->cfg.interfaces[cfg_if_index].unicast_ip[0],
+                      &pif->interfaces[pif->num_interfaces].net_addr) ==
+                     0)) {
                     perror("inet_aton");
                     ERROR("\n");
                     return PTP_ERR_NET;
                 }
+                pif->interfaces[pif->num_interfaces].pdelay_addr =
+                    pif->interfaces[pif->num_interfaces].net_addr;
                 memcpy(pif->interfaces[pif->num_interfaces].hw_addr,
                        hw_addr, IFHWADDRLEN);
                 pif->interfaces[pif->num_interfaces].if_addr = if_addr;
 
                 pif->interfaces[pif->num_interfaces].if_config = 
-                    &ptp_cfg.interfaces[cfg_if_index];
+                    &pif->owner->cfg.interfaces[cfg_if_index];
 
                 ret = PTP_ERR_OK;
                 pif->num_interfaces++;
@@ -901,6 +1860,28 @@ static int port_num_to_if_num( int port_num ){
 }
 */
 
+/**
+* Locate unicast port of an interface. Unicast port shares the interface
+* index with the multicast port.
+* @param pif Linux packet if ctx
+* @param if_index interface index
+* @param port_num port number of the unicast port returned here, unchanged
+* if interface has no unicast port.
+*/
+static void get_unicast_interface(struct linux_packet_if *pif,
+                                  int if_index, int *port_num)
+{
+    int i = 0;
+
+    for (i = 0; i < pif->num_interfaces; i++) {
+        if (pif->interfaces[i].unicast_entry &&
+            (pif->interfaces[i].if_index == if_index)) {
+            *port_num = i + 1;
+            return;
+        }
+    }
+}
+
 /**
 * Locate correct interface. 
 * @param pif Linux packet if ctx
@@ -955,21 +1936,40 @@ static struct linux_if_interface *get_interface(struct linux_packet_if
 
 /**
 * Check if interface configuration exists. 
+* @param pif Linux packet if ctx
 * @param ifr_name interface name
-* @return -1 if disabled, otherwise index to ptp_cfg.interfaces[]
+* @return -1 if disabled, otherwise index to ptp_config.interfaces[]
 */
-static int if_configured(char *if_name)
+static int if_configured(struct linux_packet_if *pif, char *if_name)
 {
     int i = 0;
 
     // check interface list
-    for (i = 0; i < ptp_cfg.num_interfaces; i++) {
-        if (strncmp(ptp_cfg.interfaces[i].name, if_name,
+    for (i = 0; i < pif->owner->cfg.num_interfaces; i++) {
+        if (strncmp(pif->owner->cfg.interfaces[i].name, if_name,
                     MIN(IFNAMSIZ, INTERFACE_NAME_LEN)) == 0) {
             DEBUG("interface %s configuration found\n",
-                  ptp_cfg.interfaces[i].name);
+                  pif->owner->cfg.interfaces[i].name);
             return i;
         }
     }
     return -1;
 }
+
+/**
+* Check if address is address of a local interface.
+* @param pif Linux packet if ctx
+* @param addr IP address.
+* @return 1 if local address, otherwise 0.
+*/
+static int local_address(struct linux_packet_if *pif, struct in_addr *addr)
+{
+    int i = 0;
+
+    for (i = 0; i < pif->num_interfaces; i++) {
+        if (pif->interfaces[i].if_addr.s_addr == addr->s_addr) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -24,8 +24,11 @@
 /******************************************************************************
 * $Id$
 ******************************************************************************/
+#define _GNU_SOURCE
 #include <signal.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
 #include <sys/stat.h>
 
 #include <ptp_general.h>
@@ -36,37 +39,48 @@
 
 #include "ptp.h"
 #include "ptp_bmc.h"
+#include "ptp_framer.h"
 #include "ptp_port.h"
-
-/// Main data
-struct ptp_ctx ptp_ctx;
-int socket_restart = 0;
+#include "ptp_arena.h"
 
 #define FRAME_LEN 500
 
 // Local data
-static int trigger_reconfiguration = 0;
+static volatile sig_atomic_t reconfig_generation = 0;
+static volatile sig_atomic_t dump_generation = 0;
 static struct sigaction sigaction_data;
-static int daemon_running = 1;
+static volatile sig_atomic_t daemon_running = 1;
+/// PTP instances, one per configuration file
+static struct ptp_ctx ptp_instances[MAX_NUM_INSTANCES];
+static int num_instances = 0;
+/// Instances start their loops together after initialization
+static pthread_barrier_t start_barrier;
+/// Serializes configuration file reading of the instances
+static pthread_mutex_t reconfig_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // Local functions
 static void signal_handler(int signal_number);
-static void reconfig_ptp();
+static int ptp_instance_init(struct ptp_ctx *ptp_ctx);
+static void *ptp_instance_run(void *arg);
+static void ptp_instance_close(struct ptp_ctx *ptp_ctx);
+static void reconfig_ptp(struct ptp_ctx *ptp_ctx);
 
 /**
  * Help.
  */
 static void print_help(char *function)
 {
-    printf("%s <parameters>\n", function);
+    printf("%s <parameters> [config file]...\n", function);
     printf("  -c <file>\t\tClock interface configuration file\n");
     printf("  -p <file>\t\tPacket interface configuration file\n");
     printf("  -o <file>\t\tOS interface configuration file\n");
-    printf("  -D\t\t\tEnable logging debug messages\n");
+    printf("  -D\t\t\tEnable logging debug messages of all categories\n");
     printf("  -h\t\t\tThis help\n");
+    printf("Every config file starts an independent PTP instance.\n");
     printf("Signals\n");
-    printf("  USR1\t\t\tenable logging debug messages\n");
+    printf("  USR1\t\t\tenable logging debug messages of all categories\n");
     printf("  HUP\t\t\ttrigger reconfiguration\n");
+    printf("  USR2\t\t\tlog statistics of ports and clock servo\n");
 }
 
 /**
@@ -76,42 +90,42 @@ static void print_help(char *function)
 */
 void ptp_main(int argc, char *argv[])
 {
-    struct ptp_port_ctx *port = NULL;
+    pthread_t threads[MAX_NUM_INSTANCES];
+    char *clock_if_file = NULL;
+    char *packet_if_file = NULL;
+    char *os_if_file = NULL;
     int ret = 0;
-    char frame[FRAME_LEN];
-    char peer_ip[IP_STR_MAX_LEN];
-    struct Timestamp time;
-    int len = FRAME_LEN;
-    int port_num = 0;
-    struct Timestamp current_time, prev_time, next_time, tmp_time;
-    u32 min_timeout_usec = 0;
-    int debug = 0;
     int daemonize = 0;
+    int lock_memory = 0;
+    int metrics_port = 0;
+    int status_files = 0;
+    char *control_socket = NULL;
+    int trace = PTP_TRACE_OFF;
+    char *trace_file = NULL;
+    int primary = -1;
+    int i = 0;
     char c;
     pid_t pid, sid;
 
-    // Clean context
-    memset(&ptp_ctx, 0, sizeof(struct ptp_ctx));
-
-    openlog("openptp", LOG_PID, LOG_DAEMON);
+    openlog("openptp", LOG_PID | LOG_NDELAY, LOG_DAEMON);
 
     // parse command line arguments
     while ((c = getopt(argc, argv, "c:p:o:fDh")) != -1) {
         switch (c) {
         case 'c': // Clock if configuration file
-            ptp_ctx.clock_if_file = strdup(optarg);
+            clock_if_file = strdup(optarg);
             break;
         case 'p': // Packet if configuration file
-            ptp_ctx.packet_if_file = strdup(optarg);
+            packet_if_file = strdup(optarg);
             break;
         case 'o': // OS if configuration file
-            ptp_ctx.os_if_file = strdup(optarg);
+            os_if_file = strdup(optarg);
             break;
         case 'f': // fork as daemon
             daemonize = 1;
             break;
         case 'D': // debug
-            debug = 1;
+            ptp_log_set_all(LOG_DEBUG);
             break;
         case 'h':              // help
         default:
@@ -157,12 +171,24 @@ void ptp_main(int argc, char *argv[])
         dup(STDOUT_FILENO);
     }
 
-    if (optind < argc ) {
-        ptp_ctx.ptp_cfg_file = strdup(argv[optind]);
-    } 
-
-    memset(&ptp_cfg, 0, sizeof(struct ptp_config));
-    ptp_cfg.debug = debug;
+    // Every config file is an instance, without config file run one
+    num_instances = argc - optind;
+    if (num_instances > MAX_NUM_INSTANCES) {
+        ERROR("Max %i instances supported\n", MAX_NUM_INSTANCES);
+        num_instances = MAX_NUM_INSTANCES;
+    }
+    if (num_instances < 1) {
+        num_instances = 1;
+    }
+    memset(ptp_instances, 0, sizeof(ptp_instances));
+    for (i = 0; i < num_instances; i++) {
+        if (optind + i < argc) {
+            ptp_instances[i].ptp_cfg_file = strdup(argv[optind + i]);
+        }
+        ptp_instances[i].clock_if_file = clock_if_file;
+        ptp_instances[i].packet_if_file = packet_if_file;
+        ptp_instances[i].os_if_file = os_if_file;
+    }
 
     // Add signal handler
     memset(&sigaction_data, 0, sizeof(struct sigaction));
@@ -174,6 +200,9 @@ void ptp_main(int argc, char *argv[])
     if (sigaction(SIGHUP, &sigaction_data, NULL) != 0) {
         ERROR("Register signal handler failed\n");
     }
+    if (sigaction(SIGUSR2, &sigaction_data, NULL) != 0) {
+        ERROR("Register signal handler failed\n");
+    }
     if (sigaction(SIGINT, &sigaction_data, NULL) != 0) {
         ERROR("Register signal handler failed\n");
     }
@@ -181,48 +210,232 @@ void ptp_main(int argc, char *argv[])
         ERROR("Register signal handler failed\n");
     }
 
-    if( ptp_ctx.ptp_cfg_file ){
-        ret = read_initialization(ptp_ctx.ptp_cfg_file);
+    for (i = 0; i < num_instances; i++) {
+        ret = ptp_instance_init(&ptp_instances[i]);
         if (ret != PTP_ERR_OK) {
-            ERROR("CFG file read %s\n", ptp_ctx.ptp_cfg_file);
+            ERROR("Instance %i initialization failed\n", i);
+            return;
+        }
+        lock_memory |= ptp_instances[i].cfg.lock_memory;
+        // Only one domain may discipline the clock
+        if (ptp_instances[i].cfg.clock_control == CLOCK_CONTROL_PRIMARY) {
+            if (primary >= 0) {
+                ERROR("Domain %i already primary, domain %i set to backup\n",
+                      ptp_instances[primary].cfg.domain,
+                      ptp_instances[i].cfg.domain);
+                ptp_instances[i].cfg.clock_control = CLOCK_CONTROL_BACKUP;
+            } else {
+                primary = i;
+            }
+        }
+    }
+
+    if (lock_memory) {
+        ptp_lock_memory();
+    }
+
+    // One exporter and one control thread serve all instances, the
+    // first configuration setting one is used
+    for (i = 0; i < num_instances; i++) {
+        if (ptp_instances[i].cfg.metrics_port > 0) {
+            metrics_port = ptp_instances[i].cfg.metrics_port;
+            break;
+        }
+    }
+    for (i = 0; i < num_instances; i++) {
+        status_files |= ptp_instances[i].cfg.status_files;
+        if (!control_socket && ptp_instances[i].cfg.control_socket[0]) {
+            control_socket = ptp_instances[i].cfg.control_socket;
+        }
+    }
+    if (metrics_port || control_socket || status_files) {
+        ptp_metrics_init(num_instances);
+        if (metrics_port) {
+            ptp_metrics_start(metrics_port);
+        }
+        if (control_socket || status_files) {
+            ptp_ctl_start(control_socket, status_files, num_instances);
+        }
+        for (i = 0; i < num_instances; i++) {
+            ptp_instances[i].metrics = ptp_metrics_slot(i);
+            ptp_instances[i].ctl = ptp_ctl_events(i);
+        }
+    }
+    for (i = 0; i < num_instances; i++) {
+        if (ptp_instances[i].cfg.trace != PTP_TRACE_OFF) {
+            trace = ptp_instances[i].cfg.trace;
+            trace_file = ptp_instances[i].cfg.trace_file;
+            break;
+        }
+    }
+    if ((trace != PTP_TRACE_OFF) &&
+        (ptp_trace_start(trace, trace_file, num_instances) == PTP_ERR_OK)) {
+        for (i = 0; i < num_instances; i++) {
+            ptp_instances[i].trace = ptp_trace_ring(i);
+        }
+    }
+
+    pthread_barrier_init(&start_barrier, NULL, num_instances);
+    // First instance is run by the main thread
+    for (i = 1; i < num_instances; i++) {
+        ret = pthread_create(&threads[i], NULL, ptp_instance_run,
+                             &ptp_instances[i]);
+        if (ret != 0) {
+            ERROR("pthread_create %s\n", strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+    // Initialization done, no heap allocations after this
+    ptp_alloc_seal(true);
+
+    ptp_instance_run(&ptp_instances[0]);
+
+    for (i = 1; i < num_instances; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    ptp_alloc_seal(false);
+    pthread_barrier_destroy(&start_barrier);
+    ptp_metrics_stop();
+    ptp_ctl_stop();
+    ptp_trace_stop();
+    for (i = 0; i < num_instances; i++) {
+        ptp_instances[i].metrics = NULL;
+        ptp_instances[i].ctl = NULL;
+        ptp_instances[i].trace = NULL;
+    }
+
+    for (i = 0; i < num_instances; i++) {
+        ptp_instance_close(&ptp_instances[i]);
+    }
+
+    DEBUG("PTP closed\n");
+}
+
+/**
+* Initialize PTP instance. Configuration file and interface 
+* configuration file names must be set to context.
+* @param ptp_ctx PTP instance.
+* @return ptp error code.
+*/
+static int ptp_instance_init(struct ptp_ctx *ptp_ctx)
+{
+    int ret = 0;
+
+    ptp_ctx->cfg.cpu = -1;
+    ptp_ctx->cfg.rx_cpu = -1;
+    ptp_ctx->cfg.max_foreign_masters = DEFAULT_NUM_FOREIGN_MASTERS;
+    ptp_ctx->cfg.clock_control = CLOCK_CONTROL_PRIMARY;
+
+    if( ptp_ctx->ptp_cfg_file ){
+        ret = read_initialization(&ptp_ctx->cfg, ptp_ctx->ptp_cfg_file);
+        if (ret != PTP_ERR_OK) {
+            ERROR("CFG file read %s\n", ptp_ctx->ptp_cfg_file);
+        }
+        // Log levels are process wide, later instances override
+        if (ptp_ctx->cfg.debug) {
+            ptp_log_set_all(LOG_DEBUG);
+        }
+        if (ptp_ctx->cfg.log[0] &&
+            (ptp_log_parse(ptp_ctx->cfg.log) != PTP_ERR_OK)) {
+            ERROR("Invalid log levels %s\n", ptp_ctx->cfg.log);
         }
     }
 
     // Init all context
-    ptp_ctx.ports_list_head = 0;
-    memset(&ptp_ctx.default_dataset, 0, sizeof(struct DefaultDataSet));
-    init_default_dataset(&ptp_ctx.default_dataset);
+    ptp_ctx->ports_list_head = 0;
+    memset(&ptp_ctx->default_dataset, 0, sizeof(struct DefaultDataSet));
+    init_default_dataset(&ptp_ctx->cfg, &ptp_ctx->default_dataset);
+
+    // Reserve memory for ports before packet_if creates them
+    ret = ptp_port_pool_init(ptp_ctx);
+    if (ret != PTP_ERR_OK) {
+        ERROR("ptp_port_pool_init\n");
+        return ret;
+    }
 
-    ret = ptp_initialize_packet_if(&ptp_ctx.pkt_ctx, 
-                                   ptp_ctx.packet_if_file);
+    ret = ptp_initialize_packet_if(&ptp_ctx->pkt_ctx, ptp_ctx,
+                                   ptp_ctx->packet_if_file);
     if (ret != 0) {
         ERROR("ptp_initialize_packet_if\n");
-        return;
+        return ret;
     }
-    ret = ptp_initialize_os_if(&ptp_ctx.os_ctx,
-                               ptp_ctx.os_if_file);
+    ret = ptp_initialize_os_if(&ptp_ctx->os_ctx, ptp_ctx,
+                               ptp_ctx->os_if_file);
     if (ret != 0) {
         ERROR("initialize_os_if\n");
-        return;
+        return ret;
     }
 
-    ret = ptp_initialize_clock_if(&ptp_ctx.clk_ctx, 
-                                  ptp_ctx.clock_if_file);
+    ret = ptp_initialize_clock_if(&ptp_ctx->clk_ctx, ptp_ctx,
+                                  ptp_ctx->clock_if_file);
     if (ret != 0) {
         ERROR("ptp_initialize_clock_if\n");
-        return;
+        return ret;
+    }
+
+    init_current_dataset(&ptp_ctx->current_dataset);
+    init_parent_dataset(&ptp_ctx->default_dataset,
+                        &ptp_ctx->parent_dataset);
+    init_time_dataset(&ptp_ctx->cfg, &ptp_ctx->time_dataset);
+    init_sec_dataset(&ptp_ctx->sec_dataset);
+
+    // Recorder file is kept over reconfiguration
+    if (ptp_ctx->cfg.servo_record[0]) {
+        struct ptp_servo_stats stats;
+
+        memset(&stats, 0, sizeof(stats));
+        ptp_get_servo_stats(&ptp_ctx->clk_ctx, &stats);
+        if (ptp_servo_rec_open(&ptp_ctx->servo_rec,
+                               ptp_ctx->cfg.servo_record,
+                               ptp_ctx->default_dataset.domain,
+                               &stats) != PTP_ERR_OK) {
+            ERROR("Servo recorder %s\n", ptp_ctx->cfg.servo_record);
+        }
     }
 
-    init_current_dataset(&ptp_ctx.current_dataset);
-    init_parent_dataset(&ptp_ctx.parent_dataset);
-    init_time_dataset(&ptp_ctx.time_dataset);
-    init_sec_dataset(&ptp_ctx.sec_dataset);
+    ptp_ctx->reconfig_seen = reconfig_generation;
+    ptp_ctx->dump_seen = dump_generation;
+    // Templates of the ports are built on first send
+    ptp_ctx->dataset_generation = 1;
+
+    return PTP_ERR_OK;
+}
+
+/**
+* Event loop of the PTP instance.
+* @param arg PTP instance (struct ptp_ctx).
+* @return NULL.
+*/
+static void *ptp_instance_run(void *arg)
+{
+    struct ptp_ctx *ptp_ctx = arg;
+    struct ptp_port_ctx *port = NULL;
+    char frame[FRAME_LEN];
+    char peer_ip[IP_STR_MAX_LEN];
+    struct Timestamp time;
+    int len = FRAME_LEN;
+    int port_num = 0;
+    struct Timestamp current_time, prev_time, next_time, tmp_time;
+    u32 min_timeout_usec = 0;
+    cpu_set_t cpuset;
+
+    // Pin instance to CPU
+    if (ptp_ctx->cfg.cpu >= 0) {
+        CPU_ZERO(&cpuset);
+        CPU_SET(ptp_ctx->cfg.cpu, &cpuset);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t),
+                                   &cpuset) != 0) {
+            ERROR("Pinning to cpu %i failed\n", ptp_ctx->cfg.cpu);
+        }
+    }
+    ptp_trace_attach(ptp_ctx->trace);
+    pthread_barrier_wait(&start_barrier);
 
     // Init prev time
-    ptp_get_time(&ptp_ctx.clk_ctx, &prev_time);
+    ptp_get_time(&ptp_ctx->clk_ctx, &prev_time);
 
     while (daemon_running) {
-        ptp_get_time(&ptp_ctx.clk_ctx, &current_time);
+        ptp_get_time(&ptp_ctx->clk_ctx, &current_time);
         
         // Check if current time has updated to older,
         // if yes, clock has been set backwards and we must
@@ -230,7 +443,7 @@ void ptp_main(int argc, char *argv[])
         if( older_timestamp(&prev_time, &current_time) ==
             &current_time ){
             DEBUG("Clock has gone to history, restart ports\n");
-            for (port = ptp_ctx.ports_list_head; port != NULL;
+            for (port = ptp_ctx->ports_list_head; port != NULL;
                  port = port->next) {
                  ptp_port_state_update(port, PORT_INITIALIZING);
             }
@@ -245,23 +458,26 @@ void ptp_main(int argc, char *argv[])
         *    of the timeouts expire.
         */
 
-        for (port = ptp_ctx.ports_list_head; port != NULL;
-             port = port->next) {
-            // ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES check
-            ptp_port_announce_recv_timeout_check(port, &current_time);
-        }
+        // Transparent clock only forwards, its ports have no state
+        if (ptp_ctx->cfg.clock_type == CLOCK_TYPE_OC) {
+            for (port = ptp_ctx->ports_list_head; port != NULL;
+                 port = port->next) {
+                // ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES check
+                ptp_port_announce_recv_timeout_check(port, &current_time);
+            }
 
-        // Run best master selection
-        ptp_bmc_run(&ptp_ctx);
+            // Run best master selection
+            ptp_bmc_run(ptp_ctx);
+        }
         // Init next_time to "Announce message transmission interval", because
         // BMC must be run then at latest
-        tmp_time.seconds = power2(ptp_cfg.announce_interval,
+        tmp_time.seconds = power2(ptp_ctx->cfg.announce_interval,
                                   &tmp_time.nanoseconds);
         copy_timestamp(&next_time, &current_time);
         inc_timestamp(&next_time, &tmp_time);
 
         // Run statemachine for every port
-        for (port = ptp_ctx.ports_list_head; port != NULL;
+        for (port = ptp_ctx->ports_list_head; port != NULL;
              port = port->next) {
             ptp_port_statemachine(port, &current_time, &tmp_time);
             // Select which port must be served soonest
@@ -269,23 +485,42 @@ void ptp_main(int argc, char *argv[])
                 copy_timestamp(&next_time, &tmp_time);
             }
         }
+        // Serve unicast sessions which are due, after port states are known
+        ptp_unicast_run(ptp_ctx, &current_time, &next_time);
+
+        // Answer Delay_Req received since the last wakeup, Sync has been
+        // sent above. If budget runs out, continue on next wakeup.
+        for (port = ptp_ctx->ports_list_head; port != NULL;
+             port = port->next) {
+            if (ptp_dresp_flush(port, &current_time) > 0) {
+                copy_timestamp(&next_time, &current_time);
+            }
+        }
+        // Publish statistics for the metrics exporter
+        if (ptp_ctx->metrics) {
+            ptp_metrics_run(ptp_ctx, &current_time, &next_time);
+        }
+
         // To get more accurate sleep times, read current time again
-        ptp_get_time(&ptp_ctx.clk_ctx, &current_time);
+        ptp_get_time(&ptp_ctx->clk_ctx, &current_time);
         timeout(&current_time, &next_time, &tmp_time);
-        DEBUG("Timeout [%us %uns]\n",
-              (u32) tmp_time.seconds, tmp_time.nanoseconds);
         min_timeout_usec =
             tmp_time.seconds * 1000000 + tmp_time.nanoseconds / 1000;
+        TRACE(PTP_TR_WAKEUP, min_timeout_usec, 0, 0, 0);
         // ptp_receive will sleep min_timeout_usec if no data is received
         len = FRAME_LEN;
-        while (ptp_receive(&ptp_ctx.pkt_ctx, &min_timeout_usec,
+        while (ptp_receive(&ptp_ctx->pkt_ctx, &min_timeout_usec,
                            &port_num, frame, &len, &time,
                            peer_ip ) == PTP_ERR_OK) {
-            for (port = ptp_ctx.ports_list_head;
+            for (port = ptp_ctx->ports_list_head;
                  port != NULL; port = port->next) {
                 if (port->port_dataset.port_identity.port_number ==
                     port_num) {
-                    ptp_port_recv(port, frame, len, &time, peer_ip);
+                    if (ptp_ctx->cfg.clock_type == CLOCK_TYPE_OC) {
+                        ptp_port_recv(port, frame, len, &time, peer_ip);
+                    } else {
+                        ptp_tc_recv(port, frame, len, &time, peer_ip);
+                    }
                     break;
                 }
             }
@@ -293,7 +528,7 @@ void ptp_main(int argc, char *argv[])
                 ERROR("frame from unconfigured port %i\n", port_num);
             }
 
-            ptp_get_time(&ptp_ctx.clk_ctx, &current_time);
+            ptp_get_time(&ptp_ctx->clk_ctx, &current_time);
             // Check if current time has updated to older,
             // if yes, break out the receive loop
             if( older_timestamp(&prev_time, &current_time) ==
@@ -302,32 +537,67 @@ void ptp_main(int argc, char *argv[])
                 break;
             }
             timeout(&current_time, &next_time, &tmp_time);
-            DEBUG("Timeout [%us %uns]\n",
-                  (u32) tmp_time.seconds, 
-                  tmp_time.nanoseconds);
             min_timeout_usec =
                 tmp_time.seconds * 1000000 + tmp_time.nanoseconds / 1000;
+            TRACE(PTP_TR_WAKEUP, min_timeout_usec, 0, 0, 0);
             len = FRAME_LEN;
+            // Collect Delay_Req while frames are pending, they are answered
+            // on the next wakeup, right away when a batch is full
+            if (port && (ptp_dresp_pending(port) > 0)) {
+                if (ptp_dresp_pending(port) >= PTP_DRESP_BUDGET) {
+                    break;
+                }
+                min_timeout_usec = 0;
+            }
+        }
+        // Check if statistics are requested
+        if (ptp_ctx->dump_seen != dump_generation) {
+            ptp_ctx->dump_seen = dump_generation;
+            ptp_stats_snapshot(ptp_ctx, &ptp_ctx->snapshot);
+            ptp_stats_dump(&ptp_ctx->snapshot);
         }
         // Check if reconfiguration request is pending
-        if( trigger_reconfiguration ){
-            reconfig_ptp();
-            trigger_reconfiguration = 0;
+        if( ptp_ctx->reconfig_seen != reconfig_generation ){
+            ptp_ctx->reconfig_seen = reconfig_generation;
+            reconfig_ptp(ptp_ctx);
         } 
         // Check if socket is broken
-        if( socket_restart ){
-            ptp_close_packet_if(&ptp_ctx.pkt_ctx);
-            ptp_initialize_packet_if(&ptp_ctx.pkt_ctx, 
-                                     ptp_ctx.packet_if_file);
-            socket_restart = 0;
+        if( ptp_ctx->socket_restart ){
+            // RX thread is restarted, which allocates in this thread only
+            pthread_mutex_lock(&reconfig_lock);
+            ptp_alloc_unseal_thread(true);
+            ptp_close_packet_if(&ptp_ctx->pkt_ctx);
+            ptp_initialize_packet_if(&ptp_ctx->pkt_ctx, ptp_ctx,
+                                     ptp_ctx->packet_if_file);
+            ptp_alloc_unseal_thread(false);
+            pthread_mutex_unlock(&reconfig_lock);
+            ptp_ctx->socket_restart = 0;
         }
     }
-    
-    ptp_close_clock_if(&ptp_ctx.clk_ctx);
-    ptp_close_os_if(&ptp_ctx.os_ctx);
-    ptp_close_packet_if(&ptp_ctx.pkt_ctx);
-    
-    DEBUG("PTP closed\n");
+    ptp_trace_attach(NULL);
+    return NULL;
+}
+
+/**
+* Close PTP instance.
+* @param ptp_ctx PTP instance.
+*/
+static void ptp_instance_close(struct ptp_ctx *ptp_ctx)
+{
+    struct ptp_rx_stats stats;
+
+    if ((ptp_get_rx_stats(&ptp_ctx->pkt_ctx, &stats) == PTP_ERR_OK) &&
+        stats.rx_thread && stats.frames) {
+        DEBUG("RX queue: frames %llu max depth %u dropped %u "
+              "latency avg %lluns max %uns\n",
+              stats.frames, stats.max_depth, stats.dropped,
+              stats.latency_sum_ns / stats.frames, stats.latency_max_ns);
+    }
+    ptp_servo_rec_close(&ptp_ctx->servo_rec);
+    ptp_close_clock_if(&ptp_ctx->clk_ctx);
+    ptp_close_os_if(&ptp_ctx->os_ctx);
+    ptp_close_packet_if(&ptp_ctx->pkt_ctx);
+    ptp_arena_release(&ptp_ctx->arena);
 }
 
 /**
@@ -338,10 +608,13 @@ static void signal_handler(int signal_number)
 {
     switch(signal_number){
     case SIGUSR1:
-        ptp_cfg.debug = 1;
+        ptp_log_set_all(LOG_DEBUG);
         break;
     case SIGHUP:
-        trigger_reconfiguration = 1;
+        reconfig_generation++;
+        break;
+    case SIGUSR2:
+        dump_generation++;
         break;
     default:
         daemon_running = 0;
@@ -351,60 +624,70 @@ static void signal_handler(int signal_number)
 
 /**
  * Do reconfiguration.
+ * @param ptp_ctx PTP instance.
  */
-static void reconfig_ptp()
+static void reconfig_ptp(struct ptp_ctx *ptp_ctx)
 {
     struct ptp_port_ctx *ctx = 0;
     int ret = 0;
 
-    if( ptp_ctx.ptp_cfg_file ){
+    if( ptp_ctx->ptp_cfg_file ){
         DEBUG("Reconfig PTP\n");
-        ret = read_initialization(ptp_ctx.ptp_cfg_file);
+        // Config file parsing uses stdio, which allocates
+        pthread_mutex_lock(&reconfig_lock);
+        ptp_alloc_unseal_thread(true);
+        ret = read_initialization(&ptp_ctx->cfg, ptp_ctx->ptp_cfg_file);
+        ptp_alloc_unseal_thread(false);
+        pthread_mutex_unlock(&reconfig_lock);
         if (ret != PTP_ERR_OK) {
-            ERROR("CFG file read %s\n", ptp_ctx.ptp_cfg_file);
+            ERROR("CFG file read %s\n", ptp_ctx->ptp_cfg_file);
         }
     }
 
     // Init default dataset
-    init_default_dataset(&ptp_ctx.default_dataset);
+    init_default_dataset(&ptp_ctx->cfg, &ptp_ctx->default_dataset);
 
-    ret = ptp_reconfig_packet_if(&ptp_ctx.pkt_ctx, 
-                                 ptp_ctx.packet_if_file);
+    ret = ptp_reconfig_packet_if(&ptp_ctx->pkt_ctx, 
+                                 ptp_ctx->packet_if_file);
     if (ret != 0) {
         ERROR("ptp_reconfig_packet_if\n");
     }
 
-    ret = ptp_reconfig_os_if(&ptp_ctx.os_ctx,
-                             ptp_ctx.os_if_file);
+    ret = ptp_reconfig_os_if(&ptp_ctx->os_ctx,
+                             ptp_ctx->os_if_file);
     if (ret != 0) {
         ERROR("ptp_reconfig_os_if\n");
     }
 
-    ret = ptp_reconfig_clock_if(&ptp_ctx.clk_ctx, 
-                                ptp_ctx.clock_if_file);
+    ret = ptp_reconfig_clock_if(&ptp_ctx->clk_ctx, 
+                                ptp_ctx->clock_if_file);
     if (ret != 0) {
         ERROR("ptp_reconfig_clock_if\n");
     }
 
-    init_current_dataset(&ptp_ctx.current_dataset);
-    init_parent_dataset(&ptp_ctx.parent_dataset);
-    init_time_dataset(&ptp_ctx.time_dataset);
-    init_sec_dataset(&ptp_ctx.sec_dataset);
+    init_current_dataset(&ptp_ctx->current_dataset);
+    init_parent_dataset(&ptp_ctx->default_dataset,
+                        &ptp_ctx->parent_dataset);
+    init_time_dataset(&ptp_ctx->cfg, &ptp_ctx->time_dataset);
+    init_sec_dataset(&ptp_ctx->sec_dataset);
 
-    ctx = ptp_ctx.ports_list_head;
+    ctx = ptp_ctx->ports_list_head;
     while (ctx != NULL) {
-        init_port_dataset( &ctx->port_dataset );
+        init_port_dataset(&ptp_ctx->cfg, &ctx->port_dataset);
         ptp_port_state_update(ctx, PORT_INITIALIZING);
         ctx = ctx->next;
     }
+    ptp_framer_invalidate(ptp_ctx);
 }
 
 /**
 * An event reporting function to main control.
+* @param ptp_ctx PTP instance.
 * @param event status value indication function call reason.
 * @param arg event specific argument.
 */
-void ptp_event_ctrl(enum ptp_event_ctrl event, void *arg)
+void ptp_event_ctrl(struct ptp_ctx *ptp_ctx,
+                    enum ptp_event_ctrl event, void *arg)
 {
     struct ptp_port_ctx *port = NULL;
 
@@ -412,7 +695,7 @@ void ptp_event_ctrl(enum ptp_event_ctrl event, void *arg)
     switch (event) {
     case PTP_MASTER_CLOCK_SELECTED:
         // Only one port can be in UNCALIRATED state -> set it to SLAVE state
-        for (port = ptp_ctx.ports_list_head; port != NULL;
+        for (port = ptp_ctx->ports_list_head; port != NULL;
              port = port->next) {
             if (port->port_dataset.port_state == PORT_UNCALIBRATED) {
                 ptp_port_state_update(port, PORT_SLAVE);
@@ -671,11 +954,13 @@ u32 power2(s32 exp, u32 * nanosecs)
 
 /**
 * Init default dataset.
+* @param cfg configuration.
 * @param default_dataset dataset.
 */
-void init_default_dataset(struct DefaultDataSet *default_dataset)
+void init_default_dataset(struct ptp_config *cfg,
+                          struct DefaultDataSet *default_dataset)
 {
-    if (ptp_cfg.one_step_clock == 0) {
+    if (cfg->one_step_clock == 0) {
         default_dataset->two_step_clock = true; // TRUE for two_step clock
     } else {
         default_dataset->two_step_clock = false;
@@ -687,14 +972,14 @@ void init_default_dataset(struct DefaultDataSet *default_dataset)
         default_dataset->clock_quality.clock_class = 255;
 
     } else {
-        default_dataset->clock_quality.clock_class = ptp_cfg.clock_class;
+        default_dataset->clock_quality.clock_class = cfg->clock_class;
     }
-    default_dataset->clock_quality.clock_accuracy = ptp_cfg.clock_accuracy;
+    default_dataset->clock_quality.clock_accuracy = cfg->clock_accuracy;
     default_dataset->clock_quality.offset_scaled_log_variance =
         DEFAULT_OFFSET_SCALED_LOG_VARIANCE;
-    default_dataset->priority1 = ptp_cfg.clock_priority1;
-    default_dataset->priority2 = ptp_cfg.clock_priority2;
-    default_dataset->domain = ptp_cfg.domain;
+    default_dataset->priority1 = cfg->clock_priority1;
+    default_dataset->priority2 = cfg->clock_priority2;
+    default_dataset->domain = cfg->domain;
 }
 
 /**
@@ -722,36 +1007,40 @@ void init_current_dataset(struct CurrentDataSet *current_dataset)
 
 /**
 * Init parent dataset.
+* @param default_dataset default dataset of the clock.
 * @param parent_dataset dataset.
 */
-void init_parent_dataset(struct ParentDataSet *parent_dataset)
+void init_parent_dataset(struct DefaultDataSet *default_dataset,
+                         struct ParentDataSet *parent_dataset)
 {
 
     memset(parent_dataset, 0, sizeof(struct ParentDataSet));
     memcpy(parent_dataset->parent_port_identity.clock_identity,
-           ptp_ctx.default_dataset.clock_identity, sizeof(ClockIdentity));
+           default_dataset->clock_identity, sizeof(ClockIdentity));
     parent_dataset->parent_stats = false;
     parent_dataset->observed_parent_offset_scaled_log_variance = 0xffff;
     parent_dataset->observed_parent_clock_phase_change_rate = 0x7fffffff;
     memcpy(parent_dataset->grandmaster_identity,
-           ptp_ctx.default_dataset.clock_identity, sizeof(ClockIdentity));
+           default_dataset->clock_identity, sizeof(ClockIdentity));
     parent_dataset->grandmaster_clock_quality.clock_class =
-        ptp_ctx.default_dataset.clock_quality.clock_class;
+        default_dataset->clock_quality.clock_class;
     parent_dataset->grandmaster_clock_quality.clock_accuracy =
-        ptp_ctx.default_dataset.clock_quality.clock_accuracy;
+        default_dataset->clock_quality.clock_accuracy;
     parent_dataset->grandmaster_clock_quality.offset_scaled_log_variance =
-        ptp_ctx.default_dataset.clock_quality.offset_scaled_log_variance;
+        default_dataset->clock_quality.offset_scaled_log_variance;
     parent_dataset->grandmaster_priority1 =
-        ptp_ctx.default_dataset.priority1;
+        default_dataset->priority1;
     parent_dataset->grandmaster_priority2 =
-        ptp_ctx.default_dataset.priority2;
+        default_dataset->priority2;
 }
 
 /**
 * Init time dataset.
+* @param cfg configuration.
 * @param time_dataset dataset.
 */
-void init_time_dataset(struct TimeProperitiesDataSet *time_dataset)
+void init_time_dataset(struct ptp_config *cfg,
+                       struct TimeProperitiesDataSet *time_dataset)
 {
     memset(time_dataset, 0, sizeof(struct TimeProperitiesDataSet));
     // The offset between TAI and UTC
@@ -771,7 +1060,7 @@ void init_time_dataset(struct TimeProperitiesDataSet *time_dataset)
     // TRUE if the clock timescale of the grandmaster clock is PTP. 
     time_dataset->ptp_timescale = true;
     // The source of time used by the grandmaster clock.      
-    time_dataset->time_source = ptp_cfg.clock_source;
+    time_dataset->time_source = cfg->clock_source;
 }
 
 /**
@@ -785,13 +1074,18 @@ void init_sec_dataset(struct SecurityDataSet *sec_dataset)
 
 /**
 * Init port dataset.
+* @param cfg configuration.
 * @param port_dataset dataset.
 */
-void init_port_dataset(struct PortDataSet *port_dataset)
+void init_port_dataset(struct ptp_config *cfg,
+                       struct PortDataSet *port_dataset)
 {
-    port_dataset->log_mean_announce_interval = ptp_cfg.announce_interval;
-    port_dataset->log_mean_sync_interval = ptp_cfg.sync_interval;
-    port_dataset->log_min_mean_delay_req_interval = ptp_cfg.delay_req_interval;
+    port_dataset->log_mean_announce_interval = cfg->announce_interval;
+    port_dataset->log_mean_sync_interval = cfg->sync_interval;
+    port_dataset->log_min_mean_delay_req_interval = cfg->delay_req_interval;
+    port_dataset->log_min_mean_pdelay_req_interval =
+        cfg->pdelay_req_interval;
+    port_dataset->delay_mechanism = cfg->delay_mechanism;
 }
 
 /**
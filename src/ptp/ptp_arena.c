@@ -0,0 +1,192 @@
+/** @file ptp_arena.c
+* PTP memory arena.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <ptp_general.h>
+#include "ptp_arena.h"
+
+/// Set when initialization is done
+static volatile int alloc_sealed = 0;
+/// Set while the calling thread may allocate although the process is sealed
+static __thread int alloc_unsealed = 0;
+
+/**
+* Reserve memory for the arena. Memory is prefaulted.
+* @param arena arena.
+* @param size size of the arena.
+* @return ptp error code.
+*/
+int ptp_arena_init(struct ptp_arena *arena, size_t size)
+{
+    memset(arena, 0, sizeof(struct ptp_arena));
+    size = PTP_ARENA_SIZE(size);
+    if (size == 0) {
+        return PTP_ERR_OK;
+    }
+    arena->base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (arena->base == MAP_FAILED) {
+        perror("mmap");
+        ERROR("Arena allocation of %lu bytes failed\n",
+              (unsigned long) size);
+        arena->base = NULL;
+        return PTP_ERR_GEN;
+    }
+    arena->size = size;
+    DEBUG("Arena %p %lu bytes\n", arena->base, (unsigned long) size);
+    return PTP_ERR_OK;
+}
+
+/**
+* Allocate zeroed memory from the arena.
+* @param arena arena.
+* @param size number of bytes.
+* @return allocated memory, NULL if arena is exhausted.
+*/
+void *ptp_arena_alloc(struct ptp_arena *arena, size_t size)
+{
+    void *mem = NULL;
+
+    size = PTP_ARENA_SIZE(size);
+    if ((arena->base == NULL) || (size > arena->size - arena->used)) {
+        ERROR("Arena exhausted, %lu/%lu bytes used\n",
+              (unsigned long) arena->used, (unsigned long) arena->size);
+        return NULL;
+    }
+    mem = arena->base + arena->used;
+    arena->used += size;
+    // mmap'd memory is zeroed, nothing is returned to the arena
+    return mem;
+}
+
+/**
+* Release the arena memory.
+* @param arena arena.
+*/
+void ptp_arena_release(struct ptp_arena *arena)
+{
+    if (arena->base) {
+        munmap(arena->base, arena->size);
+    }
+    memset(arena, 0, sizeof(struct ptp_arena));
+}
+
+/**
+* Lock all current and future pages of the process to memory.
+* @return ptp error code.
+*/
+int ptp_lock_memory(void)
+{
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        perror("mlockall");
+        ERROR("mlockall failed\n");
+        return PTP_ERR_GEN;
+    }
+    DEBUG("Memory locked\n");
+    return PTP_ERR_OK;
+}
+
+/**
+* Mark initialization done (or reopen it for reconfiguration). When built 
+* with PTP_ALLOC_GUARD (make ALLOC_GUARD=1), any heap allocation while 
+* sealed aborts the daemon.
+* @param sealed true when steady state begins.
+*/
+void ptp_alloc_seal(bool sealed)
+{
+    alloc_sealed = sealed;
+}
+
+/**
+* Allow heap allocation in the calling thread only, e.g. while it 
+* reconfigures or restarts its sockets. Other threads stay sealed.
+* @param unsealed true when the calling thread may allocate.
+*/
+void ptp_alloc_unseal_thread(bool unsealed)
+{
+    alloc_unsealed = unsealed;
+}
+
+#ifdef PTP_ALLOC_GUARD
+/* Heap allocation functions are interposed for the whole process 
+ * (including interface libraries), the glibc implementation 
+ * is used for the actual work. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/**
+* Report allocation in steady state and abort. Syslog is not used, 
+* because it may allocate itself.
+* @param func name of the allocation function.
+*/
+static void alloc_guard_fail(const char *func)
+{
+    static const char msg[] = "openptp: heap allocation after init: ";
+
+    alloc_sealed = 0;
+    write(STDERR_FILENO, msg, sizeof(msg) - 1);
+    write(STDERR_FILENO, func, strlen(func));
+    write(STDERR_FILENO, "\n", 1);
+    abort();
+}
+
+void *malloc(size_t size)
+{
+    if (alloc_sealed && !alloc_unsealed) {
+        alloc_guard_fail("malloc");
+    }
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    if (alloc_sealed && !alloc_unsealed) {
+        alloc_guard_fail("calloc");
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    if (alloc_sealed && !alloc_unsealed) {
+        alloc_guard_fail("realloc");
+    }
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+    if (alloc_sealed && !alloc_unsealed && ptr) {
+        alloc_guard_fail("free");
+    }
+    __libc_free(ptr);
+}
+#endif                          // PTP_ALLOC_GUARD
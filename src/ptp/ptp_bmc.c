@@ -24,6 +24,8 @@
 /******************************************************************************
 * $Id$
 ******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_BMC
+
 #include <ptp_general.h>
 #include <ptp_message.h>
 
@@ -32,11 +34,17 @@
 #include "ptp_internal.h"
 #include "ptp_bmc.h"
 #include "ptp_framer.h"
+#include "ptp_foreign.h"
+#include "ptp_codec.h"
 
 // Data comparison functions
-static struct ForeignMasterDataSet *ptp_bmc_select_best(struct
-                                                        ForeignMasterDataSetElem_p
-                                                        *list_head);
+static struct ForeignMasterDataSet *ptp_bmc_select_erbest(struct
+                                                          ForeignMasterTable
+                                                          *table);
+static struct ForeignMasterDataSet *ptp_bmc_select_ebest(struct
+                                                         ForeignMasterDataSet
+                                                         **erbest,
+                                                         int num_erbest);
 static int AnnounceDataComparison(struct ptp_announce *msgA,
                                   struct PortIdentity *portA,
                                   struct ptp_announce *msgB,
@@ -46,6 +54,10 @@ static void ptp_bmc_update(struct ptp_ctx *ptp_ctx,
                            struct ptp_port_ctx *ctx,
                            enum BMCUpdate bmc_update,
                            struct ForeignMasterDataSet *foreign_bes);
+static void ptp_bmc_update_stack(struct ptp_ctx *ptp_ctx,
+                                 struct ptp_port_ctx *ctx,
+                                 enum BMCUpdate bmc_update,
+                                 struct ForeignMasterDataSet *foreign_best);
 
 /**
 * PTP best master selection algorithm.
@@ -55,7 +67,7 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
 {
     struct ptp_port_ctx *port = NULL;
     struct ForeignMasterDataSet *foreign_best = 0;
-    struct ForeignMasterDataSetElem_p foreign_elem_p[MAX_NUM_INTERFACES];
+    struct ForeignMasterDataSet *erbest[MAX_NUM_INTERFACES];
     int num_foreign = 0;
     char tmpbuf[MAX_PTP_FRAME_SIZE];
     struct ptp_announce *D0 = 0;
@@ -75,10 +87,10 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
         }
     }
 
-    memset(&foreign_elem_p, 0, sizeof(foreign_elem_p));
+    memset(&erbest, 0, sizeof(erbest));
 
     // Create D0 annouce message for BMC purposes
-    ret = create_announce(ptp_ctx->ports_list_head, tmpbuf, 0, 1);
+    ret = create_announce(ptp_ctx->ports_list_head, tmpbuf, 0, 1, NULL);
     if (ret <= 0) {
         ERROR("D0 announce creation failed\n");
         return;
@@ -86,7 +98,7 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
     D0 = (struct ptp_announce *) tmpbuf;
 
     for (port = ptp_ctx->ports_list_head; port != NULL; port = port->next) {
-        DEBUG("%p %p\n", port, port->foreign_master_head);
+        DEBUG("%p %u\n", port, port->foreign_masters.num_records);
         if (num_foreign >= MAX_NUM_INTERFACES) {
             // This is sanity, should never happen 
             break;
@@ -97,13 +109,12 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
             (port->port_dataset.port_state == PORT_FAULTY)) {
             continue;
         }
-        foreign_elem_p[num_foreign].data_p =
-            ptp_bmc_select_best((struct ForeignMasterDataSetElem_p *)
-                                port->foreign_master_head);
+        erbest[num_foreign] =
+            ptp_bmc_select_erbest(&port->foreign_masters);
         num_foreign++;
     }
     // Select Ebest (Best master) from the group of Erbest (best of every port)
-    foreign_best = ptp_bmc_select_best(foreign_elem_p);
+    foreign_best = ptp_bmc_select_ebest(erbest, num_foreign);
 
     if (foreign_best) {
         DEBUG("Ebest: %s\n",
@@ -114,7 +125,7 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
     port = ptp_ctx->ports_list_head;
     for (index = 0; index < num_foreign; index++, port = port->next) {
         // (Erbest is the empty set) AND (Port state is LISTENING)
-        if ((foreign_elem_p[index].data_p == NULL) && (port->port_dataset.port_state == PORT_LISTENING) && (!port->announce_recv_timer_expired)) {      // to MASTER state?
+        if ((erbest[index] == NULL) && (port->port_dataset.port_state == PORT_LISTENING) && (!port->announce_recv_timer_expired)) {      // to MASTER state?
             // YES, remain in LISTENING state
             continue;
         }
@@ -130,13 +141,11 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
             // YES
 
             // D0 better or better by topology than Erbest ?
-            if (foreign_elem_p[index].data_p) {
+            if (erbest[index]) {
                 DEBUG("AnnounceDataComparison1\n");
                 ret = AnnounceDataComparison(D0, NULL,
-                                             &foreign_elem_p[index].
-                                             data_p->msg,
-                                             &foreign_elem_p[index].
-                                             data_p->dst_port_id);
+                                             &erbest[index]->msg,
+                                             &erbest[index]->dst_port_id);
             } else {
                 // No Erbest available -> D0 is better!
                 ret = 0;
@@ -149,7 +158,7 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
                 ptp_bmc_update(ptp_ctx, port, BMC_MASTER_M1, NULL);     // M1 
                 DEBUG("Port %i M1 BMC_MASTER\n", index);
             } else {            // No -> Passive
-                ptp_bmc_update(ptp_ctx, port, BMC_PASSIVE_P1, foreign_elem_p[index].data_p);    // P1
+                ptp_bmc_update(ptp_ctx, port, BMC_PASSIVE_P1, erbest[index]);    // P1
                 DEBUG("Port %i P1 BMC_PASSIVE\n", index);
             }
         }
@@ -173,22 +182,20 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
                 DEBUG("Port %i M2 BMC_MASTER\n", index);
             } else {            // NO 
                 // Ebest received on port R ?
-                if (foreign_best == foreign_elem_p[index].data_p) {
+                if (foreign_best == erbest[index]) {
                     // YES
                     ptp_bmc_update(ptp_ctx, port, BMC_SLAVE_S1, foreign_best);  // S1 
                     DEBUG("Port %i S1 BMC_SLAVE\n", index);
                 } else {
                     // NO
-                    if (foreign_elem_p[index].data_p) {
+                    if (erbest[index]) {
                         DEBUG("AnnounceDataComparison3\n");
                         // Ebest better by topology than Erbest
                         ret = AnnounceDataComparison(&foreign_best->msg,
                                                      &foreign_best->
                                                      dst_port_id,
-                                                     &foreign_elem_p
-                                                     [index].data_p->msg,
-                                                     &foreign_elem_p
-                                                     [index].data_p->
+                                                     &erbest[index]->msg,
+                                                     &erbest[index]->
                                                      dst_port_id);
                     } else {
                         // No Erbest available -> foreign_best is better!
@@ -215,6 +222,7 @@ void ptp_bmc_run(struct ptp_ctx *ptp_ctx)
 
 /**
 * BMC inputs for updating the status of the whole stack.
+* Message templates are invalidated if announced datasets change.
 * @param ptp_ctx PTP context.
 * @param port_ctx Port context.
 * @param new_state new bmc input.
@@ -224,9 +232,50 @@ static void ptp_bmc_update(struct ptp_ctx *ptp_ctx,
                            struct ptp_port_ctx *port_ctx,
                            enum BMCUpdate bmc_update,
                            struct ForeignMasterDataSet *foreign_best)
+{
+    struct ParentDataSet parent_dataset;
+    struct TimeProperitiesDataSet time_dataset;
+    u16 steps_removed = ptp_ctx->current_dataset.steps_removed;
+
+    memcpy(&parent_dataset, &ptp_ctx->parent_dataset,
+           sizeof(struct ParentDataSet));
+    memcpy(&time_dataset, &ptp_ctx->time_dataset,
+           sizeof(struct TimeProperitiesDataSet));
+
+    ptp_bmc_update_stack(ptp_ctx, port_ctx, bmc_update, foreign_best);
+
+    if ((steps_removed != ptp_ctx->current_dataset.steps_removed) ||
+        memcmp(&parent_dataset, &ptp_ctx->parent_dataset,
+               sizeof(struct ParentDataSet)) ||
+        memcmp(&time_dataset, &ptp_ctx->time_dataset,
+               sizeof(struct TimeProperitiesDataSet))) {
+        ptp_framer_invalidate(ptp_ctx);
+    }
+    if (memcmp(&parent_dataset.parent_port_identity,
+               &ptp_ctx->parent_dataset.parent_port_identity,
+               sizeof(struct PortIdentity)) ||
+        memcmp(parent_dataset.grandmaster_identity,
+               ptp_ctx->parent_dataset.grandmaster_identity,
+               sizeof(ClockIdentity))) {
+        ptp_ctl_parent(ptp_ctx);
+    }
+}
+
+/**
+* Update port state and datasets of the stack according to BMC input.
+* @param ptp_ctx PTP context.
+* @param port_ctx Port context.
+* @param new_state new bmc input.
+* @param master if BMC_SLAVE, contains master ClockIdentity, otherwise NULL.
+*/
+static void ptp_bmc_update_stack(struct ptp_ctx *ptp_ctx,
+                                 struct ptp_port_ctx *port_ctx,
+                                 enum BMCUpdate bmc_update,
+                                 struct ForeignMasterDataSet *foreign_best)
 {
     int state_updated = 0;
     int ret = 0;
+    u16 flags = 0;
 
     // Inform port
     if (foreign_best) {
@@ -262,7 +311,7 @@ static void ptp_bmc_update(struct ptp_ctx *ptp_ctx,
                                         &ptp_ctx->time_dataset);
         if (ret != PTP_ERR_OK) {
             // At least, init to defauts..
-            init_time_dataset(&ptp_ctx->time_dataset);
+            init_time_dataset(&ptp_ctx->cfg, &ptp_ctx->time_dataset);
         }
         break;
     case BMC_SLAVE_S1:
@@ -294,21 +343,17 @@ static void ptp_bmc_update(struct ptp_ctx *ptp_ctx,
         // Time Properities dataset
         ptp_ctx->time_dataset.current_utc_offset =
             ntohs(foreign_best->msg.current_UTC_offset);
+        flags = ptp_hdr_flags(&foreign_best->msg.hdr);
         ptp_ctx->time_dataset.current_utc_offset_valid =
-            (foreign_best->msg.hdr.
-             flags & PTP_UTC_OFFSET_VALID) ? true : false;
-        ptp_ctx->time_dataset.leap_59 =
-            (foreign_best->msg.hdr.flags & PTP_LI_59) ? true : false;
-        ptp_ctx->time_dataset.leap_61 =
-            (foreign_best->msg.hdr.flags & PTP_LI_61) ? true : false;
+            (flags & PTP_UTC_OFFSET_VALID) ? true : false;
+        ptp_ctx->time_dataset.leap_59 = (flags & PTP_LI_59) ? true : false;
+        ptp_ctx->time_dataset.leap_61 = (flags & PTP_LI_61) ? true : false;
         ptp_ctx->time_dataset.time_traceable =
-            (foreign_best->msg.hdr.
-             flags & PTP_TIME_TRACEABLE) ? true : false;
+            (flags & PTP_TIME_TRACEABLE) ? true : false;
         ptp_ctx->time_dataset.frequency_traceable =
-            (foreign_best->msg.hdr.
-             flags & PTP_FREQ_TRACEABLE) ? true : false;
+            (flags & PTP_FREQ_TRACEABLE) ? true : false;
         ptp_ctx->time_dataset.ptp_timescale =
-            (foreign_best->msg.hdr.flags & PTP_TIMESCALE) ? true : false;
+            (flags & PTP_TIMESCALE) ? true : false;
         ptp_ctx->time_dataset.time_source = foreign_best->msg.time_source;
         break;
     default:
@@ -384,30 +429,35 @@ static void ptp_bmc_update(struct ptp_ctx *ptp_ctx,
 
 
 /**
-* BMC comparison algorithm.
-* @param list_head list head to list of foreigns.
-* @return best of foreigns, or NULL if empty list
+* Compare two foreign master records.
+* @param foreignA foreign record A.
+* @param foreignB foreign record B.
+* @return AnnounceDataComparison() result.
 */
-static struct ForeignMasterDataSet *ptp_bmc_select_best(struct
-                                                        ForeignMasterDataSetElem_p
-                                                        *list_head)
+static int ptp_bmc_compare_foreign(struct ForeignMasterDataSet *foreignA,
+                                   struct ForeignMasterDataSet *foreignB)
+{
+    return AnnounceDataComparison(&foreignA->msg, &foreignA->dst_port_id,
+                                  &foreignB->msg, &foreignB->dst_port_id);
+}
+
+/**
+* BMC comparison algorithm for foreign records of one port (Erbest).
+* @param table foreign master table of the port.
+* @return best of foreigns, or NULL if empty table
+*/
+static struct ForeignMasterDataSet *ptp_bmc_select_erbest(struct
+                                                          ForeignMasterTable
+                                                          *table)
 {
     struct ForeignMasterDataSet *foreign_best = 0, *foreign = 0;
-    struct ForeignMasterDataSetElem_p *foreign_enum = NULL;
     int ret = 0;
 
-    if (list_head == NULL) {
-        return NULL;
-    }
-    if (list_head->data_p == NULL) {
+    // First one is the first candidate for best
+    foreign_best = ptp_foreign_next(table, NULL);
+    if (foreign_best == NULL) {
         return NULL;
     }
-
-    foreign_enum = list_head;
-    DEBUG("%p %p %p\n",
-          foreign_enum, foreign_enum->data_p, &foreign_enum->data_p->msg);
-    // First one is the first candidate for best
-    foreign_best = foreign_enum->data_p;
     DEBUG("Erbest candidate(first): %s\n",
           ptp_clk_id(foreign_best->msg.hdr.src_port_id.clock_identity));
 
@@ -416,21 +466,12 @@ static struct ForeignMasterDataSet *ptp_bmc_select_best(struct
      *      Choosing this, rather than which is the better clock, is essential 
      *      for the stability of the algorithm.
      *   b) If those properties are equivalent, use tie-breaking techniques.
-     * A = foreign_best.
-     * B = foreign.
+     * A = foreign.
+     * B = foreign_best.
      */
-    for (foreign_enum = foreign_enum->next;
-         foreign_enum; foreign_enum = foreign_enum->next) {
-        // Next candidate
-        foreign = foreign_enum->data_p;
-        if (foreign == NULL) {
-            break;
-        }
-        // dataset comparison 
-        ret = AnnounceDataComparison(&foreign->msg,
-                                     &foreign->dst_port_id,
-                                     &foreign_best->msg,
-                                     &foreign_best->dst_port_id);
+    for (foreign = ptp_foreign_next(table, foreign_best);
+         foreign; foreign = ptp_foreign_next(table, foreign)) {
+        ret = ptp_bmc_compare_foreign(foreign, foreign_best);
         if (ret < 0) {
             ERROR("AnnouceDataComparison ERROR %i\n", ret);
             return NULL;
@@ -441,11 +482,90 @@ static struct ForeignMasterDataSet *ptp_bmc_select_best(struct
         // else foreign_best was better -> no change
     }
 
-    DEBUG("E(r)best: %s\n",
+    DEBUG("Erbest: %s\n",
           ptp_clk_id(foreign_best->msg.hdr.src_port_id.clock_identity));
     return foreign_best;
 }
 
+/**
+* BMC comparison algorithm for Erbest of every port (Ebest).
+* @param erbest Erbest of every port, NULL if port has no Erbest.
+* @param num_erbest number of entries in erbest.
+* @return best of foreigns, or NULL if no Erbest available
+*/
+static struct ForeignMasterDataSet *ptp_bmc_select_ebest(struct
+                                                         ForeignMasterDataSet
+                                                         **erbest,
+                                                         int num_erbest)
+{
+    struct ForeignMasterDataSet *foreign_best = 0;
+    int ret = 0, i = 0;
+
+    for (i = 0; i < num_erbest; i++) {
+        if (erbest[i] == NULL) {
+            continue;
+        }
+        if (foreign_best == NULL) {
+            foreign_best = erbest[i];
+            continue;
+        }
+        ret = ptp_bmc_compare_foreign(erbest[i], foreign_best);
+        if (ret < 0) {
+            ERROR("AnnouceDataComparison ERROR %i\n", ret);
+            return NULL;
+        } else if ((ret == 0) || (ret == 1)) {
+            foreign_best = erbest[i];
+        }
+    }
+    return foreign_best;
+}
+
+/**
+* Find the worst foreign record of the table. Used for selecting
+* the record to be replaced when table is full.
+* @param table foreign master table of the port.
+* @return worst of foreigns, or NULL if empty table or comparison failed.
+*/
+struct ForeignMasterDataSet *ptp_bmc_select_worst(struct ForeignMasterTable
+                                                  *table)
+{
+    struct ForeignMasterDataSet *foreign_worst = 0, *foreign = 0;
+    int ret = 0;
+
+    foreign_worst = ptp_foreign_next(table, NULL);
+    if (foreign_worst == NULL) {
+        return NULL;
+    }
+    for (foreign = ptp_foreign_next(table, foreign_worst);
+         foreign; foreign = ptp_foreign_next(table, foreign)) {
+        ret = ptp_bmc_compare_foreign(foreign, foreign_worst);
+        if (ret < 0) {
+            ERROR("AnnouceDataComparison ERROR %i\n", ret);
+            return NULL;
+        } else if ((ret == 2) || (ret == 3)) {
+            // foreign_worst was better, change foreign_worst
+            foreign_worst = foreign;
+        }
+    }
+    return foreign_worst;
+}
+
+/**
+* Check if received announce is better than the stored foreign record.
+* @param msg announce message.
+* @param port receiver port of the announce.
+* @param foreign foreign record.
+* @return true if announce is better (or better by topology).
+*/
+bool ptp_bmc_announce_better(struct ptp_announce *msg,
+                             struct PortIdentity *port,
+                             struct ForeignMasterDataSet *foreign)
+{
+    int ret = AnnounceDataComparison(msg, port, &foreign->msg,
+                                     &foreign->dst_port_id);
+
+    return ((ret == 0) || (ret == 1));
+}
 
 /**
 * BMC data comparison algorithm.
@@ -0,0 +1,152 @@
+/** @file ptp_codec.c
+* PTP message codec.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <strings.h>
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_codec.h>
+#include <ptp_mgmt.h>
+
+/// Supported PTP version
+#define PTP_CODEC_VERSION   2
+
+/// Fixed lengths of the message types, 0 for unknown types
+static const u8 msg_fixed_len[16] = {
+#define PTP_LEN(type, name, len) [type] = len,
+    PTP_MESSAGE_TABLE(PTP_LEN)
+#undef PTP_LEN
+};
+
+/// Names of the message types
+static const char *msg_name[16] = {
+#define PTP_NAME(type, name, len) [type] = #name,
+    PTP_MESSAGE_TABLE(PTP_NAME)
+#undef PTP_NAME
+};
+
+/// Supported managementIds
+static const struct ptp_mgmt_info mgmt_info[] = {
+#define PTP_MGMT_INFO(id, name, len, scope, set) { id, #name, len, scope, set },
+    PTP_MGMT_TABLE(PTP_MGMT_INFO)
+#undef PTP_MGMT_INFO
+};
+
+/**
+* Validate received message. Header, message length and the bounds of
+* all TLVs are checked in one pass, after which the message can be
+* accessed through views and TLVs iterated with ptp_tlv_next() without
+* further checks.
+* @param buf message.
+* @param len number of bytes received.
+* @return messageLength, or PTP_ERR_FRAME if message is invalid.
+*/
+int ptp_msg_check(const void *buf, int len)
+{
+    const struct ptp_header *hdr = buf;
+    const u8 *msg = buf;
+    int msg_len = 0;
+    int offset = 0;
+
+    if (len < (int) sizeof(struct ptp_header)) {
+        return PTP_ERR_FRAME;
+    }
+    if ((hdr->ptp_ver & 0x0f) != PTP_CODEC_VERSION) {
+        return PTP_ERR_FRAME;
+    }
+    offset = msg_fixed_len[ptp_hdr_type(hdr)];
+    msg_len = ptp_hdr_len(hdr);
+    // Unknown type, truncated or too short message
+    if ((offset == 0) || (msg_len > len) || (msg_len < offset)) {
+        return PTP_ERR_FRAME;
+    }
+    // TLVs must fill the rest of the message exactly
+    while (offset < msg_len) {
+        if (offset + PTP_TLV_HDR_LEN > msg_len) {
+            return PTP_ERR_FRAME;
+        }
+        offset += PTP_TLV_HDR_LEN + ptp_get_u16(msg + offset + 2);
+    }
+    if (offset != msg_len) {
+        return PTP_ERR_FRAME;
+    }
+    return msg_len;
+}
+
+/**
+* Get fixed length of message type.
+* @param type message type.
+* @return fixed length, 0 for unknown message types.
+*/
+int ptp_msg_fixed_len(u8 type)
+{
+    return msg_fixed_len[type & 0x0f];
+}
+
+/**
+* Get name of message type.
+* @param type message type.
+* @return name.
+*/
+const char *ptp_msg_name(u8 type)
+{
+    const char *name = msg_name[type & 0x0f];
+    return name ? name : "unknown";
+}
+
+/**
+* Get properties of a managementId.
+* @param id managementId.
+* @return properties, NULL if managementId is not supported.
+*/
+const struct ptp_mgmt_info *ptp_mgmt_lookup(u16 id)
+{
+    int i = 0;
+
+    for (i = 0; i < sizeof(mgmt_info) / sizeof(mgmt_info[0]); i++) {
+        if (mgmt_info[i].id == id) {
+            return &mgmt_info[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+* Get properties of a managementId by name.
+* @param name managementId name, e.g. "DEFAULT_DATA_SET".
+* @return properties, NULL if managementId is not supported.
+*/
+const struct ptp_mgmt_info *ptp_mgmt_lookup_name(const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < sizeof(mgmt_info) / sizeof(mgmt_info[0]); i++) {
+        if (strcasecmp(mgmt_info[i].name, name) == 0) {
+            return &mgmt_info[i];
+        }
+    }
+    return NULL;
+}
@@ -27,9 +27,10 @@
 #include <stdio.h>
 #include <ptp_general.h>
 #include <xml_parser.h>
-
-/// Main configuration data
-struct ptp_config ptp_cfg;
+#include <ptp_unicast.h>
+#include <ptp_dresp.h>
+#include <ptp_ratelimit.h>
+#include <ptp_trace.h>
 
 // Helper tables for handling configuration
 struct ClockAccuracyCmp str_to_accuracy[] = {
@@ -67,10 +68,11 @@ const unsigned int str_to_source_size =
 
 /**
 * Read initialization from file.
+* @param cfg configuration to fill.
 * @param filename config file name.
 * @return ptp error code
 */
-int read_initialization(char *filename)
+int read_initialization(struct ptp_config *cfg, char *filename)
 {
     FILE *fp = 0;
     char tmp[MAX_VALUE_LEN];
@@ -116,17 +118,57 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("debug %i\n", value);
-    ptp_cfg.debug = value;
+    cfg->debug = value;
+
+    // get log levels (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_str(fp, "log", cfg->log, MAX_VALUE_LEN, &section_length);
+    if (ret != PARSER_OK) {
+        cfg->log[0] = 0;
+    }
+    DEBUG("log %s\n", cfg->log);
+
+    // get cpu (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "cpu", &value, &section_length);
+    if ((ret != PARSER_OK) || (value < 0)) {
+        value = -1;
+    }
+    DEBUG("cpu %i\n", value);
+    cfg->cpu = value;
+
+    // get rx_thread flag (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "rx_thread", &value, &section_length);
+    if ((ret != PARSER_OK) || (value == 0)) {
+        cfg->rx_thread = 0;
+    } else {
+        cfg->rx_thread = 1;
+    }
+    DEBUG("rx_thread %i\n", cfg->rx_thread);
+
+    // get rx_cpu (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "rx_cpu", &value, &section_length);
+    if ((ret != PARSER_OK) || (value < 0)) {
+        value = -1;
+    }
+    DEBUG("rx_cpu %i\n", value);
+    cfg->rx_cpu = value;
 
     // Start parsing Interfaces
     fseek(fp, 0, SEEK_SET);
-    ptp_cfg.num_interfaces = 0;
+    cfg->num_interfaces = 0;
     for (i = 0; i < MAX_NUM_INTERFACES; i++) {
         // Get next interface 
         section_length = 0;
         ret = search_tag_with_attr(fp, "Interface",
                                    tmp, MAX_VALUE_LEN,
-                                   ptp_cfg.interfaces[ptp_cfg.
+                                   cfg->interfaces[cfg->
                                                       num_interfaces].name,
                                    INTERFACE_NAME_LEN, 
                                    &section_length);
@@ -141,20 +183,20 @@ int read_initialization(char *filename)
         if (strncmp(tmp, "name", MAX_VALUE_LEN) != 0) {
             ERROR("Unknown attribute for Interface %s\n", tmp);
         }
-        ptp_cfg.interfaces[ptp_cfg.num_interfaces].enabled = 1;
+        cfg->interfaces[cfg->num_interfaces].enabled = 1;
 
         DEBUG("%s=\"%s\" %i\n",
               tmp,
-              ptp_cfg.interfaces[ptp_cfg.num_interfaces].name,
+              cfg->interfaces[cfg->num_interfaces].name,
               section_length );
 
         // delay_asymmetry setting
         ret = parse_int(fp, "delay_asymmetry", &value, &section_length);
         if (ret == PARSER_OK){
             DEBUG("%s delay_asymmetry %i\n",
-                  ptp_cfg.interfaces[ptp_cfg.num_interfaces].name,
+                  cfg->interfaces[cfg->num_interfaces].name,
                   value );
-            ptp_cfg.interfaces[ptp_cfg.num_interfaces].delay_asymmetry = value;
+            cfg->interfaces[cfg->num_interfaces].delay_asymmetry = value;
         }
 
         // multicast setting
@@ -162,40 +204,63 @@ int read_initialization(char *filename)
         section_length = cur_section_length;
         ret = parse_int(fp, "multicast", &value, &section_length);
         if ((ret != PARSER_OK) || (value == 0)) {
-            ptp_cfg.interfaces[ptp_cfg.num_interfaces].multicast_ena = 0;
+            cfg->interfaces[cfg->num_interfaces].multicast_ena = 0;
         } else {
-            ptp_cfg.interfaces[ptp_cfg.num_interfaces].multicast_ena = 1;
+            cfg->interfaces[cfg->num_interfaces].multicast_ena = 1;
         }
 
         // Unicast settings
         fseek(fp, cur_section_pos, SEEK_SET);
         section_length = cur_section_length;
-        ptp_cfg.interfaces[ptp_cfg.num_interfaces].num_unicast_addr = 0;
+        cfg->interfaces[cfg->num_interfaces].num_unicast_addr = 0;
         for (j = 0; j < MAX_NUM_INTERFACES; j++) {
             // get IP
             if (parse_str(fp, "unicast", tmp, MAX_VALUE_LEN,
                           &section_length) != PARSER_OK) {
                 break;
             }
-            ptp_cfg.interfaces[ptp_cfg.num_interfaces].num_unicast_addr++;
-            strncpy(ptp_cfg.interfaces[ptp_cfg.num_interfaces].
+            cfg->interfaces[cfg->num_interfaces].num_unicast_addr++;
+            strncpy(cfg->interfaces[cfg->num_interfaces].
                     unicast_ip[j], tmp, IP_STR_MAX_LEN);
         }
 
-        DEBUG("Interface found %i(%s): mult: %i, unicast: %i\n",
+        // unicast negotiation setting
+        fseek(fp, cur_section_pos, SEEK_SET);
+        section_length = cur_section_length;
+        ret = parse_int(fp, "unicast_negotiation", &value, &section_length);
+        if ((ret != PARSER_OK) || (value == 0)) {
+            cfg->interfaces[cfg->num_interfaces].unicast_negotiation = 0;
+        } else {
+            cfg->interfaces[cfg->num_interfaces].unicast_negotiation = 1;
+        }
+
+        // hybrid mode setting
+        fseek(fp, cur_section_pos, SEEK_SET);
+        section_length = cur_section_length;
+        ret = parse_int(fp, "hybrid", &value, &section_length);
+        if ((ret != PARSER_OK) || (value == 0)) {
+            cfg->interfaces[cfg->num_interfaces].hybrid = 0;
+        } else {
+            cfg->interfaces[cfg->num_interfaces].hybrid = 1;
+        }
+
+        DEBUG("Interface found %i(%s): mult: %i, unicast: %i, nego: %i, "
+              "hybrid: %i\n",
               i,
-              ptp_cfg.interfaces[ptp_cfg.num_interfaces].name,
-              ptp_cfg.interfaces[ptp_cfg.num_interfaces].multicast_ena,
-              ptp_cfg.interfaces[ptp_cfg.num_interfaces].num_unicast_addr);
+              cfg->interfaces[cfg->num_interfaces].name,
+              cfg->interfaces[cfg->num_interfaces].multicast_ena,
+              cfg->interfaces[cfg->num_interfaces].num_unicast_addr,
+              cfg->interfaces[cfg->num_interfaces].unicast_negotiation,
+              cfg->interfaces[cfg->num_interfaces].hybrid);
         for (j = 0;
              j <
-             ptp_cfg.interfaces[ptp_cfg.num_interfaces].num_unicast_addr;
+             cfg->interfaces[cfg->num_interfaces].num_unicast_addr;
              j++) {
             DEBUG("IP %s\n",
-                  ptp_cfg.interfaces[ptp_cfg.num_interfaces].
+                  cfg->interfaces[cfg->num_interfaces].
                   unicast_ip[j]);
         }
-        ptp_cfg.num_interfaces++;
+        cfg->num_interfaces++;
     }
 
     // Start parsing Basic options
@@ -205,6 +270,10 @@ int read_initialization(char *filename)
         ERROR("parse\n");
         return PTP_ERR_GEN;
     }
+    // Remember this section for relaxed element ordering
+    cur_section_pos = ftell(fp);
+    cur_section_length = section_length;
+
     // get one_step_clock flag
     if (parse_int(fp, "one_step_clock", &value, &section_length) !=
         PARSER_OK) {
@@ -212,7 +281,211 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("one_step_clock %i\n", value);
-    ptp_cfg.one_step_clock = value;
+    cfg->one_step_clock = value;
+
+    // get max_foreign_masters (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "max_foreign_masters", &value, &section_length);
+    if ((ret != PARSER_OK) || (value <= 0)) {
+        value = DEFAULT_NUM_FOREIGN_MASTERS;
+    } else if (value > MAX_NUM_FOREIGN_MASTERS) {
+        ERROR("max_foreign_masters %i limited to %i\n",
+              value, MAX_NUM_FOREIGN_MASTERS);
+        value = MAX_NUM_FOREIGN_MASTERS;
+    }
+    DEBUG("max_foreign_masters %i\n", value);
+    cfg->max_foreign_masters = value;
+
+    // get delay_resp_queue (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "delay_resp_queue", &value, &section_length);
+    if ((ret != PARSER_OK) || (value <= 0)) {
+        value = PTP_DRESP_DEFAULT_QUEUE;
+    } else if (value > PTP_DRESP_MAX_QUEUE) {
+        ERROR("delay_resp_queue %i limited to %i\n",
+              value, PTP_DRESP_MAX_QUEUE);
+        value = PTP_DRESP_MAX_QUEUE;
+    }
+    DEBUG("delay_resp_queue %i\n", value);
+    cfg->delay_resp_queue = value;
+
+    // get delay_req_clients (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "delay_req_clients", &value, &section_length);
+    if ((ret != PARSER_OK) || (value <= 0)) {
+        value = PTP_RL_DEFAULT_CLIENTS;
+    } else if (value > PTP_RL_MAX_CLIENTS) {
+        ERROR("delay_req_clients %i limited to %i\n",
+              value, PTP_RL_MAX_CLIENTS);
+        value = PTP_RL_MAX_CLIENTS;
+    }
+    DEBUG("delay_req_clients %i\n", value);
+    cfg->delay_req_clients = value;
+
+    // get metrics_port (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "metrics_port", &value, &section_length);
+    if ((ret != PARSER_OK) || (value < 0) || (value > 65535)) {
+        value = 0;
+    }
+    DEBUG("metrics_port %i\n", value);
+    cfg->metrics_port = value;
+
+    // get control_socket (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_str(fp, "control_socket", cfg->control_socket,
+                    MAX_VALUE_LEN, &section_length);
+    if (ret != PARSER_OK) {
+        cfg->control_socket[0] = 0;
+    }
+    DEBUG("control_socket %s\n", cfg->control_socket);
+
+    // get status_files flag (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "status_files", &value, &section_length);
+    if ((ret != PARSER_OK) || (value == 0)) {
+        cfg->status_files = 0;
+    } else {
+        cfg->status_files = 1;
+    }
+    DEBUG("status_files %i\n", cfg->status_files);
+
+    // get management_set flag (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "management_set", &value, &section_length);
+    if ((ret != PARSER_OK) || (value == 0)) {
+        cfg->management_set = 0;
+    } else {
+        cfg->management_set = 1;
+    }
+    DEBUG("management_set %i\n", cfg->management_set);
+
+    // get trace mode (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "trace", &value, &section_length);
+    if ((ret != PARSER_OK) || (value < PTP_TRACE_OFF) ||
+        (value > PTP_TRACE_STREAM)) {
+        value = PTP_TRACE_OFF;
+    }
+    DEBUG("trace %i\n", value);
+    cfg->trace = value;
+
+    // get trace_file (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_str(fp, "trace_file", cfg->trace_file,
+                    MAX_VALUE_LEN, &section_length);
+    if (ret != PARSER_OK) {
+        strncpy(cfg->trace_file, PTP_TRACE_DEFAULT_FILE, MAX_VALUE_LEN - 1);
+        cfg->trace_file[MAX_VALUE_LEN - 1] = 0;
+    }
+    DEBUG("trace_file %s\n", cfg->trace_file);
+
+    // get servo_record (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_str(fp, "servo_record", cfg->servo_record,
+                    MAX_VALUE_LEN, &section_length);
+    if (ret != PARSER_OK) {
+        cfg->servo_record[0] = 0;
+    }
+    DEBUG("servo_record %s\n", cfg->servo_record);
+
+    // get lock_memory flag (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "lock_memory", &value, &section_length);
+    if ((ret != PARSER_OK) || (value == 0)) {
+        cfg->lock_memory = 0;
+    } else {
+        cfg->lock_memory = 1;
+    }
+    DEBUG("lock_memory %i\n", cfg->lock_memory);
+
+    // get unicast_lease (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "unicast_lease", &value, &section_length);
+    if (ret != PARSER_OK) {
+        value = PTP_UC_DEFAULT_LEASE;
+    } else if ((value < PTP_UC_MIN_LEASE) || (value > PTP_UC_MAX_LEASE)) {
+        ERROR("unicast_lease %i not in %i..%i\n",
+              value, PTP_UC_MIN_LEASE, PTP_UC_MAX_LEASE);
+        value = value < PTP_UC_MIN_LEASE ? PTP_UC_MIN_LEASE :
+            PTP_UC_MAX_LEASE;
+    }
+    DEBUG("unicast_lease %i\n", value);
+    cfg->unicast_lease = value;
+
+    // get unicast_max_rate (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "unicast_max_rate", &value, &section_length);
+    if (ret != PARSER_OK) {
+        value = 0;
+    } else if (value < 0) {
+        ERROR("unicast_max_rate %i is negative, unlimited\n", value);
+        value = 0;
+    } else if ((u32) value > PTP_UC_MAX_RATE) {
+        ERROR("unicast_max_rate %i exceeds %u\n", value, PTP_UC_MAX_RATE);
+        value = PTP_UC_MAX_RATE;
+    }
+    DEBUG("unicast_max_rate %i\n", value);
+    cfg->unicast_max_rate = value;
+
+    // get unicast_sessions (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "unicast_sessions", &value, &section_length);
+    if ((ret != PARSER_OK) || (value < 1)) {
+        value = PTP_UC_DEFAULT_SESSIONS;
+    } else if (value > PTP_UC_MAX_SESSIONS) {
+        ERROR("unicast_sessions %i exceeds %i\n", value, PTP_UC_MAX_SESSIONS);
+        value = PTP_UC_MAX_SESSIONS;
+    }
+    DEBUG("unicast_sessions %i\n", value);
+    cfg->unicast_sessions = value;
+
+    // get delay_mechanism (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_str(fp, "delay_mechanism", tmp, MAX_VALUE_LEN,
+                    &section_length);
+    if ((ret != PARSER_OK) || (strncmp(tmp, "E2E", MAX_VALUE_LEN) == 0)) {
+        cfg->delay_mechanism = DELAY_E2E;
+    } else if (strncmp(tmp, "P2P", MAX_VALUE_LEN) == 0) {
+        cfg->delay_mechanism = DELAY_P2P;
+    } else {
+        ERROR("delay_mechanism %s\n", tmp);
+        return PTP_ERR_GEN;
+    }
+    DEBUG("delay_mechanism 0x%x\n", cfg->delay_mechanism);
+
+    // get clock_type (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_str(fp, "clock_type", tmp, MAX_VALUE_LEN, &section_length);
+    if ((ret != PARSER_OK) || (strncmp(tmp, "OC", MAX_VALUE_LEN) == 0)) {
+        cfg->clock_type = CLOCK_TYPE_OC;
+    } else if (strncmp(tmp, "E2E_TC", MAX_VALUE_LEN) == 0) {
+        cfg->clock_type = CLOCK_TYPE_E2E_TC;
+    } else if (strncmp(tmp, "P2P_TC", MAX_VALUE_LEN) == 0) {
+        cfg->clock_type = CLOCK_TYPE_P2P_TC;
+        // Link delays are measured on every port
+        cfg->delay_mechanism = DELAY_P2P;
+    } else {
+        ERROR("clock_type %s\n", tmp);
+        return PTP_ERR_GEN;
+    }
+    DEBUG("clock_type %i\n", cfg->clock_type);
 
     // Start parsing Clock options
     fseek(fp, 0, SEEK_SET);
@@ -231,7 +504,7 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("clock_class %i\n", value);
-    ptp_cfg.clock_class = value;
+    cfg->clock_class = value;
 
     // get clock_accuracy
     fseek(fp, cur_section_pos, SEEK_SET);
@@ -245,7 +518,7 @@ int read_initialization(char *filename)
     for (i = 0; i < str_to_accuracy_size; i++) {
         if (strncmp(tmp, str_to_accuracy[i].str, MAX_VALUE_LEN) == 0) {
             DEBUG("clock_accuracy 0x%x\n", str_to_accuracy[i].number);
-            ptp_cfg.clock_accuracy = str_to_accuracy[i].number;
+            cfg->clock_accuracy = str_to_accuracy[i].number;
             break;
         }
     }
@@ -263,7 +536,7 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("clock_priority1 %i\n", value);
-    ptp_cfg.clock_priority1 = value;
+    cfg->clock_priority1 = value;
 
     // get clock_priority2
     fseek(fp, cur_section_pos, SEEK_SET);
@@ -274,7 +547,7 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("clock_priority2 %i\n", value);
-    ptp_cfg.clock_priority2 = value;
+    cfg->clock_priority2 = value;
 
     // get domain
     fseek(fp, cur_section_pos, SEEK_SET);
@@ -284,7 +557,22 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("domain %i\n", value);
-    ptp_cfg.domain = value;
+    cfg->domain = value;
+
+    // get clock_control (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    ret = parse_int(fp, "clock_control", &value, &section_length);
+    if (ret != PARSER_OK) {
+        value = CLOCK_CONTROL_PRIMARY;
+    } else if ((value != CLOCK_CONTROL_MONITOR) &&
+               (value != CLOCK_CONTROL_PRIMARY) &&
+               (value != CLOCK_CONTROL_BACKUP)) {
+        ERROR("clock_control %i\n", value);
+        return PTP_ERR_GEN;
+    }
+    DEBUG("clock_control %i\n", value);
+    cfg->clock_control = value;
 
     // get clock_source
     fseek(fp, cur_section_pos, SEEK_SET);
@@ -297,7 +585,7 @@ int read_initialization(char *filename)
     for (i = 0; i < str_to_source_size; i++) {
         if (strncmp(tmp, str_to_source[i].str, MAX_VALUE_LEN) == 0) {
             DEBUG("clock_source 0x%x\n", str_to_source[i].time_src);
-            ptp_cfg.clock_source = str_to_source[i].time_src;
+            cfg->clock_source = str_to_source[i].time_src;
             break;
         }
     }
@@ -324,7 +612,7 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("announce_interval %i\n", value);
-    ptp_cfg.announce_interval = value;
+    cfg->announce_interval = value;
 
     // get sync_interval
     fseek(fp, cur_section_pos, SEEK_SET);
@@ -335,7 +623,7 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("sync_interval %i\n", value);
-    ptp_cfg.sync_interval = value;
+    cfg->sync_interval = value;
 
     // get delay_req_interval
     fseek(fp, cur_section_pos, SEEK_SET);
@@ -346,7 +634,17 @@ int read_initialization(char *filename)
         return PTP_ERR_GEN;
     }
     DEBUG("delay_req_interval %i\n", value);
-    ptp_cfg.delay_req_interval = value;
+    cfg->delay_req_interval = value;
+
+    // get pdelay_req_interval (optional)
+    fseek(fp, cur_section_pos, SEEK_SET);
+    section_length = cur_section_length;
+    if (parse_int(fp, "pdelay_req_interval", &value, &section_length) !=
+        PARSER_OK) {
+        value = 0;
+    }
+    DEBUG("pdelay_req_interval %i\n", value);
+    cfg->pdelay_req_interval = value;
 
     fclose(fp);
 
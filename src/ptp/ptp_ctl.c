@@ -0,0 +1,624 @@
+/** @file ptp_ctl.c
+* Control and status socket. A control thread serves status queries and
+* pushes state change events to subscribers over a UNIX socket, and writes
+* the optional status files. Instances only queue events and publish
+* snapshots, they never wait for clients or files.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_MGMT
+
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+#include <print.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_ctl.h"
+
+/// Size of the status reply buffer
+#define PTP_CTL_REPLY_LEN       (64 * 1024)
+
+static struct ptp_ctl_events queues[MAX_NUM_INSTANCES];
+static u32 dropped_seen[MAX_NUM_INSTANCES];
+static u64 sync_samples_seen[MAX_NUM_INSTANCES];
+static int num_queues = 0;
+/// Snapshot copy and reply buffer, used by control thread only
+static struct ptp_snapshot snap;
+static char reply[PTP_CTL_REPLY_LEN];
+
+static int clients[PTP_CTL_CLIENTS];
+static char socket_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+static bool files = false;
+static bool running = false;
+static int listen_sock = -1;
+static int stop_fd = -1;
+static int wake_fd = -1;
+static pthread_t ctl_thread;
+
+static void *ptp_ctl_thread(void *arg);
+
+/**
+* Open listening UNIX socket. A stale socket file is removed.
+* @param path socket path.
+* @return ptp error code.
+*/
+static int ptp_ctl_listen(const char *path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        ERROR("Control socket path too long: %s\n", path);
+        return PTP_ERR_GEN;
+    }
+    listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        perror("socket");
+        return PTP_ERR_NET;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    unlink(path);
+    if ((bind(listen_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+        (listen(listen_sock, 8) < 0)) {
+        ERROR("Control socket %s: %s\n", path, strerror(errno));
+        close(listen_sock);
+        listen_sock = -1;
+        return PTP_ERR_NET;
+    }
+    strncpy(socket_path, path, sizeof(socket_path) - 1);
+    return PTP_ERR_OK;
+}
+
+/**
+* Start control thread. It serves status queries and event subscriptions
+* on a UNIX socket and writes the optional status files. Must be called
+* before the instances run, after ptp_metrics_init().
+* @param path socket path, NULL or empty for no socket.
+* @param status_files write clock state and status to files in /tmp.
+* @param num_instances number of instances.
+* @return ptp error code.
+*/
+int ptp_ctl_start(const char *path, bool status_files, int num_instances)
+{
+    int i = 0, ret = 0;
+
+    memset(queues, 0, sizeof(queues));
+    memset(dropped_seen, 0, sizeof(dropped_seen));
+    memset(sync_samples_seen, 0, sizeof(sync_samples_seen));
+    for (i = 0; i < MAX_NUM_INSTANCES; i++) {
+        ptp_spsc_init(&queues[i].ring, PTP_CTL_EVENTS);
+    }
+    for (i = 0; i < PTP_CTL_CLIENTS; i++) {
+        clients[i] = -1;
+    }
+    socket_path[0] = 0;
+
+    if (path && path[0] && (ptp_ctl_listen(path) != PTP_ERR_OK)) {
+        return PTP_ERR_NET;
+    }
+    files = status_files;
+    if (files && (print_open() != 0)) {
+        files = false;
+    }
+    stop_fd = eventfd(0, EFD_NONBLOCK);
+    wake_fd = eventfd(0, EFD_NONBLOCK);
+    if ((stop_fd < 0) || (wake_fd < 0)) {
+        perror("eventfd");
+        ret = PTP_ERR_GEN;
+    } else {
+        num_queues = num_instances;
+        ret = pthread_create(&ctl_thread, NULL, ptp_ctl_thread, NULL);
+        if (ret != 0) {
+            ERROR("pthread_create %s\n", strerror(ret));
+            num_queues = 0;
+            ret = PTP_ERR_GEN;
+        }
+    }
+    if (ret != PTP_ERR_OK) {
+        if (stop_fd >= 0) {
+            close(stop_fd);
+        }
+        if (wake_fd >= 0) {
+            close(wake_fd);
+        }
+        if (listen_sock >= 0) {
+            close(listen_sock);
+            listen_sock = -1;
+            unlink(socket_path);
+        }
+        print_close();
+        return ret;
+    }
+    running = true;
+    if (socket_path[0]) {
+        INFO("Control socket %s\n", socket_path);
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Stop control thread.
+*/
+void ptp_ctl_stop(void)
+{
+    u64 stop = 1;
+    int i = 0;
+
+    if (!running) {
+        return;
+    }
+    if (write(stop_fd, &stop, sizeof(u64)) < 0) {
+        perror("write");
+    }
+    pthread_join(ctl_thread, NULL);
+    for (i = 0; i < PTP_CTL_CLIENTS; i++) {
+        if (clients[i] >= 0) {
+            close(clients[i]);
+            clients[i] = -1;
+        }
+    }
+    if (listen_sock >= 0) {
+        close(listen_sock);
+        listen_sock = -1;
+        unlink(socket_path);
+    }
+    close(stop_fd);
+    close(wake_fd);
+    print_close();
+    num_queues = 0;
+    running = false;
+}
+
+/**
+* Get event queue of an instance.
+* @param instance index of the instance.
+* @return event queue, NULL if control thread is not running.
+*/
+struct ptp_ctl_events *ptp_ctl_events(int instance)
+{
+    if (!running || (instance < 0) || (instance >= num_queues)) {
+        return NULL;
+    }
+    return &queues[instance];
+}
+
+/**
+* Get entry for a new event.
+* @param ptp_ctx PTP instance.
+* @param type event type.
+* @return event, NULL if events are not used or queue is full.
+*/
+static struct ptp_ctl_event *ptp_ctl_new_event(struct ptp_ctx *ptp_ctx,
+                                               enum ptp_ctl_event_type type)
+{
+    struct ptp_ctl_events *queue = ptp_ctx->ctl;
+    struct ptp_ctl_event *event = NULL;
+    int slot = 0;
+
+    if (queue == NULL) {
+        return NULL;
+    }
+    slot = ptp_spsc_produce_slot(&queue->ring);
+    if (slot < 0) {
+        __atomic_store_n(&queue->dropped, queue->dropped + 1,
+                         __ATOMIC_RELAXED);
+        return NULL;
+    }
+    event = &queue->events[slot];
+    memset(event, 0, sizeof(struct ptp_ctl_event));
+    event->type = type;
+    event->domain = ptp_ctx->default_dataset.domain;
+    ptp_get_time(&ptp_ctx->clk_ctx, &event->time);
+    return event;
+}
+
+/**
+* Publish event and wake control thread.
+* @param ptp_ctx PTP instance.
+*/
+static void ptp_ctl_post(struct ptp_ctx *ptp_ctx)
+{
+    u64 wake = 1;
+
+    ptp_spsc_produce(&ptp_ctx->ctl->ring);
+    if (write(wake_fd, &wake, sizeof(u64)) < 0) {
+        perror("write");
+    }
+}
+
+/**
+* Queue port state change event. Called by the instance thread.
+* @param ctx Port context, new state is set.
+* @param old_state state before the change.
+*/
+void ptp_ctl_port_state(struct ptp_port_ctx *ctx, enum PortState old_state)
+{
+    struct ptp_ctl_event *event = NULL;
+
+    event = ptp_ctl_new_event(ctx->ptp, PTP_CTL_PORT_STATE);
+    if (event == NULL) {
+        return;
+    }
+    event->port_number = ctx->port_dataset.port_identity.port_number;
+    strncpy(event->name, ctx->name, INTERFACE_NAME_LEN);
+    event->old_state = old_state;
+    event->new_state = ctx->port_dataset.port_state;
+    ptp_ctl_post(ctx->ptp);
+}
+
+/**
+* Queue parent change event. Called by the instance thread.
+* @param ptp_ctx PTP instance, parent dataset is updated.
+*/
+void ptp_ctl_parent(struct ptp_ctx *ptp_ctx)
+{
+    struct ptp_ctl_event *event = NULL;
+
+    event = ptp_ctl_new_event(ptp_ctx, PTP_CTL_PARENT);
+    if (event == NULL) {
+        return;
+    }
+    memcpy(&event->parent, &ptp_ctx->parent_dataset.parent_port_identity,
+           sizeof(struct PortIdentity));
+    memcpy(event->grandmaster, ptp_ctx->parent_dataset.grandmaster_identity,
+           sizeof(ClockIdentity));
+    event->local = !memcmp(event->grandmaster,
+                           ptp_ctx->default_dataset.clock_identity,
+                           sizeof(ClockIdentity));
+    ptp_ctl_post(ptp_ctx);
+}
+
+/**
+* Send all of a buffer to a client, waiting at most the send timeout.
+* @param sock client socket.
+* @param data buffer.
+* @param len length.
+* @param flags send flags.
+* @return ptp error code.
+*/
+static int ptp_ctl_send(int sock, const char *data, int len, int flags)
+{
+    int ret = 0;
+
+    while (len > 0) {
+        ret = send(sock, data, len, flags | MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return PTP_ERR_NET;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Send line to subscribers. A subscriber which does not keep up is
+* dropped, so the control thread never waits for one.
+* @param line line to send.
+* @param len line length.
+*/
+static void ptp_ctl_publish(const char *line, int len)
+{
+    int i = 0;
+
+    for (i = 0; i < PTP_CTL_CLIENTS; i++) {
+        if ((clients[i] >= 0) &&
+            (send(clients[i], line, len, MSG_DONTWAIT | MSG_NOSIGNAL) !=
+             len)) {
+            DEBUG("Subscriber %i dropped\n", clients[i]);
+            close(clients[i]);
+            clients[i] = -1;
+        }
+    }
+}
+
+/**
+* Get port state name without the PORT_ prefix.
+* @param state port state.
+* @return name.
+*/
+static const char *ptp_ctl_state_name(enum PortState state)
+{
+    return get_state_str(state) + strlen("PORT_");
+}
+
+/**
+* Send queued events of the instances to subscribers and state file.
+*/
+static void ptp_ctl_flush(void)
+{
+    struct ptp_ctl_event *event = NULL;
+    char line[PTP_CTL_LINE_LEN];
+    char name[40];
+    u32 dropped = 0;
+    int i = 0, slot = 0, len = 0;
+
+    for (i = 0; i < num_queues; i++) {
+        while ((slot = ptp_spsc_consume_slot(&queues[i].ring)) >= 0) {
+            event = &queues[i].events[slot];
+            if (event->type == PTP_CTL_PORT_STATE) {
+                len = snprintf(line, sizeof(line), "event=port_state "
+                               "time=%llu.%09u domain=%u port=%u "
+                               "interface=%s from=%s to=%s\n",
+                               (unsigned long long) event->time.seconds,
+                               event->time.nanoseconds, event->domain,
+                               event->port_number, event->name,
+                               ptp_ctl_state_name(event->old_state),
+                               ptp_ctl_state_name(event->new_state));
+                if (files) {
+                    snprintf(name, sizeof(name), "PORT_%u %s",
+                             event->port_number,
+                             get_state_str(event->new_state));
+                    print_clock_state(name);
+                }
+            } else {
+                strncpy(name, ptp_clk_id(event->parent.clock_identity),
+                        sizeof(name) - 1);
+                name[sizeof(name) - 1] = 0;
+                len = snprintf(line, sizeof(line), "event=parent "
+                               "time=%llu.%09u domain=%u parent=%s/%u "
+                               "grandmaster=%s local=%i\n",
+                               (unsigned long long) event->time.seconds,
+                               event->time.nanoseconds, event->domain,
+                               name, event->parent.port_number,
+                               ptp_clk_id(event->grandmaster), event->local);
+                if (files) {
+                    print_clock_state(event->local ? "PTP_CLK_MASTER" :
+                                      "PTP_MASTER_CHANGED");
+                }
+            }
+            ptp_spsc_consume(&queues[i].ring);
+            if (len >= sizeof(line)) {
+                len = sizeof(line) - 1;
+            }
+            ptp_ctl_publish(line, len);
+        }
+        dropped = __atomic_load_n(&queues[i].dropped, __ATOMIC_RELAXED);
+        if (dropped != dropped_seen[i]) {
+            len = snprintf(line, sizeof(line), "event=dropped count=%u\n",
+                           dropped - dropped_seen[i]);
+            dropped_seen[i] = dropped;
+            ptp_ctl_publish(line, len);
+        }
+    }
+}
+
+/**
+* Write status file line of the instances disciplining the clock, when
+* new Sync has been received.
+*/
+static void ptp_ctl_status_file(void)
+{
+    s64 offset = 0;
+    int i = 0;
+
+    for (i = 0; i < num_queues; i++) {
+        if (!ptp_metrics_read(i, &snap) || !snap.servo.discipline ||
+            (snap.servo.sync_samples == sync_samples_seen[i])) {
+            continue;
+        }
+        sync_samples_seen[i] = snap.servo.sync_samples;
+        offset = snap.offset_from_master >> 16;
+        print_clock_status(((offset < 0) ? -offset : offset) / 1000000000,
+                           offset % 1000000000, 0,
+                           (snap.servo.freq * 1000) >> 16, 0,
+                           snap.servo.offset_integral >> 16);
+    }
+}
+
+/**
+* Build status reply from the latest snapshots.
+* @return reply length.
+*/
+static int ptp_ctl_status(void)
+{
+    struct ptp_port_snapshot *port = NULL;
+    int i = 0, j = 0, len = 0;
+
+    for (i = 0; i < num_queues; i++) {
+        if (!ptp_metrics_read(i, &snap)) {
+            continue;
+        }
+        len += snprintf(reply + len, sizeof(reply) - len,
+                        "domain=%u clock=%s steps_removed=%u ",
+                        snap.domain, ptp_clk_id(snap.clock_identity),
+                        snap.steps_removed);
+        if (len >= sizeof(reply)) {
+            break;
+        }
+        len += snprintf(reply + len, sizeof(reply) - len,
+                        "parent=%s/%u ", ptp_clk_id(snap.parent.clock_identity),
+                        snap.parent.port_number);
+        if (len >= sizeof(reply)) {
+            break;
+        }
+        len += snprintf(reply + len, sizeof(reply) - len,
+                        "grandmaster=%s offset_ns=%lli "
+                        "mean_path_delay_ns=%lli freq_ppb=%lli "
+                        "discipline=%i\n", ptp_clk_id(snap.grandmaster),
+                        snap.offset_from_master >> 16,
+                        snap.mean_path_delay >> 16,
+                        (snap.servo.freq * 1000) >> 16,
+                        snap.servo.discipline);
+        for (j = 0; (j < snap.num_ports) && (len < sizeof(reply)); j++) {
+            port = &snap.ports[j];
+            len += snprintf(reply + len, sizeof(reply) - len,
+                            "port domain=%u port=%u interface=%s%s "
+                            "state=%s\n", snap.domain, port->port_number,
+                            port->name, port->unicast_port ? "/unicast" : "",
+                            ptp_ctl_state_name(port->state));
+        }
+        if (len >= sizeof(reply)) {
+            break;
+        }
+    }
+    if (len >= sizeof(reply)) {
+        len = sizeof(reply) - 1;
+    }
+    return len;
+}
+
+/**
+* Serve a client: answer status and help, or add a subscriber.
+* @param sock client socket, closed unless it becomes a subscriber.
+*/
+static void ptp_ctl_serve(int sock)
+{
+    static const char help[] =
+        "commands:\n"
+        "status     state of the instances and their ports\n"
+        "subscribe  port state and parent change events\n"
+        "log [<category>=<level>,...]\n"
+        "           show or set log levels (err, info, debug) of the\n"
+        "           categories, \"all\" sets every category\n";
+    struct timeval tv = { 1, 0 };
+    char line[PTP_CTL_LINE_LEN];
+    int len = 0, i = 0;
+
+    // Clients are served by the control thread, a stuck one is not waited
+    // for long
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    len = recv(sock, line, sizeof(line) - 1, 0);
+    if (len <= 0) {
+        close(sock);
+        return;
+    }
+    line[len] = 0;
+    line[strcspn(line, "\r\n")] = 0;
+
+    if (strcmp(line, "status") == 0) {
+        len = ptp_ctl_status();
+        ptp_ctl_send(sock, reply, len, 0);
+    } else if (strcmp(line, "subscribe") == 0) {
+        for (i = 0; i < PTP_CTL_CLIENTS; i++) {
+            if (clients[i] < 0) {
+                clients[i] = sock;
+                return;
+            }
+        }
+        len = snprintf(line, sizeof(line), "error too many subscribers\n");
+        ptp_ctl_send(sock, line, len, 0);
+    } else if ((strcmp(line, "log") == 0) ||
+               (strncmp(line, "log ", strlen("log ")) == 0)) {
+        if (line[3] && (ptp_log_parse(line + 4) != PTP_ERR_OK)) {
+            len = snprintf(reply, sizeof(reply), "error invalid levels\n");
+        } else {
+            len = ptp_log_print(reply, sizeof(reply) - 1);
+            reply[len++] = '\n';
+        }
+        ptp_ctl_send(sock, reply, len, 0);
+    } else if (strcmp(line, "help") == 0) {
+        ptp_ctl_send(sock, help, sizeof(help) - 1, 0);
+    } else {
+        len = snprintf(reply, sizeof(reply), "error unknown command\n%s",
+                       help);
+        ptp_ctl_send(sock, reply, len, 0);
+    }
+    close(sock);
+}
+
+/**
+* Control thread.
+* @param arg not used.
+* @return NULL.
+*/
+static void *ptp_ctl_thread(void *arg)
+{
+    struct timeval tv;
+    fd_set rd_fd;
+    time_t next_status = 0;
+    char buf[PTP_CTL_LINE_LEN];
+    u64 count = 0;
+    int max_fd = 0, sock = -1, ret = 0, i = 0;
+
+    while (1) {
+        FD_ZERO(&rd_fd);
+        FD_SET(stop_fd, &rd_fd);
+        FD_SET(wake_fd, &rd_fd);
+        max_fd = ptp_max(stop_fd, wake_fd);
+        if (listen_sock >= 0) {
+            FD_SET(listen_sock, &rd_fd);
+            max_fd = ptp_max(max_fd, listen_sock);
+        }
+        // Subscribers only send to close the connection
+        for (i = 0; i < PTP_CTL_CLIENTS; i++) {
+            if (clients[i] >= 0) {
+                FD_SET(clients[i], &rd_fd);
+                max_fd = ptp_max(max_fd, clients[i]);
+            }
+        }
+        tv.tv_sec = PTP_CTL_STATUS_INTERVAL;
+        tv.tv_usec = 0;
+        ret = select(max_fd + 1, &rd_fd, 0, 0, files ? &tv : NULL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            break;
+        }
+        if (FD_ISSET(stop_fd, &rd_fd)) {
+            break;
+        }
+        if (FD_ISSET(wake_fd, &rd_fd)) {
+            if (read(wake_fd, &count, sizeof(u64)) < 0) {
+                perror("read");
+            }
+            ptp_ctl_flush();
+        }
+        for (i = 0; i < PTP_CTL_CLIENTS; i++) {
+            if ((clients[i] >= 0) && FD_ISSET(clients[i], &rd_fd) &&
+                (recv(clients[i], buf, sizeof(buf), MSG_DONTWAIT) <= 0)) {
+                close(clients[i]);
+                clients[i] = -1;
+            }
+        }
+        if ((listen_sock >= 0) && FD_ISSET(listen_sock, &rd_fd)) {
+            sock = accept(listen_sock, NULL, NULL);
+            if (sock >= 0) {
+                ptp_ctl_serve(sock);
+            }
+        }
+        if (files && (time(NULL) >= next_status)) {
+            next_status = time(NULL) + PTP_CTL_STATUS_INTERVAL;
+            ptp_ctl_status_file();
+        }
+    }
+    return NULL;
+}
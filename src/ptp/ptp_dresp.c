@@ -0,0 +1,208 @@
+/** @file ptp_dresp.c
+* PTP Delay_Resp queue of master ports. Under a burst of Delay_Req,
+* responses are collected while frames are received and sent in batches
+* after the port state machine has sent Sync, so that reception and Sync
+* transmission are not stalled by one send per request.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_PORT
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+#include <packet_if.h>
+#include <clock_if.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_framer.h"
+#include "ptp_codec.h"
+#include "ptp_dresp.h"
+#include "ptp_trace.h"
+
+// Local macros
+#define MIN(a,b) ((a)<(b)?(a):(b))
+
+/**
+* Initialize Delay_Resp queue on preallocated entries.
+* @param queue Delay_Resp queue.
+* @param entries memory for the entries.
+* @param capacity number of entries.
+*/
+void ptp_dresp_init(struct ptp_dresp_queue *queue,
+                    struct ptp_dresp_entry *entries, u32 capacity)
+{
+    memset(queue, 0, sizeof(struct ptp_dresp_queue));
+    queue->entries = entries;
+    queue->capacity = capacity;
+}
+
+/**
+* Queue Delay_Resp answering a Delay_Req. Responses of unicast ports, and
+* responses to unicast requests (hybrid mode), are sent to the requester.
+* @param ctx Port context.
+* @param msg Delay_Req message.
+* @param time receive time of the Delay_Req.
+* @param peer_ip address of the requester.
+*/
+void ptp_dresp_queue(struct ptp_port_ctx *ctx, struct ptp_delay_req *msg,
+                     struct Timestamp *time, char *peer_ip)
+{
+    struct ptp_dresp_queue *queue = &ctx->delay_resp;
+    struct ptp_dresp_entry *entry = NULL;
+    struct ptp_header *hdr = NULL;
+    struct PortIdentity port_id;
+
+    if (queue->count == queue->capacity) {
+        queue->stats.dropped++;
+        return;
+    }
+    entry = &queue->entries[(queue->head + queue->count) % queue->capacity];
+
+    ptp_get_port_id(&port_id, &msg->hdr.src_port_id);
+    create_delay_resp(ctx, entry->frame, time, &port_id,
+                      ptp_hdr_seq_id(&msg->hdr),
+                      ptp_hdr_corr_field(&msg->hdr));
+    entry->unicast = ctx->unicast.sessions ||
+        (ptp_hdr_flags(&msg->hdr) & PTP_UNICAST);
+    if (entry->unicast) {
+        hdr = (struct ptp_header *) entry->frame;
+        ptp_hdr_set_flags(hdr, ptp_hdr_flags(hdr) | PTP_UNICAST);
+        strncpy(entry->peer_ip, peer_ip, IP_STR_MAX_LEN);
+    }
+    entry->delayed = false;
+
+    queue->count++;
+    queue->stats.queued++;
+    if (queue->count > queue->stats.max_depth) {
+        queue->stats.max_depth = queue->count;
+    }
+}
+
+/**
+* Check if Sync of a port is due, responses must then wait.
+* @param ctx Port context.
+* @param time current time.
+* @return true if Sync is due.
+*/
+static bool ptp_dresp_sync_due(struct ptp_port_ctx *ctx,
+                               struct Timestamp *time)
+{
+    return (ctx->timer_flags & SYNC_TIMER) &&
+        (older_timestamp(&ctx->sync_timer, time) == &ctx->sync_timer);
+}
+
+/**
+* Send queued Delay_Resp of a port, at most PTP_DRESP_BUDGET of them.
+* Sending stops early if Sync of the port becomes due. Responses left in
+* the queue are counted as delayed, responses of a port which is not
+* master anymore are dropped.
+* @param ctx Port context.
+* @param current_time current time.
+* @return number of responses still queued.
+*/
+u32 ptp_dresp_flush(struct ptp_port_ctx *ctx, struct Timestamp *current_time)
+{
+    struct ptp_dresp_queue *queue = &ctx->delay_resp;
+    struct ptp_send_vec vec[PTP_SEND_BATCH_MAX];
+    struct ptp_dresp_entry *entry = NULL;
+    struct Timestamp now;
+    u32 budget = PTP_DRESP_BUDGET;
+    int count = 0, ret = 0, i = 0;
+
+    if (queue->count == 0) {
+        return 0;
+    }
+    if (ctx->port_dataset.port_state != PORT_MASTER) {
+        queue->stats.dropped += queue->count;
+        queue->head = 0;
+        queue->count = 0;
+        return 0;
+    }
+    copy_timestamp(&now, current_time);
+    while ((queue->count > 0) && (budget > 0) &&
+           !ptp_dresp_sync_due(ctx, &now)) {
+        // Batch of consecutive entries, ring wraps between batches
+        count = MIN(MIN(queue->count, budget), PTP_SEND_BATCH_MAX);
+        count = MIN(count, queue->capacity - queue->head);
+        for (i = 0; i < count; i++) {
+            entry = &queue->entries[queue->head + i];
+            vec[i].frame = entry->frame;
+            vec[i].length = sizeof(struct ptp_delay_resp);
+            vec[i].peer_addr = entry->unicast ? entry->peer_ip : NULL;
+        }
+        ret = ptp_send_batch(&ctx->ptp->pkt_ctx, PTP_DELAY_RESP,
+                             ctx->port_dataset.port_identity.port_number,
+                             vec, count);
+        TRACE(PTP_TR_DRESP, ctx->port_dataset.port_identity.port_number,
+              count, ret, queue->count);
+        if (ret < 0) {
+            // Batch is lost, socket is reopened only if it is broken
+            if (ret == PTP_ERR_NET) {
+                ctx->ptp->socket_restart = 1;
+            }
+            ret = count;
+            queue->stats.dropped += count;
+            ptp_count_tx(&ctx->counters, PTP_DELAY_RESP, count, true);
+        } else if (ret == 0) {
+            // Nothing was accepted, drop the head so the queue advances
+            ret = 1;
+            queue->stats.dropped++;
+            ptp_count_tx(&ctx->counters, PTP_DELAY_RESP, 1, true);
+        } else {
+            queue->stats.sent += ret;
+            ptp_count_tx(&ctx->counters, PTP_DELAY_RESP, ret, false);
+        }
+        queue->head = (queue->head + ret) % queue->capacity;
+        queue->count -= ret;
+        budget -= ret;
+        if (ret < count) {
+            // Kernel queue is full, retry on next wakeup
+            break;
+        }
+        ptp_get_time(&ctx->ptp->clk_ctx, &now);
+    }
+    for (i = 0; i < queue->count; i++) {
+        entry = &queue->entries[(queue->head + i) % queue->capacity];
+        if (!entry->delayed) {
+            entry->delayed = true;
+            queue->stats.delayed++;
+        }
+    }
+    if (queue->count > 0) {
+        DEBUG("%u Delay_Resp delayed\n", queue->count);
+    }
+    return queue->count;
+}
+
+/**
+* Number of queued Delay_Resp of a port.
+* @param ctx Port context.
+* @return number of responses.
+*/
+u32 ptp_dresp_pending(struct ptp_port_ctx *ctx)
+{
+    return ctx->delay_resp.count;
+}
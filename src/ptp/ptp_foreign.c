@@ -0,0 +1,310 @@
+/** @file ptp_foreign.c
+* PTP foreign master table.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_BMC
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp.h"
+#include "ptp_foreign.h"
+
+// FNV-1a constants
+#define FNV_OFFSET_BASIS    2166136261u
+#define FNV_PRIME           16777619u
+
+/**
+* Hash of the port identity.
+* @param port_id port identity (host order).
+* @return hash value.
+*/
+static u32 ptp_foreign_hash(struct PortIdentity *port_id)
+{
+    u32 hash = FNV_OFFSET_BASIS;
+    int i = 0;
+
+    for (i = 0; i < sizeof(ClockIdentity); i++) {
+        hash ^= (u8) port_id->clock_identity[i];
+        hash *= FNV_PRIME;
+    }
+    hash ^= port_id->port_number & 0xff;
+    hash *= FNV_PRIME;
+    hash ^= port_id->port_number >> 8;
+    hash *= FNV_PRIME;
+    return hash;
+}
+
+/**
+* Compare port identities.
+* @param id1 port identity 1.
+* @param id2 port identity 2.
+* @return true if identical.
+*/
+static bool ptp_foreign_match(struct PortIdentity *id1,
+                              struct PortIdentity *id2)
+{
+    if (id1->port_number != id2->port_number) {
+        return false;
+    }
+    return (memcmp(id1->clock_identity, id2->clock_identity,
+                   sizeof(ClockIdentity)) == 0);
+}
+
+/**
+* Get number of slots needed for the foreign master table.
+* @param capacity maximum number of records.
+* @return number of slots.
+*/
+u32 ptp_foreign_table_slots(u32 capacity)
+{
+    u32 num_slots = 1;
+
+    // Keep load factor at most 0.5 to get short probe sequences
+    while (num_slots < 2 * capacity) {
+        num_slots <<= 1;
+    }
+    return num_slots;
+}
+
+/**
+* Initialize foreign master table on preallocated records.
+* No allocations are done when table is used.
+* @param table foreign master table.
+* @param capacity maximum number of records.
+* @param records memory for the slots.
+* @param num_slots number of slots, from ptp_foreign_table_slots().
+* @return ptp error code.
+*/
+int ptp_foreign_table_init(struct ForeignMasterTable *table, u32 capacity,
+                           struct ForeignMasterDataSet *records,
+                           u32 num_slots)
+{
+    memset(table, 0, sizeof(struct ForeignMasterTable));
+    if ((capacity == 0) || (capacity > MAX_NUM_FOREIGN_MASTERS) ||
+        (ptp_foreign_table_slots(capacity) > num_slots) || !records) {
+        ERROR("Invalid foreign master table capacity %u\n", capacity);
+        return PTP_ERR_GEN;
+    }
+    memset(records, 0, num_slots * sizeof(struct ForeignMasterDataSet));
+    table->records = records;
+    table->capacity = capacity;
+    table->num_slots = num_slots;
+    return PTP_ERR_OK;
+}
+
+/**
+* Find foreign master record.
+* @param table foreign master table.
+* @param port_id sourcePortIdentity of the foreign master (host order).
+* @return record, NULL if not found.
+*/
+struct ForeignMasterDataSet *ptp_foreign_lookup(struct ForeignMasterTable
+                                                *table,
+                                                struct PortIdentity
+                                                *port_id)
+{
+    u32 mask = table->num_slots - 1;
+    u32 slot = 0;
+
+    if (table->num_records == 0) {
+        return NULL;
+    }
+    slot = ptp_foreign_hash(port_id) & mask;
+    while (table->records[slot].in_use) {
+        if (ptp_foreign_match(&table->records[slot].src_port_id, port_id)) {
+            return &table->records[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+    return NULL;
+}
+
+/**
+* Add new (cleared) foreign master record.
+* @param table foreign master table.
+* @param port_id sourcePortIdentity of the foreign master (host order).
+* @return record, NULL if table is full.
+*/
+struct ForeignMasterDataSet *ptp_foreign_insert(struct ForeignMasterTable
+                                                *table,
+                                                struct PortIdentity
+                                                *port_id)
+{
+    u32 mask = table->num_slots - 1;
+    u32 slot = 0;
+    struct ForeignMasterDataSet *record = NULL;
+
+    if (table->num_records >= table->capacity) {
+        return NULL;
+    }
+    slot = ptp_foreign_hash(port_id) & mask;
+    while (table->records[slot].in_use) {
+        slot = (slot + 1) & mask;
+    }
+    record = &table->records[slot];
+    memset(record, 0, sizeof(struct ForeignMasterDataSet));
+    record->in_use = true;
+    memcpy(&record->src_port_id, port_id, sizeof(struct PortIdentity));
+    table->num_records++;
+    return record;
+}
+
+/**
+* Remove foreign master record. Following records of the same
+* probe sequence are shifted backwards, so no tombstones are needed.
+* @param table foreign master table.
+* @param record record to remove.
+*/
+void ptp_foreign_remove(struct ForeignMasterTable *table,
+                        struct ForeignMasterDataSet *record)
+{
+    u32 mask = table->num_slots - 1;
+    u32 hole = record - table->records;
+    u32 slot = hole;
+    u32 home = 0;
+
+    if (!record->in_use) {
+        return;
+    }
+    table->num_records--;
+    while (1) {
+        slot = (slot + 1) & mask;
+        if (!table->records[slot].in_use) {
+            break;
+        }
+        home = ptp_foreign_hash(&table->records[slot].src_port_id) & mask;
+        // Record can be moved to hole if its home is not in (hole, slot]
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            memcpy(&table->records[hole], &table->records[slot],
+                   sizeof(struct ForeignMasterDataSet));
+            hole = slot;
+        }
+    }
+    memset(&table->records[hole], 0, sizeof(struct ForeignMasterDataSet));
+}
+
+/**
+* Store received announce to the record and update its expiry deadlines.
+* @param record foreign master record.
+* @param msg announce message.
+* @param time receive time of the announce.
+* @param receipt_timeout announce_receipt_timeout of the port.
+*/
+void ptp_foreign_update(struct ForeignMasterDataSet *record,
+                        struct ptp_announce *msg,
+                        struct Timestamp *time, u8 receipt_timeout)
+{
+    // Announce window is recalculated only if announce interval changes
+    if ((record->window.seconds == 0 && record->window.nanoseconds == 0) ||
+        (record->window_log_interval != msg->hdr.log_mean_msg_interval)) {
+        record->window_log_interval = msg->hdr.log_mean_msg_interval;
+        record->window.seconds =
+            power2(msg->hdr.log_mean_msg_interval,
+                   &record->window.nanoseconds);
+        mult_timeout(&record->window, receipt_timeout);
+        DEBUG("Announce window %us %uns\n",
+              (u32) record->window.seconds,
+              (u32) record->window.nanoseconds);
+    }
+
+    copy_timestamp(&record->expiry, time);
+    inc_timestamp(&record->expiry, &record->window);
+    copy_timestamp(&record->announce_expiry[record->tstamp_index],
+                   &record->expiry);
+    record->tstamp_index++;
+    record->tstamp_index %= ANNOUNCE_WINDOW;
+    if (record->foreign_master_announce_messages < ANNOUNCE_WINDOW) {
+        record->foreign_master_announce_messages++;
+    }
+    memcpy(&record->msg, msg, sizeof(struct ptp_announce));
+}
+
+/**
+* Remove records whose announce window has expired.
+* @param table foreign master table.
+* @param current_time current time.
+*/
+void ptp_foreign_expire(struct ForeignMasterTable *table,
+                        struct Timestamp *current_time)
+{
+    struct ForeignMasterDataSet *record = NULL;
+    u32 slot = 0;
+    int i = 0;
+
+    if (table->num_records == 0) {
+        return;
+    }
+    while (slot < table->num_slots) {
+        record = &table->records[slot];
+        if (!record->in_use) {
+            slot++;
+            continue;
+        }
+        // Newest announce is still valid, count valid announces
+        if (older_timestamp(current_time, &record->expiry) == current_time) {
+            record->foreign_master_announce_messages = 0;
+            for (i = 0; i < ANNOUNCE_WINDOW; i++) {
+                if (older_timestamp(current_time,
+                                    &record->announce_expiry[i]) ==
+                    current_time) {
+                    record->foreign_master_announce_messages++;
+                }
+            }
+            slot++;
+            continue;
+        }
+        DEBUG("Remove foreign record %s %i\n",
+              ptp_clk_id(record->src_port_id.clock_identity),
+              record->src_port_id.port_number);
+        // Removal shifts next record to this slot, check slot again
+        ptp_foreign_remove(table, record);
+    }
+}
+
+/**
+* Iterate records of the foreign master table.
+* @param table foreign master table.
+* @param record previous record, NULL to get the first one.
+* @return next record in use, NULL when all records are iterated.
+*/
+struct ForeignMasterDataSet *ptp_foreign_next(struct ForeignMasterTable
+                                              *table,
+                                              struct ForeignMasterDataSet
+                                              *record)
+{
+    u32 slot = 0;
+
+    if (record) {
+        slot = (record - table->records) + 1;
+    }
+    for (; slot < table->num_slots; slot++) {
+        if (table->records[slot].in_use) {
+            return &table->records[slot];
+        }
+    }
+    return NULL;
+}
@@ -24,66 +24,188 @@
 /******************************************************************************
 * $Id$
 ******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_FRAMER
+
 #include "ptp.h"
 #include "ptp_framer.h"
 #include "ptp_general.h"
 #include "ptp_internal.h"
 #include "ptp_message.h"
 #include "ptp_port.h"
+#include "ptp_codec.h"
+
+/**
+* Fill common header of a template.
+* @param ctx Port context.
+* @param hdr Header to fill.
+* @param msg_type PTP message type.
+* @param len message length.
+* @param flags message flags.
+* @param control control field.
+* @param log_interval logMeanMessageInterval.
+*/
+static void build_header(struct ptp_port_ctx *ctx,
+                         struct ptp_header *hdr,
+                         u8 msg_type, u16 len, u16 flags,
+                         u8 control, s8 log_interval)
+{
+    hdr->msg_type = msg_type;   // ptp message type 
+    hdr->ptp_ver = ctx->port_dataset.version_number;    // ptp version
+    ptp_put_u16(&hdr->msg_len, len);    // messageLength
+    hdr->domain_num = ctx->ptp->default_dataset.domain; // domainNumber
+    if (ctx->unicast_port) {
+        flags |= PTP_UNICAST;
+    }
+    ptp_hdr_set_flags(hdr, flags);
+    hdr->corr_field = 0;        // correctionField
+    // sourcePortIdentity
+    ptp_put_port_id(&hdr->src_port_id, &ctx->port_dataset.port_identity);
+    hdr->seq_id = 0;
+    hdr->control = control;     // control 
+    hdr->log_mean_msg_interval = log_interval;  // logMeanMessageInterval
+}
+
+/**
+* Fill announce template.
+* @param ctx Port context.
+* @param msg Announce to fill.
+* @param local if true, use data from defaut dataset (instead of parent).
+*/
+static void build_announce(struct ptp_port_ctx *ctx,
+                           struct ptp_announce *msg, int local)
+{
+    u16 flags = 0;
+
+    flags |= ctx->ptp->time_dataset.time_traceable ? PTP_TIME_TRACEABLE : 0;
+    flags |= ctx->ptp->time_dataset.frequency_traceable ? 
+        PTP_FREQ_TRACEABLE : 0;
+    flags |= ctx->ptp->time_dataset.ptp_timescale ? PTP_TIMESCALE : 0;
+    flags |= ctx->ptp->time_dataset.current_utc_offset_valid ? 
+        PTP_UTC_OFFSET_VALID : 0;
+    build_header(ctx, &msg->hdr, PTP_ANNOUNCE, sizeof(struct ptp_announce),
+                 flags, PTP_CTRL_OTHER,
+                 ctx->port_dataset.log_mean_announce_interval);
+
+    // Announce msg content
+    ptp_put_u16(&msg->current_UTC_offset, ctx->ptp->time_dataset.current_utc_offset);    // currentUTCOffset
+    msg->time_source = ctx->ptp->time_dataset.time_source;        // timeSource 
+    // stepsRemoved
+    ptp_put_u16(&msg->steps_removed, ctx->ptp->current_dataset.steps_removed);
+    if( local ){
+        memcpy(msg->grandmasterId, 
+               ctx->ptp->default_dataset.clock_identity, 
+               sizeof(ClockIdentity));     // grandmasterIdentity
+        msg->grandmasterClkQuality.clock_class =
+            ctx->ptp->default_dataset.clock_quality.clock_class;
+        msg->grandmasterClkQuality.clock_accuracy =
+            ctx->ptp->default_dataset.clock_quality.clock_accuracy;
+        ptp_put_u16(&msg->grandmasterClkQuality.offset_scaled_log_variance,
+                    ctx->ptp->default_dataset.clock_quality.
+                    offset_scaled_log_variance);
+        // GM priority1
+        msg->grandmasterPri1 = ctx->ptp->default_dataset.priority1;  
+        // GM priority2  
+        msg->grandmasterPri2 = ctx->ptp->default_dataset.priority2;  
+    }
+    else {
+        memcpy(msg->grandmasterId, 
+               ctx->ptp->parent_dataset.grandmaster_identity, 
+               sizeof(ClockIdentity));     // grandmasterIdentity
+        msg->grandmasterClkQuality.clock_class =
+            ctx->ptp->parent_dataset.grandmaster_clock_quality.clock_class;
+        msg->grandmasterClkQuality.clock_accuracy =
+            ctx->ptp->parent_dataset.grandmaster_clock_quality.clock_accuracy;
+        ptp_put_u16(&msg->grandmasterClkQuality.offset_scaled_log_variance,
+                    ctx->ptp->parent_dataset.grandmaster_clock_quality.
+                    offset_scaled_log_variance);
+        // GM priority1
+        msg->grandmasterPri1 = ctx->ptp->parent_dataset.grandmaster_priority1;  
+        // GM priority2  
+        msg->grandmasterPri2 = ctx->ptp->parent_dataset.grandmaster_priority2;  
+    }
+}
+
+/**
+* Rebuild message templates of the port if datasets have changed.
+* @param ctx Port context.
+*/
+static void ptp_framer_prepare(struct ptp_port_ctx *ctx)
+{
+    struct ptp_port_templates *tmpl = &ctx->templates;
+    u16 flags = 0;
+
+    if (tmpl->generation == ctx->ptp->dataset_generation) {
+        return;
+    }
+    DEBUG("Rebuild templates of port %i\n",
+          ctx->port_dataset.port_identity.port_number);
+    memset(tmpl, 0, sizeof(struct ptp_port_templates));
+
+    flags = (ctx->ptp->cfg.one_step_clock == 1) ? 0 : PTP_TWO_STEP;
+    build_header(ctx, &tmpl->sync.hdr, PTP_SYNC, sizeof(struct ptp_sync),
+                 flags, PTP_CTRL_SYNC,
+                 ctx->port_dataset.log_mean_sync_interval);
+    build_header(ctx, &tmpl->follow_up.hdr, PTP_FOLLOW_UP,
+                 sizeof(struct ptp_follow_up), flags, PTP_CTRL_FOLLOW_UP,
+                 ctx->port_dataset.log_mean_sync_interval);
+    build_announce(ctx, &tmpl->announce, 0);
+    build_announce(ctx, &tmpl->announce_local, 1);
+    build_header(ctx, &tmpl->delay_req.hdr, PTP_DELAY_REQ,
+                 sizeof(struct ptp_delay_req), 0, PTP_CTRL_DELAY_REQ,
+                 PTP_MSG_DEFAULT_INTERVAL);
+    build_header(ctx, &tmpl->delay_resp.hdr, PTP_DELAY_RESP,
+                 sizeof(struct ptp_delay_resp), 0, PTP_CTRL_DELAY_RESP,
+                 ctx->port_dataset.log_min_mean_delay_req_interval);
+    build_header(ctx, &tmpl->pdelay_req.hdr, PTP_PDELAY_REQ,
+                 sizeof(struct ptp_pdelay_req), 0, PTP_CTRL_OTHER,
+                 PTP_MSG_DEFAULT_INTERVAL);
+    build_header(ctx, &tmpl->pdelay_resp.hdr, PTP_PDELAY_RESP,
+                 sizeof(struct ptp_pdelay_resp), PTP_TWO_STEP,
+                 PTP_CTRL_OTHER, PTP_MSG_DEFAULT_INTERVAL);
+    build_header(ctx, &tmpl->pdelay_resp_follow_up.hdr,
+                 PTP_PDELAY_RESP_FOLLOW_UP,
+                 sizeof(struct ptp_pdelay_resp_follow_up), 0,
+                 PTP_CTRL_OTHER, PTP_MSG_DEFAULT_INTERVAL);
+
+    tmpl->generation = ctx->ptp->dataset_generation;
+}
+
+/**
+* Invalidate message templates of all ports of the instance. Must be called
+* when default, parent, time properities or port datasets change.
+* @param ptp_ctx PTP instance.
+*/
+void ptp_framer_invalidate(struct ptp_ctx *ptp_ctx)
+{
+    ptp_ctx->dataset_generation++;
+    // Zero is reserved for never built templates
+    if (ptp_ctx->dataset_generation == 0) {
+        ptp_ctx->dataset_generation++;
+    }
+}
 
 /**
 * Function for creating PTP sync message.
 * @param ctx Port context.
 * @param buf Buffer to which frame is created.
 * @param seqid Sequence id.
+* @param time current time, used as originTimestamp in two-step mode.
 * @return size of the created frame.
 */
-int create_sync(struct ptp_port_ctx *ctx, char *buf, u16 seqid)
+int create_sync(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                struct Timestamp *time)
 {
-    struct ptp_sync *msg = 0;
+    struct ptp_sync *msg = (struct ptp_sync *) buf;
     unsigned short len = sizeof(struct ptp_sync);
-    struct Timestamp time;
-    int ret = 0;
-
-    DEBUG("\n");
-
-    memset(buf, 0, len);
-
-    // Header fields
-    msg = (struct ptp_sync *) buf;
-    msg->hdr.msg_type = PTP_SYNC;       // ptp message type 
-    msg->hdr.ptp_ver = ctx->port_dataset.version_number;        // ptp version
-    msg->hdr.msg_len = htons(len);      // messageLength
-    msg->hdr.domain_num = ptp_ctx.default_dataset.domain;       // domainNumber
-    // flags
-    if (ptp_cfg.one_step_clock == 1) {
-        msg->hdr.flags = 0;
-    } else {
-        msg->hdr.flags = PTP_TWO_STEP;
-    }
-    if (ctx->unicast_port) {
-        msg->hdr.flags |= PTP_UNICAST;
-    }
-    msg->hdr.corr_field = 0;    // correctionField
-    memcpy(msg->hdr.src_port_id.clock_identity, ctx->port_dataset.port_identity.clock_identity, sizeof(ClockIdentity)); // sourcePortIdentity 
-    msg->hdr.src_port_id.port_number =
-        htons(ctx->port_dataset.port_identity.port_number);
-    msg->hdr.seq_id = htons(seqid);
-    msg->hdr.control = PTP_CTRL_SYNC;   // control 
-    // logMeanMessageInterval
-    msg->hdr.log_mean_msg_interval =
-        ctx->port_dataset.log_mean_sync_interval;
-
-    // Sync msg content (timestamp)
-    if (ptp_cfg.one_step_clock == 1) {
-        memset(&time, 0, sizeof(struct Timestamp));
-    } else {
-        ret = ptp_get_time(&ptp_ctx.clk_ctx, &time);
-        if (ret < PTP_ERR_OK) {
-            return ret;
-        }
+
+    ptp_framer_prepare(ctx);
+    memcpy(msg, &ctx->templates.sync, len);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
+
+    // Sync msg content (timestamp), zero in one-step mode
+    if (ctx->ptp->cfg.one_step_clock != 1) {
+        ptp_put_timestamp(msg->origin_tstamp, time);    ///< originTimestamp 
     }
-    ptp_format_timestamp(&time, msg->origin_tstamp);    ///< originTimestamp 
 
     return len;
 }
@@ -99,41 +221,16 @@ int create_sync(struct ptp_port_ctx *ctx, char *buf, u16 seqid)
 int create_follow_up(struct ptp_port_ctx *ctx,
                      char *buf, struct Timestamp *time, u16 seqid)
 {
-    struct ptp_follow_up *msg = 0;
+    struct ptp_follow_up *msg = (struct ptp_follow_up *) buf;
     unsigned short len = sizeof(struct ptp_follow_up);
 
-    DEBUG("\n");
-
-    memset(buf, 0, len);
-
-    // Header fields
-    msg = (struct ptp_follow_up *) buf;
-    msg->hdr.msg_type = PTP_FOLLOW_UP;  // ptp message type
-    msg->hdr.ptp_ver = ctx->port_dataset.version_number;        // version
-    msg->hdr.msg_len = htons(len);      // messageLength
-    msg->hdr.domain_num = ptp_ctx.default_dataset.domain;       // domainNumber
-    // flags
-    if (ptp_cfg.one_step_clock == 1) {
-        msg->hdr.flags = 0;
-    } else {
-        msg->hdr.flags = PTP_TWO_STEP;
-    }
-    if (ctx->unicast_port) {
-        msg->hdr.flags |= PTP_UNICAST;
-    }
-    msg->hdr.corr_field = 0;    ///< correctionField
-    memcpy(msg->hdr.src_port_id.clock_identity, ctx->port_dataset.port_identity.clock_identity, sizeof(ClockIdentity)); // sourcePortIdentity 
-    msg->hdr.src_port_id.port_number =
-        htons(ctx->port_dataset.port_identity.port_number);
-    msg->hdr.seq_id = htons(seqid);     // sequenceId 
-    msg->hdr.control = PTP_CTRL_FOLLOW_UP;      // control 
-    // logMeanMessageInterval
-    msg->hdr.log_mean_msg_interval =
-        ctx->port_dataset.log_mean_sync_interval;
+    ptp_framer_prepare(ctx);
+    memcpy(msg, &ctx->templates.follow_up, len);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);     // sequenceId 
 
     DEBUG("%is %i\n", (int) time->seconds, (int) time->nanoseconds);
     // Follow up msg content (timestamp)
-    ptp_format_timestamp(time, msg->precise_origin_tstamp);
+    ptp_put_timestamp(msg->precise_origin_tstamp, time);
 
     return len;
 }
@@ -144,88 +241,26 @@ int create_follow_up(struct ptp_port_ctx *ctx,
 * @param buf Buffer to which frame is created.
 * @param seqid Sequence id.
 * @param local if true, use data from defaut dataset (instead of parent).
+* @param time current time used as originTimestamp, NULL for zero.
 * @return size of the created frame.
 */
 int create_announce(struct ptp_port_ctx *ctx, char *buf, 
-                    u16 seqid, int local)
+                    u16 seqid, int local, struct Timestamp *time)
 {
-    struct ptp_announce *msg = 0;
+    struct ptp_announce *msg = (struct ptp_announce *) buf;
     unsigned short len = sizeof(struct ptp_announce);
-    struct Timestamp time;
-    int ret = 0;
-
-    DEBUG("\n");
-
-    memset(buf, 0, len);
-
-    // Header fields
-    msg = (struct ptp_announce *) buf;
-    msg->hdr.msg_type = PTP_ANNOUNCE;   // ptp message type 
-    msg->hdr.ptp_ver = ctx->port_dataset.version_number;        // version 
-    msg->hdr.msg_len = htons(len);      // messageLength
-    msg->hdr.domain_num = ptp_ctx.default_dataset.domain;       // domainNumber
-    // flags
-    msg->hdr.flags =
-        ptp_ctx.time_dataset.time_traceable ? PTP_TIME_TRACEABLE : 0 |
-        ptp_ctx.time_dataset.frequency_traceable ? PTP_FREQ_TRACEABLE : 0 |
-        ptp_ctx.time_dataset.ptp_timescale ? PTP_TIMESCALE : 0 |
-        ptp_ctx.time_dataset.
-        current_utc_offset_valid ? PTP_UTC_OFFSET_VALID : 0;
-    if (ctx->unicast_port) {
-        msg->hdr.flags |= PTP_UNICAST;
+
+    ptp_framer_prepare(ctx);
+    if (local) {
+        memcpy(msg, &ctx->templates.announce_local, len);
+    } else {
+        memcpy(msg, &ctx->templates.announce, len);
     }
-    msg->hdr.corr_field = 0;    // correctionField
-    memcpy(msg->hdr.src_port_id.clock_identity, ctx->port_dataset.port_identity.clock_identity, sizeof(ClockIdentity)); // sourcePortIdentity 
-    msg->hdr.src_port_id.port_number =
-        htons(ctx->port_dataset.port_identity.port_number);
-    msg->hdr.seq_id = htons(seqid);
-    msg->hdr.control = PTP_CTRL_OTHER;  // control 
-    // logMeanMessageInterval
-    msg->hdr.log_mean_msg_interval =
-        ctx->port_dataset.log_mean_announce_interval;
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
 
-    // Announce msg content
     // Timestamp
-    ret = ptp_get_time(&ptp_ctx.clk_ctx, &time);
-    if (ret < PTP_ERR_OK) {
-        return ret;
-    }
-    ptp_format_timestamp(&time, msg->origin_tstamp);    // originTimestamp
-    msg->current_UTC_offset = htons(ptp_ctx.time_dataset.current_utc_offset);   // currentUTCOffset
-    msg->time_source = ptp_ctx.time_dataset.time_source;        // timeSource 
-    // stepsRemoved
-    msg->steps_removed = htons(ptp_ctx.current_dataset.steps_removed);
-    if( local ){
-        memcpy(msg->grandmasterId, 
-               ptp_ctx.default_dataset.clock_identity, 
-               sizeof(ClockIdentity));     // grandmasterIdentity
-        msg->grandmasterClkQuality.clock_class =
-            ptp_ctx.default_dataset.clock_quality.clock_class;
-        msg->grandmasterClkQuality.clock_accuracy =
-            ptp_ctx.default_dataset.clock_quality.clock_accuracy;
-        msg->grandmasterClkQuality.offset_scaled_log_variance =
-            htons(ptp_ctx.default_dataset.clock_quality.
-                  offset_scaled_log_variance);
-        // GM priority1
-        msg->grandmasterPri1 = ptp_ctx.default_dataset.priority1;  
-        // GM priority2  
-        msg->grandmasterPri2 = ptp_ctx.default_dataset.priority2;  
-    }
-    else {
-        memcpy(msg->grandmasterId, 
-               ptp_ctx.parent_dataset.grandmaster_identity, 
-               sizeof(ClockIdentity));     // grandmasterIdentity
-        msg->grandmasterClkQuality.clock_class =
-            ptp_ctx.parent_dataset.grandmaster_clock_quality.clock_class;
-        msg->grandmasterClkQuality.clock_accuracy =
-            ptp_ctx.parent_dataset.grandmaster_clock_quality.clock_accuracy;
-        msg->grandmasterClkQuality.offset_scaled_log_variance =
-            htons(ptp_ctx.parent_dataset.grandmaster_clock_quality.
-                  offset_scaled_log_variance);
-        // GM priority1
-        msg->grandmasterPri1 = ptp_ctx.parent_dataset.grandmaster_priority1;  
-        // GM priority2  
-        msg->grandmasterPri2 = ptp_ctx.parent_dataset.grandmaster_priority2;  
+    if (time) {
+        ptp_put_timestamp(msg->origin_tstamp, time);    // originTimestamp
     }
     return len;
 }
@@ -235,31 +270,20 @@ int create_announce(struct ptp_port_ctx *ctx, char *buf,
 * @param ctx Port context.
 * @param buf Buffer to which frame is created.
 * @param seqid Sequence id.
+* @param time current time used as originTimestamp.
 * @return size of the created frame.
 */
-int create_delay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid)
+int create_delay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                     struct Timestamp *time)
 {
-    struct ptp_delay_req *msg = 0;
+    struct ptp_delay_req *msg = (struct ptp_delay_req *) buf;
     unsigned short len = sizeof(struct ptp_delay_req);
-    struct Timestamp time;
     int64_t delay_asymmetry = 0;
-    int ret = 0;
-
-    DEBUG("\n");
 
-    memset(buf, 0, len);
+    ptp_framer_prepare(ctx);
+    memcpy(msg, &ctx->templates.delay_req, len);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
 
-    // Header fields
-    msg = (struct ptp_delay_req *) buf;
-    msg->hdr.msg_type = PTP_DELAY_REQ;  // ptp message type 
-    msg->hdr.ptp_ver = ctx->port_dataset.version_number;        // version
-    msg->hdr.msg_len = htons(len);      // messageLength
-    msg->hdr.domain_num = ptp_ctx.default_dataset.domain;       // domainNumber
-    // flags
-    msg->hdr.flags = 0;
-    if (ctx->unicast_port) {
-        msg->hdr.flags |= PTP_UNICAST;
-    }
     if( ctx->delay_asymmetry_master_set ){
         if( !memcmp(ctx->delay_asymmetry_master,
                     ctx->current_master,
@@ -270,30 +294,15 @@ int create_delay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid)
     else {
         delay_asymmetry = ctx->delay_asymmetry;
     }
-    // Scale delay asymmetry from ps to ns.sns 
-    delay_asymmetry = (delay_asymmetry << 16)/1000;
-        
-    // correctionField, remove asymmetry
-    msg->hdr.corr_field = htonll( -delay_asymmetry );    
-
-    memcpy(msg->hdr.src_port_id.clock_identity, 
-           ctx->port_dataset.port_identity.clock_identity, 
-           sizeof(ClockIdentity)); // sourcePortIdentity 
-    msg->hdr.src_port_id.port_number =
-        htons(ctx->port_dataset.port_identity.port_number);
-    msg->hdr.seq_id = htons(seqid);
-    msg->hdr.control = PTP_CTRL_DELAY_REQ;      // control 
-    msg->hdr.log_mean_msg_interval = 0x7f;      // logMeanMessageInterval
-
-    // Delay_req msg content (timestamp)
-    ret = ptp_get_time(&ptp_ctx.clk_ctx, &time);
-    if (ret < PTP_ERR_OK) {
-        ERROR("ptp_get_time\n");
-        return ret;
+    if (delay_asymmetry) {
+        // Scale delay asymmetry from ps to ns.sns 
+        delay_asymmetry = (delay_asymmetry << 16)/1000;
+        // correctionField, remove asymmetry
+        ptp_hdr_set_corr_field(&msg->hdr, -delay_asymmetry);
     }
-    ptp_format_timestamp(&time, msg->origin_tstamp);
 
-    DEBUG("%i\n", len);
+    // Delay_req msg content (timestamp)
+    ptp_put_timestamp(msg->origin_tstamp, time);
 
     return len;
 }
@@ -314,42 +323,161 @@ int create_delay_resp(struct ptp_port_ctx *ctx,
                       struct PortIdentity *src_port_id,
                       u16 seqid, u64 corr_field)
 {
-    struct ptp_delay_resp *msg = 0;
+    struct ptp_delay_resp *msg = (struct ptp_delay_resp *) buf;
     unsigned short len = sizeof(struct ptp_delay_resp);
 
-    DEBUG("\n");
-
-    memset(buf, 0, len);
-
-    // Header fields
-    msg = (struct ptp_delay_resp *) buf;
-    msg->hdr.msg_type = PTP_DELAY_RESP; // ptp message type 
-    msg->hdr.ptp_ver = ctx->port_dataset.version_number;        // version
-    msg->hdr.msg_len = htons(len);      // messageLength
-    msg->hdr.domain_num = ptp_ctx.default_dataset.domain;       // domainNumber
-    // flags
-    msg->hdr.flags = 0;
-    if (ctx->unicast_port) {
-        msg->hdr.flags |= PTP_UNICAST;
-    }
-    msg->hdr.corr_field = htonll(corr_field);   // correction field
-    memcpy(msg->hdr.src_port_id.clock_identity, ctx->port_dataset.port_identity.clock_identity, sizeof(ClockIdentity)); // sourcePortIdentity 
-    msg->hdr.src_port_id.port_number =
-        htons(ctx->port_dataset.port_identity.port_number);
-    msg->hdr.seq_id = htons(seqid);     // sequenceId 
-    msg->hdr.control = PTP_CTRL_DELAY_RESP;     // control
-    // logMeanMessageInterval
-    msg->hdr.log_mean_msg_interval =
-        ctx->port_dataset.log_min_mean_delay_req_interval;
+    ptp_framer_prepare(ctx);
+    memcpy(msg, &ctx->templates.delay_resp, len);
+    ptp_hdr_set_corr_field(&msg->hdr, corr_field);      // correction field
+    ptp_put_u16(&msg->hdr.seq_id, seqid);     // sequenceId 
 
     // Delay_resp msg content 
     // Timestamp
-    ptp_format_timestamp(time, msg->recv_tstamp);       // originTimestamp 
+    ptp_put_timestamp(msg->recv_tstamp, time);  // receiveTimestamp 
     // Copy delay_req src port id
-    memcpy(msg->req_port_id.clock_identity,
-           src_port_id->clock_identity, sizeof(ClockIdentity));
-    msg->req_port_id.port_number = htons(src_port_id->port_number);
+    ptp_put_port_id(&msg->req_port_id, src_port_id);
+
+    return len;
+
+}
+
+/**
+* Function for creating PTP Pdelay_Req message.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param seqid Sequence id.
+* @param time current time used as originTimestamp.
+* @return size of the created frame.
+*/
+int create_pdelay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                      struct Timestamp *time)
+{
+    struct ptp_pdelay_req *msg = (struct ptp_pdelay_req *) buf;
+    unsigned short len = sizeof(struct ptp_pdelay_req);
+
+    ptp_framer_prepare(ctx);
+    memcpy(msg, &ctx->templates.pdelay_req, len);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
+
+    ptp_put_timestamp(msg->origin_tstamp, time);        // originTimestamp
+
+    return len;
+}
+
+/**
+* Function for creating PTP Pdelay_Resp message (two-step).
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param time when pdelay_req was recvd
+* @param req_port_id Source port of Pdelay_Req
+* @param seqid Sequence id of Pdelay_Req.
+* @return size of the created frame.
+*/
+int create_pdelay_resp(struct ptp_port_ctx *ctx,
+                       char *buf,
+                       struct Timestamp *time,
+                       struct PortIdentity *req_port_id, u16 seqid)
+{
+    struct ptp_pdelay_resp *msg = (struct ptp_pdelay_resp *) buf;
+    unsigned short len = sizeof(struct ptp_pdelay_resp);
+
+    ptp_framer_prepare(ctx);
+    memcpy(msg, &ctx->templates.pdelay_resp, len);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
+
+    // requestReceiptTimestamp
+    ptp_put_timestamp(msg->recv_tstamp, time);
+    ptp_put_port_id(msg->req_port_id, req_port_id);
+
+    return len;
+}
+
+/**
+* Function for creating PTP Pdelay_Resp_Follow_Up message.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param time when pdelay_resp was sent
+* @param req_port_id Source port of Pdelay_Req
+* @param seqid Sequence id of Pdelay_Req.
+* @param corr_field Correction field of the Pdelay_Req
+* @return size of the created frame.
+*/
+int create_pdelay_resp_follow_up(struct ptp_port_ctx *ctx,
+                                 char *buf,
+                                 struct Timestamp *time,
+                                 struct PortIdentity *req_port_id,
+                                 u16 seqid, s64 corr_field)
+{
+    struct ptp_pdelay_resp_follow_up *msg =
+        (struct ptp_pdelay_resp_follow_up *) buf;
+    unsigned short len = sizeof(struct ptp_pdelay_resp_follow_up);
+
+    ptp_framer_prepare(ctx);
+    memcpy(msg, &ctx->templates.pdelay_resp_follow_up, len);
+    ptp_hdr_set_corr_field(&msg->hdr, corr_field);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
+
+    // responseOriginTimestamp
+    ptp_put_timestamp(msg->resp_origin_tstamp, time);
+    ptp_put_port_id(msg->req_port_id, req_port_id);
 
     return len;
+}
 
+/**
+* Function for creating PTP Management response without TLVs. Response
+* is sent as unicast, TLVs are appended by the caller.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param target_port_id Source port of the request (targetPortIdentity).
+* @param seqid Sequence id of the request.
+* @param hops startingBoundaryHops and boundaryHops.
+* @param action actionField.
+* @return size of the created frame.
+*/
+int create_management(struct ptp_port_ctx *ctx,
+                      char *buf,
+                      struct PortIdentity *target_port_id,
+                      u16 seqid, u8 hops, u8 action)
+{
+    struct ptp_management *msg = (struct ptp_management *) buf;
+    unsigned short len = offsetof(struct ptp_management, tlvs);
+
+    memset(msg, 0, len);
+    build_header(ctx, &msg->hdr, PTP_MANAGEMENT, len, PTP_UNICAST,
+                 PTP_CTRL_MANAGEMENT, PTP_MSG_DEFAULT_INTERVAL);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
+
+    // Management msg content
+    ptp_put_port_id(msg->target_port_id, target_port_id);
+    msg->starting_boundary_hops = hops;
+    msg->boundary_hops = hops;
+    msg->action = action;
+
+    return len;
+}
+
+/**
+* Function for creating PTP Signaling message without TLVs. TLVs are
+* appended and messageLength set by the caller.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param target_port_id targetPortIdentity.
+* @param seqid Sequence id.
+* @return size of the created frame.
+*/
+int create_signaling(struct ptp_port_ctx *ctx,
+                     char *buf,
+                     struct PortIdentity *target_port_id, u16 seqid)
+{
+    struct ptp_signaling *msg = (struct ptp_signaling *) buf;
+    unsigned short len = offsetof(struct ptp_signaling, tlvs);
+
+    memset(msg, 0, len);
+    build_header(ctx, &msg->hdr, PTP_SIGNALING, len, 0,
+                 PTP_CTRL_OTHER, PTP_MSG_DEFAULT_INTERVAL);
+    ptp_put_u16(&msg->hdr.seq_id, seqid);
+    ptp_put_port_id(msg->target_port_id, target_port_id);
+
+    return len;
 }
@@ -0,0 +1,165 @@
+/** @file ptp_log.c
+* Log levels of the log categories.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <ptp_general.h>
+
+/// Longest level specification parsed
+#define PTP_LOG_SPEC_LEN        256
+
+u8 ptp_log_levels[PTP_LOG_NUM] = {[0 ... PTP_LOG_NUM - 1] = LOG_INFO };
+
+static const char *cat_names[PTP_LOG_NUM] = {
+    [PTP_LOG_GENERAL] = "general",
+    [PTP_LOG_PACKET] = "packet",
+    [PTP_LOG_CLOCK] = "clock",
+    [PTP_LOG_FRAMER] = "framer",
+    [PTP_LOG_PORT] = "port",
+    [PTP_LOG_BMC] = "bmc",
+    [PTP_LOG_UNICAST] = "unicast",
+    [PTP_LOG_MGMT] = "mgmt",
+};
+
+/**
+* Get name of a level.
+* @param level LOG_ERR, LOG_INFO or LOG_DEBUG.
+* @return name.
+*/
+static const char *ptp_log_level_name(int level)
+{
+    if (level >= LOG_DEBUG) {
+        return "debug";
+    }
+    if (level >= LOG_INFO) {
+        return "info";
+    }
+    return "err";
+}
+
+/**
+* Get level by name.
+* @param name level name.
+* @return level, -1 if unknown.
+*/
+static int ptp_log_level(const char *name)
+{
+    if (strcmp(name, "debug") == 0) {
+        return LOG_DEBUG;
+    }
+    if (strcmp(name, "info") == 0) {
+        return LOG_INFO;
+    }
+    if (strcmp(name, "err") == 0) {
+        return LOG_ERR;
+    }
+    return -1;
+}
+
+/**
+* Set level of all categories.
+* @param level LOG_ERR, LOG_INFO or LOG_DEBUG.
+*/
+void ptp_log_set_all(int level)
+{
+    int i = 0;
+
+    // Also called from signal handler, only stores are done
+    for (i = 0; i < PTP_LOG_NUM; i++) {
+        __atomic_store_n(&ptp_log_levels[i], level, __ATOMIC_RELAXED);
+    }
+}
+
+/**
+* Set levels of categories.
+* @param spec comma or space separated <category>=<level> pairs, e.g.
+*        "bmc=debug,packet=err". Category "all" sets every category.
+* @return ptp error code, no level is changed on error.
+*/
+int ptp_log_parse(const char *spec)
+{
+    char buf[PTP_LOG_SPEC_LEN];
+    u8 levels[PTP_LOG_NUM];
+    char *save = NULL;
+    char *pair = NULL;
+    char *value = NULL;
+    bool found = false;
+    int i = 0, level = 0;
+
+    if (strlen(spec) >= sizeof(buf)) {
+        return PTP_ERR_GEN;
+    }
+    strcpy(buf, spec);
+    for (i = 0; i < PTP_LOG_NUM; i++) {
+        levels[i] = __atomic_load_n(&ptp_log_levels[i], __ATOMIC_RELAXED);
+    }
+    for (pair = strtok_r(buf, ", \t", &save); pair != NULL;
+         pair = strtok_r(NULL, ", \t", &save)) {
+        value = strchr(pair, '=');
+        if (value == NULL) {
+            return PTP_ERR_GEN;
+        }
+        *value++ = 0;
+        level = ptp_log_level(value);
+        if (level < 0) {
+            return PTP_ERR_GEN;
+        }
+        found = false;
+        for (i = 0; i < PTP_LOG_NUM; i++) {
+            if ((strcmp(pair, "all") == 0) ||
+                (strcmp(pair, cat_names[i]) == 0)) {
+                levels[i] = level;
+                found = true;
+            }
+        }
+        if (!found) {
+            return PTP_ERR_GEN;
+        }
+    }
+    for (i = 0; i < PTP_LOG_NUM; i++) {
+        __atomic_store_n(&ptp_log_levels[i], levels[i], __ATOMIC_RELAXED);
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Print levels of all categories as <category>=<level> pairs.
+* @param buf text is written here.
+* @param len buffer length.
+* @return text length.
+*/
+int ptp_log_print(char *buf, int len)
+{
+    int i = 0, pos = 0;
+
+    buf[0] = 0;
+    for (i = 0; (i < PTP_LOG_NUM) && (pos < len); i++) {
+        pos += snprintf(buf + pos, len - pos, "%s%s=%s", i ? " " : "",
+                        cat_names[i],
+                        ptp_log_level_name(__atomic_load_n
+                                           (&ptp_log_levels[i],
+                                            __ATOMIC_RELAXED)));
+    }
+    return (pos < len) ? pos : len - 1;
+}
@@ -0,0 +1,702 @@
+/** @file ptp_metrics.c
+* Metrics exporter. Instances publish a statistics snapshot once per
+* PTP_METRICS_INTERVAL, the exporter thread serves the latest snapshots
+* in Prometheus text format, so a scrape never waits for an instance.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_MGMT
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp.h"
+#include "ptp_codec.h"
+#include "ptp_metrics.h"
+
+/**
+* Response being built.
+*/
+struct metrics_buf {
+    char *data;                 ///< buffer
+    int size;                   ///< buffer size
+    int len;                    ///< bytes written
+};
+
+/**
+* Counter of a snapshot, found by offset of a u64 field.
+*/
+struct metrics_counter {
+    const char *name;           ///< metric name
+    const char *help;           ///< metric description
+    size_t offset;              ///< offset of the field
+};
+
+/// Counters of an instance
+static const struct metrics_counter instance_counters[] = {
+    {"openptp_servo_sync_samples_total", "Sync samples given to the servo",
+     offsetof(struct ptp_snapshot, servo.sync_samples)},
+    {"openptp_servo_delay_samples_total", "Path delay samples accepted",
+     offsetof(struct ptp_snapshot, servo.delay_samples)},
+    {"openptp_servo_delay_rejected_total", "Path delay samples rejected",
+     offsetof(struct ptp_snapshot, servo.delay_rejected)},
+    {"openptp_servo_steps_total", "Clock steps",
+     offsetof(struct ptp_snapshot, servo.steps)},
+    {"openptp_servo_adjustments_total", "Clock frequency adjustments",
+     offsetof(struct ptp_snapshot, servo.adjustments)},
+    {"openptp_rx_frames_total", "Frames handed to the instance",
+     offsetof(struct ptp_snapshot, rx.frames)},
+    {"openptp_rx_other_domain_total", "Frames of other domains dropped",
+     offsetof(struct ptp_snapshot, rx.other_domain)},
+    {"openptp_rx_truncated_total", "Frames shorter than their type",
+     offsetof(struct ptp_snapshot, rx.truncated)},
+    {"openptp_rx_latency_nanoseconds_total",
+     "Sum of RX thread to instance handoff latencies",
+     offsetof(struct ptp_snapshot, rx.latency_sum_ns)},
+    {"openptp_tc_forwarded_total", "Frames forwarded by transparent clock",
+     offsetof(struct ptp_snapshot, tc_forwarded)},
+};
+
+/**
+* 32-bit value of a snapshot, found by offset of a u32 field.
+*/
+struct metrics_value {
+    const char *name;           ///< metric name
+    const char *type;           ///< counter or gauge
+    const char *help;           ///< metric description
+    size_t offset;              ///< offset of the field
+};
+
+/// RX queue of an instance
+static const struct metrics_value rx_values[] = {
+    {"openptp_rx_queue_depth", "gauge", "Frames queued by the RX thread",
+     offsetof(struct ptp_snapshot, rx.depth)},
+    {"openptp_rx_queue_max_depth", "gauge",
+     "High watermark of frames queued by the RX thread",
+     offsetof(struct ptp_snapshot, rx.max_depth)},
+    {"openptp_rx_queue_dropped_total", "counter",
+     "Frames dropped because the RX queue was full",
+     offsetof(struct ptp_snapshot, rx.dropped)},
+    {"openptp_rx_latency_last_nanoseconds", "gauge",
+     "Latest RX thread to instance handoff latency",
+     offsetof(struct ptp_snapshot, rx.latency_last_ns)},
+    {"openptp_rx_latency_max_nanoseconds", "gauge",
+     "Maximum RX thread to instance handoff latency",
+     offsetof(struct ptp_snapshot, rx.latency_max_ns)},
+};
+
+/// Counters of a port
+static const struct metrics_counter port_counters[] = {
+    {"openptp_port_rx_invalid_total", "Received frames failing validation",
+     offsetof(struct ptp_port_snapshot, counters.rx_invalid)},
+    {"openptp_port_rx_version_total", "Received frames of other versionPTP",
+     offsetof(struct ptp_port_snapshot, counters.rx_version)},
+    {"openptp_port_tx_errors_total", "Frames not sent",
+     offsetof(struct ptp_port_snapshot, counters.tx_errors)},
+    {"openptp_port_state_changes_total", "Port state transitions",
+     offsetof(struct ptp_port_snapshot, counters.state_changes)},
+    {"openptp_port_delay_resp_matched_total",
+     "Delay_Resp received to the latest Delay_Req",
+     offsetof(struct ptp_port_snapshot, delay_resp_matched)},
+    {"openptp_port_delay_resp_late_total",
+     "Delay_Resp received to an earlier Delay_Req",
+     offsetof(struct ptp_port_snapshot, delay_resp_late)},
+    {"openptp_port_delay_resp_unmatched_total",
+     "Delay_Resp received without Delay_Req",
+     offsetof(struct ptp_port_snapshot, delay_resp_unmatched)},
+    {"openptp_port_delay_req_lost_total", "Delay_Req without Delay_Resp",
+     offsetof(struct ptp_port_snapshot, delay_req_lost)},
+    {"openptp_port_delay_req_accepted_total", "Delay_Req answered as master",
+     offsetof(struct ptp_port_snapshot, delay_req_accepted)},
+    {"openptp_port_delay_req_over_rate_total",
+     "Delay_Req dropped over requester rate",
+     offsetof(struct ptp_port_snapshot, delay_req_over_rate)},
+    {"openptp_port_delay_resp_sent_total", "Delay_Resp sent as master",
+     offsetof(struct ptp_port_snapshot, delay_resp.sent)},
+    {"openptp_port_delay_resp_dropped_total", "Delay_Resp dropped as master",
+     offsetof(struct ptp_port_snapshot, delay_resp.dropped)},
+};
+
+/// sequenceId counters of a port, by offset in struct ptp_seq_counters
+static const struct metrics_counter seq_counters[] = {
+    {"openptp_port_sequence_gaps_total", "Gaps in received sequenceId",
+     offsetof(struct ptp_seq_counters, gaps)},
+    {"openptp_port_sequence_lost_total", "Messages missing from gaps",
+     offsetof(struct ptp_seq_counters, lost)},
+    {"openptp_port_sequence_duplicates_total", "Duplicate messages",
+     offsetof(struct ptp_seq_counters, duplicates)},
+    {"openptp_port_sequence_reordered_total", "Messages received late",
+     offsetof(struct ptp_seq_counters, reordered)},
+    {"openptp_port_sequence_restarts_total", "Sender sequence restarts",
+     offsetof(struct ptp_seq_counters, restarts)},
+};
+
+static struct ptp_metrics_slot slots[MAX_NUM_INSTANCES];
+static int num_slots = 0;
+/// Copies of the snapshots, used by exporter thread only
+static struct ptp_snapshot copies[MAX_NUM_INSTANCES];
+static char response[PTP_METRICS_BUF_LEN];
+
+static int listen_sock = -1;
+static int stop_fd = -1;
+static pthread_t exporter_thread;
+
+static void *ptp_metrics_thread(void *arg);
+
+#define METRICS_U64(base, offset) (*(u64 *) ((char *) (base) + (offset)))
+#define METRICS_U32(base, offset) (*(u32 *) ((char *) (base) + (offset)))
+
+/**
+* Reserve snapshot slots of the instances. Snapshots are published when
+* the exporter or the control socket is used.
+* @param num_instances number of instances publishing snapshots.
+*/
+void ptp_metrics_init(int num_instances)
+{
+    memset(slots, 0, sizeof(slots));
+    num_slots = num_instances;
+}
+
+/**
+* Start exporter thread serving metrics in Prometheus text format over
+* HTTP on a localhost TCP port. Must be called before the instances run.
+* @param port TCP port.
+* @return ptp error code.
+*/
+int ptp_metrics_start(int port)
+{
+    struct sockaddr_in addr;
+    int on = 1, ret = 0;
+
+    listen_sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (listen_sock < 0) {
+        perror("socket");
+        return PTP_ERR_NET;
+    }
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(listen_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) ||
+        (listen(listen_sock, 8) < 0)) {
+        ERROR("Metrics port %i: %s\n", port, strerror(errno));
+        close(listen_sock);
+        listen_sock = -1;
+        return PTP_ERR_NET;
+    }
+    stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (stop_fd < 0) {
+        perror("eventfd");
+        close(listen_sock);
+        listen_sock = -1;
+        return PTP_ERR_GEN;
+    }
+    ret = pthread_create(&exporter_thread, NULL, ptp_metrics_thread, NULL);
+    if (ret != 0) {
+        ERROR("pthread_create %s\n", strerror(ret));
+        close(stop_fd);
+        close(listen_sock);
+        listen_sock = -1;
+        return PTP_ERR_GEN;
+    }
+    INFO("Metrics served on 127.0.0.1:%i\n", port);
+    return PTP_ERR_OK;
+}
+
+/**
+* Stop exporter thread.
+*/
+void ptp_metrics_stop(void)
+{
+    u64 stop = 1;
+
+    if (listen_sock < 0) {
+        return;
+    }
+    if (write(stop_fd, &stop, sizeof(u64)) < 0) {
+        perror("write");
+    }
+    pthread_join(exporter_thread, NULL);
+    close(stop_fd);
+    close(listen_sock);
+    listen_sock = -1;
+}
+
+/**
+* Get snapshot slot of an instance.
+* @param instance index of the instance.
+* @return slot, NULL if snapshots are not published.
+*/
+struct ptp_metrics_slot *ptp_metrics_slot(int instance)
+{
+    if ((instance < 0) || (instance >= num_slots)) {
+        return NULL;
+    }
+    return &slots[instance];
+}
+
+/**
+* Publish snapshot of an instance when it is due. Called from the
+* instance thread.
+* @param ptp_ctx PTP instance.
+* @param current_time current time.
+* @param next_time moved earlier if a snapshot is due sooner.
+*/
+void ptp_metrics_run(struct ptp_ctx *ptp_ctx,
+                     struct Timestamp *current_time,
+                     struct Timestamp *next_time)
+{
+    struct ptp_metrics_slot *slot = ptp_ctx->metrics;
+    struct Timestamp interval = { PTP_METRICS_INTERVAL, 0, 0 };
+
+    if (older_timestamp(current_time, &ptp_ctx->metrics_timer) ==
+        current_time) {
+        // Not due yet
+        if (older_timestamp(&ptp_ctx->metrics_timer, next_time) ==
+            &ptp_ctx->metrics_timer) {
+            copy_timestamp(next_time, &ptp_ctx->metrics_timer);
+        }
+        return;
+    }
+    // Odd sequence tells the exporter the snapshot is being written
+    __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ptp_stats_snapshot(ptp_ctx, &slot->snap);
+    slot->valid = true;
+    __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+
+    copy_timestamp(&ptp_ctx->metrics_timer, current_time);
+    inc_timestamp(&ptp_ctx->metrics_timer, &interval);
+    if (older_timestamp(&ptp_ctx->metrics_timer, next_time) ==
+        &ptp_ctx->metrics_timer) {
+        copy_timestamp(next_time, &ptp_ctx->metrics_timer);
+    }
+}
+
+/**
+* Copy latest snapshot of an instance without waiting for it.
+* @param instance index of the instance.
+* @param snap snapshot is copied here.
+* @return true if a consistent snapshot was copied.
+*/
+bool ptp_metrics_read(int instance, struct ptp_snapshot *snap)
+{
+    struct ptp_metrics_slot *slot = ptp_metrics_slot(instance);
+    u32 sequence = 0;
+    int retry = 0;
+    bool valid = false;
+
+    if (slot == NULL) {
+        return false;
+    }
+    for (retry = 0; retry < PTP_METRICS_RETRIES; retry++) {
+        sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (sequence & 1) {
+            sched_yield();
+            continue;
+        }
+        valid = slot->valid;
+        memcpy(snap, &slot->snap, sizeof(struct ptp_snapshot));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == sequence) {
+            return valid;
+        }
+    }
+    return false;
+}
+
+/**
+* Append to response.
+* @param buf response.
+* @param fmt printf format.
+*/
+static void metrics_printf(struct metrics_buf *buf, const char *fmt, ...)
+{
+    va_list args;
+    int len = 0;
+
+    if (buf->len >= buf->size) {
+        return;
+    }
+    va_start(args, fmt);
+    len = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, args);
+    va_end(args);
+    buf->len += len;
+    if (buf->len > buf->size) {
+        buf->len = buf->size;
+    }
+}
+
+/**
+* Append HELP and TYPE lines of a metric.
+* @param buf response.
+* @param name metric name.
+* @param type counter or gauge.
+* @param help description.
+*/
+static void metrics_header(struct metrics_buf *buf, const char *name,
+                           const char *type, const char *help)
+{
+    metrics_printf(buf, "# HELP %s %s\n# TYPE %s %s\n",
+                   name, help, name, type);
+}
+
+/**
+* Append 2^-16 scaled value with three decimals.
+* @param buf response.
+* @param value scaled value.
+*/
+static void metrics_scaled(struct metrics_buf *buf, s64 value)
+{
+    u64 abs = (value < 0) ? -value : value;
+
+    metrics_printf(buf, "%s%llu.%03llu\n", (value < 0) ? "-" : "",
+                   abs >> 16, ((abs & 0xffff) * 1000) >> 16);
+}
+
+/**
+* Append labels of a port.
+* @param buf response.
+* @param snap statistics of the instance.
+* @param port statistics of the port.
+*/
+static void metrics_port_labels(struct metrics_buf *buf,
+                                struct ptp_snapshot *snap,
+                                struct ptp_port_snapshot *port)
+{
+    metrics_printf(buf, "domain=\"%i\",port=\"%i\",interface=\"%s%s\"",
+                   snap->domain, port->port_number, port->name,
+                   port->unicast_port ? "/unicast" : "");
+}
+
+/**
+* Build response from the snapshots.
+* @param buf response.
+* @param valid snapshots which were copied.
+*/
+static void ptp_metrics_format(struct metrics_buf *buf, bool *valid)
+{
+    struct ptp_snapshot *snap = NULL;
+    struct ptp_port_snapshot *port = NULL;
+    int i = 0, j = 0, k = 0, type = 0;
+
+    metrics_header(buf, "openptp_snapshot_timestamp_seconds", "gauge",
+                   "Clock time of the latest snapshot");
+    for (i = 0; i < num_slots; i++) {
+        if (valid[i]) {
+            metrics_printf(buf, "openptp_snapshot_timestamp_seconds"
+                           "{domain=\"%i\"} %llu\n", copies[i].domain,
+                           copies[i].time.seconds);
+        }
+    }
+    metrics_header(buf, "openptp_parent_info", "gauge",
+                   "Parent port and grandmaster selected by BMC");
+    for (i = 0; i < num_slots; i++) {
+        if (valid[i]) {
+            snap = &copies[i];
+            metrics_printf(buf, "openptp_parent_info{domain=\"%i\","
+                           "clock=\"%s\",", snap->domain,
+                           ptp_clk_id(snap->clock_identity));
+            metrics_printf(buf, "parent=\"%s\",parent_port=\"%i\",",
+                           ptp_clk_id(snap->parent.clock_identity),
+                           snap->parent.port_number);
+            metrics_printf(buf, "grandmaster=\"%s\"} 1\n",
+                           ptp_clk_id(snap->grandmaster));
+        }
+    }
+    metrics_header(buf, "openptp_steps_removed", "gauge",
+                   "Boundary clocks between the grandmaster and clock");
+    for (i = 0; i < num_slots; i++) {
+        if (valid[i]) {
+            metrics_printf(buf, "openptp_steps_removed{domain=\"%i\"} %u\n",
+                           copies[i].domain, copies[i].steps_removed);
+        }
+    }
+    metrics_header(buf, "openptp_offset_from_master_nanoseconds", "gauge",
+                   "Offset from master");
+    for (i = 0; i < num_slots; i++) {
+        if (valid[i]) {
+            metrics_printf(buf, "openptp_offset_from_master_nanoseconds"
+                           "{domain=\"%i\"} ", copies[i].domain);
+            metrics_scaled(buf, copies[i].offset_from_master);
+        }
+    }
+    metrics_header(buf, "openptp_mean_path_delay_nanoseconds", "gauge",
+                   "Mean path delay to master");
+    for (i = 0; i < num_slots; i++) {
+        if (valid[i]) {
+            metrics_printf(buf, "openptp_mean_path_delay_nanoseconds"
+                           "{domain=\"%i\"} ", copies[i].domain);
+            metrics_scaled(buf, copies[i].mean_path_delay);
+        }
+    }
+    metrics_header(buf, "openptp_frequency_adjustment_ppb", "gauge",
+                   "Latest frequency adjustment of the servo");
+    for (i = 0; i < num_slots; i++) {
+        if (valid[i]) {
+            metrics_printf(buf, "openptp_frequency_adjustment_ppb"
+                           "{domain=\"%i\",discipline=\"%i\"} ",
+                           copies[i].domain, copies[i].servo.discipline);
+            metrics_scaled(buf, copies[i].servo.freq * 1000);
+        }
+    }
+    for (k = 0; k < sizeof(instance_counters) /
+         sizeof(instance_counters[0]); k++) {
+        metrics_header(buf, instance_counters[k].name, "counter",
+                       instance_counters[k].help);
+        for (i = 0; i < num_slots; i++) {
+            if (valid[i]) {
+                metrics_printf(buf, "%s{domain=\"%i\"} %llu\n",
+                               instance_counters[k].name, copies[i].domain,
+                               METRICS_U64(&copies[i],
+                                           instance_counters[k].offset));
+            }
+        }
+    }
+    for (k = 0; k < sizeof(rx_values) / sizeof(rx_values[0]); k++) {
+        metrics_header(buf, rx_values[k].name, rx_values[k].type,
+                       rx_values[k].help);
+        for (i = 0; i < num_slots; i++) {
+            if (valid[i]) {
+                metrics_printf(buf, "%s{domain=\"%i\"} %u\n",
+                               rx_values[k].name, copies[i].domain,
+                               METRICS_U32(&copies[i],
+                                           rx_values[k].offset));
+            }
+        }
+    }
+
+    metrics_header(buf, "openptp_port_state", "gauge",
+                   "Port state: 0 INITIALIZING 1 FAULTY 2 DISABLED "
+                   "3 LISTENING 4 PRE_MASTER 5 MASTER 6 PASSIVE "
+                   "7 UNCALIBRATED 8 SLAVE");
+    for (i = 0; i < num_slots; i++) {
+        for (j = 0; valid[i] && (j < copies[i].num_ports); j++) {
+            port = &copies[i].ports[j];
+            metrics_printf(buf, "openptp_port_state{");
+            metrics_port_labels(buf, &copies[i], port);
+            metrics_printf(buf, "} %i\n", port->state);
+        }
+    }
+    metrics_header(buf, "openptp_port_rx_total", "counter",
+                   "Frames received by messageType");
+    for (i = 0; i < num_slots; i++) {
+        for (j = 0; valid[i] && (j < copies[i].num_ports); j++) {
+            port = &copies[i].ports[j];
+            for (type = 0; type < PTP_NUM_MSG_TYPES; type++) {
+                if (port->counters.rx[type] || port->counters.tx[type]) {
+                    metrics_printf(buf, "openptp_port_rx_total{");
+                    metrics_port_labels(buf, &copies[i], port);
+                    metrics_printf(buf, ",type=\"%s\"} %llu\n",
+                                   ptp_msg_name(type),
+                                   port->counters.rx[type]);
+                }
+            }
+        }
+    }
+    metrics_header(buf, "openptp_port_tx_total", "counter",
+                   "Frames sent by messageType");
+    for (i = 0; i < num_slots; i++) {
+        for (j = 0; valid[i] && (j < copies[i].num_ports); j++) {
+            port = &copies[i].ports[j];
+            for (type = 0; type < PTP_NUM_MSG_TYPES; type++) {
+                if (port->counters.rx[type] || port->counters.tx[type]) {
+                    metrics_printf(buf, "openptp_port_tx_total{");
+                    metrics_port_labels(buf, &copies[i], port);
+                    metrics_printf(buf, ",type=\"%s\"} %llu\n",
+                                   ptp_msg_name(type),
+                                   port->counters.tx[type]);
+                }
+            }
+        }
+    }
+    for (k = 0; k < sizeof(port_counters) / sizeof(port_counters[0]); k++) {
+        metrics_header(buf, port_counters[k].name, "counter",
+                       port_counters[k].help);
+        for (i = 0; i < num_slots; i++) {
+            for (j = 0; valid[i] && (j < copies[i].num_ports); j++) {
+                port = &copies[i].ports[j];
+                metrics_printf(buf, "%s{", port_counters[k].name);
+                metrics_port_labels(buf, &copies[i], port);
+                metrics_printf(buf, "} %llu\n",
+                               METRICS_U64(port, port_counters[k].offset));
+            }
+        }
+    }
+    metrics_header(buf, "openptp_port_delay_req_offender_dropped_total",
+                   "counter", "Delay_Req dropped over rate of the worst "
+                   "requesters");
+    for (i = 0; i < num_slots; i++) {
+        for (j = 0; valid[i] && (j < copies[i].num_ports); j++) {
+            port = &copies[i].ports[j];
+            for (k = 0; k < port->num_offenders; k++) {
+                metrics_printf(buf, "openptp_port_delay_req_offender_"
+                               "dropped_total{");
+                metrics_port_labels(buf, &copies[i], port);
+                metrics_printf(buf, ",peer=\"%s\",clock=\"%s\"} %u\n",
+                               port->offenders[k].addr,
+                               ptp_clk_id(port->offenders[k].port_id.
+                                          clock_identity),
+                               port->offenders[k].dropped);
+            }
+        }
+    }
+    for (k = 0; k < sizeof(seq_counters) / sizeof(seq_counters[0]); k++) {
+        metrics_header(buf, seq_counters[k].name, "counter",
+                       seq_counters[k].help);
+        for (i = 0; i < num_slots; i++) {
+            for (j = 0; valid[i] && (j < copies[i].num_ports); j++) {
+                port = &copies[i].ports[j];
+                for (type = 0; type < PTP_SEQ_NUM_TYPES; type++) {
+                    metrics_printf(buf, "%s{", seq_counters[k].name);
+                    metrics_port_labels(buf, &copies[i], port);
+                    metrics_printf(buf, ",type=\"%s\"} %llu\n",
+                                   ptp_seq_type_name(type),
+                                   METRICS_U64(&port->seq[type],
+                                               seq_counters[k].offset));
+                }
+            }
+        }
+    }
+}
+
+/**
+* Send all of a buffer to a client.
+* @param sock client socket.
+* @param data buffer.
+* @param len length.
+* @return ptp error code.
+*/
+static int metrics_send(int sock, const char *data, int len)
+{
+    int ret = 0;
+
+    while (len > 0) {
+        ret = send(sock, data, len, MSG_NOSIGNAL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return PTP_ERR_NET;
+        }
+        data += ret;
+        len -= ret;
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Serve one HTTP request. Only GET of / and /metrics is supported.
+* @param sock client socket.
+*/
+static void ptp_metrics_serve(int sock)
+{
+    struct metrics_buf buf = { response, sizeof(response), 0 };
+    bool valid[MAX_NUM_INSTANCES];
+    char request[512];
+    char header[160];
+    struct timeval tv = { 1, 0 };
+    int len = 0, i = 0;
+
+    // A client which does not send its request is not waited for long
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    len = recv(sock, request, sizeof(request) - 1, 0);
+    if (len <= 0) {
+        return;
+    }
+    request[len] = 0;
+    if ((strncmp(request, "GET / ", 6) != 0) &&
+        (strncmp(request, "GET /metrics ", 13) != 0) &&
+        (strncmp(request, "GET /metrics?", 13) != 0)) {
+        len = snprintf(header, sizeof(header), "HTTP/1.0 404 Not Found\r\n"
+                       "Content-Length: 0\r\nConnection: close\r\n\r\n");
+        metrics_send(sock, header, len);
+        return;
+    }
+
+    for (i = 0; i < num_slots; i++) {
+        valid[i] = ptp_metrics_read(i, &copies[i]);
+    }
+    ptp_metrics_format(&buf, valid);
+    if (buf.len >= buf.size) {
+        ERROR("Metrics truncated to %i bytes\n", buf.size);
+    }
+
+    len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: %i\r\nConnection: close\r\n\r\n",
+                   buf.len);
+    if (metrics_send(sock, header, len) == PTP_ERR_OK) {
+        metrics_send(sock, buf.data, buf.len);
+    }
+}
+
+/**
+* Exporter thread. Serves clients one at a time from the published
+* snapshots, instances are never waited for.
+* @param arg not used.
+* @return NULL.
+*/
+static void *ptp_metrics_thread(void *arg)
+{
+    fd_set rd_fd;
+    int sock = -1, ret = 0;
+
+    while (1) {
+        FD_ZERO(&rd_fd);
+        FD_SET(listen_sock, &rd_fd);
+        FD_SET(stop_fd, &rd_fd);
+        ret = select(ptp_max(listen_sock, stop_fd) + 1, &rd_fd, 0, 0, NULL);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("select");
+            break;
+        }
+        if (FD_ISSET(stop_fd, &rd_fd)) {
+            break;
+        }
+        sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0) {
+            continue;
+        }
+        ptp_metrics_serve(sock);
+        close(sock);
+    }
+    return NULL;
+}
@@ -0,0 +1,376 @@
+/** @file ptp_mgmt.c
+* PTP management messages.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_MGMT
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_framer.h"
+#include "ptp_codec.h"
+#include "ptp_mgmt.h"
+
+/// portNumber of targetPortIdentity targeting all ports
+#define PTP_MGMT_ALL_PORTS      0xFFFF
+/// Accepted range of log message intervals set by management
+#define PTP_MGMT_LOG_INTERVAL_MIN   -7
+#define PTP_MGMT_LOG_INTERVAL_MAX   7
+/// Smallest accepted announceReceiptTimeout
+#define PTP_MGMT_RECEIPT_TIMEOUT_MIN    2
+
+/**
+* Check if targetPortIdentity clockIdentity targets this clock.
+* @param ptp_ctx PTP instance.
+* @param clock_id clockIdentity of targetPortIdentity.
+* @return true if this clock is targeted.
+*/
+static bool ptp_mgmt_target_clock(struct ptp_ctx *ptp_ctx, u8 * clock_id)
+{
+    int i = 0;
+
+    for (i = 0; i < sizeof(ClockIdentity); i++) {
+        if (clock_id[i] != 0xff) {
+            break;
+        }
+    }
+    if (i == sizeof(ClockIdentity)) {
+        return true;
+    }
+    return (compare_clock_id(clock_id,
+                             ptp_ctx->default_dataset.clock_identity) == 0);
+}
+
+/**
+* Write clock quality.
+* @param buf buffer.
+* @param quality clock quality.
+*/
+static void ptp_mgmt_put_quality(u8 * buf, struct ClockQuality *quality)
+{
+    buf[0] = quality->clock_class;
+    buf[1] = quality->clock_accuracy;
+    ptp_put_u16(buf + 2, quality->offset_scaled_log_variance);
+}
+
+/**
+* Encode dataField of a managementId.
+* @param ctx Port context, source of port datasets.
+* @param id managementId.
+* @param data buffer of PTP_MGMT_DATA_MAX octets.
+*/
+static void ptp_mgmt_get(struct ptp_port_ctx *ctx, u16 id, u8 * data)
+{
+    struct ptp_ctx *ptp_ctx = ctx->ptp;
+    struct DefaultDataSet *def = &ptp_ctx->default_dataset;
+    struct ParentDataSet *parent = &ptp_ctx->parent_dataset;
+    struct TimeProperitiesDataSet *time = &ptp_ctx->time_dataset;
+    struct PortDataSet *port = &ctx->port_dataset;
+
+    memset(data, 0, PTP_MGMT_DATA_MAX);
+    switch (id) {
+    case PTP_MGMT_DEFAULT_DATA_SET:
+        data[0] = (def->two_step_clock ? 0x01 : 0) |
+            (def->slave_only ? 0x02 : 0);
+        ptp_put_u16(data + 2, def->num_ports);
+        data[4] = def->priority1;
+        ptp_mgmt_put_quality(data + 5, &def->clock_quality);
+        data[9] = def->priority2;
+        memcpy(data + 10, def->clock_identity, sizeof(ClockIdentity));
+        data[18] = def->domain;
+        break;
+    case PTP_MGMT_CURRENT_DATA_SET:
+        ptp_put_u16(data, ptp_ctx->current_dataset.steps_removed);
+        ptp_put_u64(data + 2, ptp_ctx->current_dataset.offset_from_master.
+                    scaled_nanoseconds);
+        ptp_put_u64(data + 10, ptp_ctx->current_dataset.mean_path_delay.
+                    scaled_nanoseconds);
+        break;
+    case PTP_MGMT_PARENT_DATA_SET:
+        ptp_put_port_id(data, &parent->parent_port_identity);
+        data[10] = parent->parent_stats ? 0x01 : 0;
+        ptp_put_u16(data + 12,
+                    parent->observed_parent_offset_scaled_log_variance);
+        ptp_put_u32(data + 14,
+                    parent->observed_parent_clock_phase_change_rate);
+        data[18] = parent->grandmaster_priority1;
+        ptp_mgmt_put_quality(data + 19, &parent->grandmaster_clock_quality);
+        data[23] = parent->grandmaster_priority2;
+        memcpy(data + 24, parent->grandmaster_identity,
+               sizeof(ClockIdentity));
+        break;
+    case PTP_MGMT_TIME_PROPERTIES_DATA_SET:
+        ptp_put_u16(data, time->current_utc_offset);
+        data[2] = (time->leap_61 ? 0x01 : 0) |
+            (time->leap_59 ? 0x02 : 0) |
+            (time->current_utc_offset_valid ? 0x04 : 0) |
+            (time->ptp_timescale ? 0x08 : 0) |
+            (time->time_traceable ? 0x10 : 0) |
+            (time->frequency_traceable ? 0x20 : 0);
+        data[3] = time->time_source;
+        break;
+    case PTP_MGMT_PORT_DATA_SET:
+        ptp_put_port_id(data, &port->port_identity);
+        // portState enumeration starts from INITIALIZING = 1
+        data[10] = port->port_state + 1;
+        data[11] = port->log_min_mean_delay_req_interval;
+        ptp_put_u64(data + 12, port->peer_mean_path_delay.scaled_nanoseconds);
+        data[20] = port->log_mean_announce_interval;
+        data[21] = port->announce_receipt_timeout;
+        data[22] = port->log_mean_sync_interval;
+        data[23] = port->delay_mechanism;
+        data[24] = port->log_min_mean_pdelay_req_interval;
+        data[25] = port->version_number & 0x0f;
+        break;
+    case PTP_MGMT_PRIORITY1:
+        data[0] = def->priority1;
+        break;
+    case PTP_MGMT_PRIORITY2:
+        data[0] = def->priority2;
+        break;
+    case PTP_MGMT_DOMAIN:
+        data[0] = def->domain;
+        break;
+    case PTP_MGMT_SLAVE_ONLY:
+        data[0] = def->slave_only ? 0x01 : 0;
+        break;
+    case PTP_MGMT_LOG_ANNOUNCE_INTERVAL:
+        data[0] = port->log_mean_announce_interval;
+        break;
+    case PTP_MGMT_ANNOUNCE_RECEIPT_TIMEOUT:
+        data[0] = port->announce_receipt_timeout;
+        break;
+    case PTP_MGMT_LOG_SYNC_INTERVAL:
+        data[0] = port->log_mean_sync_interval;
+        break;
+    case PTP_MGMT_VERSION_NUMBER:
+        data[0] = port->version_number & 0x0f;
+        break;
+    case PTP_MGMT_DELAY_MECHANISM:
+        data[0] = port->delay_mechanism;
+        break;
+    case PTP_MGMT_LOG_MIN_PDELAY_REQ_INTERVAL:
+        data[0] = port->log_min_mean_pdelay_req_interval;
+        break;
+    }
+}
+
+/**
+* Apply dataField of a SET. Changed values are used in the following
+* messages and timer restarts.
+* @param ctx Port context, target of port datasets.
+* @param id settable managementId.
+* @param data dataField.
+* @return 0 if value was set, otherwise managementErrorId.
+*/
+static u16 ptp_mgmt_set(struct ptp_port_ctx *ctx, u16 id, u8 * data)
+{
+    struct PortDataSet *port = &ctx->port_dataset;
+    s8 interval = (s8) data[0];
+
+    switch (id) {
+    case PTP_MGMT_LOG_ANNOUNCE_INTERVAL:
+    case PTP_MGMT_LOG_SYNC_INTERVAL:
+    case PTP_MGMT_LOG_MIN_PDELAY_REQ_INTERVAL:
+        if ((interval < PTP_MGMT_LOG_INTERVAL_MIN) ||
+            (interval > PTP_MGMT_LOG_INTERVAL_MAX)) {
+            return PTP_MGMT_ERR_WRONG_VALUE;
+        }
+        break;
+    case PTP_MGMT_ANNOUNCE_RECEIPT_TIMEOUT:
+        if (data[0] < PTP_MGMT_RECEIPT_TIMEOUT_MIN) {
+            return PTP_MGMT_ERR_WRONG_VALUE;
+        }
+        break;
+    }
+
+    switch (id) {
+    case PTP_MGMT_PRIORITY1:
+        ctx->ptp->default_dataset.priority1 = data[0];
+        break;
+    case PTP_MGMT_PRIORITY2:
+        ctx->ptp->default_dataset.priority2 = data[0];
+        break;
+    case PTP_MGMT_LOG_ANNOUNCE_INTERVAL:
+        port->log_mean_announce_interval = interval;
+        break;
+    case PTP_MGMT_ANNOUNCE_RECEIPT_TIMEOUT:
+        port->announce_receipt_timeout = data[0];
+        break;
+    case PTP_MGMT_LOG_SYNC_INTERVAL:
+        port->log_mean_sync_interval = interval;
+        break;
+    case PTP_MGMT_LOG_MIN_PDELAY_REQ_INTERVAL:
+        port->log_min_mean_pdelay_req_interval = interval;
+        break;
+    default:
+        return PTP_MGMT_ERR_NOT_SETABLE;
+    }
+    DEBUG("SET %s %i\n", ptp_mgmt_lookup(id)->name, (s8) data[0]);
+    // Prebuilt messages carry priorities and intervals
+    ptp_framer_invalidate(ctx->ptp);
+    return 0;
+}
+
+/**
+* Send management response to the requester.
+* @param ctx Port context the request was received from.
+* @param port Port context of the responding port.
+* @param req management request.
+* @param action actionField of the response.
+* @param id managementId.
+* @param error managementErrorId, 0 to respond with dataField.
+*/
+static void ptp_mgmt_respond(struct ptp_port_ctx *ctx,
+                             struct ptp_port_ctx *port,
+                             struct ptp_management *req,
+                             u8 action, u16 id, u16 error)
+{
+    char frame[PTP_MGMT_FRAME_LEN];
+    struct PortIdentity requester;
+    u8 *tlv = NULL;
+    u8 hops = 0;
+    int data_len = 0;
+    int len = 0;
+
+    ptp_get_port_id(&requester, &req->hdr.src_port_id);
+    if (req->starting_boundary_hops > req->boundary_hops) {
+        hops = req->starting_boundary_hops - req->boundary_hops;
+    }
+    len = create_management(port, frame, &requester,
+                            ptp_hdr_seq_id(&req->hdr), hops, action);
+    tlv = (u8 *) frame + len;
+    if (error) {
+        ptp_put_u16(tlv, MANAGEMENT_ERROR_STATUS);
+        ptp_put_u16(tlv + 2, PTP_MGMT_ERR_LEN);
+        ptp_put_u16(tlv + 4, error);
+        ptp_put_u16(tlv + 6, id);
+        memset(tlv + 8, 0, PTP_MGMT_ERR_LEN - 4);
+        len += PTP_TLV_HDR_LEN + PTP_MGMT_ERR_LEN;
+    } else {
+        data_len = ptp_mgmt_lookup(id)->len;
+        ptp_put_u16(tlv, MANAGEMENT);
+        ptp_put_u16(tlv + 2, PTP_MGMT_ID_LEN + data_len);
+        ptp_put_u16(tlv + 4, id);
+        ptp_mgmt_get(port, id, tlv + PTP_TLV_HDR_LEN + PTP_MGMT_ID_LEN);
+        len += PTP_TLV_HDR_LEN + PTP_MGMT_ID_LEN + data_len;
+    }
+    ptp_put_u16(&((struct ptp_header *) frame)->msg_len, len);
+
+    if (ptp_send_reply(&ctx->ptp->pkt_ctx,
+                       ctx->port_dataset.port_identity.port_number,
+                       frame, len) != PTP_ERR_OK) {
+        ERROR("Management response 0x%04x failed\n", id);
+        ptp_count_tx(&ctx->counters, PTP_MANAGEMENT, 1, true);
+    } else {
+        ptp_count_tx(&ctx->counters, PTP_MANAGEMENT, 1, false);
+    }
+}
+
+/**
+* Handle received management message. GET, SET and COMMAND actions
+* targeted to this clock are answered with a unicast response to the
+* sender, other actions are ignored.
+* @param ctx Port context the message was received from.
+* @param buf management message validated with ptp_msg_check().
+* @param len msg length.
+*/
+void ptp_mgmt_recv(struct ptp_port_ctx *ctx, char *buf, int len)
+{
+    struct ptp_management *msg = ptp_view_management(buf);
+    const struct ptp_mgmt_info *info = NULL;
+    struct ptp_port_ctx *port = NULL;
+    struct PortIdentity target;
+    struct ptp_tlv tlv;
+    int offset = 0;
+    int scope = PTP_MGMT_CLOCK;
+    u8 action = msg->action & 0x0f;
+    u8 resp_action = PTP_MGMT_RESPONSE;
+    u16 error = 0;
+    u16 port_error = 0;
+    u16 id = 0;
+
+    ptp_get_port_id(&target, msg->target_port_id);
+    if (!ptp_mgmt_target_clock(ctx->ptp, target.clock_identity)) {
+        return;
+    }
+    if ((action != PTP_MGMT_GET) && (action != PTP_MGMT_SET) &&
+        (action != PTP_MGMT_COMMAND)) {
+        return;
+    }
+    if (!ptp_tlv_next(buf, &offset, &tlv) || (tlv.type != MANAGEMENT) ||
+        (tlv.length < PTP_MGMT_ID_LEN)) {
+        DEBUG("No management TLV\n");
+        return;
+    }
+    id = ptp_get_u16(tlv.value);
+    info = ptp_mgmt_lookup(id);
+    DEBUG("Management action %i id 0x%04x port %i\n",
+          action, id, target.port_number);
+
+    if (info == NULL) {
+        error = PTP_MGMT_ERR_NO_SUCH_ID;
+    } else if (action == PTP_MGMT_COMMAND) {
+        // NULL_MANAGEMENT is the only supported command
+        if (id != PTP_MGMT_NULL_MANAGEMENT) {
+            error = PTP_MGMT_ERR_NOT_SUPPORTED;
+        }
+        resp_action = PTP_MGMT_ACKNOWLEDGE;
+    } else if (action == PTP_MGMT_SET) {
+        // Any host on the segment can send SET, it is off by default
+        if (!ctx->ptp->cfg.management_set) {
+            error = PTP_MGMT_ERR_NOT_SUPPORTED;
+        } else if (!info->settable) {
+            error = PTP_MGMT_ERR_NOT_SETABLE;
+        } else if (tlv.length != PTP_MGMT_ID_LEN + info->len) {
+            error = PTP_MGMT_ERR_WRONG_LENGTH;
+        }
+    }
+    if (info) {
+        scope = info->scope;
+    }
+
+    // Clock is answered once, port datasets by every targeted port
+    for (port = ctx->ptp->ports_list_head; port != NULL; port = port->next) {
+        if (scope == PTP_MGMT_CLOCK) {
+            if (port != ctx) {
+                continue;
+            }
+        } else if ((target.port_number != PTP_MGMT_ALL_PORTS) &&
+                   (target.port_number !=
+                    port->port_dataset.port_identity.port_number)) {
+            continue;
+        }
+        // Failure on one port does not stop SET of the others
+        port_error = error;
+        if ((port_error == 0) && (action == PTP_MGMT_SET)) {
+            port_error = ptp_mgmt_set(port, id, tlv.value + PTP_MGMT_ID_LEN);
+        }
+        ptp_mgmt_respond(ctx, port, msg, resp_action, id, port_error);
+    }
+}
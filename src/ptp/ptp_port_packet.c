@@ -24,28 +24,109 @@
 /******************************************************************************
 * $Id$
 ******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_PORT
+
 #include "ptp.h"
 #include "ptp_general.h"
 #include "ptp_internal.h"
 #include "ptp_message.h"
 #include "ptp_port.h"
 #include "ptp_framer.h"
+#include "ptp_codec.h"
+#include "ptp_foreign.h"
+#include "ptp_tc.h"
+#include "ptp_trace.h"
+
+/**
+* Reserve port contexts (with their foreign master tables, Delay_Resp
+* queues and Delay_Req requester tables) and the unicast session table
+* from the arena.
+* Port contexts are taken from this pool when ports are created and 
+* returned when ports are closed.
+* @param ptp_ctx main context.
+* @return ptp error code.
+*/
+int ptp_port_pool_init(struct ptp_ctx *ptp_ctx)
+{
+    struct ptp_port_ctx *ctx = NULL;
+    u32 num_slots = ptp_foreign_table_slots(ptp_ctx->cfg.max_foreign_masters);
+    u32 num_dresp = ptp_ctx->cfg.delay_resp_queue;
+    u32 num_clients = ptp_rl_slots(ptp_ctx->cfg.delay_req_clients);
+    size_t size = 0;
+    int i = 0;
+
+    size = MAX_NUM_INTERFACES *
+        (PTP_ARENA_SIZE(sizeof(struct ptp_port_ctx)) +
+         PTP_ARENA_SIZE(num_slots * sizeof(struct ForeignMasterDataSet)) +
+         PTP_ARENA_SIZE(num_dresp * sizeof(struct ptp_dresp_entry)) +
+         PTP_ARENA_SIZE(num_clients * sizeof(struct ptp_rl_client))) +
+        ptp_unicast_table_size(ptp_ctx->cfg.unicast_sessions);
+    if (ptp_arena_init(&ptp_ctx->arena, size) != PTP_ERR_OK) {
+        return PTP_ERR_GEN;
+    }
+    if (ptp_unicast_table_init(ptp_ctx, ptp_ctx->cfg.unicast_sessions) !=
+        PTP_ERR_OK) {
+        return PTP_ERR_GEN;
+    }
+    ptp_ctx->foreign_capacity = ptp_ctx->cfg.max_foreign_masters;
+    ptp_ctx->free_ports_head = NULL;
+    for (i = 0; i < MAX_NUM_INTERFACES; i++) {
+        ctx = ptp_arena_alloc(&ptp_ctx->arena, sizeof(struct ptp_port_ctx));
+        if (ctx == NULL) {
+            return PTP_ERR_GEN;
+        }
+        ctx->foreign_masters.records =
+            ptp_arena_alloc(&ptp_ctx->arena,
+                            num_slots *
+                            sizeof(struct ForeignMasterDataSet));
+        if (ctx->foreign_masters.records == NULL) {
+            return PTP_ERR_GEN;
+        }
+        ctx->foreign_masters.num_slots = num_slots;
+        ctx->delay_resp.entries =
+            ptp_arena_alloc(&ptp_ctx->arena,
+                            num_dresp * sizeof(struct ptp_dresp_entry));
+        if (ctx->delay_resp.entries == NULL) {
+            return PTP_ERR_GEN;
+        }
+        ctx->delay_resp.capacity = num_dresp;
+        ctx->delay_req_clients.clients =
+            ptp_arena_alloc(&ptp_ctx->arena,
+                            num_clients * sizeof(struct ptp_rl_client));
+        if (ctx->delay_req_clients.clients == NULL) {
+            return PTP_ERR_GEN;
+        }
+        ctx->delay_req_clients.num_slots = num_clients;
+        ctx->next = ptp_ctx->free_ports_head;
+        ptp_ctx->free_ports_head = ctx;
+    }
+    return PTP_ERR_OK;
+}
 
 /**
 * Function for reporting new PTP port. After completion of this function call,
 * PTP module may start sending and receiving to this port.
 * @see port_id 
+* @param ptp_ctx PTP instance.
 * @param port_num port number.
 * @param identity clock identity.
 * @param unicast_port Flag to indicate that port is using unicast.
 * @param if_config Interface configuration.
 */
-void ptp_new_port(int port_num, 
+void ptp_new_port(struct ptp_ctx *ptp_ctx,
+                  int port_num, 
                   ClockIdentity identity, 
                   bool unicast_port,
                   struct interface_config* if_config )
 {
-    struct ptp_port_ctx *ctx = ptp_ctx.ports_list_head;
+    struct ptp_port_ctx *ctx = ptp_ctx->ports_list_head;
+    struct ForeignMasterDataSet *records = NULL;
+    struct ptp_dresp_entry *dresp_entries = NULL;
+    struct ptp_rl_client *clients = NULL;
+    u32 num_slots = 0;
+    u32 num_dresp = 0;
+    u32 num_clients = 0;
+    u32 capacity = ptp_ctx->cfg.max_foreign_masters;
 
     // Check that this port id is not in use
     while (ctx != NULL) {
@@ -57,13 +138,25 @@ void ptp_new_port(int port_num,
         ctx = ctx->next;
     }
 
-    ctx = malloc(sizeof(struct ptp_port_ctx));
+    // Take context from pool, foreign master table, Delay_Resp queue and
+    // Delay_Req requester memory is reused
+    ctx = ptp_ctx->free_ports_head;
     if (ctx == 0) {
         ERROR("Allocation of new port ctx failed\n");
         return;
     }
+    ptp_ctx->free_ports_head = ctx->next;
+    records = ctx->foreign_masters.records;
+    num_slots = ctx->foreign_masters.num_slots;
+    dresp_entries = ctx->delay_resp.entries;
+    num_dresp = ctx->delay_resp.capacity;
+    clients = ctx->delay_req_clients.clients;
+    num_clients = ctx->delay_req_clients.num_slots;
     memset(ctx, 0, sizeof(struct ptp_port_ctx));
+    ctx->ptp = ptp_ctx;
     ctx->unicast_port = unicast_port;
+    // Hybrid mode applies to the multicast port of the interface
+    ctx->hybrid = !unicast_port && if_config->hybrid;
     ctx->delay_asymmetry = if_config->delay_asymmetry;
     if( if_config->delay_asymmetry_master_set ){
         ctx->delay_asymmetry_master_set = 1;
@@ -72,6 +165,15 @@ void ptp_new_port(int port_num,
                sizeof(ClockIdentity));
     }
     strncpy(ctx->name, if_config->name, INTERFACE_NAME_LEN);
+    if (capacity > ptp_ctx->foreign_capacity) {
+        ERROR("max_foreign_masters %u exceeds %u reserved at startup\n",
+              capacity, ptp_ctx->foreign_capacity);
+        capacity = ptp_ctx->foreign_capacity;
+    }
+    ptp_foreign_table_init(&ctx->foreign_masters, capacity,
+                           records, num_slots);
+    ptp_dresp_init(&ctx->delay_resp, dresp_entries, num_dresp);
+    ptp_rl_init(&ctx->delay_req_clients, clients, num_clients);
 
     // Init portdataset
     memcpy(ctx->port_dataset.port_identity.clock_identity,
@@ -79,11 +181,14 @@ void ptp_new_port(int port_num,
     ctx->port_dataset.port_identity.port_number = port_num;
 
     // Init data from config file
-    init_port_dataset( &ctx->port_dataset );
+    init_port_dataset(&ptp_ctx->cfg, &ctx->port_dataset);
 
     ctx->port_dataset.version_number = PTP_VERSION;
     ctx->port_dataset.announce_receipt_timeout = ANNOUNCE_WINDOW;
-    ctx->port_dataset.delay_mechanism = DELAY_DISABLED;
+    ctx->neighbor_rate_ratio = 1.0;
+
+    // Sessions are hashed by port number, which is now known
+    ptp_unicast_init(ctx, if_config);
     
     ptp_port_state_update(ctx, PORT_INITIALIZING);
 
@@ -91,30 +196,97 @@ void ptp_new_port(int port_num,
      * because this is static) */
     if (port_num == 1) {
         // Set first port identity as clock identity
-        memcpy(ptp_ctx.default_dataset.clock_identity, 
+        memcpy(ptp_ctx->default_dataset.clock_identity, 
                identity, sizeof(ClockIdentity));// Local clock identity
     }
-    ptp_ctx.default_dataset.num_ports++;
+    ptp_ctx->default_dataset.num_ports++;
+    ptp_framer_invalidate(ptp_ctx);
 
     // Add to port list
-    ctx->next = ptp_ctx.ports_list_head;
-    ptp_ctx.ports_list_head = ctx;
+    ctx->next = ptp_ctx->ports_list_head;
+    ptp_ctx->ports_list_head = ctx;
 
     DEBUG("Added port %i/%i %p %s\n", 
-          port_num, ptp_ctx.default_dataset.num_ports, 
+          port_num, ptp_ctx->default_dataset.num_ports, 
           ctx, ptp_clk_id(identity));
 }
 
+/**
+* Report sequenceId accounting of received frames, Delay_Resp received
+* for Delay_Req in flight, Delay_Resp queue statistics and requesters
+* whose Delay_Req were dropped for exceeding their rate.
+* @param ctx Port context.
+*/
+static void ptp_port_report(struct ptp_port_ctx *ctx)
+{
+    struct ptp_rl_client *worst[PTP_RL_REPORT];
+    struct ptp_dresp_stats *stats = &ctx->delay_resp.stats;
+    struct ptp_delay_req_table *reqs = &ctx->delay_reqs;
+    struct ptp_seq_source *source = NULL;
+    struct ptp_seq_counters *cnt = NULL;
+    int port_num = ctx->port_dataset.port_identity.port_number;
+    int count = 0, i = 0, type = 0;
+
+    for (type = 0; type < PTP_SEQ_NUM_TYPES; type++) {
+        cnt = &ctx->seq_stats.total[type];
+        if (cnt->frames == 0) {
+            continue;
+        }
+        DEBUG("Port %i %s: frames %llu gaps %llu lost %llu duplicates %llu "
+              "reordered %llu restarts %llu\n", port_num,
+              ptp_seq_type_name(type), cnt->frames, cnt->gaps, cnt->lost,
+              cnt->duplicates, cnt->reordered, cnt->restarts);
+        for (i = 0; i < PTP_SEQ_SOURCES; i++) {
+            source = &ctx->seq_stats.sources[i];
+            cnt = &source->types[type].counters;
+            if (!source->in_use || (cnt->frames == 0)) {
+                continue;
+            }
+            DEBUG("  %s/%i: frames %llu gaps %llu lost %llu "
+                  "duplicates %llu reordered %llu restarts %llu\n",
+                  ptp_clk_id(source->port_id.clock_identity),
+                  source->port_id.port_number, cnt->frames, cnt->gaps,
+                  cnt->lost, cnt->duplicates, cnt->reordered,
+                  cnt->restarts);
+        }
+    }
+
+    if (reqs->matched || reqs->late || reqs->lost || reqs->unmatched) {
+        DEBUG("Port %i Delay_Resp received: matched %llu late %llu "
+              "lost %llu unmatched %llu\n", port_num,
+              reqs->matched, reqs->late, reqs->lost, reqs->unmatched);
+    }
+    if ((stats->queued == 0) && (ctx->delay_req_clients.dropped == 0)) {
+        return;
+    }
+    DEBUG("Port %i Delay_Resp: queued %llu sent %llu delayed %llu "
+          "dropped %llu max depth %u\n", port_num,
+          stats->queued, stats->sent, stats->delayed, stats->dropped,
+          stats->max_depth);
+    DEBUG("Port %i Delay_Req: accepted %llu over rate %llu "
+          "requesters evicted %llu\n", port_num,
+          ctx->delay_req_clients.accepted, ctx->delay_req_clients.dropped,
+          ctx->delay_req_clients.evicted);
+    count = ptp_rl_offenders(&ctx->delay_req_clients, worst, PTP_RL_REPORT);
+    for (i = 0; i < count; i++) {
+        DEBUG("  %s %s/%i: accepted %u over rate %u\n",
+              worst[i]->addr, ptp_clk_id(worst[i]->port_id.clock_identity),
+              worst[i]->port_id.port_number, worst[i]->accepted,
+              worst[i]->dropped);
+    }
+}
+
 /**
 * Function for closing existing PTP port. After completion of this function 
 * call, PTP module must stop sending and receiving to this port. All 
 * pending send operations shall be completed with frame_sent.
 * @see port_num 
+* @param ptp_ctx PTP instance.
 * @param port_num port number.
 */
-void ptp_close_port(int port_num)
+void ptp_close_port(struct ptp_ctx *ptp_ctx, int port_num)
 {
-    struct ptp_port_ctx *tmp_ctx = ptp_ctx.ports_list_head, *prev_ctx = 0;
+    struct ptp_port_ctx *tmp_ctx = ptp_ctx->ports_list_head, *prev_ctx = 0;
     DEBUG("\n");
 
     // Remove from queue
@@ -122,20 +294,25 @@ void ptp_close_port(int port_num)
         if (tmp_ctx->port_dataset.port_identity.port_number == port_num) {
             // match found
             if (!prev_ctx) {
-                ptp_ctx.ports_list_head = tmp_ctx->next;
+                ptp_ctx->ports_list_head = tmp_ctx->next;
             } else {
-                prev_ctx = tmp_ctx->next;
+                prev_ctx->next = tmp_ctx->next;
             }
             break;
         }
+        prev_ctx = tmp_ctx;
         tmp_ctx = tmp_ctx->next;
     }
     if (!tmp_ctx) {
         ERROR("NOT FOUND\n");
     } else {
-        free(tmp_ctx);
+        ptp_port_report(tmp_ctx);
+        ptp_unicast_close(tmp_ctx);
+        // Return context to pool
+        tmp_ctx->next = ptp_ctx->free_ports_head;
+        ptp_ctx->free_ports_head = tmp_ctx;
         // Update default dataset
-        ptp_ctx.default_dataset.num_ports--;
+        ptp_ctx->default_dataset.num_ports--;
         DEBUG("Closed port %i\n", port_num);
     }
 }
@@ -144,16 +321,18 @@ void ptp_close_port(int port_num)
 * Function for reporting the completion of sending of the PTP event 
 * frame. Called for Delay_req and Sync frames (if two step clock). 
 * @see send.
+* @param ptp_ctx PTP instance.
 * @param port_num port number.
 * @param msg_hdr Header of the sent frame.
 * @param error sending process failed, ptp error number returned.
 * @param sent_time timestamp of the sent ptp frame.
 */
-void ptp_frame_sent(int port_num,
+void ptp_frame_sent(struct ptp_ctx *ptp_ctx,
+                    int port_num,
                     struct ptp_header *msg_hdr,
                     int error, struct Timestamp *sent_time)
 {
-    struct ptp_port_ctx *ctx = ptp_ctx.ports_list_head;
+    struct ptp_port_ctx *ctx = ptp_ctx->ports_list_head;
 
     while (ctx != NULL) {
         if (ctx->port_dataset.port_identity.port_number == port_num) {
@@ -166,32 +345,69 @@ void ptp_frame_sent(int port_num,
         ERROR("Port not found\n");
         return;
     }
+    if ((ptp_ctx->cfg.clock_type != CLOCK_TYPE_OC) &&
+        (compare_clock_id(msg_hdr->src_port_id.clock_identity,
+                          ptp_ctx->default_dataset.clock_identity) != 0)) {
+        // Frame forwarded by transparent clock
+        ptp_tc_frame_sent(ctx, msg_hdr, sent_time);
+        return;
+    }
 
+    TRACE(PTP_TR_SENT, port_num, msg_hdr->msg_type & 0x0f,
+          ptp_hdr_seq_id(msg_hdr), ptp_trace_ns(sent_time));
     switch (msg_hdr->msg_type & 0x0f) {
     case PTP_SYNC:
-        if (ptp_cfg.one_step_clock == 0) {
+        if (ptp_ctx->cfg.one_step_clock == 0) {
             // This is executed only if TWO_STEP_CLOCK==1
             char tmpbuf[MAX_PTP_FRAME_SIZE];
             int ret = 0;
-            DEBUG("Sync sent, send follow_up\n");
             // create follow_up
             ret = create_follow_up(ctx, tmpbuf, sent_time,
                                    htons(msg_hdr->seq_id));
             if (ret > 0) {
-                DEBUG("Send Follow up\n");
-                ret = ptp_send(&ptp_ctx.pkt_ctx, PTP_FOLLOW_UP,
+                ret = ptp_send(&ptp_ctx->pkt_ctx, PTP_FOLLOW_UP,
                                port_num, tmpbuf, ret);
-                if( ret != PTP_ERR_OK ){
-                    socket_restart = 1;
+                ptp_count_tx(&ctx->counters, PTP_FOLLOW_UP, 1,
+                             ret != PTP_ERR_OK);
+                TRACE(PTP_TR_TX, port_num, PTP_FOLLOW_UP,
+                      ptp_hdr_seq_id(msg_hdr), ret);
+                if( ret == PTP_ERR_NET ){
+                    ptp_ctx->socket_restart = 1;
                 }
             }
         }
         break;
     case PTP_DELAY_REQ:
-        DEBUG("delay_req sent, store timestamp\n");
-        // Store timestamp and seq_id
-        ctx->delay_req_seqid_sent = ntohs(msg_hdr->seq_id);
-        copy_timestamp(&ctx->delay_req_send_time, sent_time);
+        ptp_port_delay_req_sent(ctx, ptp_hdr_seq_id(msg_hdr), sent_time);
+        break;
+    case PTP_PDELAY_REQ:
+        ctx->pdelay_req_seqid_sent = ptp_hdr_seq_id(msg_hdr);
+        copy_timestamp(&ctx->pdelay_t1, sent_time);
+        ctx->pdelay_t1_valid = true;
+        break;
+    case PTP_PDELAY_RESP:
+        {
+            // Two-step responder, send t3 in follow_up
+            struct ptp_pdelay_resp *resp = (struct ptp_pdelay_resp *) msg_hdr;
+            struct PortIdentity req_port_id;
+            char tmpbuf[MAX_PTP_FRAME_SIZE];
+            int ret = 0;
+
+            ptp_get_port_id(&req_port_id, resp->req_port_id);
+            ret = create_pdelay_resp_follow_up(ctx, tmpbuf, sent_time,
+                                               &req_port_id,
+                                               ptp_hdr_seq_id(msg_hdr),
+                                               ctx->pdelay_req_corr_field);
+            if (ret > 0) {
+                ret = ptp_send(&ptp_ctx->pkt_ctx, PTP_PDELAY_RESP_FOLLOW_UP,
+                               port_num, tmpbuf, ret);
+                ptp_count_tx(&ctx->counters, PTP_PDELAY_RESP_FOLLOW_UP, 1,
+                             ret != PTP_ERR_OK);
+                if( ret == PTP_ERR_NET ){
+                    ptp_ctx->socket_restart = 1;
+                }
+            }
+        }
         break;
     default:
         // Nothing
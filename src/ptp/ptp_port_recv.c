@@ -24,12 +24,19 @@
 /******************************************************************************
 * $Id$
 ******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_PORT
+
 #include "ptp.h"
 #include "ptp_general.h"
 #include "ptp_message.h"
 #include "ptp_port.h"
 #include "ptp_framer.h"
 #include "ptp_internal.h"
+#include "ptp_bmc.h"
+#include "ptp_foreign.h"
+#include "ptp_codec.h"
+#include "ptp_mgmt.h"
+#include "ptp_trace.h"
 
 // Functions for handling specific PTP frames
 static void ptp_port_recv_sync(struct ptp_port_ctx *ctx,
@@ -44,10 +51,39 @@ static void ptp_port_recv_announce(struct ptp_port_ctx *ctx,
                                    char* peer_ip);
 static void ptp_port_recv_delay_req(struct ptp_port_ctx *ctx,
                                     struct ptp_delay_req *msg,
-                                    struct Timestamp *time);
+                                    struct Timestamp *time,
+                                    char *peer_ip);
 static void ptp_port_recv_delay_resp(struct ptp_port_ctx *ctx,
                                      struct ptp_delay_resp *msg,
                                      struct Timestamp *time);
+static void ptp_port_recv_pdelay_req(struct ptp_port_ctx *ctx,
+                                     struct ptp_pdelay_req *msg,
+                                     struct Timestamp *time,
+                                     char *peer_ip);
+static void ptp_port_recv_pdelay_resp(struct ptp_port_ctx *ctx,
+                                      struct ptp_pdelay_resp *msg,
+                                      struct Timestamp *time);
+static void ptp_port_recv_pdelay_resp_follow_up(struct ptp_port_ctx *ctx,
+                                                struct
+                                                ptp_pdelay_resp_follow_up
+                                                *msg,
+                                                struct Timestamp *time);
+static void ptp_port_pdelay_update(struct ptp_port_ctx *ctx,
+                                   struct Timestamp *t3, s64 corr_field);
+static int ptp_port_send_resp(struct ptp_port_ctx *ctx, int msg_type,
+                              char *buf, int len,
+                              struct ptp_header *req_hdr, char *peer_ip);
+static struct ptp_sync_slot *ptp_port_sync_slot(struct ptp_port_ctx *ctx,
+                                                u16 seq_id);
+static void ptp_port_sync_complete(struct ptp_port_ctx *ctx,
+                                   struct ptp_sync_slot *slot);
+
+/// Number of Pdelay measurements over which neighbor rate ratio is measured
+#define PDELAY_RATIO_WINDOW     8
+/// Maximum accepted neighbor frequency offset, ppm
+#define PDELAY_RATIO_MAX_PPM    1000
+/// Weight of new measurement in meanLinkDelay filter is 1/PDELAY_FILTER
+#define PDELAY_FILTER           4
 
 /**
 * Function for handling received PTP messages for port.
@@ -65,63 +101,76 @@ void ptp_port_recv(struct ptp_port_ctx *ctx,
 {
     struct ptp_header *hdr = (struct ptp_header *) buf;
 
-    if (hdr->domain_num != ptp_ctx.default_dataset.domain) {
-        DEBUG("PTP message from wrong domain\n");
+    // Frames of other domains are filtered by the packet interface
+
+    // Validate header, length and TLVs before any field is accessed
+    if (ptp_msg_check(buf, len) < 0) {
+        DEBUG("Invalid frame, length %i\n", len);
+        ptp_count_rx_invalid(&ctx->counters, buf, len);
         return;
     }
+    ctx->counters.rx[ptp_hdr_type(hdr)]++;
+    TRACE(PTP_TR_RX, ctx->port_dataset.port_identity.port_number,
+          ptp_hdr_type(hdr), ptp_hdr_seq_id(hdr), ptp_trace_ns(time));
 
-    switch (hdr->msg_type & 0x0f) {
+    ptp_port_dispatch(ctx, buf, len, time, peer_ip);
+}
+
+/**
+* Handle received PTP message, which is already validated and counted.
+* @param ctx Port context.
+* @param buf PTP message.
+* @param len msg length.
+* @param time timestamp for received frame.
+* @param peer_ip IP address of the sender of this message.
+*/
+void ptp_port_dispatch(struct ptp_port_ctx *ctx, char *buf, int len,
+                       struct Timestamp *time, char *peer_ip)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    struct PortIdentity src_port_id;
+
+    if (ctx->unicast.sessions) {
+        ptp_unicast_seen(ctx, peer_ip, time);
+    }
+    ptp_get_port_id(&src_port_id, &hdr->src_port_id);
+    ptp_seq_recv(&ctx->seq_stats, &src_port_id, ptp_hdr_type(hdr),
+                 ptp_hdr_seq_id(hdr));
+
+    switch (ptp_hdr_type(hdr)) {
     case PTP_SYNC:
-        DEBUG("PTP_SYNC 0x%012llxs 0x%08x.%04xns(0x%llx): %i\n",
-              time->seconds,
-              time->nanoseconds,
-              time->frac_nanoseconds,
-              ntohll(hdr->corr_field), 
-              ntohs(hdr->seq_id));
-        ptp_port_recv_sync(ctx, (struct ptp_sync *) hdr, time);
+        ptp_port_recv_sync(ctx, ptp_view_sync(buf), time);
         break;
     case PTP_FOLLOW_UP:
-        DEBUG("PTP_FOLLOW_UP 0x%012llxs 0x%08x.%04xns(0x%llx): %i\n",
-              time->seconds,
-              time->nanoseconds,
-              time->frac_nanoseconds,
-              ntohll(hdr->corr_field), 
-              ntohs(hdr->seq_id));
-        ptp_port_recv_follow_up(ctx, (struct ptp_follow_up *) hdr, time);
+        ptp_port_recv_follow_up(ctx, ptp_view_follow_up(buf), time);
         break;
     case PTP_DELAY_REQ:
-        DEBUG("PTP_DELAY_REQ 0x%012llxs 0x%08x.%04xns(0x%llx): %i\n",
-              time->seconds,
-              time->nanoseconds,
-              time->frac_nanoseconds,
-              ntohll(hdr->corr_field), 
-              ntohs(hdr->seq_id));
-        ptp_port_recv_delay_req(ctx, (struct ptp_delay_req *) hdr, time);
+        ptp_port_recv_delay_req(ctx, ptp_view_delay_req(buf), time,
+                                peer_ip);
         break;
     case PTP_ANNOUNCE:
-        DEBUG("PTP_ANNOUNCE  0x%012llxs 0x%08x.%04xns(0x%llx): %i\n",
-              time->seconds,
-              time->nanoseconds,
-              time->frac_nanoseconds,
-              ntohll(hdr->corr_field), 
-              ntohs(hdr->seq_id));
-        ptp_port_recv_announce(ctx, (struct ptp_announce *) hdr, time, peer_ip);
+        ptp_port_recv_announce(ctx, ptp_view_announce(buf), time, peer_ip);
         break;
     case PTP_DELAY_RESP:
-        DEBUG("PTP_DELAY_RESP 0x%012llxs 0x%08x.%04xns(0x%llx): %i\n",
-              time->seconds,
-              time->nanoseconds,
-              time->frac_nanoseconds,
-              ntohll(hdr->corr_field), 
-              ntohs(hdr->seq_id));
-        ptp_port_recv_delay_resp(ctx, (struct ptp_delay_resp *) hdr, time);
+        ptp_port_recv_delay_resp(ctx, ptp_view_delay_resp(buf), time);
         break;
     case PTP_PDELAY_REQ:
+        ptp_port_recv_pdelay_req(ctx, ptp_view_pdelay_req(buf), time,
+                                 peer_ip);
+        break;
     case PTP_PDELAY_RESP:
+        ptp_port_recv_pdelay_resp(ctx, ptp_view_pdelay_resp(buf), time);
+        break;
     case PTP_PDELAY_RESP_FOLLOW_UP:
-    case PTP_SIGNALING:
+        ptp_port_recv_pdelay_resp_follow_up(ctx,
+                                            ptp_view_pdelay_resp_follow_up
+                                            (buf), time);
+        break;
     case PTP_MANAGEMENT:
-        DEBUG("TODO: %i\n", hdr->msg_type & 0x0f);
+        ptp_mgmt_recv(ctx, buf, len);
+        break;
+    case PTP_SIGNALING:
+        ptp_unicast_recv(ctx, buf, time, peer_ip);
         break;
     }
 
@@ -137,8 +186,8 @@ static void ptp_port_recv_sync(struct ptp_port_ctx *ctx,
                                struct ptp_sync *msg,
                                struct Timestamp *time)
 {
+    struct ptp_sync_slot *slot = NULL;
     int64_t delay_asymmetry = 0;
-    DEBUG("\n");
 
     // Check port state
     if ((ctx->port_dataset.port_state == PORT_INITIALIZING) ||
@@ -154,8 +203,6 @@ static void ptp_port_recv_sync(struct ptp_port_ctx *ctx,
         if (memcmp(ctx->current_master,
                    msg->hdr.src_port_id.clock_identity,
                    sizeof(ClockIdentity)) == 0) {
-            DEBUG("Sync from current master %i\n", ntohs(msg->hdr.seq_id));
-
             // Check if we need to do asymmetry correction
             if( ctx->delay_asymmetry_master_set ){
                 if( !memcmp(ctx->delay_asymmetry_master,
@@ -171,19 +218,39 @@ static void ptp_port_recv_sync(struct ptp_port_ctx *ctx,
             // Scale delay asymmetry from ps to ns.sns 
             delay_asymmetry = (delay_asymmetry << 16)/1000;
 
+            // With peer delay mechanism, link delay is corrected here
+            if (ctx->port_dataset.delay_mechanism == DELAY_P2P) {
+                delay_asymmetry +=
+                    ctx->port_dataset.peer_mean_path_delay.
+                    scaled_nanoseconds;
+            }
+
 
-            if (!(msg->hdr.flags & PTP_TWO_STEP)) {
+            if (!(ptp_hdr_flags(&msg->hdr) & PTP_TWO_STEP)) {
                 // ONE_STEP master->sync local clk
-                struct Timestamp master_time;
-                ptp_convert_timestamp(&master_time, msg->origin_tstamp);
-                add_correction(&master_time,
-                               ntohll(msg->hdr.corr_field) + delay_asymmetry);
-                ptp_sync_rcv(&ptp_ctx.clk_ctx, &master_time, time);
-            } else {            // Store seq_id and timestamp
-                ctx->sync_seqid = ntohs(msg->hdr.seq_id);
-                ctx->sync_recv_corr_field = 
-                    ntohll(msg->hdr.corr_field) + delay_asymmetry;
-                copy_timestamp(&ctx->sync_recv_time, time);
+                struct Timestamp origin, master_time;
+                s64 correction =
+                    ptp_hdr_corr_field(&msg->hdr) + delay_asymmetry;
+                ptp_get_timestamp(&origin, msg->origin_tstamp);
+                copy_timestamp(&master_time, &origin);
+                add_correction(&master_time, correction);
+                TRACE(PTP_TR_SYNC,
+                      ctx->port_dataset.port_identity.port_number,
+                      ptp_hdr_seq_id(&msg->hdr), ptp_trace_ns(&master_time),
+                      ptp_trace_ns(time));
+                ptp_sync_rcv(&ctx->ptp->clk_ctx, &master_time, time);
+                ptp_servo_rec_sync(ctx, ptp_hdr_seq_id(&msg->hdr), &origin,
+                                   time, correction);
+            } else {            // Pair with Follow_Up
+                slot = ptp_port_sync_slot(ctx, ptp_hdr_seq_id(&msg->hdr));
+                if (slot == NULL) {
+                    return;
+                }
+                slot->sync_valid = true;
+                slot->sync_corr_field =
+                    ptp_hdr_corr_field(&msg->hdr) + delay_asymmetry;
+                copy_timestamp(&slot->recv_time, time);
+                ptp_port_sync_complete(ctx, slot);
             }
         }
     }
@@ -199,8 +266,7 @@ static void ptp_port_recv_follow_up(struct ptp_port_ctx *ctx,
                                     struct ptp_follow_up *msg,
                                     struct Timestamp *time)
 {
-
-    DEBUG("\n");
+    struct ptp_sync_slot *slot = NULL;
 
     // Check port state
     if ((ctx->port_dataset.port_state == PORT_INITIALIZING) ||
@@ -216,27 +282,87 @@ static void ptp_port_recv_follow_up(struct ptp_port_ctx *ctx,
         if (memcmp(ctx->current_master,
                    msg->hdr.src_port_id.clock_identity,
                    sizeof(ClockIdentity)) == 0) {
-            // Associate to recvd sync
-            if (ctx->sync_seqid == ntohs(msg->hdr.seq_id)) {
-                struct Timestamp master_time;
-                DEBUG("Follow_up from current master %i\n",
-                      ntohs(msg->hdr.seq_id));
-                // calc 
-                ptp_convert_timestamp(&master_time,
-                                      msg->precise_origin_tstamp);
-                add_correction(&master_time, ctx->sync_recv_corr_field +
-                               ntohll(msg->hdr.corr_field));
-                ptp_sync_rcv(&ptp_ctx.clk_ctx,
-                             &master_time, &ctx->sync_recv_time);
-            } else {
-                ERROR
-                    ("Follow_up from current master, seq_id mismatch:%i %i\n",
-                     ctx->sync_seqid, ntohs(msg->hdr.seq_id));
+            // Pair with Sync, which may also arrive later
+            slot = ptp_port_sync_slot(ctx, ptp_hdr_seq_id(&msg->hdr));
+            if (slot == NULL) {
+                return;
             }
+            slot->follow_up_valid = true;
+            slot->follow_up_corr_field = ptp_hdr_corr_field(&msg->hdr);
+            ptp_get_timestamp(&slot->origin, msg->precise_origin_tstamp);
+            ptp_port_sync_complete(ctx, slot);
         }
     }
 }
 
+/**
+* Get slot of a two-step Sync of the current master. Slots of another
+* master are discarded, and a slot still waiting for an older sequenceId
+* is taken over.
+* @param ctx Port context.
+* @param seq_id sequenceId of Sync or Follow_Up.
+* @return slot, NULL if sample is not newer than the last one delivered.
+*/
+static struct ptp_sync_slot *ptp_port_sync_slot(struct ptp_port_ctx *ctx,
+                                                u16 seq_id)
+{
+    struct ptp_sync_window *window = &ctx->sync_window;
+    struct ptp_sync_slot *slot = NULL;
+    s16 age = 0;
+
+    if (memcmp(window->master, ctx->current_master,
+               sizeof(ClockIdentity)) != 0) {
+        memset(window, 0, sizeof(struct ptp_sync_window));
+        memcpy(window->master, ctx->current_master, sizeof(ClockIdentity));
+    }
+    // Late frames are dropped, a larger jump back is a restarted master
+    age = (s16) (window->last_seq_id - seq_id);
+    if (window->last_valid && (age >= 0) && (age < PTP_SYNC_WINDOW)) {
+        DEBUG("Sync %i older than last sample %i\n",
+              seq_id, window->last_seq_id);
+        return NULL;
+    }
+    slot = &window->slots[seq_id & (PTP_SYNC_WINDOW - 1)];
+    if ((slot->sync_valid || slot->follow_up_valid) &&
+        (slot->seq_id != seq_id)) {
+        DEBUG("%s %i not paired\n",
+              slot->sync_valid ? "Sync" : "Follow_up", slot->seq_id);
+        slot->sync_valid = false;
+        slot->follow_up_valid = false;
+    }
+    slot->seq_id = seq_id;
+    return slot;
+}
+
+/**
+* Pass Sync to clock if both Sync and Follow_Up of the slot are received.
+* @param ctx Port context.
+* @param slot slot of the Sync.
+*/
+static void ptp_port_sync_complete(struct ptp_port_ctx *ctx,
+                                   struct ptp_sync_slot *slot)
+{
+    struct ptp_sync_window *window = &ctx->sync_window;
+    struct Timestamp master_time;
+
+    if (!slot->sync_valid || !slot->follow_up_valid) {
+        return;
+    }
+    copy_timestamp(&master_time, &slot->origin);
+    add_correction(&master_time, slot->sync_corr_field +
+                   slot->follow_up_corr_field);
+    TRACE(PTP_TR_SYNC, ctx->port_dataset.port_identity.port_number,
+          slot->seq_id, ptp_trace_ns(&master_time),
+          ptp_trace_ns(&slot->recv_time));
+    ptp_sync_rcv(&ctx->ptp->clk_ctx, &master_time, &slot->recv_time);
+    ptp_servo_rec_sync(ctx, slot->seq_id, &slot->origin, &slot->recv_time,
+                       slot->sync_corr_field + slot->follow_up_corr_field);
+    slot->sync_valid = false;
+    slot->follow_up_valid = false;
+    window->last_valid = true;
+    window->last_seq_id = slot->seq_id;
+}
+
 /**
 * Function for handling received Announce.
 * @param ctx Port context.
@@ -249,12 +375,8 @@ static void ptp_port_recv_announce(struct ptp_port_ctx *ctx,
                                    struct Timestamp *time,
                                    char* peer_ip)
 {
-    struct ForeignMasterDataSetElem *foreign_elem =
-        ctx->foreign_master_head;
     struct ForeignMasterDataSet *foreign = 0;
-    int i = 0, num_foreign_masters = 0;
-
-    DEBUG("\n");
+    struct PortIdentity src_port_id;
 
     // Check port state
     if ((ctx->port_dataset.port_state == PORT_INITIALIZING) ||
@@ -265,7 +387,7 @@ static void ptp_port_recv_announce(struct ptp_port_ctx *ctx,
     }
     // Qualify announce message
     // Check ALTERNATE_MASTER flag
-    if (msg->hdr.flags & PTP_ALTERNATE_MASTER) {
+    if (ptp_hdr_flags(&msg->hdr) & PTP_ALTERNATE_MASTER) {
         // Announce with ALTERNATE_MASTER flag not accepted
         return;
     }
@@ -273,10 +395,10 @@ static void ptp_port_recv_announce(struct ptp_port_ctx *ctx,
     if ((ctx->port_dataset.port_state == PORT_UNCALIBRATED) ||
         (ctx->port_dataset.port_state == PORT_SLAVE)) {
         if (((memcmp(msg->hdr.src_port_id.clock_identity,
-                     ptp_ctx.parent_dataset.parent_port_identity.
+                     ctx->ptp->parent_dataset.parent_port_identity.
                      clock_identity, sizeof(ClockIdentity))) == 0)
-            && (ntohs(msg->hdr.src_port_id.port_number) ==
-                ptp_ctx.parent_dataset.parent_port_identity.port_number)) {
+            && (ptp_get_u16(&msg->hdr.src_port_id.port_number) ==
+                ctx->ptp->parent_dataset.parent_port_identity.port_number)) {
             // match
             ptp_port_announce_recv_timeout_restart(ctx, time);
         }
@@ -290,85 +412,53 @@ static void ptp_port_recv_announce(struct ptp_port_ctx *ctx,
         }
     }
 
-    while (foreign_elem) {
-        foreign = foreign_elem->data_p;
-        num_foreign_masters++;
-        // check if from a known foreign master (port)
-        if (((memcmp(msg->hdr.src_port_id.clock_identity,
-                     foreign->src_port_id.clock_identity,
-                     sizeof(ClockIdentity))) == 0) &&
-            (ntohs(msg->hdr.src_port_id.port_number) ==
-             foreign->src_port_id.port_number)) {
-            // found, continue 
-            break;
-        }
-        foreign = 0;
-        foreign_elem = foreign_elem->next;
-    }
+    ptp_get_port_id(&src_port_id, &msg->hdr.src_port_id);
 
+    // check if from a known foreign master (port)
+    foreign = ptp_foreign_lookup(&ctx->foreign_masters, &src_port_id);
     if (foreign) {              // found
-        DEBUG("Update foreign record ");
-        for (i = 0; i < 9; i++) {
-            DEBUG_PLAIN("%02x:",
-                        0xff & ((char *) &foreign->src_port_id)[i]);
-        }
-        DEBUG_PLAIN("%02x\n", 0xff & ((char *) &foreign->src_port_id)[i]);
-
-        memcpy(&foreign->announce_tstamp[foreign->tstamp_index],
-               time, sizeof(struct Timestamp));
-        foreign->tstamp_index++;
-        foreign->tstamp_index %= ANNOUNCE_WINDOW;
-        memcpy(&foreign->msg, msg, sizeof(struct ptp_announce));
-    } else if (num_foreign_masters >= MAX_NUM_FOREIGN_MASTERS) {
-        DEBUG("List of foreign masters full\n");
-    } else {                    // unknown foreign, and room in list
-        // Create new foreign record
-        foreign_elem = malloc(sizeof(struct ForeignMasterDataSetElem));
-        if (!foreign_elem) {
-            ERROR("Mem alloc fail\n");
-        } else {
-            memset(foreign_elem, 0,
-                   sizeof(struct ForeignMasterDataSetElem));
-            foreign_elem->data_p = &foreign_elem->data;
-            foreign = foreign_elem->data_p;
+        DEBUG("Update foreign record %s %i\n",
+              ptp_clk_id(foreign->src_port_id.clock_identity),
+              foreign->src_port_id.port_number);
+        ptp_foreign_update(foreign, msg, time,
+                           ctx->port_dataset.announce_receipt_timeout);
+        return;
+    }
 
-            // copy source clock id ...
-            memcpy(foreign->src_port_id.clock_identity,
-                   msg->hdr.src_port_id.clock_identity,
-                   sizeof(ClockIdentity));
-            // ... port ...
-            foreign->src_port_id.port_number =
-                ntohs(msg->hdr.src_port_id.port_number);
-            // ... and ip.
-            strncpy(foreign->src_ip, peer_ip, IP_STR_MAX_LEN);
-
-            // copy destination clock id ...
-            memcpy(foreign->dst_port_id.clock_identity,
-                   ctx->port_dataset.port_identity.clock_identity,
-                   sizeof(ClockIdentity));
-            // ... and port
-            foreign->dst_port_id.port_number =
-                ctx->port_dataset.port_identity.port_number;
-
-            // Update timestamps
-            foreign->foreign_master_announce_messages = 1;
-            memcpy(&foreign->announce_tstamp[foreign->tstamp_index],
-                   time, sizeof(struct Timestamp));
-            foreign->tstamp_index++;
-            // Store announce for BMC use
-            memcpy(&foreign->msg, msg, sizeof(struct ptp_announce));
-            // Add foreign to list  
-            foreign_elem->next = ctx->foreign_master_head;
-            ctx->foreign_master_head = foreign_elem;
-
-            DEBUG("Added foreign record ");
-            for (i = 0; i < 8; i++) {
-                DEBUG_PLAIN("%02x:",
-                            0xff & foreign->src_port_id.clock_identity[i]);
-            }
-            DEBUG_PLAIN("%x\n", 0xffff & foreign->src_port_id.port_number);
+    if (ctx->foreign_masters.num_records >=
+        ctx->foreign_masters.capacity) {
+        // Table full, replace the worst record if this one is better
+        foreign = ptp_bmc_select_worst(&ctx->foreign_masters);
+        if ((foreign == NULL) ||
+            !ptp_bmc_announce_better(msg,
+                                     &ctx->port_dataset.port_identity,
+                                     foreign)) {
+            DEBUG("Table of foreign masters full\n");
+            return;
         }
+        DEBUG("Replace foreign record %s %i\n",
+              ptp_clk_id(foreign->src_port_id.clock_identity),
+              foreign->src_port_id.port_number);
+        ptp_foreign_remove(&ctx->foreign_masters, foreign);
     }
+    // Create new foreign record
+    foreign = ptp_foreign_insert(&ctx->foreign_masters, &src_port_id);
+    if (!foreign) {
+        ERROR("Foreign record insert failed\n");
+        return;
+    }
+    // Store source ip ...
+    strncpy(foreign->src_ip, peer_ip, IP_STR_MAX_LEN);
+    // ... and destination clock id and port
+    memcpy(&foreign->dst_port_id, &ctx->port_dataset.port_identity,
+           sizeof(struct PortIdentity));
+    // Update timestamps and store announce for BMC use
+    ptp_foreign_update(foreign, msg, time,
+                       ctx->port_dataset.announce_receipt_timeout);
+
+    DEBUG("Added foreign record %s %i\n",
+          ptp_clk_id(foreign->src_port_id.clock_identity),
+          foreign->src_port_id.port_number);
 }
 
 /**
@@ -376,16 +466,16 @@ static void ptp_port_recv_announce(struct ptp_port_ctx *ctx,
 * @param ctx Port context.
 * @param msg Delay_req message.
 * @param time frame timestamp
+* @param peer_ip IP address of the sender of this message.
 */
 static void ptp_port_recv_delay_req(struct ptp_port_ctx *ctx,
                                     struct ptp_delay_req *msg,
-                                    struct Timestamp *time)
+                                    struct Timestamp *time,
+                                    char *peer_ip)
 {
-    char tmpbuf[MAX_PTP_FRAME_SIZE];
-    int ret = 0;
     struct PortIdentity port_id;
+    s8 log_interval = 0;
 
-    DEBUG("\n");
     // Check port state
     if ((ctx->port_dataset.port_state == PORT_INITIALIZING) ||
         (ctx->port_dataset.port_state == PORT_DISABLED) ||
@@ -394,26 +484,61 @@ static void ptp_port_recv_delay_req(struct ptp_port_ctx *ctx,
         return;
     }
 
+    // Ports using peer delay mechanism do not answer Delay_Req
+    if (ctx->port_dataset.delay_mechanism != DELAY_E2E) {
+        return;
+    }
+
+    // Negotiated unicast ports answer only if peer holds a grant
+    if (!ptp_unicast_granted(ctx, peer_ip, PTP_DELAY_RESP)) {
+        return;
+    }
+
     if (ctx->port_dataset.port_state == PORT_MASTER) {
-        // Get port id
-        memcpy(port_id.clock_identity,
-               msg->hdr.src_port_id.clock_identity, sizeof(ClockIdentity));
-        port_id.port_number = ntohs(msg->hdr.src_port_id.port_number);
-
-        // create delay_resp
-        ret = create_delay_resp(ctx, tmpbuf, time, &port_id,
-                                htons(msg->hdr.seq_id),
-                                ntohll(msg->hdr.corr_field));
-        if (ret > 0) {
-            DEBUG("Send Delay_resp\n");
-            ret = ptp_send(&ptp_ctx.pkt_ctx, PTP_DELAY_RESP,
-                           ctx->port_dataset.port_identity.port_number,
-                           tmpbuf, ret);
-            if( ret != PTP_ERR_OK ){
-                socket_restart = 1;
-            }
+        // Requester may not exceed the rate it is told in Delay_Resp
+        ptp_get_port_id(&port_id, &msg->hdr.src_port_id);
+        log_interval =
+            ptp_unicast_interval(ctx, peer_ip, PTP_DELAY_RESP,
+                                 ctx->port_dataset.
+                                 log_min_mean_delay_req_interval);
+        if (!ptp_rl_admit(&ctx->delay_req_clients, &port_id,
+                          peer_ip, log_interval, time)) {
+            return;
         }
+        // Delay_Resp is sent in a batch after this wakeup
+        ptp_dresp_queue(ctx, msg, time, peer_ip);
+    }
+}
+
+/**
+* Send Pdelay_Resp. Unicast ports send it to the requester, other ports
+* answer unicast requests unicast too. Delay_Resp is queued instead.
+* Without requester address the response is sent multicast.
+* @param ctx Port context.
+* @param msg_type PTP_PDELAY_RESP.
+* @param buf frame.
+* @param len frame length.
+* @param req_hdr header of the request.
+* @param peer_ip IP address of the requester, NULL if not known.
+* @return ptp error code.
+*/
+static int ptp_port_send_resp(struct ptp_port_ctx *ctx, int msg_type,
+                              char *buf, int len,
+                              struct ptp_header *req_hdr, char *peer_ip)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    int ret = 0;
+
+    if (peer_ip && (ptp_hdr_flags(req_hdr) & PTP_UNICAST)) {
+        ptp_hdr_set_flags(hdr, ptp_hdr_flags(hdr) | PTP_UNICAST);
+    } else if (!peer_ip || !ctx->unicast.sessions) {
+        ret = ptp_send(&ctx->ptp->pkt_ctx, msg_type,
+                       ctx->port_dataset.port_identity.port_number,
+                       buf, len);
+        ptp_count_tx(&ctx->counters, msg_type, 1, ret != PTP_ERR_OK);
+        return ret;
     }
+    return ptp_unicast_send(ctx, msg_type, buf, len, peer_ip);
 }
 
 /**
@@ -426,7 +551,9 @@ static void ptp_port_recv_delay_resp(struct ptp_port_ctx *ctx,
                                      struct ptp_delay_resp *msg,
                                      struct Timestamp *time)
 {
-    DEBUG("\n");
+    struct ptp_delay_req_slot *slot = NULL;
+    struct Timestamp master_time, send_time;
+    u16 seq_id = 0;
 
     // Check port state
     if ((ctx->port_dataset.port_state == PORT_INITIALIZING) ||
@@ -439,7 +566,7 @@ static void ptp_port_recv_delay_resp(struct ptp_port_ctx *ctx,
     if ((ctx->port_dataset.port_state == PORT_SLAVE) ||
         (ctx->port_dataset.port_state == PORT_UNCALIBRATED)) {
         ClockIdentity clock_id;
-        u16 port_number = ntohs(msg->req_port_id.port_number);
+        u16 port_number = ptp_get_u16(&msg->req_port_id.port_number);
 
         memcpy(clock_id, 
                msg->req_port_id.clock_identity,
@@ -461,21 +588,311 @@ static void ptp_port_recv_delay_resp(struct ptp_port_ctx *ctx,
             return;
         }
 
-        // sequence_id and current_master
-        if (((ctx->delay_req_seqid_sent) == ntohs(msg->hdr.seq_id)) &&
-            (memcmp(ctx->current_master,
-                    msg->hdr.src_port_id.clock_identity,
-                    sizeof(ClockIdentity)) == 0)) {
-            struct Timestamp master_time;
-            DEBUG("Delay_resp from current master\n");
-            ptp_convert_timestamp(&master_time, msg->recv_tstamp);
-            add_correction(&ctx->delay_req_send_time,
-                           ntohll(msg->hdr.corr_field) );
-            ptp_delay_rcv(&ptp_ctx.clk_ctx, &ctx->delay_req_send_time,
-                          &master_time);
-        } else if ((ctx->delay_req_seqid_sent) != ntohs(msg->hdr.seq_id)) {
-            DEBUG("delay_req seq_id mismatch %i %i\n",
-                  (ctx->delay_req_seqid_sent), ntohs(msg->hdr.seq_id));
+        if (memcmp(ctx->current_master,
+                   msg->hdr.src_port_id.clock_identity,
+                   sizeof(ClockIdentity)) != 0) {
+            return;
+        }
+        // Find Delay_Req in flight by sequence_id
+        seq_id = ptp_hdr_seq_id(&msg->hdr);
+        slot = &ctx->delay_reqs.slots[seq_id & (PTP_DELAY_REQ_WINDOW - 1)];
+        if (!slot->valid || (slot->seq_id != seq_id)) {
+            DEBUG("delay_req seq_id %i not in flight\n", seq_id);
+            ctx->delay_reqs.unmatched++;
+            return;
+        }
+        slot->valid = false;
+        if (older_timestamp(&slot->expiry, time) == &slot->expiry) {
+            // Response came too late, counted once as lost
+            DEBUG("delay_req %i expired\n", seq_id);
+            ctx->delay_reqs.lost++;
+            return;
+        }
+        if (seq_id == ctx->delay_reqs.last_seq_id) {
+            ctx->delay_reqs.matched++;
+        } else {
+            DEBUG("Late delay_resp %i, latest %i\n",
+                  seq_id, ctx->delay_reqs.last_seq_id);
+            ctx->delay_reqs.late++;
         }
+        ptp_get_timestamp(&master_time, msg->recv_tstamp);
+        copy_timestamp(&send_time, &slot->send_time);
+        add_correction(&send_time, ptp_hdr_corr_field(&msg->hdr));
+        TRACE(PTP_TR_DELAY, ctx->port_dataset.port_identity.port_number,
+              seq_id, ptp_trace_ns(&send_time), ptp_trace_ns(&master_time));
+        ptp_delay_rcv(&ctx->ptp->clk_ctx, &send_time, &master_time);
+        ptp_servo_rec_delay(ctx, seq_id, &slot->send_time, &master_time,
+                            ptp_hdr_corr_field(&msg->hdr));
+    }
+}
+
+/**
+* Store send time of Delay_Req. Delay_Req in flight which have expired
+* are counted lost.
+* @param ctx Port context.
+* @param seq_id sequenceId of Delay_Req.
+* @param sent_time send time.
+*/
+void ptp_port_delay_req_sent(struct ptp_port_ctx *ctx, u16 seq_id,
+                             struct Timestamp *sent_time)
+{
+    struct ptp_delay_req_table *table = &ctx->delay_reqs;
+    struct ptp_delay_req_slot *slot = NULL;
+    struct Timestamp timeout;
+    u32 nanosecs = 0;
+    u64 expiry_ns = 0;
+    int i = 0;
+
+    for (i = 0; i < PTP_DELAY_REQ_WINDOW; i++) {
+        slot = &table->slots[i];
+        if (slot->valid &&
+            (older_timestamp(&slot->expiry, sent_time) == &slot->expiry)) {
+            DEBUG("delay_req %i lost\n", slot->seq_id);
+            slot->valid = false;
+            table->lost++;
+        }
+    }
+    slot = &table->slots[seq_id & (PTP_DELAY_REQ_WINDOW - 1)];
+    if (slot->valid) {
+        DEBUG("delay_req %i lost\n", slot->seq_id);
+        table->lost++;
+    }
+    slot->valid = true;
+    slot->seq_id = seq_id;
+    copy_timestamp(&slot->send_time, sent_time);
+    expiry_ns = power2(ctx->port_dataset.log_min_mean_delay_req_interval,
+                       &nanosecs) * (u64) SEC_IN_NS + nanosecs;
+    expiry_ns *= PTP_DELAY_REQ_EXPIRY;
+    timeout.seconds = expiry_ns / SEC_IN_NS;
+    timeout.nanoseconds = expiry_ns % SEC_IN_NS;
+    timeout.frac_nanoseconds = 0;
+    copy_timestamp(&slot->expiry, sent_time);
+    inc_timestamp(&slot->expiry, &timeout);
+    table->last_seq_id = seq_id;
+}
+
+/**
+* Function for handling received Pdelay_Req. Pdelay_Req is answered
+* in every port state (except disabled ones).
+* @param ctx Port context.
+* @param msg Pdelay_Req message.
+* @param time frame timestamp
+* @param peer_ip IP address of the sender of this message.
+*/
+static void ptp_port_recv_pdelay_req(struct ptp_port_ctx *ctx,
+                                     struct ptp_pdelay_req *msg,
+                                     struct Timestamp *time,
+                                     char *peer_ip)
+{
+    char tmpbuf[MAX_PTP_FRAME_SIZE];
+    int ret = 0;
+    struct PortIdentity port_id;
+
+    // Check port state, transparent clock ports are not in any state
+    if ((ctx->port_dataset.delay_mechanism != DELAY_P2P) ||
+        ((ctx->ptp->cfg.clock_type == CLOCK_TYPE_OC) &&
+         ((ctx->port_dataset.port_state == PORT_INITIALIZING) ||
+          (ctx->port_dataset.port_state == PORT_DISABLED) ||
+          (ctx->port_dataset.port_state == PORT_FAULTY)))) {
+        // Discard
+        return;
+    }
+    if (!ptp_unicast_granted(ctx, peer_ip, PTP_PDELAY_RESP)) {
+        return;
+    }
+
+    ptp_get_port_id(&port_id, &msg->hdr.src_port_id);
+    // Correction is returned in Pdelay_Resp_Follow_Up
+    ctx->pdelay_req_corr_field = ptp_hdr_corr_field(&msg->hdr);
+
+    ret = create_pdelay_resp(ctx, tmpbuf, time, &port_id,
+                             ptp_hdr_seq_id(&msg->hdr));
+    if (ret > 0) {
+        DEBUG("Send Pdelay_resp\n");
+        ret = ptp_port_send_resp(ctx, PTP_PDELAY_RESP, tmpbuf, ret,
+                                 &msg->hdr, peer_ip);
+        if( ret == PTP_ERR_NET ){
+            ctx->ptp->socket_restart = 1;
+        }
+    }
+}
+
+/**
+* Check that Pdelay_Resp(_Follow_Up) answers our last Pdelay_Req.
+* @param ctx Port context.
+* @param hdr message header.
+* @param req_port_id requestingPortIdentity of the message.
+* @return true if message answers our last Pdelay_Req.
+*/
+static bool ptp_port_pdelay_match(struct ptp_port_ctx *ctx,
+                                  struct ptp_header *hdr, u8 * req_port_id)
+{
+    struct PortIdentity port_id;
+
+    ptp_get_port_id(&port_id, req_port_id);
+    if ((compare_clock_id(port_id.clock_identity,
+                          ctx->port_dataset.port_identity.
+                          clock_identity) != 0) ||
+        (port_id.port_number !=
+         ctx->port_dataset.port_identity.port_number)) {
+        // Answer to some other port
+        return false;
+    }
+    if (!ctx->pdelay_t1_valid ||
+        (ctx->pdelay_req_seqid_sent != ptp_hdr_seq_id(hdr))) {
+        DEBUG("pdelay seq_id mismatch %i %i\n",
+              ctx->pdelay_req_seqid_sent, ptp_hdr_seq_id(hdr));
+        return false;
+    }
+    return true;
+}
+
+/**
+* Function for handling received Pdelay_Resp.
+* @param ctx Port context.
+* @param msg Pdelay_Resp message.
+* @param time frame timestamp
+*/
+static void ptp_port_recv_pdelay_resp(struct ptp_port_ctx *ctx,
+                                      struct ptp_pdelay_resp *msg,
+                                      struct Timestamp *time)
+{
+    struct PortIdentity peer;
+
+    if (ctx->port_dataset.delay_mechanism != DELAY_P2P) {
+        return;
+    }
+    if (!ptp_port_pdelay_match(ctx, &msg->hdr, msg->req_port_id)) {
+        return;
+    }
+    ptp_get_port_id(&peer, &msg->hdr.src_port_id);
+    if (ctx->pdelay_resp_valid &&
+        (memcmp(&peer, &ctx->pdelay_peer, sizeof(struct PortIdentity)))) {
+        // More than one responder on the link, measurement is not valid
+        ERROR("Multiple Pdelay_Resp for %i\n", ptp_hdr_seq_id(&msg->hdr));
+        ctx->pdelay_t1_valid = false;
+        ctx->pdelay_resp_valid = false;
+        return;
+    }
+    memcpy(&ctx->pdelay_peer, &peer, sizeof(struct PortIdentity));
+    ptp_get_timestamp(&ctx->pdelay_t2, msg->recv_tstamp);
+    copy_timestamp(&ctx->pdelay_t4, time);
+    ctx->pdelay_corr_field = ptp_hdr_corr_field(&msg->hdr);
+
+    if (ptp_hdr_flags(&msg->hdr) & PTP_TWO_STEP) {
+        // Wait for Pdelay_Resp_Follow_Up
+        ctx->pdelay_resp_valid = true;
+    } else {
+        // One-step responder, turnaround time is in correctionField
+        ptp_port_pdelay_update(ctx, NULL, ctx->pdelay_corr_field);
+        ctx->pdelay_t1_valid = false;
+    }
+}
+
+/**
+* Function for handling received Pdelay_Resp_Follow_Up.
+* @param ctx Port context.
+* @param msg Pdelay_Resp_Follow_Up message.
+* @param time frame timestamp
+*/
+static void ptp_port_recv_pdelay_resp_follow_up(struct ptp_port_ctx *ctx,
+                                                struct
+                                                ptp_pdelay_resp_follow_up
+                                                *msg,
+                                                struct Timestamp *time)
+{
+    struct PortIdentity peer;
+    struct Timestamp t3;
+
+    if ((ctx->port_dataset.delay_mechanism != DELAY_P2P) ||
+        !ctx->pdelay_resp_valid) {
+        return;
+    }
+    if (!ptp_port_pdelay_match(ctx, &msg->hdr, msg->req_port_id)) {
+        return;
+    }
+    ptp_get_port_id(&peer, &msg->hdr.src_port_id);
+    if (memcmp(&peer, &ctx->pdelay_peer, sizeof(struct PortIdentity))) {
+        DEBUG("Pdelay_Resp_Follow_Up from other peer\n");
+        return;
+    }
+    ptp_get_timestamp(&t3, msg->resp_origin_tstamp);
+    ptp_port_pdelay_update(ctx, &t3, ctx->pdelay_corr_field +
+                           ptp_hdr_corr_field(&msg->hdr));
+    ctx->pdelay_t1_valid = false;
+    ctx->pdelay_resp_valid = false;
+}
+
+/**
+* Get difference of timestamps in nanoseconds.
+* @param a timestamp.
+* @param b timestamp.
+* @return a - b in ns.
+*/
+static s64 pdelay_diff_ns(struct Timestamp *a, struct Timestamp *b)
+{
+    return ((s64) a->seconds - (s64) b->seconds) * SEC_IN_NS +
+        ((s64) a->nanoseconds - (s64) b->nanoseconds);
+}
+
+/**
+* Update neighbor rate ratio and meanLinkDelay from completed peer delay
+* measurement (t1 - t4 stored to port context).
+* @param ctx Port context.
+* @param t3 send time of Pdelay_Resp, NULL if responder is one-step.
+* @param corr_field sum of correction fields of the responses (scaled ns).
+*/
+static void ptp_port_pdelay_update(struct ptp_port_ctx *ctx,
+                                   struct Timestamp *t3, s64 corr_field)
+{
+    s64 turnaround = 0;
+    s64 link_delay = 0;
+    s64 *mean_link_delay =
+        &ctx->port_dataset.peer_mean_path_delay.scaled_nanoseconds;
+    double ratio = 0;
+    s64 local = 0;
+
+    if (t3) {
+        // Neighbor rate ratio from t3 and t4 of successive measurements
+        if (ctx->pdelay_ratio_count == 0) {
+            copy_timestamp(&ctx->pdelay_ratio_t3, t3);
+            copy_timestamp(&ctx->pdelay_ratio_t4, &ctx->pdelay_t4);
+        }
+        if (++ctx->pdelay_ratio_count > PDELAY_RATIO_WINDOW) {
+            local = pdelay_diff_ns(&ctx->pdelay_t4, &ctx->pdelay_ratio_t4);
+            if (local > 0) {
+                ratio = (double) pdelay_diff_ns(t3, &ctx->pdelay_ratio_t3) /
+                    (double) local;
+                if ((ratio > 1.0 - PDELAY_RATIO_MAX_PPM / 1e6) &&
+                    (ratio < 1.0 + PDELAY_RATIO_MAX_PPM / 1e6)) {
+                    ctx->neighbor_rate_ratio = ratio;
+                } else {
+                    DEBUG("neighbor rate ratio %f rejected\n", ratio);
+                }
+            }
+            // Next measurement becomes the reference of a new window
+            ctx->pdelay_ratio_count = 0;
+        }
+        turnaround = pdelay_diff_ns(t3, &ctx->pdelay_t2) << 16;
+    }
+
+    // meanLinkDelay = ((t4 - t1) * r - (t3 - t2) - corrections) / 2
+    link_delay = (s64) ((double) (pdelay_diff_ns(&ctx->pdelay_t4,
+                                                 &ctx->pdelay_t1) << 16) *
+                        ctx->neighbor_rate_ratio);
+    link_delay = (link_delay - turnaround - corr_field) / 2;
+    if (link_delay < 0) {
+        DEBUG("Not using negative link delay %ins\n",
+              (s32) (link_delay >> 16));
+        return;
+    }
+
+    if (*mean_link_delay == 0) {
+        *mean_link_delay = link_delay;
+    } else {
+        *mean_link_delay += (link_delay - *mean_link_delay) / PDELAY_FILTER;
     }
+    DEBUG("link delay %ins mean %ins ratio %f\n",
+          (s32) (link_delay >> 16), (s32) (*mean_link_delay >> 16),
+          ctx->neighbor_rate_ratio);
 }
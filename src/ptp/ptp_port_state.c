@@ -24,6 +24,8 @@
 /*******************************************************************************
 * $Id$
 *******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_PORT
+
 #include <ptp_general.h>
 #include <ptp_message.h>
 #include <ptp_internal.h>
@@ -32,6 +34,9 @@
 #include "ptp.h"
 #include "ptp_port.h"
 #include "ptp_framer.h"
+#include "ptp_foreign.h"
+#include "ptp_codec.h"
+#include "ptp_trace.h"
 
 /// static functions for handling PTP port states
 static void ptp_port_state_initializing(struct ptp_port_ctx *ctx,
@@ -61,6 +66,13 @@ static void ptp_port_state_uncalibrated(struct ptp_port_ctx *ctx,
 static void ptp_port_state_slave(struct ptp_port_ctx *ctx,
                                  struct Timestamp *current_time,
                                  bool enter_state);
+// Peer delay mechanism
+static void ptp_port_pdelay_req(struct ptp_port_ctx *ctx,
+                                struct Timestamp *current_time);
+// Delay requests of unicast ports
+static bool ptp_port_req_leased(struct ptp_port_ctx *ctx, u8 msg_type);
+static int ptp_port_send_req(struct ptp_port_ctx *ctx, int msg_type,
+                             char *buf, int len);
 
 /**
 * Statemachine for PTP port.
@@ -73,169 +85,83 @@ void ptp_port_statemachine(struct ptp_port_ctx *ctx,
                            struct Timestamp *next_time)
 {
     struct Timestamp timeout_tmp;
-    struct Timestamp timestamp_tmp;
     struct Timestamp *timeout_p = &timeout_tmp;
-    struct ForeignMasterDataSetElem *foreign_elem =
-        ctx->foreign_master_head;
-    struct ForeignMasterDataSetElem *foreign_elem_prev = 0, *ftmp = 0;
-    struct ForeignMasterDataSet *foreign = 0;
     bool enter_state = false;
-    int i = 0;
 
     memset(&timeout_tmp, 0, sizeof(struct Timestamp));
-    memset(&timestamp_tmp, 0, sizeof(struct Timestamp));
-
-    DEBUG("%s %us %uns\n", get_state_str(ctx->port_dataset.port_state),
-          (u32) current_time->seconds, current_time->nanoseconds);
-
-    // Check foreign records timestamps
-    while (foreign_elem) {
-        foreign = foreign_elem->data_p;
-        // Get timeout value for announce_interval
-        timeout_tmp.seconds =
-            power2(foreign->msg.hdr.log_mean_msg_interval,
-                   &timeout_tmp.nanoseconds);
-        /* Get timeout which is the length of the announce window 
-         * (announce_interval*ANNOUNCE_WINDOW) */
-        mult_timeout(&timeout_tmp,
-                     ctx->port_dataset.announce_receipt_timeout);
-        DEBUG("Announce window %us %uns\n",
-              (u32) timeout_tmp.seconds, (u32) timeout_tmp.nanoseconds);
-
-        // initialialize timestamp to current time
-        copy_timestamp(&timestamp_tmp, current_time);
-        // dec timestamp with announce window timeout
-        dec_timestamp(&timestamp_tmp, &timeout_tmp);
-
-        DEBUG("Announce history %us %uns\n",
-              (u32) timestamp_tmp.seconds,
-              (u32) timestamp_tmp.nanoseconds);
-        foreign->foreign_master_announce_messages = 0;
-        for (i = 0; i < ANNOUNCE_WINDOW; i++) {
-            if ((foreign->announce_tstamp[i].seconds == 0) &&
-                (foreign->announce_tstamp[i].nanoseconds == 0)) {
-                // invalid timestamp
-                continue;
-            }
-            /* check announce timestamps comparing to 
-             * calculated announce window */
-            if (older_timestamp(&foreign->announce_tstamp[i],
-                                &timestamp_tmp) == &timestamp_tmp) {
-                // This is ok        
-                foreign->foreign_master_announce_messages += 1;
-            } else {
-                DEBUG("Expired announce: %llis %ins\n",
-                      foreign->announce_tstamp[i].seconds,
-                      foreign->announce_tstamp[i].nanoseconds);
-            }
-        }
-        DEBUG("Valid announces: %i\n",
-              foreign->foreign_master_announce_messages);
-        if (foreign->foreign_master_announce_messages == 0) {
-            DEBUG("Remove foreign record ");
-            for (i = 0; i < 9; i++) {
-                DEBUG_PLAIN("%02x:",
-                            0xff & ((char *) &foreign->src_port_id)[i]);
-            }
-            DEBUG_PLAIN("%02x\n",
-                        0xff & ((char *) &foreign->src_port_id)[i]);
-
-            ftmp = foreign_elem;
-            foreign_elem = foreign_elem->next;
-            free(ftmp);
-            if (foreign_elem_prev == 0) {
-                ctx->foreign_master_head = foreign_elem;
-            } else {
-                foreign_elem_prev->next = foreign_elem;
+
+    // Ports of transparent clock have no state, only peer delay is measured
+    if (ctx->ptp->cfg.clock_type == CLOCK_TYPE_OC) {
+        // Remove foreign records with expired announce window
+        ptp_foreign_expire(&ctx->foreign_masters, current_time);
+
+        do {
+            enter_state = ctx->port_state_updated;
+            ctx->port_state_updated = false;
+
+            switch (ctx->port_dataset.port_state) {
+            case PORT_INITIALIZING:
+                ptp_port_state_initializing(ctx, current_time, enter_state);
+                break;
+            case PORT_FAULTY:
+                ptp_port_state_faulty(ctx, current_time, enter_state);
+                break;
+            case PORT_DISABLED:
+                ptp_port_state_disabled(ctx, current_time, enter_state);
+                break;
+            case PORT_LISTENING:
+                ptp_port_state_listening(ctx, current_time, enter_state);
+                break;
+            case PORT_PRE_MASTER:
+                ptp_port_state_pre_master(ctx, current_time, enter_state);
+                break;
+            case PORT_MASTER:
+                ptp_port_state_master(ctx, current_time, enter_state);
+                break;
+            case PORT_PASSIVE:
+                ptp_port_state_passive(ctx, current_time, enter_state);
+                break;
+            case PORT_UNCALIBRATED:
+                ptp_port_state_uncalibrated(ctx, current_time, enter_state);
+                break;
+            case PORT_SLAVE:
+                ptp_port_state_slave(ctx, current_time, enter_state);
+                break;
+            default:
+                ERROR("Error state: %i\n", ctx->port_dataset.port_state);
+                break;
             }
-        } else {
-            // update pointers
-            foreign_elem_prev = foreign_elem;
-            foreign_elem = foreign_elem->next;
-        }
+        } while (ctx->port_state_updated);
     }
 
-    do {
-        enter_state = ctx->port_state_updated;
-        ctx->port_state_updated = false;
-
-        switch (ctx->port_dataset.port_state) {
-        case PORT_INITIALIZING:
-            ptp_port_state_initializing(ctx, current_time, enter_state);
-            break;
-        case PORT_FAULTY:
-            ptp_port_state_faulty(ctx, current_time, enter_state);
-            break;
-        case PORT_DISABLED:
-            ptp_port_state_disabled(ctx, current_time, enter_state);
-            break;
-        case PORT_LISTENING:
-            ptp_port_state_listening(ctx, current_time, enter_state);
-            break;
-        case PORT_PRE_MASTER:
-            ptp_port_state_pre_master(ctx, current_time, enter_state);
-            break;
-        case PORT_MASTER:
-            ptp_port_state_master(ctx, current_time, enter_state);
-            break;
-        case PORT_PASSIVE:
-            ptp_port_state_passive(ctx, current_time, enter_state);
-            break;
-        case PORT_UNCALIBRATED:
-            ptp_port_state_uncalibrated(ctx, current_time, enter_state);
-            break;
-        case PORT_SLAVE:
-            ptp_port_state_slave(ctx, current_time, enter_state);
-            break;
-        default:
-            ERROR("Error state: %i\n", ctx->port_dataset.port_state);
-            break;
-        }
-    } while (ctx->port_state_updated);
+    // Peer delay is measured in every state, so that link delay is
+    // already known when port becomes slave
+    ptp_port_pdelay_req(ctx, current_time);
 
     // Default timeout is 120s 
     timeout_tmp.seconds = current_time->seconds + 120;
     timeout_tmp.nanoseconds = current_time->nanoseconds;
 
     // solve which timeout is next
-    DEBUG("Timer flags: 0x%02x\n", ctx->timer_flags);
     if (ctx->timer_flags & ANNOUNCE_TIMER) {
-        DEBUG("Announce timer: %llus %uns\n",
-              ctx->announce_timer.seconds,
-              ctx->announce_timer.nanoseconds);
         timeout_p = older_timestamp(timeout_p, &ctx->announce_timer);
     }
     if (ctx->timer_flags & SYNC_TIMER) {
-        DEBUG("Sync timer: %llus %uns\n",
-              ctx->sync_timer.seconds, ctx->sync_timer.nanoseconds);
         timeout_p = older_timestamp(timeout_p, &ctx->sync_timer);
     }
     if (ctx->timer_flags & DELAY_REQ_TIMER) {
-        DEBUG("Delay_req timer: %llus %uns\n",
-              ctx->delay_req_timer.seconds,
-              ctx->delay_req_timer.nanoseconds);
         timeout_p = older_timestamp(timeout_p, &ctx->delay_req_timer);
     }
     if (ctx->timer_flags & PDELAY_REQ_TIMER) {
-        DEBUG("PDelay_req timer: %llus %uns\n",
-              ctx->pdelay_req_timer.seconds,
-              ctx->pdelay_req_timer.nanoseconds);
         timeout_p = older_timestamp(timeout_p, &ctx->pdelay_req_timer);
     }
     if (ctx->timer_flags & ANNOUNCE_RECV_TIMER) {
-        DEBUG("timeout_p: %llus %uns\n",
-              timeout_p->seconds, timeout_p->nanoseconds);
-        DEBUG("Announce recv timer: %llus %uns\n",
-              ctx->announce_recv_timer.seconds,
-              ctx->announce_recv_timer.nanoseconds);
         timeout_p = older_timestamp(timeout_p, &ctx->announce_recv_timer);
-        DEBUG("timeout_p: %llus %uns\n",
-              timeout_p->seconds, timeout_p->nanoseconds);
     }
     copy_timestamp(next_time, timeout_p);
-    DEBUG("Next time [%llus %uns]: %llus %uns\n",
-          current_time->seconds, current_time->nanoseconds,
-          next_time->seconds, next_time->nanoseconds);
+    TRACE(PTP_TR_TIMERS, ctx->port_dataset.port_identity.port_number,
+          ctx->port_dataset.port_state, ctx->timer_flags,
+          ptp_trace_ns(next_time));
 }
 
 /**
@@ -327,6 +253,55 @@ static void ptp_port_state_pre_master(struct ptp_port_ctx *ctx,
     }
 }
 
+/**
+* Check if port may request delay measurement. Unicast ports request it
+* from the current master, if the master has granted the response. Hybrid
+* ports send Delay_Req to the current master, once it is known.
+* @param ctx Port context.
+* @param msg_type PTP_DELAY_RESP or PTP_PDELAY_RESP.
+* @return true if request may be sent.
+*/
+static bool ptp_port_req_leased(struct ptp_port_ctx *ctx, u8 msg_type)
+{
+    bool hybrid = ctx->hybrid && (msg_type == PTP_DELAY_RESP);
+
+    if (!ctx->unicast.sessions && !hybrid) {
+        return true;
+    }
+    if (ctx->current_master_ip[0] == '\0') {
+        return false;
+    }
+    return ptp_unicast_leased(ctx, ctx->current_master_ip, msg_type);
+}
+
+/**
+* Send Delay_Req or Pdelay_Req. Unicast ports send it to the current
+* master, and so do hybrid ports with Delay_Req. Send time of unicast
+* requests is the transmit timestamp given by ptp_unicast_send().
+* @param ctx Port context.
+* @param msg_type PTP_DELAY_REQ or PTP_PDELAY_REQ.
+* @param buf frame.
+* @param len frame length.
+* @return ptp error code.
+*/
+static int ptp_port_send_req(struct ptp_port_ctx *ctx, int msg_type,
+                             char *buf, int len)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    int ret = 0;
+
+    if (ctx->hybrid && (msg_type == PTP_DELAY_REQ)) {
+        ptp_hdr_set_flags(hdr, ptp_hdr_flags(hdr) | PTP_UNICAST);
+    } else if (!ctx->unicast.sessions) {
+        ret = ptp_send(&ctx->ptp->pkt_ctx, msg_type,
+                       ctx->port_dataset.port_identity.port_number,
+                       buf, len);
+        ptp_count_tx(&ctx->counters, msg_type, 1, ret != PTP_ERR_OK);
+        return ret;
+    }
+    return ptp_unicast_send(ctx, msg_type, buf, len, ctx->current_master_ip);
+}
+
 /**
 * Statemachine function for state MASTER.
 * @param ctx Port context.
@@ -348,37 +323,37 @@ static void ptp_port_state_master(struct ptp_port_ctx *ctx,
         // ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES stop
         ptp_port_announce_recv_timeout_stop(ctx, current_time);
     }
+    // Peers of unicast ports get Sync and Announce from their sessions
+    if (ctx->unicast.sessions) {
+        ctx->timer_flags &= ~(SYNC_TIMER | ANNOUNCE_TIMER);
+        return;
+    }
     // Check if it is time to send sync
     if (enter_state ||
         (older_timestamp(&ctx->sync_timer, current_time) !=
          current_time)) {
-        DEBUG("Sync %us %uns\n", (u32) ctx->sync_timer.seconds,
-              ctx->sync_timer.nanoseconds);
         // create sync
-        ret = create_sync(ctx, tmpbuf, ctx->sync_seqid);
+        ret = create_sync(ctx, tmpbuf, ctx->sync_seqid, current_time);
         if (ret > 0) {
-            DEBUG("Send SYNC\n");
-            ret = ptp_send(&ptp_ctx.pkt_ctx, PTP_SYNC,
+            ret = ptp_send(&ctx->ptp->pkt_ctx, PTP_SYNC,
                            ctx->port_dataset.port_identity.port_number,
                            tmpbuf, ret);
-            if (ret == PTP_ERR_OK) {
+            ptp_count_tx(&ctx->counters, PTP_SYNC, 1, ret != PTP_ERR_OK);
+            TRACE(PTP_TR_TX, ctx->port_dataset.port_identity.port_number,
+                  PTP_SYNC, ctx->sync_seqid, ret);
+            // Frame lost on a working socket waits for the next interval
+            if (ret != PTP_ERR_NET) {
                 ctx->sync_seqid++;
-                // sync sent succesfully, update timeout
+                // update timeout
                 time_tmp.seconds =
                     power2(ctx->port_dataset.log_mean_sync_interval,
                            &time_tmp.nanoseconds);
                 copy_timestamp(&ctx->sync_timer, current_time);
                 inc_timestamp(&ctx->sync_timer, &time_tmp);
-                DEBUG("Set Sync timeout 2^%i=%us %uns %us %uns\n",
-                      ctx->port_dataset.log_mean_sync_interval,
-                      (u32) time_tmp.seconds,
-                      (u32) time_tmp.nanoseconds,
-                      (u32) ctx->sync_timer.seconds,
-                      (u32) ctx->sync_timer.nanoseconds);
                 ctx->timer_flags |= SYNC_TIMER;
             }
             else {
-                socket_restart = 1;
+                ctx->ptp->socket_restart = 1;
             }
         }
     }
@@ -386,34 +361,29 @@ static void ptp_port_state_master(struct ptp_port_ctx *ctx,
     if (enter_state ||
         (older_timestamp(&ctx->announce_timer,
                          current_time) != current_time)) {
-        DEBUG("Announce %us %uns\n",
-              (u32) ctx->announce_timer.seconds,
-              ctx->announce_timer.nanoseconds);
         // Create and send announce
-        ret = create_announce(ctx, tmpbuf, ctx->announce_seqid, 0);
+        ret = create_announce(ctx, tmpbuf, ctx->announce_seqid, 0,
+                              current_time);
         if (ret > 0) {
-            DEBUG("Send ANNOUNCE\n");
-            ret = ptp_send(&ptp_ctx.pkt_ctx, PTP_ANNOUNCE,
+            ret = ptp_send(&ctx->ptp->pkt_ctx, PTP_ANNOUNCE,
                            ctx->port_dataset.port_identity.port_number,
                            tmpbuf, ret);
-            if (ret == PTP_ERR_OK) {
+            ptp_count_tx(&ctx->counters, PTP_ANNOUNCE, 1, ret != PTP_ERR_OK);
+            TRACE(PTP_TR_TX, ctx->port_dataset.port_identity.port_number,
+                  PTP_ANNOUNCE, ctx->announce_seqid, ret);
+            // Frame lost on a working socket waits for the next interval
+            if (ret != PTP_ERR_NET) {
                 ctx->announce_seqid++;
-                // announce sent succesfully, update timeout
+                // update timeout
                 time_tmp.seconds =
                     power2(ctx->port_dataset.log_mean_announce_interval,
                            &time_tmp.nanoseconds);
                 copy_timestamp(&ctx->announce_timer, current_time);
                 inc_timestamp(&ctx->announce_timer, &time_tmp);
-                DEBUG("Set Announce timeout 2^%i=%us %uns %us %uns\n",
-                      ctx->port_dataset.log_mean_announce_interval,
-                      (u32) time_tmp.seconds,
-                      (u32) time_tmp.nanoseconds,
-                      (u32) ctx->announce_timer.seconds,
-                      (u32) ctx->announce_timer.nanoseconds);
                 ctx->timer_flags |= ANNOUNCE_TIMER;
             }
             else {
-                socket_restart = 1;
+                ctx->ptp->socket_restart = 1;
             }
         }
     }
@@ -456,23 +426,31 @@ static void ptp_port_state_uncalibrated(struct ptp_port_ctx *ctx,
         // reset seqids
         ctx->sync_seqid = 0;
         ctx->delay_req_seqid = 0;
+        // Responses to requests before the reset are not accepted
+        memset(ctx->delay_reqs.slots, 0, sizeof(ctx->delay_reqs.slots));
         // ANNOUNCE_RECEIPT_TIMEOUT_EXPIRES restart
         ptp_port_announce_recv_timeout_restart(ctx, current_time);
     }
+    // Delay_Req is sent only if the master has granted Delay_Resp
+    if (!ptp_port_req_leased(ctx, PTP_DELAY_RESP)) {
+        ctx->timer_flags &= ~DELAY_REQ_TIMER;
+    }
     // Check if it is time to send delay_req 
-    if (enter_state ||
-        (older_timestamp(&ctx->delay_req_timer,
-                         current_time) != current_time)) {
+    else if ((ctx->port_dataset.delay_mechanism == DELAY_E2E) &&
+             (enter_state ||
+              (older_timestamp(&ctx->delay_req_timer,
+                               current_time) != current_time))) {
         // create delay_req
-        ret = create_delay_req(ctx, tmpbuf, ctx->delay_req_seqid);
+        ret = create_delay_req(ctx, tmpbuf, ctx->delay_req_seqid,
+                               current_time);
         if (ret > 0) {
-            DEBUG("Send Delay_req %i\n", ctx->delay_req_seqid);
-            ret = ptp_send(&ptp_ctx.pkt_ctx, PTP_DELAY_REQ,
-                           ctx->port_dataset.port_identity.port_number,
-                           tmpbuf, ret);
-            if (ret == PTP_ERR_OK) {
+            ret = ptp_port_send_req(ctx, PTP_DELAY_REQ, tmpbuf, ret);
+            TRACE(PTP_TR_TX, ctx->port_dataset.port_identity.port_number,
+                  PTP_DELAY_REQ, ctx->delay_req_seqid, ret);
+            // Frame lost on a working socket waits for the next interval
+            if (ret != PTP_ERR_NET) {
                 ctx->delay_req_seqid++;
-                // delay req sent succesfully, update timeout
+                // update timeout
                 secs =
                     power2(ctx->port_dataset.
                            log_min_mean_delay_req_interval, &nanosecs);
@@ -491,15 +469,10 @@ static void ptp_port_state_uncalibrated(struct ptp_port_ctx *ctx,
                     ctx->delay_req_timer.nanoseconds -= SEC_IN_NS;
                     ctx->delay_req_timer.seconds++;
                 }   
-                DEBUG("Set Delay_req timeout 2^%i-2^%i=%uus %us %uns\n",
-                      ctx->port_dataset.log_min_mean_delay_req_interval,
-                      ctx->port_dataset.log_min_mean_delay_req_interval +
-                      1, t1_usec, (u32) ctx->delay_req_timer.seconds,
-                      (u32) ctx->delay_req_timer.nanoseconds);
                 ctx->timer_flags |= DELAY_REQ_TIMER;
             }
             else {
-                socket_restart = 1;
+                ctx->ptp->socket_restart = 1;
             }
         }
     }
@@ -530,18 +503,23 @@ static void ptp_port_state_slave(struct ptp_port_ctx *ctx,
     /* Not neccessary when enter_state==true, because 
      * always entering from UNCALIBRATED
      * state which has already issued delay_reqs and updated the sync_timer. */
-    if (older_timestamp(&ctx->delay_req_timer,
-                        current_time) != current_time) {
+    if (!ptp_port_req_leased(ctx, PTP_DELAY_RESP)) {
+        ctx->timer_flags &= ~DELAY_REQ_TIMER;
+    }
+    else if ((ctx->port_dataset.delay_mechanism == DELAY_E2E) &&
+             (older_timestamp(&ctx->delay_req_timer,
+                              current_time) != current_time)) {
         // create delay_req
-        ret = create_delay_req(ctx, tmpbuf, ctx->delay_req_seqid);
+        ret = create_delay_req(ctx, tmpbuf, ctx->delay_req_seqid,
+                               current_time);
         if (ret > 0) {
-            DEBUG("Send Delay_req %i\n", ctx->delay_req_seqid);
-            ret = ptp_send(&ptp_ctx.pkt_ctx, PTP_DELAY_REQ,
-                           ctx->port_dataset.port_identity.port_number,
-                           tmpbuf, ret);
-            if (ret == PTP_ERR_OK) {
+            ret = ptp_port_send_req(ctx, PTP_DELAY_REQ, tmpbuf, ret);
+            TRACE(PTP_TR_TX, ctx->port_dataset.port_identity.port_number,
+                  PTP_DELAY_REQ, ctx->delay_req_seqid, ret);
+            // Frame lost on a working socket waits for the next interval
+            if (ret != PTP_ERR_NET) {
                 ctx->delay_req_seqid++;
-                // delay req sent succesfully, update timeout
+                // update timeout
                 secs =
                     power2(ctx->port_dataset.
                            log_min_mean_delay_req_interval, &nanosecs);
@@ -560,20 +538,73 @@ static void ptp_port_state_slave(struct ptp_port_ctx *ctx,
                     ctx->delay_req_timer.nanoseconds -= SEC_IN_NS;
                     ctx->delay_req_timer.seconds++;
                 }   
-                DEBUG("Set Delay_req timeout 2^%i-2^%i=%uus %us %uns\n",
-                      ctx->port_dataset.log_min_mean_delay_req_interval,
-                      ctx->port_dataset.log_min_mean_delay_req_interval +
-                      1, t1_usec, (u32) ctx->delay_req_timer.seconds,
-                      (u32) ctx->delay_req_timer.nanoseconds);
                 ctx->timer_flags |= DELAY_REQ_TIMER;
             }
             else {
-                socket_restart = 1;
+                ctx->ptp->socket_restart = 1;
             }
         }
     }
 }
 
+/**
+* Send Pdelay_Req if peer delay mechanism is used and it is time to send.
+* @param ctx Port context.
+* @param current_time current time.
+*/
+static void ptp_port_pdelay_req(struct ptp_port_ctx *ctx,
+                                struct Timestamp *current_time)
+{
+    char tmpbuf[MAX_PTP_FRAME_SIZE];
+    int ret = 0;
+    struct Timestamp time_tmp;
+
+    if (ctx->port_dataset.delay_mechanism != DELAY_P2P) {
+        return;
+    }
+    // Transparent clock ports are not in any state
+    if ((ctx->ptp->cfg.clock_type == CLOCK_TYPE_OC) &&
+        ((ctx->port_dataset.port_state == PORT_INITIALIZING) ||
+         (ctx->port_dataset.port_state == PORT_DISABLED) ||
+         (ctx->port_dataset.port_state == PORT_FAULTY))) {
+        return;
+    }
+    // Pdelay_Req is sent only if the master has granted Pdelay_Resp
+    if (!ptp_port_req_leased(ctx, PTP_PDELAY_RESP)) {
+        ctx->timer_flags &= ~PDELAY_REQ_TIMER;
+        return;
+    }
+    // Timers are disabled on state change, then send immediately
+    if ((ctx->timer_flags & PDELAY_REQ_TIMER) &&
+        (older_timestamp(&ctx->pdelay_req_timer,
+                         current_time) == current_time)) {
+        return;
+    }
+    ret = create_pdelay_req(ctx, tmpbuf, ctx->pdelay_req_seqid,
+                            current_time);
+    if (ret > 0) {
+        // Previous measurement is abandoned
+        ctx->pdelay_t1_valid = false;
+        ctx->pdelay_resp_valid = false;
+        ret = ptp_port_send_req(ctx, PTP_PDELAY_REQ, tmpbuf, ret);
+        TRACE(PTP_TR_TX, ctx->port_dataset.port_identity.port_number,
+              PTP_PDELAY_REQ, ctx->pdelay_req_seqid, ret);
+        // Frame lost on a working socket waits for the next interval
+        if (ret != PTP_ERR_NET) {
+            ctx->pdelay_req_seqid++;
+            time_tmp.seconds =
+                power2(ctx->port_dataset.log_min_mean_pdelay_req_interval,
+                       &time_tmp.nanoseconds);
+            copy_timestamp(&ctx->pdelay_req_timer, current_time);
+            inc_timestamp(&ctx->pdelay_req_timer, &time_tmp);
+            ctx->timer_flags |= PDELAY_REQ_TIMER;
+        }
+        else {
+            ctx->ptp->socket_restart = 1;
+        }
+    }
+}
+
 /**
 * Function for updating the PTP port state.
 * This function should check the validity of the port state updates, 
@@ -585,6 +616,7 @@ void ptp_port_state_update(struct ptp_port_ctx *ctx,
                            enum PortState new_state)
 {
     struct interface_config* if_config = 0;
+    enum PortState old_state;
     int i = 0;
 
     // Do ctx updates
@@ -593,10 +625,10 @@ void ptp_port_state_update(struct ptp_port_ctx *ctx,
         // When going to INITIALIZING, update delay_asymmetry
         
         // Locate correct interface
-        for( i = 0; i < ptp_cfg.num_interfaces; i++ ){
-            if( !strncmp(ctx->name, ptp_cfg.interfaces[i].name, 
+        for( i = 0; i < ctx->ptp->cfg.num_interfaces; i++ ){
+            if( !strncmp(ctx->name, ctx->ptp->cfg.interfaces[i].name, 
                          INTERFACE_NAME_LEN) ){
-                if_config = &ptp_cfg.interfaces[i];
+                if_config = &ctx->ptp->cfg.interfaces[i];
                 break;
             }
         }
@@ -636,7 +668,12 @@ void ptp_port_state_update(struct ptp_port_ctx *ctx,
         DEBUG("from %s to %s\n",
               get_state_str(ctx->port_dataset.port_state),
               get_state_str(new_state));
+        old_state = ctx->port_dataset.port_state;
         ctx->port_dataset.port_state = new_state;
+        ctx->counters.state_changes++;
+        TRACE(PTP_TR_STATE, ctx->port_dataset.port_identity.port_number,
+              old_state, new_state, 0);
+        ptp_ctl_port_state(ctx, old_state);
         ctx->timer_flags = 0;   // Disable timers
         ctx->port_state_updated = true; // indicate that port state has updated
     }
@@ -659,7 +696,7 @@ bool ptp_port_bmc_update(struct ptp_port_ctx *ctx,
     struct Timestamp current_time = { 0, 0 };
     bool state_update = false;
 
-    if (ptp_get_time(&ptp_ctx.clk_ctx, &current_time) != PTP_ERR_OK) {
+    if (ptp_get_time(&ctx->ptp->clk_ctx, &current_time) != PTP_ERR_OK) {
         ERROR("ptp_get_time\n");
         // No valid time
         current_time.seconds = current_time.nanoseconds = 0;
@@ -689,7 +726,7 @@ bool ptp_port_bmc_update(struct ptp_port_ctx *ctx,
             if (bmc_update == BMC_MASTER_M3) {
                 // For M3, N shall be the value incremented by 1 (one) of 
                 // the steps_removed field of the current data set
-                N = ptp_ctx.current_dataset.steps_removed + 1;
+                N = ctx->ptp->current_dataset.steps_removed + 1;
             }
             time_tmp.seconds =
                 power2(ctx->port_dataset.log_mean_announce_interval,
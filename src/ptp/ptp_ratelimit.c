@@ -0,0 +1,228 @@
+/** @file ptp_ratelimit.c
+* PTP Delay_Req admission of master ports. Every requester has a token
+* bucket which is filled at the rate the master advertises in
+* logMessageInterval of Delay_Resp. Requests over the rate are dropped
+* before a response is built.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_PORT
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp.h"
+#include "ptp_ratelimit.h"
+
+// FNV-1a constants
+#define FNV_OFFSET_BASIS    2166136261u
+#define FNV_PRIME           16777619u
+
+/**
+* Hash of the requester.
+* @param addr source address.
+* @return hash value.
+*/
+static u32 ptp_rl_hash(const char *addr)
+{
+    u32 hash = FNV_OFFSET_BASIS;
+    int i = 0;
+
+    for (i = 0; (i < IP_STR_MAX_LEN) && addr[i]; i++) {
+        hash = (hash ^ (u8) addr[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+* Check if slot holds the requester. Requesters are told apart by source
+* address only: sourcePortIdentity is chosen by the sender, a new identity
+* must not give a new burst.
+* @param client slot.
+* @param addr source address.
+* @return true if requester matches.
+*/
+static bool ptp_rl_match(struct ptp_rl_client *client, const char *addr)
+{
+    return client->in_use &&
+        (strncmp(client->addr, addr, IP_STR_MAX_LEN) == 0);
+}
+
+/**
+* Get number of slots needed for the requester table.
+* @param capacity number of requesters.
+* @return number of slots.
+*/
+u32 ptp_rl_slots(u32 capacity)
+{
+    u32 num_slots = PTP_RL_PROBE;
+
+    while (num_slots < capacity) {
+        num_slots <<= 1;
+    }
+    return num_slots;
+}
+
+/**
+* Initialize requester table on preallocated slots.
+* @param table requester table.
+* @param clients memory for the slots.
+* @param num_slots number of slots, from ptp_rl_slots().
+*/
+void ptp_rl_init(struct ptp_rl_table *table, struct ptp_rl_client *clients,
+                 u32 num_slots)
+{
+    memset(table, 0, sizeof(struct ptp_rl_table));
+    memset(clients, 0, num_slots * sizeof(struct ptp_rl_client));
+    table->clients = clients;
+    table->num_slots = num_slots;
+}
+
+/**
+* Find requester, or take a slot for it: a free slot of the probe window,
+* or the least recent requester of the window.
+* @param table requester table.
+* @param addr source address.
+* @return slot, in_use is false for a new requester.
+*/
+static struct ptp_rl_client *ptp_rl_lookup(struct ptp_rl_table *table,
+                                           const char *addr)
+{
+    u32 mask = table->num_slots - 1;
+    u32 slot = ptp_rl_hash(addr) & mask;
+    struct ptp_rl_client *client = NULL;
+    struct ptp_rl_client *victim = NULL;
+    int i = 0;
+
+    for (i = 0; i < PTP_RL_PROBE; i++, slot = (slot + 1) & mask) {
+        client = &table->clients[slot];
+        if (!client->in_use) {
+            if (!victim || victim->in_use) {
+                victim = client;
+            }
+            continue;
+        }
+        if (ptp_rl_match(client, addr)) {
+            return client;
+        }
+        if (!victim || (victim->in_use && (client->last_ns <
+                                           victim->last_ns))) {
+            victim = client;
+        }
+    }
+    if (victim->in_use) {
+        table->evicted++;
+        victim->in_use = false;
+    }
+    return victim;
+}
+
+/**
+* Admit a request. Requester (source address) may send PTP_RL_BURST
+* requests back to back, then one per 2^log_interval seconds.
+* @param table requester table.
+* @param port_id sourcePortIdentity of the request (host order).
+* @param addr source address.
+* @param log_interval minimum request interval of the requester.
+* @param time receive time of the request.
+* @return true if request is answered, false if it is over rate.
+*/
+bool ptp_rl_admit(struct ptp_rl_table *table, struct PortIdentity *port_id,
+                  char *addr, s8 log_interval, struct Timestamp *time)
+{
+    struct ptp_rl_client *client = ptp_rl_lookup(table, addr);
+    u64 now = time->seconds * SEC_IN_NS + time->nanoseconds;
+    u64 interval = 0;
+    u32 nanosecs = 0;
+
+    interval = power2(log_interval, &nanosecs) * (u64) SEC_IN_NS + nanosecs;
+    if (!client->in_use) {
+        memset(client, 0, sizeof(struct ptp_rl_client));
+        client->in_use = true;
+        strncpy(client->addr, addr, IP_STR_MAX_LEN);
+        client->credit_ns = PTP_RL_BURST * interval;
+    } else if (now > client->last_ns) {
+        // Refill, time going backwards (clock step) adds nothing
+        client->credit_ns += now - client->last_ns;
+        if (client->credit_ns > PTP_RL_BURST * interval) {
+            client->credit_ns = PTP_RL_BURST * interval;
+        }
+    }
+    client->last_ns = now;
+    memcpy(&client->port_id, port_id, sizeof(struct PortIdentity));
+
+    if (client->credit_ns < interval) {
+        client->dropped++;
+        table->dropped++;
+        // Report first drop and then every power of two
+        if ((client->dropped & (client->dropped - 1)) == 0) {
+            DEBUG("Delay_Req over rate 2^%i from %s %s/%i: %u dropped\n",
+                  log_interval, addr,
+                  ptp_clk_id(port_id->clock_identity),
+                  port_id->port_number, client->dropped);
+        }
+        return false;
+    }
+    client->credit_ns -= interval;
+    client->accepted++;
+    table->accepted++;
+    return true;
+}
+
+/**
+* Get requesters with the most dropped requests.
+* @param table requester table.
+* @param worst requesters returned here, worst first.
+* @param max size of worst.
+* @return number of requesters returned.
+*/
+int ptp_rl_offenders(struct ptp_rl_table *table,
+                     struct ptp_rl_client **worst, int max)
+{
+    struct ptp_rl_client *client = NULL;
+    int count = 0, i = 0;
+    u32 slot = 0;
+
+    for (slot = 0; slot < table->num_slots; slot++) {
+        client = &table->clients[slot];
+        if (!client->in_use || (client->dropped == 0)) {
+            continue;
+        }
+        // Insertion into the sorted list
+        for (i = count; (i > 0) && (worst[i - 1]->dropped < client->dropped);
+             i--) {
+            if (i < max) {
+                worst[i] = worst[i - 1];
+            }
+        }
+        if (i < max) {
+            worst[i] = client;
+            if (count < max) {
+                count++;
+            }
+        }
+    }
+    return count;
+}
@@ -0,0 +1,213 @@
+/** @file ptp_seqstat.c
+* PTP sequenceId gap and loss accounting of received messages. Every
+* sender increments sequenceId by one per message type, so gaps are
+* lost frames and steps back are duplicates or reordering.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_PORT
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp_seqstat.h"
+
+static const char *ptp_seq_type_names[PTP_SEQ_NUM_TYPES] = {
+    "Announce",
+    "Sync",
+    "Follow_Up",
+};
+
+/**
+* Get tracked type of message.
+* @param msg_type PTP message type.
+* @return PTP_SEQ_xxx, -1 if not tracked.
+*/
+static int ptp_seq_index(u8 msg_type)
+{
+    switch (msg_type) {
+    case PTP_ANNOUNCE:
+        return PTP_SEQ_ANNOUNCE;
+    case PTP_SYNC:
+        return PTP_SEQ_SYNC;
+    case PTP_FOLLOW_UP:
+        return PTP_SEQ_FOLLOW_UP;
+    }
+    return -1;
+}
+
+/**
+* Get tracked sender.
+* @param stats sequence statistics of the port.
+* @param port_id sourcePortIdentity (host order).
+* @return sender, NULL if not tracked.
+*/
+struct ptp_seq_source *ptp_seq_find(struct ptp_seq_stats *stats,
+                                    struct PortIdentity *port_id)
+{
+    struct ptp_seq_source *source = NULL;
+    int i = 0;
+
+    for (i = 0; i < PTP_SEQ_SOURCES; i++) {
+        source = &stats->sources[i];
+        if (source->in_use &&
+            (source->port_id.port_number == port_id->port_number) &&
+            (memcmp(source->port_id.clock_identity,
+                    port_id->clock_identity, sizeof(ClockIdentity)) == 0)) {
+            return source;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Get tracked sender, replace least recent sender if not tracked.
+* @param stats sequence statistics of the port.
+* @param port_id sourcePortIdentity (host order).
+* @return sender.
+*/
+static struct ptp_seq_source *ptp_seq_source(struct ptp_seq_stats *stats,
+                                             struct PortIdentity *port_id)
+{
+    struct ptp_seq_source *source = ptp_seq_find(stats, port_id);
+    struct ptp_seq_source *victim = &stats->sources[0];
+    int i = 0;
+
+    if (source) {
+        return source;
+    }
+    for (i = 0; i < PTP_SEQ_SOURCES; i++) {
+        source = &stats->sources[i];
+        if (!source->in_use) {
+            victim = source;
+            break;
+        }
+        if (source->last_frame < victim->last_frame) {
+            victim = source;
+        }
+    }
+    memset(victim, 0, sizeof(struct ptp_seq_source));
+    victim->in_use = true;
+    memcpy(&victim->port_id, port_id, sizeof(struct PortIdentity));
+    return victim;
+}
+
+/**
+* Add value to a counter of sender and port.
+* @param counter counter of sender.
+* @param total counter of port.
+* @param value value to add.
+*/
+static inline void ptp_seq_count(u64 * counter, u64 * total, s64 value)
+{
+    *counter += value;
+    *total += value;
+}
+
+/**
+* Account received frame.
+* @param stats sequence statistics of the port.
+* @param port_id sourcePortIdentity of the frame (host order).
+* @param msg_type PTP message type, other than Announce, Sync and
+* Follow_Up are ignored.
+* @param seq_id sequenceId of the frame.
+*/
+void ptp_seq_recv(struct ptp_seq_stats *stats, struct PortIdentity *port_id,
+                  u8 msg_type, u16 seq_id)
+{
+    struct ptp_seq_source *source = NULL;
+    struct ptp_seq_track *track = NULL;
+    struct ptp_seq_counters *cnt = NULL;
+    struct ptp_seq_counters *total = NULL;
+    int index = ptp_seq_index(msg_type);
+    s16 diff = 0;
+    u64 bit = 0;
+
+    if (index < 0) {
+        return;
+    }
+    source = ptp_seq_source(stats, port_id);
+    source->last_frame = ++stats->frames;
+    track = &source->types[index];
+    cnt = &track->counters;
+    total = &stats->total[index];
+    ptp_seq_count(&cnt->frames, &total->frames, 1);
+
+    if (!track->valid) {
+        track->valid = true;
+        track->last_seq_id = seq_id;
+        track->history = 1;
+        return;
+    }
+    diff = (s16) (seq_id - track->last_seq_id);
+    if ((diff > 0) && (diff <= PTP_SEQ_MAX_GAP)) {
+        if (diff > 1) {
+            DEBUG("%s %s/%i: %i missing before %i\n",
+                  ptp_seq_type_names[index],
+                  ptp_clk_id(port_id->clock_identity),
+                  port_id->port_number, diff - 1, seq_id);
+            ptp_seq_count(&cnt->gaps, &total->gaps, 1);
+            ptp_seq_count(&cnt->lost, &total->lost, diff - 1);
+        }
+        track->history = (diff < PTP_SEQ_WINDOW) ?
+            ((track->history << diff) | 1) : 1;
+        track->last_seq_id = seq_id;
+    } else if (diff == 0) {
+        ptp_seq_count(&cnt->duplicates, &total->duplicates, 1);
+    } else if ((diff < 0) && (-diff < PTP_SEQ_WINDOW)) {
+        bit = 1ULL << -diff;
+        if (track->history & bit) {
+            ptp_seq_count(&cnt->duplicates, &total->duplicates, 1);
+        } else {
+            // Frame was counted lost when the newer one arrived
+            track->history |= bit;
+            ptp_seq_count(&cnt->reordered, &total->reordered, 1);
+            if (cnt->lost > 0) {
+                ptp_seq_count(&cnt->lost, &total->lost, -1);
+            }
+        }
+    } else {
+        DEBUG("%s %s/%i: sequence restarted %i -> %i\n",
+              ptp_seq_type_names[index],
+              ptp_clk_id(port_id->clock_identity),
+              port_id->port_number, track->last_seq_id, seq_id);
+        ptp_seq_count(&cnt->restarts, &total->restarts, 1);
+        track->last_seq_id = seq_id;
+        track->history = 1;
+    }
+}
+
+/**
+* Get name of tracked message type.
+* @param type PTP_SEQ_xxx.
+* @return name.
+*/
+const char *ptp_seq_type_name(int type)
+{
+    if ((type < 0) || (type >= PTP_SEQ_NUM_TYPES)) {
+        return "unknown";
+    }
+    return ptp_seq_type_names[type];
+}
@@ -0,0 +1,401 @@
+/** @file ptp_servo_rec.c
+* Servo recorder. Every Sync and Delay_Req given to the servo is appended
+* to a memory mapped file together with the servo state after it. The
+* instance thread only fills a fixed-size record and, when the file is
+* full, switches to the next file. Files are created, mapped and closed
+* by the recorder thread.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_CLOCK
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include <ptp_general.h>
+#include <clock_if.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_servo_rec.h"
+
+/// Size of a full recorder file
+#define PTP_SERVO_REC_FILE_SIZE \
+    (sizeof(struct ptp_servo_rec_header) + \
+     PTP_SERVO_REC_RECORDS * sizeof(struct ptp_servo_record))
+/// Interval of the recorder thread checking for a full file, ms
+#define PTP_SERVO_REC_POLL_MS   100
+
+/**
+* Get clock in nanoseconds.
+* @param clock clock id.
+* @return nanoseconds.
+*/
+static u64 ptp_servo_rec_clock(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+* Get timestamp in nanoseconds.
+* @param time timestamp.
+* @return nanoseconds.
+*/
+static u64 ptp_servo_rec_ns(struct Timestamp *time)
+{
+    return (u64) time->seconds * 1000000000ULL + time->nanoseconds;
+}
+
+/**
+* Set creation time of a recorder file.
+* @param header mapped file.
+*/
+static void ptp_servo_rec_start(struct ptp_servo_rec_header *header)
+{
+    header->realtime = ptp_servo_rec_clock(CLOCK_REALTIME);
+    header->monotonic = ptp_servo_rec_clock(CLOCK_MONOTONIC);
+}
+
+/**
+* Create and map recorder file.
+* @param rec recorder, domain is set.
+* @param path file to create.
+* @param fd file descriptor is returned here.
+* @return mapped file, NULL on error.
+*/
+static struct ptp_servo_rec_header *ptp_servo_rec_map(struct ptp_servo_rec
+                                                      *rec, const char *path,
+                                                      int *fd)
+{
+    struct ptp_servo_rec_header *header = NULL;
+
+    *fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (*fd < 0) {
+        ERROR("%s: %s\n", path, strerror(errno));
+        return NULL;
+    }
+    if (ftruncate(*fd, PTP_SERVO_REC_FILE_SIZE) < 0) {
+        ERROR("%s: %s\n", path, strerror(errno));
+        close(*fd);
+        return NULL;
+    }
+    // Pages are touched now, not when the servo runs
+    header = mmap(NULL, PTP_SERVO_REC_FILE_SIZE, PROT_READ | PROT_WRITE,
+                  MAP_SHARED | MAP_POPULATE, *fd, 0);
+    if (header == MAP_FAILED) {
+        perror("mmap");
+        close(*fd);
+        return NULL;
+    }
+    memcpy(header->magic, PTP_SERVO_REC_MAGIC, sizeof(header->magic));
+    header->version = PTP_SERVO_REC_VERSION;
+    header->record_size = sizeof(struct ptp_servo_record);
+    header->capacity = PTP_SERVO_REC_RECORDS;
+    header->domain = rec->domain;
+    header->count = 0;
+    ptp_servo_rec_start(header);
+    return header;
+}
+
+/**
+* Unmap recorder file and cut it to the records written.
+* @param header mapped file.
+* @param fd file descriptor.
+*/
+static void ptp_servo_rec_unmap(struct ptp_servo_rec_header *header, int fd)
+{
+    size_t size = sizeof(struct ptp_servo_rec_header) +
+        header->count * sizeof(struct ptp_servo_record);
+
+    munmap(header, PTP_SERVO_REC_FILE_SIZE);
+    if (ftruncate(fd, size) < 0) {
+        perror("ftruncate");
+    }
+    close(fd);
+}
+
+/**
+* Close full file handed over by the instance thread, move it to
+* <name>.1 and the next file, now written, to <name>.
+* @param rec recorder.
+*/
+static void ptp_servo_rec_retire(struct ptp_servo_rec *rec)
+{
+    char old_path[MAX_VALUE_LEN + 2];
+    char next_path[MAX_VALUE_LEN + 5];
+
+    ptp_servo_rec_unmap(rec->retired, rec->retired_fd);
+    rec->retired = NULL;
+    snprintf(old_path, sizeof(old_path), "%s.1", rec->path);
+    snprintf(next_path, sizeof(next_path), "%s.next", rec->path);
+    if (rename(rec->path, old_path) < 0) {
+        perror("rename");
+    }
+    if (rename(next_path, rec->path) < 0) {
+        perror("rename");
+    }
+}
+
+/**
+* Recorder thread. Prepares the next file and retires full ones, so the
+* instance thread makes no system calls when the file is full.
+* @param arg recorder.
+* @return NULL.
+*/
+static void *ptp_servo_rec_thread(void *arg)
+{
+    struct ptp_servo_rec *rec = (struct ptp_servo_rec *) arg;
+    struct ptp_servo_rec_header *spare = NULL;
+    char next_path[MAX_VALUE_LEN + 5];
+    struct pollfd pfd;
+    int fd = -1;
+
+    snprintf(next_path, sizeof(next_path), "%s.next", rec->path);
+    pfd.fd = rec->stop_fd;
+    pfd.events = POLLIN;
+    for (;;) {
+        // Spare is taken after the full file is handed over
+        if (!__atomic_load_n(&rec->spare, __ATOMIC_ACQUIRE)) {
+            if (rec->retired) {
+                ptp_servo_rec_retire(rec);
+            }
+            spare = ptp_servo_rec_map(rec, next_path, &fd);
+            if (spare) {
+                rec->spare_fd = fd;
+                __atomic_store_n(&rec->spare, spare, __ATOMIC_RELEASE);
+            }
+        }
+        if (poll(&pfd, 1, PTP_SERVO_REC_POLL_MS) != 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Open recorder file. An existing file is replaced.
+* @param rec recorder.
+* @param path recorder file.
+* @param domain domain of the instance.
+* @param stats servo statistics at open, changes to them are flagged.
+* @return ptp error code.
+*/
+int ptp_servo_rec_open(struct ptp_servo_rec *rec, const char *path,
+                       u8 domain, struct ptp_servo_stats *stats)
+{
+    int ret = 0;
+
+    memset(rec, 0, sizeof(struct ptp_servo_rec));
+    strncpy(rec->path, path, MAX_VALUE_LEN - 1);
+    rec->domain = domain;
+    memcpy(&rec->stats, stats, sizeof(struct ptp_servo_stats));
+    rec->header = ptp_servo_rec_map(rec, rec->path, &rec->fd);
+    if (rec->header == NULL) {
+        return PTP_ERR_GEN;
+    }
+    rec->records = (struct ptp_servo_record *) (rec->header + 1);
+    rec->stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (rec->stop_fd < 0) {
+        perror("eventfd");
+        ptp_servo_rec_unmap(rec->header, rec->fd);
+        rec->header = NULL;
+        return PTP_ERR_GEN;
+    }
+    ret = pthread_create(&rec->thread, NULL, ptp_servo_rec_thread, rec);
+    if (ret != 0) {
+        ERROR("pthread_create %s\n", strerror(ret));
+        close(rec->stop_fd);
+        ptp_servo_rec_unmap(rec->header, rec->fd);
+        rec->header = NULL;
+        return PTP_ERR_GEN;
+    }
+    INFO("Servo recorder %s\n", rec->path);
+    return PTP_ERR_OK;
+}
+
+/**
+* Close recorder file.
+* @param rec recorder.
+*/
+void ptp_servo_rec_close(struct ptp_servo_rec *rec)
+{
+    char next_path[MAX_VALUE_LEN + 5];
+    u64 stop = 1;
+
+    if (!rec->header) {
+        return;
+    }
+    if (write(rec->stop_fd, &stop, sizeof(u64)) < 0) {
+        perror("write");
+    }
+    pthread_join(rec->thread, NULL);
+    close(rec->stop_fd);
+    if (rec->retired) {
+        ptp_servo_rec_retire(rec);
+    }
+    if (rec->spare) {
+        munmap(rec->spare, PTP_SERVO_REC_FILE_SIZE);
+        close(rec->spare_fd);
+        rec->spare = NULL;
+        snprintf(next_path, sizeof(next_path), "%s.next", rec->path);
+        unlink(next_path);
+    }
+    ptp_servo_rec_unmap(rec->header, rec->fd);
+    rec->header = NULL;
+    rec->records = NULL;
+    if (rec->dropped) {
+        INFO("Servo recorder dropped %u records\n", rec->dropped);
+    }
+}
+
+/**
+* Switch to the next file prepared by the recorder thread and hand the
+* full one over to it.
+* @param rec recorder.
+* @return ptp error code, PTP_ERR_GEN if the next file is not ready.
+*/
+static int ptp_servo_rec_rotate(struct ptp_servo_rec *rec)
+{
+    struct ptp_servo_rec_header *spare =
+        __atomic_load_n(&rec->spare, __ATOMIC_ACQUIRE);
+
+    if (!spare) {
+        return PTP_ERR_GEN;
+    }
+    ptp_servo_rec_start(spare);
+    rec->retired_fd = rec->fd;
+    rec->retired = rec->header;
+    rec->fd = rec->spare_fd;
+    rec->header = spare;
+    rec->records = (struct ptp_servo_record *) (spare + 1);
+    __atomic_store_n(&rec->spare, NULL, __ATOMIC_RELEASE);
+    return PTP_ERR_OK;
+}
+
+/**
+* Append record of a servo input.
+* @param ctx Port context.
+* @param type enum ptp_servo_rec_type.
+* @param seq_id sequenceId of the message.
+* @param origin t1 or t3 without correction.
+* @param receive t2 or t4.
+* @param correction correction applied to origin, ns 2^-16.
+*/
+static void ptp_servo_rec_add(struct ptp_port_ctx *ctx, u8 type, u16 seq_id,
+                              struct Timestamp *origin,
+                              struct Timestamp *receive, s64 correction)
+{
+    struct ptp_servo_rec *rec = &ctx->ptp->servo_rec;
+    struct ptp_servo_record *record = NULL;
+    struct ptp_servo_stats stats;
+    u64 count = 0;
+
+    if (!rec->header) {
+        return;
+    }
+    count = rec->header->count;
+    if (count >= rec->header->capacity) {
+        if (ptp_servo_rec_rotate(rec) != PTP_ERR_OK) {
+            rec->dropped++;
+            return;
+        }
+        count = 0;
+    }
+    if (ptp_get_servo_stats(&ctx->ptp->clk_ctx, &stats) != PTP_ERR_OK) {
+        memset(&stats, 0, sizeof(stats));
+    }
+    record = &rec->records[count];
+    record->time = ptp_servo_rec_clock(CLOCK_MONOTONIC);
+    record->type = type;
+    record->flags = 0;
+    if (stats.discipline) {
+        record->flags |= PTP_SERVO_REC_DISCIPLINE;
+    }
+    if (stats.steps != rec->stats.steps) {
+        record->flags |= PTP_SERVO_REC_STEP;
+    }
+    if (stats.adjustments != rec->stats.adjustments) {
+        record->flags |= PTP_SERVO_REC_FREQ;
+    }
+    if (stats.tick != rec->stats.tick) {
+        record->flags |= PTP_SERVO_REC_TICK;
+    }
+    if (stats.delay_rejected != rec->stats.delay_rejected) {
+        record->flags |= PTP_SERVO_REC_REJECTED;
+    }
+    record->port = ctx->port_dataset.port_identity.port_number;
+    record->seq = seq_id;
+    record->origin = ptp_servo_rec_ns(origin);
+    record->receive = ptp_servo_rec_ns(receive);
+    record->correction = correction;
+    record->path_delay =
+        ctx->ptp->current_dataset.mean_path_delay.scaled_nanoseconds;
+    record->offset =
+        ctx->ptp->current_dataset.offset_from_master.scaled_nanoseconds;
+    record->freq = stats.freq;
+    record->integral = stats.offset_integral;
+    record->tick = stats.tick;
+    // Readers of a live file see only complete records
+    __atomic_store_n(&rec->header->count, count + 1, __ATOMIC_RELEASE);
+    memcpy(&rec->stats, &stats, sizeof(stats));
+}
+
+/**
+* Record Sync given to the servo. Called after ptp_sync_rcv().
+* @param ctx Port context.
+* @param seq_id sequenceId of the Sync.
+* @param t1 origin timestamp without correction.
+* @param t2 receive timestamp.
+* @param correction correction applied to t1, ns 2^-16.
+*/
+void ptp_servo_rec_sync(struct ptp_port_ctx *ctx, u16 seq_id,
+                        struct Timestamp *t1, struct Timestamp *t2,
+                        s64 correction)
+{
+    ptp_servo_rec_add(ctx, PTP_SERVO_REC_SYNC, seq_id, t1, t2, correction);
+}
+
+/**
+* Record Delay_Req timestamps given to the servo. Called after
+* ptp_delay_rcv().
+* @param ctx Port context.
+* @param seq_id sequenceId of the Delay_Req.
+* @param t3 send timestamp without correction.
+* @param t4 receive timestamp of the master.
+* @param correction correction applied to t3, ns 2^-16.
+*/
+void ptp_servo_rec_delay(struct ptp_port_ctx *ctx, u16 seq_id,
+                         struct Timestamp *t3, struct Timestamp *t4,
+                         s64 correction)
+{
+    ptp_servo_rec_add(ctx, PTP_SERVO_REC_DELAY, seq_id, t3, t4, correction);
+}
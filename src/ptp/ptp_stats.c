@@ -0,0 +1,185 @@
+/** @file ptp_stats.c
+* PTP port counters and statistics snapshot.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_codec.h"
+#include "ptp_stats.h"
+
+/**
+* Copy statistics of a port.
+* @param ctx Port context.
+* @param snap statistics are returned here.
+*/
+static void ptp_stats_port(struct ptp_port_ctx *ctx,
+                           struct ptp_port_snapshot *snap)
+{
+    struct ptp_rl_client *worst[PTP_RL_REPORT];
+    int i = 0;
+
+    memset(snap, 0, sizeof(struct ptp_port_snapshot));
+    snap->port_number = ctx->port_dataset.port_identity.port_number;
+    strncpy(snap->name, ctx->name, INTERFACE_NAME_LEN);
+    snap->unicast_port = ctx->unicast_port;
+    snap->state = ctx->port_dataset.port_state;
+    memcpy(&snap->counters, &ctx->counters,
+           sizeof(struct ptp_port_counters));
+    memcpy(snap->seq, ctx->seq_stats.total, sizeof(snap->seq));
+    snap->delay_resp_matched = ctx->delay_reqs.matched;
+    snap->delay_resp_late = ctx->delay_reqs.late;
+    snap->delay_req_lost = ctx->delay_reqs.lost;
+    snap->delay_resp_unmatched = ctx->delay_reqs.unmatched;
+    memcpy(&snap->delay_resp, &ctx->delay_resp.stats,
+           sizeof(struct ptp_dresp_stats));
+    snap->delay_req_accepted = ctx->delay_req_clients.accepted;
+    snap->delay_req_over_rate = ctx->delay_req_clients.dropped;
+    // Requester table is scanned only when something was dropped
+    if (snap->delay_req_over_rate) {
+        snap->num_offenders = ptp_rl_offenders(&ctx->delay_req_clients,
+                                               worst, PTP_RL_REPORT);
+    }
+    for (i = 0; i < snap->num_offenders; i++) {
+        strncpy(snap->offenders[i].addr, worst[i]->addr, IP_STR_MAX_LEN);
+        memcpy(&snap->offenders[i].port_id, &worst[i]->port_id,
+               sizeof(struct PortIdentity));
+        snap->offenders[i].dropped = worst[i]->dropped;
+    }
+}
+
+/**
+* Copy statistics of an instance and its ports. Must be called by the
+* instance thread, which is the only writer, so the view is consistent.
+* @param ptp_ctx PTP instance.
+* @param snap statistics are returned here.
+*/
+void ptp_stats_snapshot(struct ptp_ctx *ptp_ctx, struct ptp_snapshot *snap)
+{
+    struct ptp_port_ctx *port = NULL;
+
+    memset(snap, 0, sizeof(struct ptp_snapshot));
+    ptp_get_time(&ptp_ctx->clk_ctx, &snap->time);
+    snap->domain = ptp_ctx->default_dataset.domain;
+    memcpy(snap->clock_identity, ptp_ctx->default_dataset.clock_identity,
+           sizeof(ClockIdentity));
+    memcpy(&snap->parent, &ptp_ctx->parent_dataset.parent_port_identity,
+           sizeof(struct PortIdentity));
+    memcpy(snap->grandmaster,
+           ptp_ctx->parent_dataset.grandmaster_identity,
+           sizeof(ClockIdentity));
+    snap->steps_removed = ptp_ctx->current_dataset.steps_removed;
+    snap->offset_from_master =
+        ptp_ctx->current_dataset.offset_from_master.scaled_nanoseconds;
+    snap->mean_path_delay =
+        ptp_ctx->current_dataset.mean_path_delay.scaled_nanoseconds;
+    ptp_get_servo_stats(&ptp_ctx->clk_ctx, &snap->servo);
+    ptp_get_rx_stats(&ptp_ctx->pkt_ctx, &snap->rx);
+    snap->tc_forwarded = ptp_ctx->tc.forwarded;
+    snap->tc_uncorrected = ptp_ctx->tc.uncorrected;
+    for (port = ptp_ctx->ports_list_head;
+         port && (snap->num_ports < MAX_NUM_INTERFACES); port = port->next) {
+        ptp_stats_port(port, &snap->ports[snap->num_ports++]);
+    }
+}
+
+/**
+* Write statistics of a port to syslog.
+* @param snap statistics.
+*/
+static void ptp_stats_dump_port(struct ptp_port_snapshot *snap)
+{
+    struct ptp_port_counters *cnt = &snap->counters;
+    int type = 0;
+
+    INFO("Port %i %s%s %s: state changes %llu rx invalid %llu "
+         "version %llu tx errors %llu\n", snap->port_number, snap->name,
+         snap->unicast_port ? " unicast" : "", get_state_str(snap->state),
+         cnt->state_changes, cnt->rx_invalid, cnt->rx_version,
+         cnt->tx_errors);
+    for (type = 0; type < PTP_NUM_MSG_TYPES; type++) {
+        if (cnt->rx[type] || cnt->tx[type]) {
+            INFO("  %s: rx %llu tx %llu\n", ptp_msg_name(type),
+                 cnt->rx[type], cnt->tx[type]);
+        }
+    }
+    for (type = 0; type < PTP_SEQ_NUM_TYPES; type++) {
+        if (snap->seq[type].gaps || snap->seq[type].duplicates ||
+            snap->seq[type].reordered || snap->seq[type].restarts) {
+            INFO("  %s sequence: gaps %llu lost %llu duplicates %llu "
+                 "reordered %llu restarts %llu\n", ptp_seq_type_name(type),
+                 snap->seq[type].gaps, snap->seq[type].lost,
+                 snap->seq[type].duplicates, snap->seq[type].reordered,
+                 snap->seq[type].restarts);
+        }
+    }
+    if (cnt->tx[PTP_DELAY_REQ]) {
+        INFO("  Delay_Resp received: matched %llu late %llu unmatched %llu, "
+             "Delay_Req lost %llu\n", snap->delay_resp_matched,
+             snap->delay_resp_late, snap->delay_resp_unmatched,
+             snap->delay_req_lost);
+    }
+    if (snap->delay_req_accepted || snap->delay_req_over_rate) {
+        INFO("  Delay_Req accepted %llu over rate %llu, Delay_Resp "
+             "sent %llu delayed %llu dropped %llu max depth %u\n",
+             snap->delay_req_accepted, snap->delay_req_over_rate,
+             snap->delay_resp.sent, snap->delay_resp.delayed,
+             snap->delay_resp.dropped, snap->delay_resp.max_depth);
+    }
+}
+
+/**
+* Write statistics to syslog.
+* @param snap statistics.
+*/
+void ptp_stats_dump(struct ptp_snapshot *snap)
+{
+    int i = 0;
+
+    INFO("Domain %i clock %s steps removed %u\n", snap->domain,
+         ptp_clk_id(snap->clock_identity), snap->steps_removed);
+    INFO("Grandmaster %s offset %llins path delay %llins\n",
+         ptp_clk_id(snap->grandmaster), snap->offset_from_master >> 16,
+         snap->mean_path_delay >> 16);
+    INFO("Servo%s: sync %llu delay %llu rejected %llu steps %llu "
+         "adjustments %llu freq %lli\n",
+         snap->servo.discipline ? " disciplining" : "",
+         snap->servo.sync_samples, snap->servo.delay_samples,
+         snap->servo.delay_rejected, snap->servo.steps,
+         snap->servo.adjustments, snap->servo.freq);
+    INFO("RX: frames %llu other domain %llu truncated %llu "
+         "queue dropped %u\n", snap->rx.frames, snap->rx.other_domain,
+         snap->rx.truncated, snap->rx.dropped);
+    if (snap->tc_forwarded) {
+        INFO("TC: forwarded %llu uncorrected %u\n",
+             snap->tc_forwarded, snap->tc_uncorrected);
+    }
+    for (i = 0; i < snap->num_ports; i++) {
+        ptp_stats_dump_port(&snap->ports[i]);
+    }
+}
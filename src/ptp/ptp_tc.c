@@ -0,0 +1,353 @@
+/** @file ptp_tc.c
+* PTP end-to-end and peer-to-peer transparent clock.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_PORT
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_codec.h"
+#include "ptp_tc.h"
+#include "ptp_mgmt.h"
+
+/// Bit of the port in port masks
+#define PTP_TC_PORT_BIT(port_num)   (1u << ((port_num) - 1))
+
+/**
+* Get table slot of event message.
+* @param msg_type PTP_SYNC or PTP_DELAY_REQ.
+* @param port_id sourcePortIdentity of the message (host order).
+* @param seq_id sequenceId of the message.
+* @return slot index.
+*/
+static u32 ptp_tc_slot(u8 msg_type, struct PortIdentity *port_id,
+                       u16 seq_id)
+{
+    u32 hash = seq_id;
+
+    hash ^= (u32) msg_type << 16;
+    hash ^= (u32) port_id->port_number << 20;
+    hash ^= (u8) port_id->clock_identity[7] << 8;
+    hash ^= (u8) port_id->clock_identity[6];
+    return hash & (PTP_TC_TABLE_LEN - 1);
+}
+
+/**
+* Find forwarded event message.
+* @param tc transparent clock data.
+* @param msg_type PTP_SYNC or PTP_DELAY_REQ.
+* @param port_id sourcePortIdentity of the message (host order).
+* @param seq_id sequenceId of the message.
+* @return entry, NULL if not found.
+*/
+static struct ptp_tc_entry *ptp_tc_lookup(struct ptp_tc *tc, u8 msg_type,
+                                          struct PortIdentity *port_id,
+                                          u16 seq_id)
+{
+    struct ptp_tc_entry *entry =
+        &tc->entries[ptp_tc_slot(msg_type, port_id, seq_id)];
+
+    if ((entry->msg_type != msg_type) || (entry->seq_id != seq_id) ||
+        (entry->src_port_id.port_number != port_id->port_number) ||
+        (memcmp(entry->src_port_id.clock_identity,
+                port_id->clock_identity, sizeof(ClockIdentity)) != 0)) {
+        return NULL;
+    }
+    return entry;
+}
+
+/**
+* Store received event message. Entry of older message in the same slot
+* is replaced.
+* @param tc transparent clock data.
+* @param hdr header of the message.
+* @param ingress port number message was received from.
+* @param time receive time of the message.
+* @return entry.
+*/
+static struct ptp_tc_entry *ptp_tc_insert(struct ptp_tc *tc,
+                                          struct ptp_header *hdr,
+                                          int ingress,
+                                          struct Timestamp *time)
+{
+    struct PortIdentity port_id;
+    struct ptp_tc_entry *entry = NULL;
+    u8 msg_type = ptp_hdr_type(hdr);
+    u16 seq_id = ptp_hdr_seq_id(hdr);
+
+    ptp_get_port_id(&port_id, &hdr->src_port_id);
+    entry = &tc->entries[ptp_tc_slot(msg_type, &port_id, seq_id)];
+    entry->msg_type = msg_type;
+    entry->seq_id = seq_id;
+    memcpy(&entry->src_port_id, &port_id, sizeof(struct PortIdentity));
+    entry->ingress = ingress;
+    copy_timestamp(&entry->rx_time, time);
+    entry->tx_ports = 0;
+    return entry;
+}
+
+/**
+* Get residence time of forwarded event message.
+* @param entry forwarded event message.
+* @param egress port number the message was sent to.
+* @param residence residence time returned here (scaled ns).
+* @return true if residence time is valid.
+*/
+static bool ptp_tc_residence(struct ptp_tc_entry *entry, int egress,
+                             s64 * residence)
+{
+    struct Timestamp *tx_time = &entry->tx_time[egress - 1];
+    s64 ns = 0;
+
+    if (!(entry->tx_ports & PTP_TC_PORT_BIT(egress))) {
+        return false;
+    }
+    ns = ((s64) tx_time->seconds - (s64) entry->rx_time.seconds) *
+        SEC_IN_NS +
+        ((s64) tx_time->nanoseconds - (s64) entry->rx_time.nanoseconds);
+    if ((ns < 0) || (ns > PTP_TC_MAX_RESIDENCE_NS)) {
+        DEBUG("Residence time %llins out of range\n", ns);
+        return false;
+    }
+    *residence = ns << 16;
+    return true;
+}
+
+/**
+* Send message to egress port. If entry is given, send time is stored to
+* it and, for one-step Sync, residence time is added to corr_field of the
+* message. Stored send time is replaced by loopback timestamp when
+* it is received.
+* @param ptp_ctx PTP instance.
+* @param egress port number to send to.
+* @param buf PTP message.
+* @param len msg length.
+* @param entry forwarded event message, NULL if not event message.
+* @param one_step_corr original corr_field of one-step Sync, NULL if
+*                      correction is not done on send.
+*/
+static void ptp_tc_send(struct ptp_ctx *ptp_ctx, int egress, char *buf,
+                        int len, struct ptp_tc_entry *entry,
+                        s64 * one_step_corr)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    s64 residence = 0;
+
+    if (entry) {
+        ptp_get_time(&ptp_ctx->clk_ctx, &entry->tx_time[egress - 1]);
+        entry->tx_ports |= PTP_TC_PORT_BIT(egress);
+        if (one_step_corr) {
+            if (!ptp_tc_residence(entry, egress, &residence)) {
+                residence = 0;
+                ptp_ctx->tc.uncorrected++;
+            }
+            ptp_hdr_set_corr_field(hdr, *one_step_corr + residence);
+        }
+    }
+    if (ptp_send(&ptp_ctx->pkt_ctx, ptp_hdr_type(hdr), egress,
+                 buf, len) == PTP_ERR_NET) {
+        ptp_ctx->socket_restart = 1;
+    }
+    ptp_ctx->tc.forwarded++;
+}
+
+/**
+* Forward Follow_Up or Delay_Resp, residence time of the event message
+* on the egress port is added to corr_field.
+* @param ptp_ctx PTP instance.
+* @param ingress port number message was received from.
+* @param buf PTP message.
+* @param len msg length.
+* @param entry forwarded event message, NULL if not found.
+* @param event_egress port number the event message was sent to, 0 if
+*                     the port the general message is sent to.
+* @param link_delay ingress link delay added to corr_field (scaled ns).
+*/
+static void ptp_tc_forward_general(struct ptp_ctx *ptp_ctx, int ingress,
+                                   char *buf, int len,
+                                   struct ptp_tc_entry *entry,
+                                   int event_egress, s64 link_delay)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    struct ptp_port_ctx *port = NULL;
+    s64 corr_field = ptp_hdr_corr_field(hdr) + link_delay;
+    s64 residence = 0;
+    int egress = 0;
+
+    for (port = ptp_ctx->ports_list_head; port != NULL; port = port->next) {
+        egress = port->port_dataset.port_identity.port_number;
+        if (egress == ingress) {
+            continue;
+        }
+        if (entry &&
+            ptp_tc_residence(entry, event_egress ? event_egress : egress,
+                             &residence)) {
+            ptp_hdr_set_corr_field(hdr, corr_field + residence);
+        } else {
+            ptp_hdr_set_corr_field(hdr, corr_field);
+            ptp_ctx->tc.uncorrected++;
+        }
+        ptp_tc_send(ptp_ctx, egress, buf, len, NULL, NULL);
+    }
+}
+
+/**
+* Forward message received by transparent clock to the other ports.
+* Residence time is added to the correction field of one-step Sync,
+* two-step Sync residence is added to Follow_Up and Delay_Req residence
+* to Delay_Resp. Peer-to-peer transparent clock adds also meanLinkDelay
+* of the ingress port to Sync (Follow_Up), handles peer delay messages
+* on its ports and drops Delay_Req and Delay_Resp.
+* @param ctx Port context of the ingress port.
+* @param buf PTP message.
+* @param len msg length.
+* @param time timestamp for received frame.
+* @param peer_ip IP address of the sender of this message.
+*/
+void ptp_tc_recv(struct ptp_port_ctx *ctx, char *buf, int len,
+                 struct Timestamp *time, char *peer_ip)
+{
+    struct ptp_ctx *ptp_ctx = ctx->ptp;
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    struct ptp_port_ctx *port = NULL;
+    struct ptp_tc_entry *entry = NULL;
+    struct ptp_delay_resp *resp = NULL;
+    struct PortIdentity port_id;
+    int ingress = ctx->port_dataset.port_identity.port_number;
+    int egress = 0;
+    int msg_len = 0;
+    s64 corr_field = 0;
+    s64 link_delay = 0;
+    bool p2p = (ptp_ctx->cfg.clock_type == CLOCK_TYPE_P2P_TC);
+
+    msg_len = ptp_msg_check(buf, len);
+    if (msg_len < 0) {
+        DEBUG("Invalid frame\n");
+        ptp_count_rx_invalid(&ctx->counters, buf, len);
+        return;
+    }
+    len = msg_len;
+    ctx->counters.rx[ptp_hdr_type(hdr)]++;
+
+    if (p2p) {
+        link_delay = ctx->port_dataset.peer_mean_path_delay.
+            scaled_nanoseconds;
+    }
+
+    switch (ptp_hdr_type(hdr)) {
+    case PTP_SYNC:
+    case PTP_DELAY_REQ:
+        if (p2p && (ptp_hdr_type(hdr) == PTP_DELAY_REQ)) {
+            // Delay is measured link by link, no end-to-end requests
+            break;
+        }
+        entry = ptp_tc_insert(&ptp_ctx->tc, hdr, ingress, time);
+        corr_field = ptp_hdr_corr_field(hdr) + link_delay;
+        for (port = ptp_ctx->ports_list_head; port != NULL;
+             port = port->next) {
+            egress = port->port_dataset.port_identity.port_number;
+            if (egress == ingress) {
+                continue;
+            }
+            if ((ptp_hdr_type(hdr) == PTP_SYNC) &&
+                !(ptp_hdr_flags(hdr) & PTP_TWO_STEP)) {
+                ptp_tc_send(ptp_ctx, egress, buf, len, entry, &corr_field);
+            } else {
+                ptp_tc_send(ptp_ctx, egress, buf, len, entry, NULL);
+            }
+        }
+        break;
+    case PTP_FOLLOW_UP:
+        ptp_get_port_id(&port_id, &hdr->src_port_id);
+        entry = ptp_tc_lookup(&ptp_ctx->tc, PTP_SYNC, &port_id,
+                              ptp_hdr_seq_id(hdr));
+        ptp_tc_forward_general(ptp_ctx, ingress, buf, len, entry, 0,
+                               link_delay);
+        break;
+    case PTP_DELAY_RESP:
+        if (p2p) {
+            break;
+        }
+        // Delay_Req was forwarded to the port Delay_Resp came from
+        resp = ptp_view_delay_resp(buf);
+        ptp_get_port_id(&port_id, &resp->req_port_id);
+        entry = ptp_tc_lookup(&ptp_ctx->tc, PTP_DELAY_REQ, &port_id,
+                              ptp_hdr_seq_id(hdr));
+        ptp_tc_forward_general(ptp_ctx, ingress, buf, len, entry, ingress,
+                               0);
+        break;
+    case PTP_PDELAY_REQ:
+    case PTP_PDELAY_RESP:
+    case PTP_PDELAY_RESP_FOLLOW_UP:
+        // Peer delay messages are link local, link delay is measured by
+        // the ports of peer-to-peer transparent clock
+        if (p2p) {
+            ptp_port_dispatch(ctx, buf, len, time, peer_ip);
+        }
+        break;
+    default:
+        if (ptp_hdr_type(hdr) == PTP_MANAGEMENT) {
+            // Answered also by the transparent clock itself
+            ptp_mgmt_recv(ctx, buf, len);
+        }
+        for (port = ptp_ctx->ports_list_head; port != NULL;
+             port = port->next) {
+            egress = port->port_dataset.port_identity.port_number;
+            if (egress != ingress) {
+                ptp_tc_send(ptp_ctx, egress, buf, len, NULL, NULL);
+            }
+        }
+        break;
+    }
+}
+
+/**
+* Store send time of a forwarded event message.
+* @param ctx Port context of the egress port.
+* @param msg_hdr Header of the sent frame.
+* @param sent_time timestamp of the sent frame.
+*/
+void ptp_tc_frame_sent(struct ptp_port_ctx *ctx, struct ptp_header *msg_hdr,
+                       struct Timestamp *sent_time)
+{
+    struct ptp_tc_entry *entry = NULL;
+    struct PortIdentity port_id;
+    int egress = ctx->port_dataset.port_identity.port_number;
+    u8 msg_type = ptp_hdr_type(msg_hdr);
+
+    if ((msg_type != PTP_SYNC) && (msg_type != PTP_DELAY_REQ)) {
+        return;
+    }
+    ptp_get_port_id(&port_id, &msg_hdr->src_port_id);
+    entry = ptp_tc_lookup(&ctx->ptp->tc, msg_type, &port_id,
+                          ptp_hdr_seq_id(msg_hdr));
+    if (entry && (entry->tx_ports & PTP_TC_PORT_BIT(egress))) {
+        copy_timestamp(&entry->tx_time[egress - 1], sent_time);
+    }
+}
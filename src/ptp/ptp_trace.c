@@ -0,0 +1,439 @@
+/** @file ptp_trace.c
+* Binary trace of the hot path. Instance threads write fixed-size records
+* to their own rings without locks, formatting or system calls other than
+* reading the monotonic clock. Records are written to a binary trace file
+* by a drain thread or on exit, and formatted only by the decoder.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+
+#include <ptp_general.h>
+#include <ptp_codec.h>
+#include <ptp_trace.h>
+
+/// Records written to the trace file at a time
+#define PTP_TRACE_BATCH         256
+
+__thread struct ptp_trace_ring *ptp_trace_local = NULL;
+
+static struct ptp_trace_ring *rings = NULL;
+static int num_rings = 0;
+static int trace_fd = -1;
+static u64 file_size = 0;
+static char trace_path[MAX_VALUE_LEN];
+/// Copy buffer, used by drain thread or by ptp_trace_stop() only
+static struct ptp_trace_entry batch[PTP_TRACE_BATCH];
+static bool draining = false;
+static int stop_fd = -1;
+static pthread_t drain_thread;
+
+/**
+* Argument formats of the decoder.
+*/
+enum ptp_trace_arg {
+    ARG_NONE = 0,
+    ARG_UINT,                   ///< unsigned
+    ARG_INT,                    ///< signed, e.g. error code
+    ARG_HEX,                    ///< flags
+    ARG_TIME,                   ///< timestamp in ns
+    ARG_MSG,                    ///< PTP message type
+    ARG_STATE,                  ///< enum PortState
+};
+
+/**
+* Decoder description of an event.
+*/
+struct ptp_trace_event {
+    const char *name;
+    struct {
+        const char *name;
+        enum ptp_trace_arg format;
+    } args[PTP_TRACE_ARGS];
+};
+
+static const struct ptp_trace_event events[PTP_TR_NUM] = {
+    [PTP_TR_LOST] = {"lost", {{"records", ARG_UINT}}},
+    [PTP_TR_WAKEUP] = {"wakeup", {{"timeout_us", ARG_UINT}}},
+    [PTP_TR_RX] = {"rx", {{"port", ARG_UINT}, {"type", ARG_MSG},
+                          {"seq", ARG_UINT}, {"time", ARG_TIME}}},
+    [PTP_TR_TX] = {"tx", {{"port", ARG_UINT}, {"type", ARG_MSG},
+                          {"seq", ARG_UINT}, {"ret", ARG_INT}}},
+    [PTP_TR_SENT] = {"sent", {{"port", ARG_UINT}, {"type", ARG_MSG},
+                              {"seq", ARG_UINT}, {"time", ARG_TIME}}},
+    [PTP_TR_TIMERS] = {"timers", {{"port", ARG_UINT}, {"state", ARG_STATE},
+                                  {"flags", ARG_HEX}, {"next", ARG_TIME}}},
+    [PTP_TR_SYNC] = {"sync", {{"port", ARG_UINT}, {"seq", ARG_UINT},
+                              {"master", ARG_TIME}, {"local", ARG_TIME}}},
+    [PTP_TR_DELAY] = {"delay", {{"port", ARG_UINT}, {"seq", ARG_UINT},
+                                {"sent", ARG_TIME}, {"master", ARG_TIME}}},
+    [PTP_TR_STATE] = {"state", {{"port", ARG_UINT}, {"from", ARG_STATE},
+                                {"to", ARG_STATE}}},
+    [PTP_TR_DRESP] = {"delay_resp", {{"port", ARG_UINT}, {"batch", ARG_UINT},
+                                     {"sent", ARG_INT},
+                                     {"queued", ARG_UINT}}},
+};
+
+static const char *state_names[] = {
+    "INITIALIZING", "FAULTY", "DISABLED", "LISTENING", "PRE_MASTER",
+    "MASTER", "PASSIVE", "UNCALIBRATED", "SLAVE",
+};
+
+static void *ptp_trace_drain_thread(void *arg);
+
+/**
+* Get clock in nanoseconds.
+* @param clock clock id.
+* @return nanoseconds.
+*/
+static u64 ptp_trace_clock(clockid_t clock)
+{
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+* Open trace file and write its header.
+* @return ptp error code.
+*/
+static int ptp_trace_open(void)
+{
+    struct ptp_trace_header header;
+
+    trace_fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (trace_fd < 0) {
+        ERROR("%s: %s\n", trace_path, strerror(errno));
+        return PTP_ERR_GEN;
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PTP_TRACE_MAGIC, sizeof(header.magic));
+    header.version = PTP_TRACE_VERSION;
+    header.entry_size = sizeof(struct ptp_trace_entry);
+    header.realtime = ptp_trace_clock(CLOCK_REALTIME);
+    header.monotonic = ptp_trace_clock(CLOCK_MONOTONIC);
+    if (write(trace_fd, &header, sizeof(header)) != sizeof(header)) {
+        perror("write");
+    }
+    file_size = sizeof(header);
+    return PTP_ERR_OK;
+}
+
+/**
+* Write records to trace file. File is rotated to <name>.1 when full.
+* @param entries records.
+* @param count number of records.
+*/
+static void ptp_trace_write(struct ptp_trace_entry *entries, int count)
+{
+    static char old_path[MAX_VALUE_LEN + 2];
+    size_t len = count * sizeof(struct ptp_trace_entry);
+
+    if (trace_fd < 0) {
+        return;
+    }
+    if (file_size + len > PTP_TRACE_FILE_MAX) {
+        close(trace_fd);
+        snprintf(old_path, sizeof(old_path), "%s.1", trace_path);
+        if (rename(trace_path, old_path) < 0) {
+            perror("rename");
+        }
+        if (ptp_trace_open() != PTP_ERR_OK) {
+            return;
+        }
+    }
+    if (write(trace_fd, entries, len) != (ssize_t) len) {
+        perror("write");
+    }
+    file_size += len;
+}
+
+/**
+* Copy record of a ring.
+* @param ring ring.
+* @param index index of the record.
+* @param entry record is copied here.
+* @return false if record was overwritten or is being written.
+*/
+static bool ptp_trace_copy(struct ptp_trace_ring *ring, u64 index,
+                           struct ptp_trace_entry *entry)
+{
+    struct ptp_trace_record *rec =
+        &ring->records[index & (PTP_TRACE_RECORDS - 1)];
+
+    if (__atomic_load_n(&rec->sequence, __ATOMIC_ACQUIRE) != index + 1) {
+        return false;
+    }
+    memcpy(entry, &rec->entry, sizeof(struct ptp_trace_entry));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&rec->sequence, __ATOMIC_RELAXED) == index + 1;
+}
+
+/**
+* Write records of a ring which are not yet written. Records overwritten
+* meanwhile are reported with a PTP_TR_LOST record.
+* @param ring ring.
+*/
+static void ptp_trace_drain(struct ptp_trace_ring *ring)
+{
+    u64 head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    u64 tail = ring->tail;
+    u64 lost = 0;
+    int count = 0;
+
+    if (head - tail > PTP_TRACE_RECORDS) {
+        lost = head - tail - PTP_TRACE_RECORDS;
+        tail = head - PTP_TRACE_RECORDS;
+    }
+    for (; tail != head; tail++) {
+        if (!ptp_trace_copy(ring, tail, &batch[count])) {
+            lost++;
+            continue;
+        }
+        if (++count == PTP_TRACE_BATCH) {
+            ptp_trace_write(batch, count);
+            count = 0;
+        }
+    }
+    if (lost > 0) {
+        memset(&batch[count], 0, sizeof(struct ptp_trace_entry));
+        batch[count].time = ptp_trace_clock(CLOCK_MONOTONIC);
+        batch[count].id = PTP_TR_LOST;
+        batch[count].thread = ring->thread;
+        batch[count].args[0] = lost;
+        count++;
+    }
+    if (count > 0) {
+        ptp_trace_write(batch, count);
+    }
+    ring->tail = tail;
+}
+
+/**
+* Start tracing: reserve rings, open trace file and, in stream mode,
+* start drain thread. Must be called before traced threads run.
+* @param mode enum ptp_trace_mode.
+* @param file trace file.
+* @param num_threads number of traced threads.
+* @return ptp error code.
+*/
+int ptp_trace_start(int mode, const char *file, int num_threads)
+{
+    size_t size = num_threads * sizeof(struct ptp_trace_ring);
+    int i = 0, ret = 0;
+
+    if ((mode == PTP_TRACE_OFF) || (num_threads <= 0) || rings) {
+        return PTP_ERR_GEN;
+    }
+    // Rings are touched now so that tracing never faults pages in
+    rings = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (rings == MAP_FAILED) {
+        perror("mmap");
+        rings = NULL;
+        return PTP_ERR_GEN;
+    }
+    for (i = 0; i < num_threads; i++) {
+        rings[i].thread = i;
+    }
+    num_rings = num_threads;
+
+    strncpy(trace_path, file, MAX_VALUE_LEN - 1);
+    trace_path[MAX_VALUE_LEN - 1] = 0;
+    if (ptp_trace_open() != PTP_ERR_OK) {
+        ptp_trace_stop();
+        return PTP_ERR_GEN;
+    }
+    if (mode == PTP_TRACE_STREAM) {
+        stop_fd = eventfd(0, EFD_NONBLOCK);
+        if (stop_fd < 0) {
+            perror("eventfd");
+            ptp_trace_stop();
+            return PTP_ERR_GEN;
+        }
+        ret = pthread_create(&drain_thread, NULL, ptp_trace_drain_thread,
+                             NULL);
+        if (ret != 0) {
+            ERROR("pthread_create %s\n", strerror(ret));
+            ptp_trace_stop();
+            return PTP_ERR_GEN;
+        }
+        draining = true;
+    }
+    INFO("Trace to %s%s\n", trace_path,
+         draining ? "" : " on exit");
+    return PTP_ERR_OK;
+}
+
+/**
+* Stop tracing after traced threads have exited. Remaining records are
+* written to the trace file.
+*/
+void ptp_trace_stop(void)
+{
+    u64 stop = 1;
+    int i = 0;
+
+    if (!rings) {
+        return;
+    }
+    if (draining) {
+        if (write(stop_fd, &stop, sizeof(u64)) < 0) {
+            perror("write");
+        }
+        pthread_join(drain_thread, NULL);
+        draining = false;
+    }
+    if (stop_fd >= 0) {
+        close(stop_fd);
+        stop_fd = -1;
+    }
+    for (i = 0; i < num_rings; i++) {
+        ptp_trace_drain(&rings[i]);
+    }
+    if (trace_fd >= 0) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    munmap(rings, num_rings * sizeof(struct ptp_trace_ring));
+    rings = NULL;
+    num_rings = 0;
+}
+
+/**
+* Get ring of a traced thread.
+* @param thread index of the thread.
+* @return ring, NULL if tracing is off.
+*/
+struct ptp_trace_ring *ptp_trace_ring(int thread)
+{
+    if (!rings || (thread < 0) || (thread >= num_rings)) {
+        return NULL;
+    }
+    return &rings[thread];
+}
+
+/**
+* Trace the calling thread to a ring.
+* @param ring ring from ptp_trace_ring(), NULL to stop tracing the thread.
+*/
+void ptp_trace_attach(struct ptp_trace_ring *ring)
+{
+    ptp_trace_local = ring;
+}
+
+/**
+* Drain thread, writes records of all rings periodically.
+* @param arg not used.
+* @return NULL.
+*/
+static void *ptp_trace_drain_thread(void *arg)
+{
+    struct timeval tv;
+    fd_set rd_fd;
+    int i = 0, ret = 0;
+
+    while (1) {
+        FD_ZERO(&rd_fd);
+        FD_SET(stop_fd, &rd_fd);
+        tv.tv_sec = 0;
+        tv.tv_usec = PTP_TRACE_DRAIN_MS * 1000;
+        ret = select(stop_fd + 1, &rd_fd, 0, 0, &tv);
+        if ((ret < 0) && (errno != EINTR)) {
+            perror("select");
+            break;
+        }
+        if ((ret > 0) && FD_ISSET(stop_fd, &rd_fd)) {
+            break;
+        }
+        for (i = 0; i < num_rings; i++) {
+            ptp_trace_drain(&rings[i]);
+        }
+    }
+    return NULL;
+}
+
+/**
+* Format record as text.
+* @param entry record.
+* @param buf text is written here.
+* @param len buffer length.
+* @return text length.
+*/
+int ptp_trace_format(const struct ptp_trace_entry *entry, char *buf,
+                     int len)
+{
+    const struct ptp_trace_event *event = NULL;
+    const char *name = NULL;
+    u64 value = 0;
+    int i = 0, pos = 0;
+
+    if (entry->id >= PTP_TR_NUM) {
+        return snprintf(buf, len, "event%u 0x%llx 0x%llx 0x%llx 0x%llx",
+                        entry->id, entry->args[0], entry->args[1],
+                        entry->args[2], entry->args[3]);
+    }
+    event = &events[entry->id];
+    pos = snprintf(buf, len, "%s", event->name);
+    for (i = 0; (i < PTP_TRACE_ARGS) && (pos < len); i++) {
+        name = event->args[i].name;
+        value = entry->args[i];
+        switch (event->args[i].format) {
+        case ARG_UINT:
+            pos += snprintf(buf + pos, len - pos, " %s=%llu", name, value);
+            break;
+        case ARG_INT:
+            pos += snprintf(buf + pos, len - pos, " %s=%lli", name,
+                            (long long) value);
+            break;
+        case ARG_HEX:
+            pos += snprintf(buf + pos, len - pos, " %s=0x%llx", name, value);
+            break;
+        case ARG_TIME:
+            pos += snprintf(buf + pos, len - pos, " %s=%llu.%09llu", name,
+                            value / 1000000000ULL, value % 1000000000ULL);
+            break;
+        case ARG_MSG:
+            pos += snprintf(buf + pos, len - pos, " %s=%s", name,
+                            ptp_msg_name(value));
+            break;
+        case ARG_STATE:
+            pos += snprintf(buf + pos, len - pos, " %s=%s", name,
+                            (value < sizeof(state_names) /
+                             sizeof(state_names[0])) ?
+                            state_names[value] : "UNKNOWN");
+            break;
+        default:
+            break;
+        }
+    }
+    return (pos < len) ? pos : len - 1;
+}
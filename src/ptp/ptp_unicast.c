@@ -0,0 +1,1063 @@
+/** @file ptp_unicast.c
+* PTP unicast sessions and negotiation.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#define PTP_LOG_CAT PTP_LOG_UNICAST
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_framer.h"
+#include "ptp_codec.h"
+#include "ptp_unicast.h"
+
+/// Value lengths of the negotiation TLVs
+#define PTP_UC_REQUEST_LEN      6
+#define PTP_UC_GRANT_LEN        8
+#define PTP_UC_CANCEL_LEN       2
+/// renewalInvited flag of GRANT_UNICAST_TRANSMISSION
+#define PTP_UC_RENEWAL_INVITED  0x01
+/// Shortest interval that can be granted
+#define PTP_UC_MIN_LOG_INTERVAL -7
+
+/// Message types of the lease array indexes
+static const u8 uc_msg_type[PTP_UC_NUM_TYPES] = {
+    [PTP_UC_ANNOUNCE] = PTP_ANNOUNCE,
+    [PTP_UC_SYNC] = PTP_SYNC,
+    [PTP_UC_DELAY_RESP] = PTP_DELAY_RESP,
+    [PTP_UC_PDELAY_RESP] = PTP_PDELAY_RESP,
+};
+
+/**
+* Get lease array index of message type.
+* @param msg_type PTP message type.
+* @return index, -1 if message type can not be negotiated.
+*/
+static int ptp_uc_index(u8 msg_type)
+{
+    int i = 0;
+
+    for (i = 0; i < PTP_UC_NUM_TYPES; i++) {
+        if (uc_msg_type[i] == msg_type) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+* Get message rate of an interval.
+* @param log_interval logInterMessagePeriod.
+* @return rate in 1/PTP_UC_RATE_UNIT messages per second.
+*/
+static u32 ptp_uc_rate(s8 log_interval)
+{
+    if (log_interval <= 0) {
+        return PTP_UC_RATE_UNIT << -log_interval;
+    }
+    if (log_interval >= 8) {
+        return 1;
+    }
+    return PTP_UC_RATE_UNIT >> log_interval;
+}
+
+/**
+* Get interval requested for a message type.
+* @param ctx Port context.
+* @param index lease array index.
+* @return logInterMessagePeriod.
+*/
+static s8 ptp_uc_interval(struct ptp_port_ctx *ctx, int index)
+{
+    switch (index) {
+    case PTP_UC_ANNOUNCE:
+        return ctx->port_dataset.log_mean_announce_interval;
+    case PTP_UC_SYNC:
+        return ctx->port_dataset.log_mean_sync_interval;
+    case PTP_UC_DELAY_RESP:
+        return ctx->port_dataset.log_min_mean_delay_req_interval;
+    default:
+        return ctx->port_dataset.log_min_mean_pdelay_req_interval;
+    }
+}
+
+/**
+* Set deadline some seconds after the current time.
+* @param deadline deadline is returned here.
+* @param time current time.
+* @param seconds seconds after current time.
+*/
+static void ptp_uc_deadline(struct Timestamp *deadline,
+                            struct Timestamp *time, u32 seconds)
+{
+    struct Timestamp inc;
+
+    memset(&inc, 0, sizeof(inc));
+    inc.seconds = seconds;
+    copy_timestamp(deadline, time);
+    inc_timestamp(deadline, &inc);
+}
+
+/**
+* Check if a deadline has been reached.
+* @param deadline deadline.
+* @param time current time.
+* @return true if deadline is not after current time.
+*/
+static bool ptp_uc_due(struct Timestamp *deadline, struct Timestamp *time)
+{
+    return older_timestamp(time, deadline) == deadline;
+}
+
+/**
+* Hash of a peer of a port (FNV-1a).
+* @param port_num port number.
+* @param addr peer address.
+* @return hash.
+*/
+static u32 ptp_uc_hash(u16 port_num, const char *addr)
+{
+    u32 hash = 2166136261u;
+    int i = 0;
+
+    hash = (hash ^ (port_num & 0xff)) * 16777619u;
+    hash = (hash ^ (port_num >> 8)) * 16777619u;
+    for (i = 0; (i < IP_STR_MAX_LEN) && addr[i]; i++) {
+        hash = (hash ^ (u8) addr[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+* Check if session a must be served before session b.
+* @param a session.
+* @param b session.
+* @return true if deadline of a is before deadline of b.
+*/
+static bool ptp_uc_before(struct ptp_uc_session *a, struct ptp_uc_session *b)
+{
+    return older_timestamp(&a->deadline, &b->deadline) == &a->deadline;
+}
+
+/**
+* Place heap entry.
+* @param table session table.
+* @param index heap index.
+* @param s session.
+*/
+static void ptp_uc_heap_set(struct ptp_uc_table *table, u32 index,
+                            struct ptp_uc_session *s)
+{
+    table->heap[index] = s;
+    s->heap_index = index;
+}
+
+/**
+* Restore heap order after deadline of a session has moved.
+* @param table session table.
+* @param index heap index of the session.
+*/
+static void ptp_uc_heap_fix(struct ptp_uc_table *table, u32 index)
+{
+    struct ptp_uc_session *s = table->heap[index];
+    u32 child = 0;
+
+    // Towards the root
+    while (index > 0 && ptp_uc_before(s, table->heap[(index - 1) / 2])) {
+        ptp_uc_heap_set(table, index, table->heap[(index - 1) / 2]);
+        index = (index - 1) / 2;
+    }
+    // Towards the leaves
+    while ((child = 2 * index + 1) < table->count) {
+        if ((child + 1 < table->count) &&
+            ptp_uc_before(table->heap[child + 1], table->heap[child])) {
+            child++;
+        }
+        if (!ptp_uc_before(table->heap[child], s)) {
+            break;
+        }
+        ptp_uc_heap_set(table, index, table->heap[child]);
+        index = child;
+    }
+    ptp_uc_heap_set(table, index, s);
+}
+
+/**
+* Find session of a peer.
+* @param ctx Port context.
+* @param addr peer address.
+* @return session, NULL if not found.
+*/
+static struct ptp_uc_session *ptp_uc_find(struct ptp_port_ctx *ctx,
+                                          const char *addr)
+{
+    struct ptp_uc_table *table = &ctx->ptp->unicast;
+    struct ptp_uc_session *s = NULL;
+    u32 hash = 0;
+
+    if (!ctx->unicast_port || (table->count == 0)) {
+        return NULL;
+    }
+    hash = ptp_uc_hash(ctx->port_dataset.port_identity.port_number, addr);
+    for (s = table->buckets[hash & table->hash_mask]; s != NULL;
+         s = s->next) {
+        if ((s->hash == hash) && (s->port == ctx) &&
+            (strncmp(s->addr, addr, IP_STR_MAX_LEN) == 0)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/**
+* Add session for a peer. Session is served on the next run.
+* @param ctx Port context.
+* @param addr peer address.
+* @return session, NULL if table is full.
+*/
+static struct ptp_uc_session *ptp_uc_add(struct ptp_port_ctx *ctx,
+                                         const char *addr)
+{
+    struct ptp_uc_table *table = &ctx->ptp->unicast;
+    struct ptp_uc_session *s = table->free_head;
+    u32 bucket = 0;
+
+    if (s == NULL) {
+        ERROR("unicast sessions exhausted (%u)\n", table->capacity);
+        return NULL;
+    }
+    table->free_head = s->next;
+    memset(s, 0, sizeof(struct ptp_uc_session));
+    s->port = ctx;
+    strncpy(s->addr, addr, IP_STR_MAX_LEN - 1);
+    s->hash = ptp_uc_hash(ctx->port_dataset.port_identity.port_number,
+                          s->addr);
+    bucket = s->hash & table->hash_mask;
+    s->next = table->buckets[bucket];
+    table->buckets[bucket] = s;
+    // Zero deadline is the earliest
+    ptp_uc_heap_set(table, table->count++, s);
+    ptp_uc_heap_fix(table, s->heap_index);
+    ctx->unicast.num_sessions++;
+    DEBUG("Unicast session %s port %i (%u)\n", s->addr,
+          ctx->port_dataset.port_identity.port_number, table->count);
+    return s;
+}
+
+/**
+* Release grant given to the peer and the capacity it reserved.
+* @param table session table.
+* @param grant grant.
+*/
+static void ptp_uc_release(struct ptp_uc_table *table,
+                           struct ptp_uc_lease *grant)
+{
+    if (grant->active) {
+        table->rate -= grant->rate;
+    }
+    grant->active = false;
+    grant->rate = 0;
+}
+
+/**
+* Unlink session from the hash table and return it to the free list.
+* Heap is maintained by the caller.
+* @param table session table.
+* @param s session.
+*/
+static void ptp_uc_free(struct ptp_uc_table *table, struct ptp_uc_session *s)
+{
+    struct ptp_uc_session **prev = &table->buckets[s->hash & table->hash_mask];
+    int i = 0;
+
+    while (*prev != s) {
+        prev = &(*prev)->next;
+    }
+    *prev = s->next;
+    for (i = 0; i < PTP_UC_NUM_TYPES; i++) {
+        ptp_uc_release(table, &s->granted[i]);
+    }
+    s->port->unicast.num_sessions--;
+    s->next = table->free_head;
+    table->free_head = s;
+}
+
+/**
+* Remove session.
+* @param table session table.
+* @param s session.
+*/
+static void ptp_uc_remove(struct ptp_uc_table *table,
+                          struct ptp_uc_session *s)
+{
+    u32 index = s->heap_index;
+
+    DEBUG("Remove unicast session %s\n", s->addr);
+    ptp_uc_free(table, s);
+    if (index < --table->count) {
+        ptp_uc_heap_set(table, index, table->heap[table->count]);
+        ptp_uc_heap_fix(table, index);
+    }
+}
+
+/**
+* Serve session on the next run.
+* @param s session.
+* @param time current time.
+*/
+static void ptp_uc_wake(struct ptp_uc_session *s, struct Timestamp *time)
+{
+    copy_timestamp(&s->deadline, time);
+    ptp_uc_heap_fix(&s->port->ptp->unicast, s->heap_index);
+}
+
+/**
+* Write TLV header.
+* @param buf buffer.
+* @param type tlvType.
+* @param len lengthField.
+* @return pointer to valueField.
+*/
+static u8 *ptp_uc_put_tlv(u8 * buf, u16 type, u16 len)
+{
+    ptp_put_u16(buf, type);
+    ptp_put_u16(buf + 2, len);
+    memset(buf + PTP_TLV_HDR_LEN, 0, len);
+    return buf + PTP_TLV_HDR_LEN;
+}
+
+/**
+* Send Signaling message to a peer.
+* @param ctx Port context.
+* @param buf Signaling message with TLVs.
+* @param len message length.
+* @param addr peer address.
+*/
+static void ptp_uc_signal(struct ptp_port_ctx *ctx, char *buf, int len,
+                          char *addr)
+{
+    ptp_put_u16(&((struct ptp_header *) buf)->msg_len, len);
+    ptp_unicast_send(ctx, PTP_SIGNALING, buf, len, addr);
+}
+
+/**
+* Grant or deny unicast transmission requested by the peer. Request is
+* granted if the rate fits into the capacity of the instance.
+* @param s session.
+* @param index lease array index.
+* @param log_interval requested logInterMessagePeriod.
+* @param duration requested duration, s.
+* @param time current time.
+* @return granted duration, 0 if denied.
+*/
+static u32 ptp_uc_grant(struct ptp_uc_session *s, int index,
+                        s8 log_interval, u32 duration,
+                        struct Timestamp *time)
+{
+    struct ptp_uc_table *table = &s->port->ptp->unicast;
+    struct ptp_uc_lease *grant = &s->granted[index];
+    struct ptp_config *cfg = &s->port->ptp->cfg;
+    u32 max_rate = (u32) cfg->unicast_max_rate * PTP_UC_RATE_UNIT;
+    u32 rate = 0;
+    u32 reserved = table->rate;
+
+    if ((duration == 0) || (log_interval < PTP_UC_MIN_LOG_INTERVAL)) {
+        return 0;
+    }
+    // Interval is validated first, the shift is defined only for it
+    rate = ptp_uc_rate(log_interval);
+    // Renewal replaces the earlier reservation
+    if (grant->active) {
+        reserved -= grant->rate;
+    }
+    if (max_rate && ((u64) reserved + rate > max_rate)) {
+        DEBUG("Deny %s 2^%i to %s: %u/%u\n",
+              ptp_msg_name(uc_msg_type[index]), log_interval, s->addr,
+              reserved + rate, max_rate);
+        ptp_uc_release(table, grant);
+        return 0;
+    }
+    if (duration > cfg->unicast_lease) {
+        duration = cfg->unicast_lease;
+    }
+    ptp_uc_release(table, grant);
+    grant->active = true;
+    grant->log_interval = log_interval;
+    grant->duration = duration;
+    grant->rate = rate;
+    table->rate += rate;
+    ptp_uc_deadline(&grant->expiry, time, duration);
+    DEBUG("Grant %s 2^%i %us to %s\n", ptp_msg_name(uc_msg_type[index]),
+          log_interval, duration, s->addr);
+    return duration;
+}
+
+/**
+* Memory needed from the arena for the session table.
+* @param capacity number of sessions.
+* @return size in bytes.
+*/
+size_t ptp_unicast_table_size(u32 capacity)
+{
+    u32 buckets = 1;
+
+    while (buckets < capacity) {
+        buckets <<= 1;
+    }
+    return PTP_ARENA_SIZE(capacity * sizeof(struct ptp_uc_session)) +
+        PTP_ARENA_SIZE(buckets * sizeof(struct ptp_uc_session *)) +
+        PTP_ARENA_SIZE(capacity * sizeof(struct ptp_uc_session *));
+}
+
+/**
+* Reserve session table of an instance from its arena.
+* @param ptp_ctx PTP instance.
+* @param capacity number of sessions.
+* @return ptp error code.
+*/
+int ptp_unicast_table_init(struct ptp_ctx *ptp_ctx, u32 capacity)
+{
+    struct ptp_uc_table *table = &ptp_ctx->unicast;
+    struct ptp_uc_session *sessions = NULL;
+    u32 buckets = 1;
+    u32 i = 0;
+
+    while (buckets < capacity) {
+        buckets <<= 1;
+    }
+    memset(table, 0, sizeof(struct ptp_uc_table));
+    sessions = ptp_arena_alloc(&ptp_ctx->arena,
+                               capacity * sizeof(struct ptp_uc_session));
+    table->buckets = ptp_arena_alloc(&ptp_ctx->arena,
+                                     buckets *
+                                     sizeof(struct ptp_uc_session *));
+    table->heap = ptp_arena_alloc(&ptp_ctx->arena,
+                                  capacity *
+                                  sizeof(struct ptp_uc_session *));
+    if ((sessions == NULL) || (table->buckets == NULL) ||
+        (table->heap == NULL)) {
+        return PTP_ERR_GEN;
+    }
+    table->capacity = capacity;
+    table->hash_mask = buckets - 1;
+    for (i = capacity; i > 0; i--) {
+        sessions[i - 1].next = table->free_head;
+        table->free_head = &sessions[i - 1];
+    }
+    return PTP_ERR_OK;
+}
+
+/**
+* Initialize unicast data of a port and add sessions for the configured
+* peers.
+* @param ctx Port context.
+* @param if_config Interface configuration.
+*/
+void ptp_unicast_init(struct ptp_port_ctx *ctx,
+                      struct interface_config *if_config)
+{
+    struct ptp_uc_session *s = NULL;
+    int i = 0;
+
+    memset(&ctx->unicast, 0, sizeof(struct ptp_unicast));
+    // Transparent clocks forward Signaling, they have no sessions
+    if (!ctx->unicast_port || (ctx->ptp->cfg.clock_type != CLOCK_TYPE_OC)) {
+        return;
+    }
+    ctx->unicast.sessions = true;
+    ctx->unicast.negotiation = if_config->unicast_negotiation;
+    for (i = 0; i < if_config->num_unicast_addr; i++) {
+        s = ptp_uc_add(ctx, if_config->unicast_ip[i]);
+        if (s == NULL) {
+            break;
+        }
+        s->configured = true;
+    }
+}
+
+/**
+* Remove sessions of a closed port and release capacity they reserved.
+* @param ctx Port context.
+*/
+void ptp_unicast_close(struct ptp_port_ctx *ctx)
+{
+    struct ptp_uc_table *table = &ctx->ptp->unicast;
+    u32 i = 0, kept = 0;
+
+    if (ctx->unicast.num_sessions == 0) {
+        return;
+    }
+    // Drop sessions of the port, then rebuild the heap
+    for (i = 0; i < table->count; i++) {
+        if (table->heap[i]->port == ctx) {
+            ptp_uc_free(table, table->heap[i]);
+        } else {
+            ptp_uc_heap_set(table, kept++, table->heap[i]);
+        }
+    }
+    table->count = kept;
+    for (i = kept / 2; i > 0; i--) {
+        ptp_uc_heap_fix(table, i - 1);
+    }
+}
+
+/**
+* Handle received Signaling message: grant or deny requests, store grants
+* and acknowledge cancels. Session is created for a new peer.
+* @param ctx Port context.
+* @param buf Signaling message validated with ptp_msg_check().
+* @param time receive time.
+* @param peer_ip address of the peer.
+*/
+void ptp_unicast_recv(struct ptp_port_ctx *ctx, char *buf,
+                      struct Timestamp *time, char *peer_ip)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    struct ptp_uc_session *s = NULL;
+    struct ptp_uc_lease *lease = NULL;
+    struct PortIdentity peer;
+    struct ptp_tlv tlv;
+    char resp[MAX_PTP_FRAME_SIZE];
+    u8 *value = NULL;
+    int offset = 0;
+    int len = 0;
+    int index = 0;
+    u32 granted = 0;
+
+    if (!ctx->unicast.negotiation) {
+        DEBUG("Signaling on port without negotiation\n");
+        return;
+    }
+    s = ptp_uc_find(ctx, peer_ip);
+    if (s == NULL) {
+        // Requests of a new peer are denied if table is full
+        s = ptp_uc_add(ctx, peer_ip);
+    }
+    ptp_get_port_id(&peer, &hdr->src_port_id);
+    len = create_signaling(ctx, resp, &peer,
+                           s ? s->signaling_seqid++ : 0);
+
+    while (ptp_tlv_next(buf, &offset, &tlv)) {
+        // Room for a response TLV
+        if (len + PTP_TLV_HDR_LEN + PTP_UC_GRANT_LEN > MAX_PTP_FRAME_SIZE) {
+            break;
+        }
+        if (tlv.length < PTP_UC_CANCEL_LEN) {
+            continue;
+        }
+        index = ptp_uc_index(tlv.value[0] >> 4);
+        switch (tlv.type) {
+        case REQUEST_UNICAST_TRANSMISSION:
+            if (tlv.length < PTP_UC_REQUEST_LEN) {
+                break;
+            }
+            granted = 0;
+            if (s && (index >= 0)) {
+                granted = ptp_uc_grant(s, index, (s8) tlv.value[1],
+                                       ptp_get_u32(tlv.value + 2), time);
+            }
+            value = ptp_uc_put_tlv((u8 *) resp + len,
+                                   GRANT_UNICAST_TRANSMISSION,
+                                   PTP_UC_GRANT_LEN);
+            value[0] = tlv.value[0] & 0xf0;
+            value[1] = tlv.value[1];
+            ptp_put_u32(value + 2, granted);
+            value[7] = PTP_UC_RENEWAL_INVITED;
+            len += PTP_TLV_HDR_LEN + PTP_UC_GRANT_LEN;
+            break;
+        case GRANT_UNICAST_TRANSMISSION:
+            if ((tlv.length < PTP_UC_GRANT_LEN) || (index < 0) || !s) {
+                break;
+            }
+            lease = &s->leased[index];
+            lease->duration = ptp_get_u32(tlv.value + 2);
+            lease->log_interval = (s8) tlv.value[1];
+            lease->active = (lease->duration != 0);
+            if (lease->active) {
+                ptp_uc_deadline(&lease->expiry, time, lease->duration);
+            }
+            DEBUG("%s %s 2^%i %us by %s\n",
+                  lease->active ? "Granted" : "Denied",
+                  ptp_msg_name(uc_msg_type[index]), lease->log_interval,
+                  lease->duration, s->addr);
+            break;
+        case CANCEL_UNICAST_TRANSMISSION:
+            // Cancel applies to both directions of the message type
+            if (s && (index >= 0)) {
+                ptp_uc_release(&ctx->ptp->unicast, &s->granted[index]);
+                s->leased[index].active = false;
+                DEBUG("Cancel %s by %s\n", ptp_msg_name(uc_msg_type[index]),
+                      s->addr);
+            }
+            value = ptp_uc_put_tlv((u8 *) resp + len,
+                                   ACKNOWLEDGE_CANCEL_UNICAST_TRANSMISSION,
+                                   PTP_UC_CANCEL_LEN);
+            value[0] = tlv.value[0] & 0xf0;
+            len += PTP_TLV_HDR_LEN + PTP_UC_CANCEL_LEN;
+            break;
+        default:
+            break;
+        }
+    }
+    if (len > offsetof(struct ptp_signaling, tlvs)) {
+        ptp_uc_signal(ctx, resp, len, peer_ip);
+    }
+    if (s) {
+        copy_timestamp(&s->last_recv, time);
+        // Transmission of new grants starts, unused session is removed
+        ptp_uc_wake(s, time);
+    }
+}
+
+/**
+* Record reception of a frame from a peer.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param time receive time.
+*/
+void ptp_unicast_seen(struct ptp_port_ctx *ctx, char *peer_ip,
+                      struct Timestamp *time)
+{
+    struct ptp_uc_session *s = ptp_uc_find(ctx, peer_ip);
+
+    if (s) {
+        copy_timestamp(&s->last_recv, time);
+    }
+}
+
+/**
+* Check if port needs messages of a type from a peer in its current
+* state. Announce is needed from every configured peer for BMC, the
+* rest only from the current master.
+* @param s session of a configured peer.
+* @param index lease array index.
+* @return true if lease is needed.
+*/
+static bool ptp_uc_needed(struct ptp_uc_session *s, int index)
+{
+    struct ptp_port_ctx *ctx = s->port;
+    enum PortState state = ctx->port_dataset.port_state;
+    bool master = (strncmp(s->addr, ctx->current_master_ip,
+                           IP_STR_MAX_LEN) == 0);
+
+    switch (index) {
+    case PTP_UC_ANNOUNCE:
+        return true;
+    case PTP_UC_SYNC:
+        return master &&
+            ((state == PORT_UNCALIBRATED) || (state == PORT_SLAVE));
+    case PTP_UC_DELAY_RESP:
+        return master &&
+            (ctx->port_dataset.delay_mechanism == DELAY_E2E) &&
+            ((state == PORT_UNCALIBRATED) || (state == PORT_SLAVE));
+    default:
+        return master && (ctx->port_dataset.delay_mechanism == DELAY_P2P);
+    }
+}
+
+/**
+* Expire grants and leases of a session. For a configured peer, request
+* leases needed in the current port state and cancel leases not needed
+* anymore. Leases are renewed when a quarter of their duration is left.
+* @param s session.
+* @param current_time current time.
+*/
+static void ptp_uc_check(struct ptp_uc_session *s,
+                         struct Timestamp *current_time)
+{
+    struct ptp_port_ctx *ctx = s->port;
+    struct ptp_uc_lease *lease = NULL;
+    struct PortIdentity peer;
+    struct Timestamp renew;
+    struct Timestamp tmp;
+    char buf[MAX_PTP_FRAME_SIZE];
+    u8 *value = NULL;
+    int len = 0;
+    int i = 0;
+
+    ptp_uc_deadline(&s->check_timer, current_time, PTP_UC_CHECK_INTERVAL);
+    if (!ctx->unicast.negotiation) {
+        return;
+    }
+    // Peer is not known before negotiation, target all ports
+    memset(peer.clock_identity, 0xff, sizeof(ClockIdentity));
+    peer.port_number = 0xffff;
+    len = create_signaling(ctx, buf, &peer, s->signaling_seqid);
+
+    for (i = 0; i < PTP_UC_NUM_TYPES; i++) {
+        if (s->granted[i].active &&
+            ptp_uc_due(&s->granted[i].expiry, current_time)) {
+            DEBUG("Grant %s to %s expired\n", ptp_msg_name(uc_msg_type[i]),
+                  s->addr);
+            ptp_uc_release(&ctx->ptp->unicast, &s->granted[i]);
+        }
+        lease = &s->leased[i];
+        if (lease->active && ptp_uc_due(&lease->expiry, current_time)) {
+            DEBUG("Lease %s by %s expired\n", ptp_msg_name(uc_msg_type[i]),
+                  s->addr);
+            lease->active = false;
+        }
+        if (!s->configured) {
+            continue;
+        }
+
+        if (!ptp_uc_needed(s, i)) {
+            if (lease->active) {
+                value = ptp_uc_put_tlv((u8 *) buf + len,
+                                       CANCEL_UNICAST_TRANSMISSION,
+                                       PTP_UC_CANCEL_LEN);
+                value[0] = uc_msg_type[i] << 4;
+                len += PTP_TLV_HDR_LEN + PTP_UC_CANCEL_LEN;
+                lease->active = false;
+            }
+            continue;
+        }
+        if (lease->active) {
+            // Renew when a quarter of the lease is left
+            memset(&tmp, 0, sizeof(tmp));
+            tmp.seconds = lease->duration / 4;
+            copy_timestamp(&renew, &lease->expiry);
+            dec_timestamp(&renew, &tmp);
+            if (!ptp_uc_due(&renew, current_time)) {
+                continue;
+            }
+        }
+        if (!ptp_uc_due(&lease->retry, current_time)) {
+            continue;
+        }
+        value = ptp_uc_put_tlv((u8 *) buf + len,
+                               REQUEST_UNICAST_TRANSMISSION,
+                               PTP_UC_REQUEST_LEN);
+        value[0] = uc_msg_type[i] << 4;
+        value[1] = ptp_uc_interval(ctx, i);
+        ptp_put_u32(value + 2, ctx->ptp->cfg.unicast_lease);
+        len += PTP_TLV_HDR_LEN + PTP_UC_REQUEST_LEN;
+        ptp_uc_deadline(&lease->retry, current_time, PTP_UC_RETRY_INTERVAL);
+    }
+    if (len > offsetof(struct ptp_signaling, tlvs)) {
+        DEBUG("Send Signaling %i to %s\n", len, s->addr);
+        s->signaling_seqid++;
+        ptp_uc_signal(ctx, buf, len, s->addr);
+    }
+}
+
+/**
+* Check if port may transmit a message type to the peer of a session.
+* @param s session.
+* @param index lease array index.
+* @param log_interval interval of the messages is returned here.
+* @return true if messages may be sent.
+*/
+static bool ptp_uc_may_send(struct ptp_uc_session *s, int index,
+                            s8 * log_interval)
+{
+    if (!s->port->unicast.negotiation) {
+        // Configured peers get messages at the port intervals
+        *log_interval = ptp_uc_interval(s->port, index);
+        return s->configured;
+    }
+    *log_interval = s->granted[index].log_interval;
+    return s->granted[index].active;
+}
+
+/**
+* Send Announce and Sync to the peer of a master port when due.
+* @param s session.
+* @param current_time current time.
+*/
+static void ptp_uc_transmit(struct ptp_uc_session *s,
+                            struct Timestamp *current_time)
+{
+    struct ptp_port_ctx *ctx = s->port;
+    char tmpbuf[MAX_PTP_FRAME_SIZE];
+    struct Timestamp time_tmp;
+    s8 interval = 0;
+    int ret = 0;
+
+    if (!ptp_uc_may_send(s, PTP_UC_ANNOUNCE, &interval)) {
+        copy_timestamp(&s->announce_timer, current_time);
+    } else if (ptp_uc_due(&s->announce_timer, current_time)) {
+        ret = create_announce(ctx, tmpbuf, s->announce_seqid, 0,
+                              current_time);
+        if (ret > 0) {
+            ((struct ptp_header *) tmpbuf)->log_mean_msg_interval = interval;
+            if (ptp_unicast_send(ctx, PTP_ANNOUNCE, tmpbuf, ret, s->addr) ==
+                PTP_ERR_OK) {
+                s->announce_seqid++;
+            }
+        }
+        time_tmp.seconds = power2(interval, &time_tmp.nanoseconds);
+        time_tmp.frac_nanoseconds = 0;
+        copy_timestamp(&s->announce_timer, current_time);
+        inc_timestamp(&s->announce_timer, &time_tmp);
+    }
+
+    if (!ptp_uc_may_send(s, PTP_UC_SYNC, &interval)) {
+        copy_timestamp(&s->sync_timer, current_time);
+    } else if (ptp_uc_due(&s->sync_timer, current_time)) {
+        ret = create_sync(ctx, tmpbuf, s->sync_seqid, current_time);
+        if (ret > 0) {
+            ((struct ptp_header *) tmpbuf)->log_mean_msg_interval = interval;
+            if (ptp_unicast_send(ctx, PTP_SYNC, tmpbuf, ret, s->addr) ==
+                PTP_ERR_OK) {
+                s->sync_seqid++;
+                copy_timestamp(&s->last_sync, current_time);
+            }
+        }
+        time_tmp.seconds = power2(interval, &time_tmp.nanoseconds);
+        time_tmp.frac_nanoseconds = 0;
+        copy_timestamp(&s->sync_timer, current_time);
+        inc_timestamp(&s->sync_timer, &time_tmp);
+    }
+}
+
+/**
+* Serve session: check leases, transmit if port is master and compute
+* next deadline. Unused sessions of unconfigured peers are removed.
+* @param s session.
+* @param current_time current time.
+*/
+static void ptp_uc_serve(struct ptp_uc_session *s,
+                         struct Timestamp *current_time)
+{
+    struct ptp_port_ctx *ctx = s->port;
+    struct ptp_uc_table *table = &ctx->ptp->unicast;
+    bool master = (ctx->port_dataset.port_state == PORT_MASTER);
+    bool used = s->configured;
+    s8 interval = 0;
+    int i = 0;
+
+    if (ptp_uc_due(&s->check_timer, current_time)) {
+        ptp_uc_check(s, current_time);
+    }
+    for (i = 0; i < PTP_UC_NUM_TYPES; i++) {
+        used = used || s->granted[i].active || s->leased[i].active;
+    }
+    if (!used) {
+        ptp_uc_remove(table, s);
+        return;
+    }
+    if (master) {
+        ptp_uc_transmit(s, current_time);
+    }
+
+    copy_timestamp(&s->deadline, &s->check_timer);
+    if (master && ptp_uc_may_send(s, PTP_UC_ANNOUNCE, &interval)) {
+        copy_timestamp(&s->deadline,
+                       older_timestamp(&s->deadline, &s->announce_timer));
+    }
+    if (master && ptp_uc_may_send(s, PTP_UC_SYNC, &interval)) {
+        copy_timestamp(&s->deadline,
+                       older_timestamp(&s->deadline, &s->sync_timer));
+    }
+    ptp_uc_heap_fix(table, s->heap_index);
+}
+
+/**
+* Serve sessions which are due: expire leases, request and cancel leases,
+* and send Announce and Sync to the peers of master ports.
+* @param ptp_ctx PTP instance.
+* @param current_time current time.
+* @param next_time moved earlier if a session must be served sooner.
+*/
+void ptp_unicast_run(struct ptp_ctx *ptp_ctx,
+                     struct Timestamp *current_time,
+                     struct Timestamp *next_time)
+{
+    struct ptp_uc_table *table = &ptp_ctx->unicast;
+    u32 budget = table->count;
+
+    // Every session is served at most once per run
+    while ((table->count > 0) && (budget-- > 0) &&
+           ptp_uc_due(&table->heap[0]->deadline, current_time)) {
+        ptp_uc_serve(table->heap[0], current_time);
+    }
+    if ((table->count > 0) &&
+        (older_timestamp(&table->heap[0]->deadline, next_time) ==
+         &table->heap[0]->deadline)) {
+        copy_timestamp(next_time, &table->heap[0]->deadline);
+    }
+}
+
+/**
+* Check if port may transmit a message to a peer. Ports without
+* negotiation always transmit, others only while the peer holds a grant.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param msg_type PTP_ANNOUNCE, PTP_SYNC, PTP_DELAY_RESP or PTP_PDELAY_RESP.
+* @return true if message may be sent.
+*/
+bool ptp_unicast_granted(struct ptp_port_ctx *ctx, char *peer_ip,
+                         u8 msg_type)
+{
+    struct ptp_uc_session *s = NULL;
+    int index = ptp_uc_index(msg_type);
+
+    if (!ctx->unicast.negotiation || (index < 0)) {
+        return true;
+    }
+    s = ptp_uc_find(ctx, peer_ip);
+    return s && s->granted[index].active;
+}
+
+/**
+* Check if a peer transmits a message to port. Ports without negotiation
+* always expect messages, others only while they hold a lease.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param msg_type PTP_ANNOUNCE, PTP_SYNC, PTP_DELAY_RESP or PTP_PDELAY_RESP.
+* @return true if lease is valid.
+*/
+bool ptp_unicast_leased(struct ptp_port_ctx *ctx, char *peer_ip,
+                        u8 msg_type)
+{
+    struct ptp_uc_session *s = NULL;
+    int index = ptp_uc_index(msg_type);
+
+    if (!ctx->unicast.negotiation || (index < 0)) {
+        return true;
+    }
+    s = ptp_uc_find(ctx, peer_ip);
+    return s && s->leased[index].active;
+}
+
+/**
+* Get logInterMessagePeriod of a message a peer holds a grant for.
+* @param ctx Port context.
+* @param peer_ip address of the peer.
+* @param msg_type PTP_ANNOUNCE, PTP_SYNC, PTP_DELAY_RESP or PTP_PDELAY_RESP.
+* @param log_interval returned if port does not negotiate or peer has
+* no grant.
+* @return log interval.
+*/
+s8 ptp_unicast_interval(struct ptp_port_ctx *ctx, char *peer_ip,
+                        u8 msg_type, s8 log_interval)
+{
+    struct ptp_uc_session *s = NULL;
+    int index = ptp_uc_index(msg_type);
+
+    if (!ctx->unicast.negotiation || (index < 0)) {
+        return log_interval;
+    }
+    s = ptp_uc_find(ctx, peer_ip);
+    if (s && s->granted[index].active) {
+        return s->granted[index].log_interval;
+    }
+    return log_interval;
+}
+
+/**
+* Send message of a port to a unicast peer. Unicast frames are not
+* looped back for timestamping, so the send time is the transmit timestamp
+* returned by the packet interface. It is requested only for the messages
+* that use it: two-step Sync and Pdelay_Resp, whose follow up messages
+* carry it, and Delay_Req and Pdelay_Req, whose send times are stored.
+* @param ctx Port context.
+* @param msg_type PTP message type.
+* @param buf frame.
+* @param len frame length.
+* @param peer_ip address of the peer.
+* @return ptp error code.
+*/
+int ptp_unicast_send(struct ptp_port_ctx *ctx, int msg_type,
+                     char *buf, int len, char *peer_ip)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    int port_num = ctx->port_dataset.port_identity.port_number;
+    struct Timestamp sent_time;
+    struct Timestamp *tstamp = NULL;
+    struct PortIdentity req_port_id;
+    char tmpbuf[MAX_PTP_FRAME_SIZE];
+    int ret = 0;
+
+    // Timestamp lookup waits for the error queue, other messages skip it
+    switch (msg_type) {
+    case PTP_SYNC:
+        if (!ctx->ptp->cfg.one_step_clock) {
+            tstamp = &sent_time;
+        }
+        break;
+    case PTP_DELAY_REQ:
+    case PTP_PDELAY_REQ:
+    case PTP_PDELAY_RESP:
+        tstamp = &sent_time;
+        break;
+    default:
+        break;
+    }
+    ret = ptp_send_to(&ctx->ptp->pkt_ctx, msg_type, port_num, buf, len,
+                      peer_ip, tstamp);
+    ptp_count_tx(&ctx->counters, msg_type, 1, ret != PTP_ERR_OK);
+    if (ret != PTP_ERR_OK) {
+        if (ret == PTP_ERR_NET) {
+            ctx->ptp->socket_restart = 1;
+        }
+        return ret;
+    }
+    switch (msg_type) {
+    case PTP_SYNC:
+        if (ctx->ptp->cfg.one_step_clock) {
+            break;
+        }
+        ret = create_follow_up(ctx, tmpbuf, &sent_time, ptp_hdr_seq_id(hdr));
+        if (ret > 0) {
+            ((struct ptp_header *) tmpbuf)->log_mean_msg_interval =
+                hdr->log_mean_msg_interval;
+            ret = ptp_send_to(&ctx->ptp->pkt_ctx, PTP_FOLLOW_UP, port_num,
+                              tmpbuf, ret, peer_ip, NULL);
+            ptp_count_tx(&ctx->counters, PTP_FOLLOW_UP, 1,
+                         ret != PTP_ERR_OK);
+        }
+        break;
+    case PTP_PDELAY_RESP:
+        ptp_get_port_id(&req_port_id,
+                        ((struct ptp_pdelay_resp *) buf)->req_port_id);
+        ret = create_pdelay_resp_follow_up(ctx, tmpbuf, &sent_time,
+                                           &req_port_id,
+                                           ptp_hdr_seq_id(hdr),
+                                           ctx->pdelay_req_corr_field);
+        if (ret > 0) {
+            ret = ptp_send_to(&ctx->ptp->pkt_ctx, PTP_PDELAY_RESP_FOLLOW_UP,
+                              port_num, tmpbuf, ret, peer_ip, NULL);
+            ptp_count_tx(&ctx->counters, PTP_PDELAY_RESP_FOLLOW_UP, 1,
+                         ret != PTP_ERR_OK);
+        }
+        break;
+    case PTP_DELAY_REQ:
+    case PTP_PDELAY_REQ:
+        ptp_frame_sent(ctx->ptp, port_num, hdr, PTP_ERR_OK, &sent_time);
+        break;
+    default:
+        break;
+    }
+    if (ret == PTP_ERR_NET) {
+        ctx->ptp->socket_restart = 1;
+        return ret;
+    }
+    return PTP_ERR_OK;
+}
@@ -0,0 +1,172 @@
+/** @file ptp_codec_bench.c
+* Codec benchmark. Measures how many received messages per second are
+* validated with ptp_msg_check() and decoded through the views and
+* ptp_tlv_next(), for messages with and without TLVs.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+#include <time.h>
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_internal.h>
+#include <ptp_codec.h>
+
+/// Default number of messages decoded per case
+#define BENCH_ROUNDS    10000000
+/// TLVs of the Signaling case
+#define BENCH_TLVS      4
+
+/**
+* Get monotonic clock in nanoseconds.
+* @return nanoseconds.
+*/
+static u64 bench_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+* Build message with header and TLVs, other fields zero.
+* @param buf buffer.
+* @param type message type.
+* @param num_tlvs number of TLVs, 8 bytes of value each.
+* @return message length.
+*/
+static int bench_frame(u8 * buf, u8 type, int num_tlvs)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    int len = ptp_msg_fixed_len(type);
+    int i = 0;
+
+    memset(buf, 0, MAX_PTP_FRAME_SIZE);
+    hdr->msg_type = type;
+    hdr->ptp_ver = 2;
+    for (i = 0; i < num_tlvs; i++) {
+        ptp_put_u16(buf + len, 0x0004);
+        ptp_put_u16(buf + len + 2, 8);
+        len += PTP_TLV_HDR_LEN + 8;
+    }
+    ptp_put_u16(&hdr->msg_len, len);
+    ptp_put_u16(&hdr->seq_id, 1);
+    return len;
+}
+
+/**
+* Validate and decode a message like the receive path does.
+* @param buf message.
+* @param len received length.
+* @return sum of decoded fields.
+*/
+static u64 bench_decode(u8 * buf, int len)
+{
+    struct ptp_announce *announce = NULL;
+    struct ptp_tlv tlv;
+    struct Timestamp time;
+    u64 sum = 0;
+    int offset = 0;
+
+    if (ptp_msg_check(buf, len) < 0) {
+        return 0;
+    }
+    sum += ptp_hdr_seq_id((struct ptp_header *) buf);
+    sum += ptp_hdr_corr_field((struct ptp_header *) buf);
+    switch (ptp_hdr_type((struct ptp_header *) buf)) {
+    case PTP_SYNC:
+        ptp_get_timestamp(&time, ptp_view_sync(buf)->origin_tstamp);
+        sum += time.seconds + time.nanoseconds;
+        break;
+    case PTP_ANNOUNCE:
+        announce = ptp_view_announce(buf);
+        ptp_get_timestamp(&time, announce->origin_tstamp);
+        sum += time.seconds + time.nanoseconds;
+        sum += ptp_get_u16(&announce->current_UTC_offset);
+        sum += ptp_get_u16(&announce->steps_removed);
+        sum += announce->grandmasterPri1 + announce->grandmasterPri2;
+        break;
+    default:
+        while (ptp_tlv_next(buf, &offset, &tlv)) {
+            sum += tlv.type + tlv.length;
+        }
+        break;
+    }
+    return sum;
+}
+
+/**
+* Main function of the codec benchmark.
+* @param argc Number of commandline parameters.
+* @param argv Commandline parameters.
+* @return 0.
+*/
+int main(int argc, char *argv[])
+{
+    static const struct {
+        const char *name;
+        u8 type;
+        int num_tlvs;
+    } cases[] = {
+        {"Sync", PTP_SYNC, 0},
+        {"Announce", PTP_ANNOUNCE, 0},
+        {"Signaling", PTP_SIGNALING, BENCH_TLVS},
+    };
+    u8 buf[MAX_PTP_FRAME_SIZE];
+    u32 rounds = BENCH_ROUNDS, i = 0;
+    volatile u64 sink = 0;
+    u64 start = 0, ns = 0;
+    size_t c = 0;
+    int len = 0;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [messages per case]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        rounds = strtoul(argv[1], NULL, 0);
+        if (rounds == 0) {
+            rounds = BENCH_ROUNDS;
+        }
+    }
+    printf("%-10s %6s %10s %12s\n", "message", "bytes", "ns", "Mmsg/s");
+    for (c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        len = bench_frame(buf, cases[c].type, cases[c].num_tlvs);
+        for (i = 0; i < rounds / 10; i++) {
+            sink += bench_decode(buf, len);
+        }
+        start = bench_ns();
+        for (i = 0; i < rounds; i++) {
+            // Each message is different, like received ones
+            buf[offsetof(struct ptp_header, seq_id) + 1] = i;
+            sink += bench_decode(buf, len);
+        }
+        ns = bench_ns() - start;
+        printf("%-10s %6i %10.1f %12.1f\n", cases[c].name, len,
+               (double) ns / rounds, rounds * 1000.0 / ns);
+    }
+    return 0;
+}
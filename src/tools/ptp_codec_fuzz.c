@@ -0,0 +1,247 @@
+/** @file ptp_codec_fuzz.c
+* Fuzz target of the message codec. LLVMFuzzerTestOneInput() runs one
+* input through ptp_msg_check() and, if it is accepted, walks its TLVs
+* with ptp_tlv_next() and reads the header fields, aborting if anything
+* lies outside messageLength. Build it for libFuzzer with e.g.
+*   clang -g -fsanitize=fuzzer,address -DPTP_FUZZ_LIBFUZZER -Iinclude
+*     -Iinclude/linux tools/ptp_codec_fuzz.c ptp/ptp_codec.c
+* Without PTP_FUZZ_LIBFUZZER a standalone driver is built ("make bench"),
+* which runs files given on the command line, or random frames shaped like
+* PTP messages.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+#include <stdint.h>
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_codec.h>
+
+/// Largest input, longer inputs are cut
+#define FUZZ_MAX_LEN        1500
+/// Default number of random frames of the standalone driver
+#define FUZZ_ROUNDS         2000000
+
+/**
+* Report a codec bug and abort.
+* @param what broken invariant.
+* @param len input length.
+*/
+static void fuzz_fail(const char *what, int len)
+{
+    fprintf(stderr, "codec fuzz: %s, input length %i\n", what, len);
+    abort();
+}
+
+/**
+* Run one input through the codec. The input is copied to a buffer of its
+* own size, so reads past it are found by AddressSanitizer.
+* @param data input.
+* @param size input length.
+* @return 0.
+*/
+int LLVMFuzzerTestOneInput(const uint8_t * data, size_t size)
+{
+    struct ptp_tlv tlv;
+    struct PortIdentity port_id;
+    u8 *buf = NULL;
+    int len = (size < FUZZ_MAX_LEN) ? size : FUZZ_MAX_LEN;
+    int msg_len = 0, offset = 0, end = 0;
+    volatile u32 sink = 0;
+
+    buf = malloc(len ? len : 1);
+    if (buf == NULL) {
+        return 0;
+    }
+    memcpy(buf, data, len);
+    msg_len = ptp_msg_check(buf, len);
+    if (msg_len < 0) {
+        free(buf);
+        return 0;
+    }
+    if ((msg_len > len) || (msg_len < (int) sizeof(struct ptp_header)) ||
+        (msg_len < ptp_msg_fixed_len(ptp_hdr_type((void *) buf)))) {
+        fuzz_fail("accepted length out of bounds", len);
+    }
+    sink += ptp_hdr_seq_id((void *) buf) + ptp_hdr_flags((void *) buf);
+    sink += (u32) ptp_hdr_corr_field((void *) buf);
+    ptp_get_port_id(&port_id, buf + offsetof(struct ptp_header, src_port_id));
+    sink += port_id.port_number;
+    // TLVs must exactly fill the rest of the message
+    end = ptp_msg_fixed_len(ptp_hdr_type((void *) buf));
+    while (ptp_tlv_next(buf, &offset, &tlv)) {
+        if ((tlv.value < buf + PTP_TLV_HDR_LEN) ||
+            (tlv.value + tlv.length > buf + msg_len)) {
+            fuzz_fail("TLV out of bounds", len);
+        }
+        if (tlv.length) {
+            sink += tlv.value[0] + tlv.value[tlv.length - 1];
+        }
+        sink += tlv.type;
+        end = offset;
+    }
+    if (end != msg_len) {
+        fuzz_fail("TLVs do not fill the message", len);
+    }
+    free(buf);
+    return 0;
+}
+
+#ifndef PTP_FUZZ_LIBFUZZER
+/// State of the random generator
+static u64 fuzz_state = 0x9e3779b97f4a7c15ULL;
+
+/**
+* Get random number (xorshift64*).
+* @return random number.
+*/
+static u32 fuzz_random(void)
+{
+    fuzz_state ^= fuzz_state >> 12;
+    fuzz_state ^= fuzz_state << 25;
+    fuzz_state ^= fuzz_state >> 27;
+    return (u32) ((fuzz_state * 0x2545f4914f6cdd1dULL) >> 32);
+}
+
+/**
+* Build random frame. Most frames have a valid header and TLVs of random
+* lengths, so that the checks past the header are reached, then some
+* bytes are corrupted and the frame may be cut.
+* @param buf buffer of FUZZ_MAX_LEN bytes.
+* @return frame length.
+*/
+static int fuzz_frame(u8 * buf)
+{
+    struct ptp_header *hdr = (struct ptp_header *) buf;
+    int len = 0, msg_len = 0, i = 0, tlv_len = 0;
+
+    for (i = 0; i < FUZZ_MAX_LEN; i++) {
+        buf[i] = fuzz_random();
+    }
+    if (fuzz_random() % 8 == 0) {
+        // Random bytes
+        return fuzz_random() % FUZZ_MAX_LEN;
+    }
+    hdr->msg_type = fuzz_random() % 16;
+    hdr->ptp_ver = 2;
+    msg_len = ptp_msg_fixed_len(ptp_hdr_type(hdr));
+    if (msg_len == 0) {
+        msg_len = sizeof(struct ptp_header);
+    }
+    // TLVs
+    while ((fuzz_random() % 3 != 0) && (msg_len + 64 < FUZZ_MAX_LEN)) {
+        tlv_len = fuzz_random() % 48;
+        ptp_put_u16(buf + msg_len, fuzz_random() % 0x10);
+        ptp_put_u16(buf + msg_len + 2, tlv_len);
+        msg_len += PTP_TLV_HDR_LEN + tlv_len;
+    }
+    ptp_put_u16(&hdr->msg_len, msg_len);
+    len = msg_len;
+    // Corrupt, cut or extend
+    switch (fuzz_random() % 4) {
+    case 0:
+        for (i = fuzz_random() % 4; i >= 0; i--) {
+            buf[fuzz_random() % (msg_len + 1)] = fuzz_random();
+        }
+        break;
+    case 1:
+        len = fuzz_random() % (msg_len + 1);
+        break;
+    case 2:
+        len = msg_len + fuzz_random() % 32;
+        if (len > FUZZ_MAX_LEN) {
+            len = FUZZ_MAX_LEN;
+        }
+        break;
+    default:
+        break;
+    }
+    return len;
+}
+
+/**
+* Run input file through the codec.
+* @param file input file.
+* @return 0 if file was read.
+*/
+static int fuzz_file(const char *file)
+{
+    u8 buf[FUZZ_MAX_LEN];
+    FILE *fp = NULL;
+    size_t len = 0;
+
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        perror(file);
+        return 1;
+    }
+    len = fread(buf, 1, sizeof(buf), fp);
+    fclose(fp);
+    LLVMFuzzerTestOneInput(buf, len);
+    return 0;
+}
+
+/**
+* Main function of the standalone fuzz driver.
+* @param argc Number of commandline parameters.
+* @param argv Commandline parameters.
+* @return 0 if no bug was found.
+*/
+int main(int argc, char *argv[])
+{
+    u8 buf[FUZZ_MAX_LEN];
+    u32 rounds = FUZZ_ROUNDS, i = 0, accepted = 0;
+    int len = 0, ret = 0;
+
+    if ((argc > 1) && (strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "Usage: %s [-n frames] [-s seed] [file ...]\n"
+                "Files are run once, otherwise %u random frames\n",
+                argv[0], FUZZ_ROUNDS);
+        return 1;
+    }
+    for (i = 1; i < (u32) argc; i++) {
+        if ((strcmp(argv[i], "-n") == 0) && (i + 1 < (u32) argc)) {
+            rounds = strtoul(argv[++i], NULL, 0);
+        } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < (u32) argc)) {
+            fuzz_state = strtoull(argv[++i], NULL, 0) | 1;
+        } else {
+            ret |= fuzz_file(argv[i]);
+            rounds = 0;
+        }
+    }
+    for (i = 0; i < rounds; i++) {
+        len = fuzz_frame(buf);
+        if (ptp_msg_check(buf, len) >= 0) {
+            accepted++;
+        }
+        LLVMFuzzerTestOneInput(buf, len);
+    }
+    if (rounds) {
+        printf("%u frames, %u accepted, no codec errors\n", rounds,
+               accepted);
+    }
+    return ret;
+}
+#endif                          // PTP_FUZZ_LIBFUZZER
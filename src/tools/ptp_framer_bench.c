@@ -0,0 +1,269 @@
+/** @file ptp_framer_bench.c
+* Framer benchmark. Measures create_sync, create_announce and
+* create_delay_req of the framer, which copy a per-port template, against
+* building the same message field by field from the datasets, as the
+* framer did before the templates.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+#include <time.h>
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+
+#include "ptp.h"
+#include "ptp_port.h"
+#include "ptp_codec.h"
+#include "ptp_framer.h"
+
+/// Default number of messages created per case
+#define BENCH_ROUNDS    1000000
+
+/**
+* Benchmark case.
+*/
+struct bench_case {
+    const char *name;           ///< message
+    int (*templated) (struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                      struct Timestamp *time);  ///< framer
+    int (*built) (struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                  struct Timestamp *time);      ///< field by field
+};
+
+/**
+* Get monotonic clock in nanoseconds.
+* @return nanoseconds.
+*/
+static u64 bench_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+* Fill header from the datasets like the framer did before templates.
+* @param ctx Port context.
+* @param hdr Header to fill.
+* @param msg_type PTP message type.
+* @param len message length.
+* @param flags message flags.
+* @param control control field.
+* @param log_interval logMeanMessageInterval.
+* @param seqid Sequence id.
+*/
+static void built_header(struct ptp_port_ctx *ctx, struct ptp_header *hdr,
+                         u8 msg_type, u16 len, u16 flags, u8 control,
+                         s8 log_interval, u16 seqid)
+{
+    memset(hdr, 0, len);
+    hdr->msg_type = msg_type;
+    hdr->ptp_ver = ctx->port_dataset.version_number;
+    ptp_put_u16(&hdr->msg_len, len);
+    hdr->domain_num = ctx->ptp->default_dataset.domain;
+    if (ctx->unicast_port) {
+        flags |= PTP_UNICAST;
+    }
+    ptp_hdr_set_flags(hdr, flags);
+    ptp_put_port_id(&hdr->src_port_id, &ctx->port_dataset.port_identity);
+    ptp_put_u16(&hdr->seq_id, seqid);
+    hdr->control = control;
+    hdr->log_mean_msg_interval = log_interval;
+}
+
+/**
+* Create Sync without template.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param seqid Sequence id.
+* @param time originTimestamp.
+* @return size of the created frame.
+*/
+static int built_sync(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                      struct Timestamp *time)
+{
+    struct ptp_sync *msg = (struct ptp_sync *) buf;
+
+    built_header(ctx, &msg->hdr, PTP_SYNC, sizeof(struct ptp_sync),
+                 (ctx->ptp->cfg.one_step_clock == 1) ? 0 : PTP_TWO_STEP,
+                 PTP_CTRL_SYNC, ctx->port_dataset.log_mean_sync_interval,
+                 seqid);
+    ptp_put_timestamp(msg->origin_tstamp, time);
+    return sizeof(struct ptp_sync);
+}
+
+/**
+* Create Announce of the parent dataset without template.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param seqid Sequence id.
+* @param time originTimestamp.
+* @return size of the created frame.
+*/
+static int built_announce(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                          struct Timestamp *time)
+{
+    struct ptp_announce *msg = (struct ptp_announce *) buf;
+    struct ptp_ctx *ptp = ctx->ptp;
+    u16 flags = 0;
+
+    flags |= ptp->time_dataset.time_traceable ? PTP_TIME_TRACEABLE : 0;
+    flags |= ptp->time_dataset.frequency_traceable ? PTP_FREQ_TRACEABLE : 0;
+    flags |= ptp->time_dataset.ptp_timescale ? PTP_TIMESCALE : 0;
+    flags |= ptp->time_dataset.current_utc_offset_valid ?
+        PTP_UTC_OFFSET_VALID : 0;
+    built_header(ctx, &msg->hdr, PTP_ANNOUNCE, sizeof(struct ptp_announce),
+                 flags, PTP_CTRL_OTHER,
+                 ctx->port_dataset.log_mean_announce_interval, seqid);
+    ptp_put_timestamp(msg->origin_tstamp, time);
+    ptp_put_u16(&msg->current_UTC_offset,
+                ptp->time_dataset.current_utc_offset);
+    msg->time_source = ptp->time_dataset.time_source;
+    ptp_put_u16(&msg->steps_removed, ptp->current_dataset.steps_removed);
+    memcpy(msg->grandmasterId, ptp->parent_dataset.grandmaster_identity,
+           sizeof(ClockIdentity));
+    msg->grandmasterClkQuality.clock_class =
+        ptp->parent_dataset.grandmaster_clock_quality.clock_class;
+    msg->grandmasterClkQuality.clock_accuracy =
+        ptp->parent_dataset.grandmaster_clock_quality.clock_accuracy;
+    ptp_put_u16(&msg->grandmasterClkQuality.offset_scaled_log_variance,
+                ptp->parent_dataset.grandmaster_clock_quality.
+                offset_scaled_log_variance);
+    msg->grandmasterPri1 = ptp->parent_dataset.grandmaster_priority1;
+    msg->grandmasterPri2 = ptp->parent_dataset.grandmaster_priority2;
+    return sizeof(struct ptp_announce);
+}
+
+/**
+* Create Delay_Req without template.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param seqid Sequence id.
+* @param time originTimestamp.
+* @return size of the created frame.
+*/
+static int built_delay_req(struct ptp_port_ctx *ctx, char *buf, u16 seqid,
+                           struct Timestamp *time)
+{
+    struct ptp_delay_req *msg = (struct ptp_delay_req *) buf;
+
+    built_header(ctx, &msg->hdr, PTP_DELAY_REQ, sizeof(struct ptp_delay_req),
+                 0, PTP_CTRL_DELAY_REQ, PTP_MSG_DEFAULT_INTERVAL, seqid);
+    ptp_put_timestamp(msg->origin_tstamp, time);
+    return sizeof(struct ptp_delay_req);
+}
+
+/**
+* Create Announce of the parent dataset with the framer.
+* @param ctx Port context.
+* @param buf Buffer to which frame is created.
+* @param seqid Sequence id.
+* @param time originTimestamp.
+* @return size of the created frame.
+*/
+static int templated_announce(struct ptp_port_ctx *ctx, char *buf,
+                              u16 seqid, struct Timestamp *time)
+{
+    return create_announce(ctx, buf, seqid, 0, time);
+}
+
+/// Messages measured
+static const struct bench_case cases[] = {
+    {"Sync", create_sync, built_sync},
+    {"Announce", templated_announce, built_announce},
+    {"Delay_Req", create_delay_req, built_delay_req},
+};
+
+/**
+* Create messages and return time per message.
+* @param ctx Port context.
+* @param create function creating the message.
+* @param rounds number of messages.
+* @return nanoseconds per message.
+*/
+static double bench_run(struct ptp_port_ctx *ctx,
+                        int (*create) (struct ptp_port_ctx *ctx, char *buf,
+                                       u16 seqid, struct Timestamp *time),
+                        u32 rounds)
+{
+    char buf[MAX_PTP_FRAME_SIZE];
+    struct Timestamp time = { 1000, 0, 0 };
+    u64 start = 0;
+    u32 i = 0;
+
+    start = bench_ns();
+    for (i = 0; i < rounds; i++) {
+        time.nanoseconds = i;
+        create(ctx, buf, (u16) i, &time);
+        // Keep the frame from being optimized away
+        __asm__ __volatile__("":::"memory");
+    }
+    return (double) (bench_ns() - start) / rounds;
+}
+
+/**
+* Main function of the framer benchmark.
+* @param argc Number of commandline parameters.
+* @param argv Commandline parameters.
+* @return 0.
+*/
+int main(int argc, char *argv[])
+{
+    static struct ptp_ctx ptp;
+    static struct ptp_port_ctx port;
+    u32 rounds = BENCH_ROUNDS;
+    double templated = 0, built = 0;
+    size_t i = 0;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [messages per case]\n", argv[0]);
+        return 1;
+    }
+    if (argc == 2) {
+        rounds = strtoul(argv[1], NULL, 0);
+        if (rounds == 0) {
+            rounds = BENCH_ROUNDS;
+        }
+    }
+    ptp.default_dataset.domain = 0;
+    ptp.dataset_generation = 1;
+    port.ptp = &ptp;
+    port.port_dataset.version_number = 2;
+    port.port_dataset.port_identity.port_number = 1;
+    port.port_dataset.log_mean_sync_interval = 0;
+    port.port_dataset.log_mean_announce_interval = 1;
+
+    printf("%-10s %12s %12s\n", "message", "template ns", "built ns");
+    for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        // Warm up caches and the templates
+        bench_run(&port, cases[i].templated, rounds / 10 + 1);
+        bench_run(&port, cases[i].built, rounds / 10 + 1);
+        templated = bench_run(&port, cases[i].templated, rounds);
+        built = bench_run(&port, cases[i].built, rounds);
+        printf("%-10s %12.1f %12.1f\n", cases[i].name, templated, built);
+    }
+    return 0;
+}
@@ -0,0 +1,423 @@
+/** @file ptp_mgmt.c
+* PTP management client. Sends management GET, SET and COMMAND requests
+* as unicast to one or more PTP nodes and prints the responses.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include <ptp_general.h>
+#include <ptp_message.h>
+#include <ptp_codec.h>
+#include <ptp_mgmt.h>
+
+/// Default response timeout, ms
+#define MGMT_DEFAULT_TIMEOUT_MS 1000
+/// Maximum number of nodes in one run
+#define MGMT_MAX_NODES          1024
+
+/**
+* Management request target.
+*/
+struct mgmt_node {
+    char *name;                 ///< address given on command line
+    struct sockaddr_in addr;    ///< node general port address
+    int responses;              ///< number of responses received
+};
+
+/// Names of portState values, indexed by portState - 1
+static const char *port_state_name[] = {
+    "INITIALIZING", "FAULTY", "DISABLED", "LISTENING", "PRE_MASTER",
+    "MASTER", "PASSIVE", "UNCALIBRATED", "SLAVE"
+};
+
+/**
+* Print usage.
+* @param prog program name.
+*/
+static void usage(char *prog)
+{
+    int id = 0;
+    const struct ptp_mgmt_info *info = NULL;
+
+    fprintf(stderr,
+            "Usage: %s [-d domain] [-t timeout_ms] GET|CMD <id> <node>...\n"
+            "       %s [-d domain] [-t timeout_ms] SET <id> <value> "
+            "<node>...\n" "Management ids:\n", prog, prog);
+    for (id = 0; id <= 0xffff; id++) {
+        info = ptp_mgmt_lookup(id);
+        if (info) {
+            fprintf(stderr, "  %-28s%s\n", info->name,
+                    info->settable ? " (settable)" : "");
+        }
+    }
+}
+
+/**
+* Get time in milliseconds.
+* @return time.
+*/
+static long long now_ms(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+/**
+* Print port identity.
+* @param buf port identity.
+*/
+static void print_port_id(u8 * buf)
+{
+    struct PortIdentity port_id;
+
+    ptp_get_port_id(&port_id, buf);
+    printf("%s/%u", ptp_clk_id(port_id.clock_identity),
+           port_id.port_number);
+}
+
+/**
+* Print scaled nanoseconds.
+* @param name field name.
+* @param buf TimeInterval.
+*/
+static void print_interval(const char *name, u8 * buf)
+{
+    s64 scaled = (s64) ptp_get_u64(buf);
+
+    printf("  %-38s %lld.%03lld ns\n", name, scaled >> 16,
+           ((scaled & 0xffff) * 1000) >> 16);
+}
+
+/**
+* Print dataField of a management TLV.
+* @param id managementId.
+* @param data dataField.
+* @param len dataField length.
+*/
+static void print_data(u16 id, u8 * data, int len)
+{
+    const struct ptp_mgmt_info *info = ptp_mgmt_lookup(id);
+
+    if ((info == NULL) || (len < info->len)) {
+        printf("  unknown or truncated data, %i octets\n", len);
+        return;
+    }
+    switch (id) {
+    case PTP_MGMT_DEFAULT_DATA_SET:
+        printf("  %-38s %i\n", "twoStepFlag", data[0] & 0x01);
+        printf("  %-38s %i\n", "slaveOnly", (data[0] >> 1) & 0x01);
+        printf("  %-38s %u\n", "numberPorts", ptp_get_u16(data + 2));
+        printf("  %-38s %u\n", "priority1", data[4]);
+        printf("  %-38s %u\n", "clockClass", data[5]);
+        printf("  %-38s 0x%02x\n", "clockAccuracy", data[6]);
+        printf("  %-38s 0x%04x\n", "offsetScaledLogVariance",
+               ptp_get_u16(data + 7));
+        printf("  %-38s %u\n", "priority2", data[9]);
+        printf("  %-38s %s\n", "clockIdentity", ptp_clk_id(data + 10));
+        printf("  %-38s %u\n", "domainNumber", data[18]);
+        break;
+    case PTP_MGMT_CURRENT_DATA_SET:
+        printf("  %-38s %u\n", "stepsRemoved", ptp_get_u16(data));
+        print_interval("offsetFromMaster", data + 2);
+        print_interval("meanPathDelay", data + 10);
+        break;
+    case PTP_MGMT_PARENT_DATA_SET:
+        printf("  %-38s ", "parentPortIdentity");
+        print_port_id(data);
+        printf("\n");
+        printf("  %-38s %i\n", "parentStats", data[10] & 0x01);
+        printf("  %-38s 0x%04x\n", "observedParentOffsetScaledLogVariance",
+               ptp_get_u16(data + 12));
+        printf("  %-38s %i\n", "observedParentClockPhaseChangeRate",
+               (s32) ptp_get_u32(data + 14));
+        printf("  %-38s %u\n", "grandmasterPriority1", data[18]);
+        printf("  %-38s %u\n", "grandmasterClockClass", data[19]);
+        printf("  %-38s 0x%02x\n", "grandmasterClockAccuracy", data[20]);
+        printf("  %-38s 0x%04x\n", "grandmasterOffsetScaledLogVariance",
+               ptp_get_u16(data + 21));
+        printf("  %-38s %u\n", "grandmasterPriority2", data[23]);
+        printf("  %-38s %s\n", "grandmasterIdentity", ptp_clk_id(data + 24));
+        break;
+    case PTP_MGMT_TIME_PROPERTIES_DATA_SET:
+        printf("  %-38s %i\n", "currentUtcOffset", (s16) ptp_get_u16(data));
+        printf("  %-38s %i\n", "leap61", data[2] & 0x01);
+        printf("  %-38s %i\n", "leap59", (data[2] >> 1) & 0x01);
+        printf("  %-38s %i\n", "currentUtcOffsetValid",
+               (data[2] >> 2) & 0x01);
+        printf("  %-38s %i\n", "ptpTimescale", (data[2] >> 3) & 0x01);
+        printf("  %-38s %i\n", "timeTraceable", (data[2] >> 4) & 0x01);
+        printf("  %-38s %i\n", "frequencyTraceable", (data[2] >> 5) & 0x01);
+        printf("  %-38s 0x%02x\n", "timeSource", data[3]);
+        break;
+    case PTP_MGMT_PORT_DATA_SET:
+        printf("  %-38s ", "portIdentity");
+        print_port_id(data);
+        printf("\n");
+        if ((data[10] >= 1) && (data[10] <= 9)) {
+            printf("  %-38s %s\n", "portState", port_state_name[data[10] - 1]);
+        } else {
+            printf("  %-38s %u\n", "portState", data[10]);
+        }
+        printf("  %-38s %i\n", "logMinDelayReqInterval", (s8) data[11]);
+        print_interval("peerMeanPathDelay", data + 12);
+        printf("  %-38s %i\n", "logAnnounceInterval", (s8) data[20]);
+        printf("  %-38s %u\n", "announceReceiptTimeout", data[21]);
+        printf("  %-38s %i\n", "logSyncInterval", (s8) data[22]);
+        printf("  %-38s %s\n", "delayMechanism",
+               data[23] == 1 ? "E2E" : data[23] == 2 ? "P2P" : "DISABLED");
+        printf("  %-38s %i\n", "logMinPdelayReqInterval", (s8) data[24]);
+        printf("  %-38s %u\n", "versionNumber", data[25] & 0x0f);
+        break;
+    case PTP_MGMT_NULL_MANAGEMENT:
+        break;
+    case PTP_MGMT_LOG_ANNOUNCE_INTERVAL:
+    case PTP_MGMT_LOG_SYNC_INTERVAL:
+    case PTP_MGMT_LOG_MIN_PDELAY_REQ_INTERVAL:
+        printf("  %-38s %i\n", info->name, (s8) data[0]);
+        break;
+    default:
+        printf("  %-38s %u\n", info->name, data[0]);
+        break;
+    }
+}
+
+/**
+* Print received management response.
+* @param node node the response was received from.
+* @param buf response.
+* @param len response length.
+*/
+static void print_response(struct mgmt_node *node, u8 * buf, int len)
+{
+    struct ptp_management *msg = ptp_view_management(buf);
+    const struct ptp_mgmt_info *info = NULL;
+    struct ptp_tlv tlv;
+    int offset = 0;
+    u16 id = 0;
+
+    printf("%s ", node->name);
+    print_port_id((u8 *) & msg->hdr.src_port_id);
+    while (ptp_tlv_next(buf, &offset, &tlv)) {
+        if ((tlv.type == MANAGEMENT) && (tlv.length >= PTP_MGMT_ID_LEN)) {
+            id = ptp_get_u16(tlv.value);
+            info = ptp_mgmt_lookup(id);
+            printf(" %s\n", info ? info->name : "unknown");
+            print_data(id, tlv.value + PTP_MGMT_ID_LEN,
+                       tlv.length - PTP_MGMT_ID_LEN);
+        } else if ((tlv.type == MANAGEMENT_ERROR_STATUS) &&
+                   (tlv.length >= PTP_MGMT_ERR_LEN)) {
+            id = ptp_get_u16(tlv.value + 2);
+            info = ptp_mgmt_lookup(id);
+            printf(" %s error 0x%04x\n", info ? info->name : "unknown",
+                   ptp_get_u16(tlv.value));
+        }
+    }
+}
+
+/**
+* Build management request.
+* @param buf buffer of PTP_MGMT_FRAME_LEN octets.
+* @param domain domainNumber.
+* @param seq_id sequenceId.
+* @param action actionField.
+* @param info managementId.
+* @param value value of SET.
+* @return request length.
+*/
+static int build_request(u8 * buf, u8 domain, u16 seq_id, u8 action,
+                         const struct ptp_mgmt_info *info, int value)
+{
+    struct ptp_management *msg = (struct ptp_management *) buf;
+    struct PortIdentity port_id;
+    u8 *tlv = NULL;
+    int data_len = (action == PTP_MGMT_SET) ? info->len : 0;
+    int len = offsetof(struct ptp_management, tlvs);
+    pid_t pid = getpid();
+
+    memset(buf, 0, PTP_MGMT_FRAME_LEN);
+    msg->hdr.msg_type = PTP_MANAGEMENT;
+    msg->hdr.ptp_ver = 2;
+    msg->hdr.domain_num = domain;
+    ptp_hdr_set_flags(&msg->hdr, PTP_UNICAST);
+    // Client identity is derived from the process id
+    memset(&port_id, 0, sizeof(port_id));
+    port_id.clock_identity[3] = 0xff;
+    port_id.clock_identity[4] = 0xfe;
+    port_id.clock_identity[5] = pid >> 16;
+    port_id.clock_identity[6] = pid >> 8;
+    port_id.clock_identity[7] = pid;
+    port_id.port_number = 1;
+    ptp_put_port_id(&msg->hdr.src_port_id, &port_id);
+    ptp_put_u16(&msg->hdr.seq_id, seq_id);
+    msg->hdr.control = PTP_CTRL_MANAGEMENT;
+    msg->hdr.log_mean_msg_interval = PTP_MSG_DEFAULT_INTERVAL;
+    // All clocks and ports of the node
+    memset(msg->target_port_id, 0xff, sizeof(msg->target_port_id));
+    msg->action = action;
+
+    tlv = buf + len;
+    ptp_put_u16(tlv, MANAGEMENT);
+    ptp_put_u16(tlv + 2, PTP_MGMT_ID_LEN + data_len);
+    ptp_put_u16(tlv + 4, info->id);
+    if (data_len) {
+        tlv[6] = value;
+    }
+    len += PTP_TLV_HDR_LEN + PTP_MGMT_ID_LEN + data_len;
+    ptp_put_u16(&msg->hdr.msg_len, len);
+    return len;
+}
+
+/**
+* Main function.
+* @param argc Number of commandline parameters.
+* @param argv Commandline parameters.
+* @return 0 if every node responded.
+*/
+int main(int argc, char *argv[])
+{
+    static struct mgmt_node nodes[MGMT_MAX_NODES];
+    const struct ptp_mgmt_info *info = NULL;
+    struct sockaddr_in from;
+    struct timeval tv;
+    socklen_t from_len = 0;
+    u8 buf[PTP_MGMT_FRAME_LEN];
+    u8 rbuf[1500];
+    long long deadline = 0;
+    long long remaining = 0;
+    int timeout_ms = MGMT_DEFAULT_TIMEOUT_MS;
+    int domain = DEFAULT_DOMAIN;
+    int action = 0;
+    int value = 0;
+    int num_nodes = 0;
+    int missing = 0;
+    int sock = 0;
+    int opt = 0;
+    int len = 0;
+    int i = 0;
+
+    while ((opt = getopt(argc, argv, "+d:t:h")) != -1) {
+        switch (opt) {
+        case 'd':
+            domain = atoi(optarg);
+            break;
+        case 't':
+            timeout_ms = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (strcasecmp(argv[optind], "GET") == 0) {
+        action = PTP_MGMT_GET;
+    } else if (strcasecmp(argv[optind], "SET") == 0) {
+        action = PTP_MGMT_SET;
+    } else if (strcasecmp(argv[optind], "CMD") == 0) {
+        action = PTP_MGMT_COMMAND;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    info = ptp_mgmt_lookup_name(argv[optind + 1]);
+    if (info == NULL) {
+        fprintf(stderr, "Unknown management id %s\n", argv[optind + 1]);
+        return 1;
+    }
+    optind += 2;
+    if (action == PTP_MGMT_SET) {
+        value = atoi(argv[optind++]);
+    }
+    for (; (optind < argc) && (num_nodes < MGMT_MAX_NODES); optind++) {
+        nodes[num_nodes].name = argv[optind];
+        nodes[num_nodes].addr.sin_family = AF_INET;
+        nodes[num_nodes].addr.sin_port = htons(DEFAULT_GENERAL_PORT);
+        if (inet_aton(argv[optind], &nodes[num_nodes].addr.sin_addr) == 0) {
+            fprintf(stderr, "Invalid address %s\n", argv[optind]);
+            return 1;
+        }
+        num_nodes++;
+    }
+    if (num_nodes == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sock = socket(PF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    // Requests to all nodes are sent first, sequenceId identifies node
+    for (i = 0; i < num_nodes; i++) {
+        len = build_request(buf, domain, i, action, info, value);
+        if (sendto(sock, buf, len, 0, (struct sockaddr *) &nodes[i].addr,
+                   sizeof(struct sockaddr_in)) != len) {
+            perror("send");
+        }
+    }
+
+    deadline = now_ms() + timeout_ms;
+    while ((remaining = deadline - now_ms()) > 0) {
+        tv.tv_sec = remaining / 1000;
+        tv.tv_usec = (remaining % 1000) * 1000;
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        from_len = sizeof(from);
+        len = recvfrom(sock, rbuf, sizeof(rbuf), 0,
+                       (struct sockaddr *) &from, &from_len);
+        if (len < 0) {
+            break;
+        }
+        if ((ptp_msg_check(rbuf, len) < 0) ||
+            (ptp_hdr_type((struct ptp_header *) rbuf) != PTP_MANAGEMENT)) {
+            continue;
+        }
+        i = ptp_hdr_seq_id((struct ptp_header *) rbuf);
+        if ((i >= num_nodes) ||
+            (from.sin_addr.s_addr != nodes[i].addr.sin_addr.s_addr)) {
+            continue;
+        }
+        nodes[i].responses++;
+        print_response(&nodes[i], rbuf, len);
+    }
+    close(sock);
+
+    for (i = 0; i < num_nodes; i++) {
+        if (nodes[i].responses == 0) {
+            printf("%s no response\n", nodes[i].name);
+            missing++;
+        }
+    }
+    return missing ? 2 : 0;
+}
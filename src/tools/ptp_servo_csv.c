@@ -0,0 +1,139 @@
+/** @file ptp_servo_csv.c
+* Servo recorder converter. Prints records of servo recorder files
+* written by the daemon as CSV, one row per record.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+
+#include <ptp_general.h>
+#include <ptp_servo_rec.h>
+
+/**
+* Print timestamp in seconds.
+* @param ns timestamp, ns.
+*/
+static void print_time(u64 ns)
+{
+    printf(",%llu.%09llu", ns / 1000000000ULL, ns % 1000000000ULL);
+}
+
+/**
+* Print scaled value.
+* @param value value multiplied by 2^16.
+* @param mult multiplier of the value.
+*/
+static void print_scaled(s64 value, double mult)
+{
+    printf(",%.3f", (double) value * mult / 65536.0);
+}
+
+/**
+* Print records of a recorder file.
+* @param file recorder file.
+* @return 0 if file was converted.
+*/
+static int convert(const char *file)
+{
+    struct ptp_servo_rec_header header;
+    struct ptp_servo_record record;
+    FILE *fp = NULL;
+    u64 i = 0, time = 0;
+
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        perror(file);
+        return 1;
+    }
+    if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+        (memcmp(header.magic, PTP_SERVO_REC_MAGIC,
+                sizeof(header.magic)) != 0)) {
+        fprintf(stderr, "%s: not a servo recorder file\n", file);
+        fclose(fp);
+        return 1;
+    }
+    if ((header.version != PTP_SERVO_REC_VERSION) ||
+        (header.record_size != sizeof(record))) {
+        fprintf(stderr, "%s: unsupported version %u\n", file,
+                header.version);
+        fclose(fp);
+        return 1;
+    }
+    // Records past count of a live file are not complete
+    for (i = 0; (i < header.count) &&
+         (fread(&record, sizeof(record), 1, fp) == 1); i++) {
+        time = header.realtime + (record.time - header.monotonic);
+        printf("%llu.%09llu,%u,%u,%s,%u", time / 1000000000ULL,
+               time % 1000000000ULL, header.domain, record.port,
+               (record.type == PTP_SERVO_REC_SYNC) ? "sync" : "delay",
+               record.seq);
+        if (record.type == PTP_SERVO_REC_SYNC) {
+            print_time(record.origin);
+            print_time(record.receive);
+            printf(",,");
+        } else {
+            printf(",,");
+            print_time(record.origin);
+            print_time(record.receive);
+        }
+        print_scaled(record.correction, 1.0);
+        print_scaled(record.path_delay, 1.0);
+        print_scaled(record.offset, 1.0);
+        print_scaled(record.freq, 1000.0);
+        print_scaled(record.integral, 1.0);
+        printf(",%i,%u,%u,%u,%u,%u\n", record.tick,
+               !!(record.flags & PTP_SERVO_REC_DISCIPLINE),
+               !!(record.flags & PTP_SERVO_REC_STEP),
+               !!(record.flags & PTP_SERVO_REC_FREQ),
+               !!(record.flags & PTP_SERVO_REC_TICK),
+               !!(record.flags & PTP_SERVO_REC_REJECTED));
+    }
+    fclose(fp);
+    return 0;
+}
+
+/**
+* Main function of the servo recorder converter.
+* @param argc Number of commandline parameters.
+* @param argv Commandline parameters.
+* @return 0 if all files were converted.
+*/
+int main(int argc, char *argv[])
+{
+    int i = 0, ret = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <recorder file> [recorder file ...]\n"
+                "Files are printed in the given order, e.g. "
+                "<name>.1 <name>\n", argv[0]);
+        return 1;
+    }
+    printf("time,domain,port,type,seq,t1,t2,t3,t4,correction_ns,"
+           "path_delay_ns,offset_ns,freq_ppb,integral_ns,tick_us,"
+           "discipline,step,freq_adjusted,tick_adjusted,rejected\n");
+    for (i = 1; i < argc; i++) {
+        ret |= convert(argv[i]);
+    }
+    return ret;
+}
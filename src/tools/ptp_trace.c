@@ -0,0 +1,84 @@
+/** @file ptp_trace.c
+* Trace decoder. Prints records of a binary trace file written by the
+* daemon, one line per record.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+
+#include <ptp_general.h>
+#include <ptp_trace.h>
+
+/**
+* Main function of the trace decoder.
+* @param argc Number of commandline parameters.
+* @param argv Commandline parameters.
+* @return 0 if file was decoded.
+*/
+int main(int argc, char *argv[])
+{
+    struct ptp_trace_header header;
+    struct ptp_trace_entry entry;
+    const char *file = PTP_TRACE_DEFAULT_FILE;
+    char line[256];
+    FILE *fp = NULL;
+    u64 time = 0;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [trace file]\n"
+                "Default trace file is %s\n", argv[0],
+                PTP_TRACE_DEFAULT_FILE);
+        return 1;
+    }
+    if (argc == 2) {
+        file = argv[1];
+    }
+    fp = fopen(file, "r");
+    if (fp == NULL) {
+        perror(file);
+        return 1;
+    }
+    if ((fread(&header, sizeof(header), 1, fp) != 1) ||
+        (memcmp(header.magic, PTP_TRACE_MAGIC, sizeof(header.magic)) != 0)) {
+        fprintf(stderr, "%s: not a trace file\n", file);
+        fclose(fp);
+        return 1;
+    }
+    if ((header.version != PTP_TRACE_VERSION) ||
+        (header.entry_size != sizeof(entry))) {
+        fprintf(stderr, "%s: unsupported version %u\n", file,
+                header.version);
+        fclose(fp);
+        return 1;
+    }
+    // Records carry monotonic time, print it as wall clock time
+    while (fread(&entry, sizeof(entry), 1, fp) == 1) {
+        time = header.realtime + (entry.time - header.monotonic);
+        ptp_trace_format(&entry, line, sizeof(line));
+        printf("%llu.%09llu %u %s\n", time / 1000000000ULL,
+               time % 1000000000ULL, entry.thread, line);
+    }
+    fclose(fp);
+    return 0;
+}
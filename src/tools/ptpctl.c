@@ -0,0 +1,115 @@
+/** @file ptpctl.c
+* PTP control client. Sends a command to the control socket of the
+* daemon and prints the reply, or the events of a subscription until it
+* is interrupted.
+*/
+
+/*
+    Openptp is an open source PTP version 2 (IEEE 1588-2008) daemon.
+
+    Copyright (C) 2007-2009  Flexibilis Oy
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License version 2
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/******************************************************************************
+* $Id$
+******************************************************************************/
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <ptp_general.h>
+#include <ptp_ctl.h>
+
+/**
+* Print usage.
+* @param prog program name.
+*/
+static void usage(char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [-s socket] status|subscribe|help\n"
+            "       %s [-s socket] log [<category>=<level>,...]\n"
+            "Default socket is %s\n", prog, prog, PTP_CTL_DEFAULT_PATH);
+}
+
+/**
+* Main function of the control client.
+* @param argc Number of commandline parameters.
+* @param argv Commandline parameters.
+* @return 0 if command was sent and reply received.
+*/
+int main(int argc, char *argv[])
+{
+    struct sockaddr_un addr;
+    char *path = PTP_CTL_DEFAULT_PATH;
+    char buf[PTP_CTL_LINE_LEN];
+    int sock = 0;
+    int opt = 0;
+    int len = 0, i = 0;
+
+    while ((opt = getopt(argc, argv, "s:h")) != -1) {
+        switch (opt) {
+        case 's':
+            path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if ((argc - optind < 1) || (strlen(path) >= sizeof(addr.sun_path))) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock < 0) {
+        perror("socket");
+        return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+    if (connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(sock);
+        return 1;
+    }
+    // Command and its arguments are sent as one line
+    for (i = optind; (i < argc) && (len < sizeof(buf)); i++) {
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%s",
+                        (i > optind) ? " " : "", argv[i]);
+    }
+    if (len >= sizeof(buf) - 1) {
+        usage(argv[0]);
+        close(sock);
+        return 1;
+    }
+    buf[len++] = '\n';
+    if (send(sock, buf, len, 0) != len) {
+        perror("send");
+        close(sock);
+        return 1;
+    }
+    // Reply ends when daemon closes the connection
+    while ((len = recv(sock, buf, sizeof(buf), 0)) > 0) {
+        fwrite(buf, 1, len, stdout);
+        fflush(stdout);
+    }
+    close(sock);
+    return (len < 0) ? 1 : 0;
+}